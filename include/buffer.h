@@ -1,6 +1,16 @@
 //
 // Created by David Nugent on 4/02/2016.
 // Simple ring buffer
+//
+// Capacity is always a power of two, and the lo/hi positions run freely
+// (they are masked only when the data is accessed), so a buffer can be
+// filled completely and wrapping costs no branches. Where supported,
+// larger buffers are mapped twice into adjacent virtual memory so that
+// the used and free regions are always contiguous.
+//
+// Elastic buffers (b_max > 0) start without memory, grow geometrically
+// as data is added up to b_max, and give their memory back to a shared
+// pool of free blocks when trimmed while idle.
 
 #ifndef GENERIC_BUFFER_H
 #define GENERIC_BUFFER_H
@@ -11,15 +21,26 @@ typedef struct buffer_s buffer_t;
 
 struct buffer_s {
     int alloc;
+    int mirrored;       // data is mapped twice, back to back
     size_t
-        b_size,         // size of the buffer
+        b_size,         // size of the buffer (0 or a power of 2)
         b_lo,           // lo position, data fetched from here
-        b_hi;           // hi position, data added at here
+        b_hi,           // hi position, data added at here
+        b_min,          // elastic: initial allocation
+        b_max,          // elastic: ceiling (0 = fixed size)
+        b_mark;         // elastic: hi position at last trim
     void *data;
 };
 
 extern buffer_t *buffer_init(buffer_t *buffer, size_t size);
+extern buffer_t *buffer_init_elastic(buffer_t *buffer, size_t size, size_t max);
 extern void buffer_free(buffer_t *buffer);
+extern size_t buffer_reserve(buffer_t *buffer, size_t len);
+extern size_t buffer_trim(buffer_t *buffer);
+
+// free blocks held for reuse
+extern size_t buffer_pool_bytes(void);
+extern void buffer_pool_drain(void);
 
 extern void buffer_flush(buffer_t *buffer);
 extern size_t buffer_available(buffer_t *buffer);
@@ -37,4 +58,12 @@ extern size_t buffer_peek(buffer_t *dev, void *buf, size_t len);
 extern size_t buffer_get(buffer_t *buffer, void *buf, size_t len);
 extern size_t buffer_put(buffer_t *buffer, void const *buf, size_t len);
 
+// Direct access to buffer memory, for system calls and parsers
+// the region returned is contiguous, its length is returned in *len
+extern void *buffer_peekptr(buffer_t *buffer, size_t offset, size_t *len);
+extern void *buffer_readptr(buffer_t *buffer, size_t *len);
+extern void *buffer_writeptr(buffer_t *buffer, size_t *len);
+extern size_t buffer_consume(buffer_t *buffer, size_t len);
+extern size_t buffer_produce(buffer_t *buffer, size_t len);
+
 #endif //GENERIC_BUFFER_H
@@ -0,0 +1,48 @@
+//
+// Shared streaming compression of the serial fan-out
+//
+// Output is a raw deflate stream (RFC 1951, no zlib header) flushed to a
+// byte boundary after every chunk, so that it can be decoded as it arrives.
+// All connections using the same level share one compressor, and so one
+// compressed copy of each chunk. A connection joins at a chunk boundary:
+// the compressor is reset first, which adds no output, so that nothing
+// after it refers back to data the newcomer has not seen. The same applies
+// to data sent to one connection only, as stored (uncompressed) blocks.
+
+#ifndef GENERIC_COMPRESS_H
+#define GENERIC_COMPRESS_H
+
+#include <stddef.h>
+#include <zlib.h>
+
+#include "buffer.h"
+#include "segbuf.h"
+
+#define COMPRESS_DEFAULT    6           // default level
+#define COMPRESS_LEVELS     10          // levels 1-9, 0 is none
+#define COMPRESS_OUTMAX     (1 << 20)   // largest compressed chunk
+
+typedef struct compressor_s compressor_t;
+
+struct compressor_s {
+    int level;
+    int ready;                  // stream initialised
+    int reset;                  // reset before the next chunk
+    int done;                   // chunk compressed in this pass
+    z_stream zs;
+    buffer_t out;               // compressed chunk
+    segbuf_t segs;              // the same, as shared segments
+    unsigned long long bytes_in;
+    unsigned long long bytes_out;
+};
+
+extern int compressor_init(compressor_t *c, int level);
+extern void compressor_free(compressor_t *c);
+extern void compressor_resync(compressor_t *c);
+extern size_t compressor_chunk(compressor_t *c, buffer_t *src, size_t length);
+extern void compressor_flush(compressor_t *c);
+
+// data for one connection only, stored within its compressed stream
+extern size_t compress_stored(buffer_t *dst, void const *data, size_t length);
+
+#endif //GENERIC_COMPRESS_H
@@ -5,16 +5,32 @@
 #ifndef GENERIC_DEVICE_H
 #define GENERIC_DEVICE_H
 
+// device ranks, highest preferred
+#define RANK_OTHER  0           // not a usb device
+#define RANK_USB    1           // unknown usb serial device (modem, etc.)
+#define RANK_BOARD  4           // known hdmi2usb board
+
 // controller serial device llist node
 
 struct ctrldev {
     struct ctrldev *next;
     char *devname;
+    int rank;
+    unsigned short vid, pid;    // usb vendor and product id (0 = not usb)
+    char *serial;               // usb serial number (NULL = none)
+    char const *board;          // known board name (NULL = unknown)
 };
 
+// Device names are separated by '|' and may be glob patterns, or select
+// usb devices by "usb:vid[:pid[:serial]]" (hex ids). "auto" finds known
+// boards, then other usb serial devices.
 extern struct ctrldev *find_serial_all(char const *filespec);
 extern void ctrldev_free(struct ctrldev *first_dev);
 
 extern char *find_serial(char const *filespec);
+extern void find_serial_flush(void);
+
+extern char const *device_board(unsigned short vid, unsigned short pid, int *rank);
+extern void device_set_root(char const *root);
 
 #endif //GENERIC_DEVICE_H
@@ -0,0 +1,63 @@
+//
+// Incremental parser for hdmi2usb firmware output
+// Serial data is fed in as it arrives, in chunks of any size, and
+// typed events are passed to a handler as lines (or the prompt) are
+// recognised. No memory is allocated after initialisation.
+
+#ifndef GENERIC_DEVPARSE_H
+#define GENERIC_DEVPARSE_H
+
+#include <stddef.h>
+
+#include "timer.h"
+
+#define DEVPARSE_LINEMAX    256     // longer lines are truncated
+#define DEVPARSE_PROMPTMAX  32      // longest output recognised as a prompt
+
+enum devEvent {
+    DEVEVT_LINE,            // any other line of output
+    DEVEVT_PROMPT,          // prompt, device is ready for the next command
+    DEVEVT_ACK,             // echo of the last command sent to the device
+    DEVEVT_STATUS,          // status report line ("name: value")
+    DEVEVT_EDID,            // EDID dump header or data line
+    DEVEVT_ERROR,           // error report
+    DEVEVT_MAX
+};
+
+typedef struct devparse_s devparse_t;
+typedef struct devevent_s devevent_t;
+
+struct devevent_s {
+    int type;
+    utime_t timestamp;      // time at which the event was parsed
+    char const *text;       // event text, not NUL terminated and only valid during the callback
+    size_t length;
+};
+
+typedef void (*devparse_handler_t)(devevent_t const *event, void *arg);
+
+struct devparse_s {
+    int alloc;
+    devparse_handler_t handler;
+    void *arg;
+    int in_edid;            // within an EDID dump
+    size_t length;          // bytes in the current line
+    size_t truncated;       // bytes discarded from the current line
+    size_t acklen;          // length of expected command echo (0 = none)
+    unsigned long events[DEVEVT_MAX];
+    char ack[DEVPARSE_LINEMAX];
+    char line[DEVPARSE_LINEMAX];
+};
+
+extern devparse_t *devparse_init(devparse_t *parser, devparse_handler_t handler, void *arg);
+extern void devparse_free(devparse_t *parser);
+extern void devparse_reset(devparse_t *parser);
+
+extern char const *devparse_event_name(int type);
+
+// a command was sent to the device, its echo will be reported as DEVEVT_ACK
+extern void devparse_expect(devparse_t *parser, char const *command, size_t length);
+// parse a chunk of device output, returns the number of events raised
+extern size_t devparse_feed(devparse_t *parser, void const *data, size_t length, utime_t now);
+
+#endif //GENERIC_DEVPARSE_H
@@ -0,0 +1,64 @@
+//
+// Line filters compiled to a DFA
+//
+// Patterns are a small regular expression subset:
+//   c       literal character (\c for a literal special character)
+//   .       any character
+//   [...]   character class, ranges (a-z) and negation ([^...]) allowed
+//   * + ?   zero or more, one or more, zero or one of the previous item
+//   ^ $     anchor the match at the start/end of the line
+// Unanchored patterns match anywhere in the line, so a plain word is a
+// substring match and "^word" a prefix match.
+
+#ifndef GENERIC_FILTER_H
+#define GENERIC_FILTER_H
+
+#include <stddef.h>
+
+#include "array.h"
+
+#define FILTER_MAXITEMS     62      // items (after expansion of '+') per pattern, and the final
+                                    // position must leave the top bit of a state mask clear
+#define FILTER_MAXSTATES    255     // DFA states per pattern
+
+// per state accept flags
+#define FILTER_ACCEPT       0x01    // match if the line ends here
+#define FILTER_MATCHED      0x02    // match regardless of what follows
+
+typedef struct filter_s filter_t;
+typedef struct filterset_s filterset_t;
+
+struct filter_s {
+    int alloc;
+    size_t nstates;
+    unsigned char start;        // start state
+    unsigned char *next;        // transition table, nstates x 256
+    unsigned char *accept;      // accept flags per state
+};
+
+extern filter_t *filter_compile(filter_t *filter, char const *pattern, char const **errmsg);
+extern void filter_free(filter_t *filter);
+extern int filter_match(filter_t *filter, char const *text, size_t length);
+
+// A set of shared filters, each evaluated once per line regardless
+// of the number of subscribers using it
+
+struct filterset_s {
+    int alloc;
+    array_t entries;
+};
+
+extern filterset_t *filterset_init(filterset_t *fset);
+extern void filterset_free(filterset_t *fset);
+extern size_t filterset_count(filterset_t *fset);
+
+extern int filterset_add(filterset_t *fset, char const *pattern, char const **errmsg);
+extern char const *filterset_pattern(filterset_t *fset, int id);
+extern void filterset_unmark(filterset_t *fset);
+extern void filterset_mark(filterset_t *fset, int id);
+extern size_t filterset_sweep(filterset_t *fset);
+
+extern void filterset_match(filterset_t *fset, char const *text, size_t length);
+extern int filterset_matched(filterset_t *fset, int id);
+
+#endif //GENERIC_FILTER_H
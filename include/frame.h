@@ -0,0 +1,47 @@
+//
+// Length prefixed binary framing for the client protocol
+//
+// Each frame is an 8 byte header followed by <length> bytes of payload:
+//   magic(1) type(1) length(2) reqid(4)
+// multi-byte fields are in network byte order.
+// The magic byte is not valid in text commands, so the first byte sent
+// on a connection selects the protocol used for the rest of it.
+
+#ifndef GENERIC_FRAME_H
+#define GENERIC_FRAME_H
+
+#include <stdint.h>
+
+#include "buffer.h"
+
+#define FRAME_MAGIC     0xb2
+#define FRAME_HDRSIZE   8
+#define FRAME_MAXDATA   0xffff
+
+enum frameType {
+    FRAME_HELLO = 1,        // client <-> server: select framed protocol (no payload)
+    FRAME_COMMAND,          // client -> server: command for the device
+    FRAME_RESPONSE,         // server -> client: device output resulting from request <reqid>
+    FRAME_DONE,             // server -> client: request <reqid> has completed
+    FRAME_EVENT,            // server -> client: unsolicited device output
+    FRAME_ERROR,            // server -> client: request <reqid> rejected, payload is the reason
+    FRAME_FILTER,           // client -> server: set output filter to payload (empty = none)
+};
+
+typedef struct frame_header_s frame_header_t;
+
+struct frame_header_s {
+    uint8_t magic;
+    uint8_t type;
+    uint16_t length;        // payload length
+    uint32_t reqid;         // request id, 0 for unsolicited frames
+};
+
+extern size_t frame_header_encode(void *dst, int type, uint32_t reqid, size_t length);
+extern int frame_header_decode(void const *src, size_t size, frame_header_t *hdr);
+
+// queue complete frames in a buffer, all or nothing
+extern size_t frame_put(buffer_t *dst, int type, uint32_t reqid, void const *data, size_t length);
+extern size_t frame_copy(buffer_t *dst, int type, uint32_t reqid, buffer_t *src, size_t length);
+
+#endif //GENERIC_FRAME_H
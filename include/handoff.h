@@ -0,0 +1,52 @@
+//
+// Hand over open devices to another process
+//
+// Records are sent over a unix stream socket, each a small header and a
+// payload, optionally carrying one file descriptor (SCM_RIGHTS). Device
+// records hold everything needed to resume the device where the sender
+// left off: its descriptor, driver settings, session state and the
+// unprocessed contents of its buffers.
+
+#ifndef GENERIC_HANDOFF_H
+#define GENERIC_HANDOFF_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "selector.h"
+
+#define HANDOFF_MAGIC   0x48325548  // 'H2UH'
+#define HANDOFF_VERSION 2
+#define HANDOFF_MAXDATA (16 * 1024 * 1024)
+#define HANDOFF_READY   'R'         // receiver acknowledgement
+
+enum handoffType {
+    HANDOFF_END,                // no more records
+    HANDOFF_STATE,              // application state (opaque)
+    HANDOFF_DEVICE,             // a device, see handoff_send_device()
+};
+
+enum handoffKind {
+    HANDOFF_SERIAL,
+    HANDOFF_LISTEN,
+    HANDOFF_ACCEPTED,
+    HANDOFF_CONNECT,
+};
+
+typedef struct handoff_device_s handoff_device_t;
+
+// device details returned to the receiver for it to complete
+struct handoff_device_s {
+    int kind;                   // enum handoffKind
+    int listener;               // accepted: sender's index of its listener (-1 = none)
+    char const *filter;         // output filter pattern (NULL = none)
+    size_t filterlen;
+};
+
+extern int handoff_send(int sock, int type, int fd, void const *data, size_t length);
+extern int handoff_recv(int sock, int *type, int *fd, void **data, size_t *length);
+
+extern int handoff_send_device(int sock, iodev_t *dev, int listener, char const *filter);
+extern iodev_t *handoff_recv_device(selector_t *selector, int fd, void const *data, size_t length, handoff_device_t *info);
+
+#endif //GENERIC_HANDOFF_H
@@ -5,8 +5,15 @@
 #ifndef HDMI2USBD_HDMI2USBD_H
 #define HDMI2USBD_HDMI2USBD_H
 
+#include <stdint.h>
+
 #include "selector.h"
+#include "nettcp.h"
 #include "timer.h"
+#include "devparse.h"
+#include "filter.h"
+#include "compress.h"
+#include "pacing.h"
 
 #define HDMI2USBD_VERSION "1.0"
 #define HDMI2USBD_NAME "hdmi2usbd"
@@ -26,29 +33,80 @@ enum {
 
 // configuration data
 struct hdmi2usb_opts {
+    char const *config;         // options file (re-read on SIGHUP)
     int verbose;
     int logflags;
     char const *logfile;
+    char const *loglevels;      // per module log levels (NULL = verbose)
+    char const *recorder;       // flight recorder dump file (NULL = default)
     int daemonize;
     unsigned long baudrate;
     char const *port;
     char const *listen_addr;
     unsigned short listen_port;
     int listen_flags;
+    int backlog;                // listen(2) backlog
+    unsigned maxconn;           // connections per listener (0 = unlimited)
+    unsigned maxperaddr;        // connections per client address (0 = unlimited)
+    tcp_profile_t sockopts;     // socket options for client connections
+    char const *mcast_addr;
+    unsigned short mcast_port;
+    int mcast_ttl;              // multicast ttl/hop limit
+    char const *upstream_addr;  // relay this daemon instead of a serial device
+    unsigned short upstream_port;
+    char const *admin_addr;     // admin control listener
+    unsigned short admin_port;  // (0 = none)
+    char const *websocket_addr; // WebSocket gateway listener
+    unsigned short websocket_port;  // (0 = none)
     unsigned iobufsize;
+    unsigned iobufmax;          // connection buffers grow up to this size
+    unsigned long input_rate;   // client input limit, bytes per second (0 = unlimited)
+    unsigned long input_burst;  // bytes a client may send at once
+    unsigned long maxline;      // longest command line (0 = unlimited)
+    unsigned long maxqueue;     // commands queued per client before reads are held (0 = unlimited)
     unsigned long loop_time;
-    unsigned long command_time;
+    unsigned long command_time; // minimum time between commands (ms)
+    int adaptive;               // pace commands by device prompt
+    unsigned long profile_time; // log the loop profile every so many seconds (0 = never)
+    unsigned long stall_time;   // event loop phases taking longer than this (ms) are stalls (0 = off)
+    int inherit_fd;             // receive devices from an upgrading instance (-1 = none)
 };
 
 typedef unsigned long millitime_t;
 
+// framed client request currently being serviced by the device
+struct hdmi2usb_request {
+    int active;
+    size_t index;               // device index of the requesting connection
+    int fd;                     // and its fd (guards against slot reuse)
+    uint32_t reqid;             // client supplied request id
+};
+
 // working data
 struct hdmi2usb {
     struct hdmi2usb_opts opts;
     selector_t selector;        // selector (including device array)
     buffer_t proc;              // serial input (pre-processing)
     buffer_t copy;              // output to network connections (post-processing)
-    microtimer_t last_command;       // timestamp of last command
+    segbuf_t fanout;            // the same output as shared segments (text connections)
+    segbuf_t wsfanout;          // and as a WebSocket frame (WebSocket connections)
+    compressor_t compressors[COMPRESS_LEVELS]; // and compressed, by level (text connections)
+    pacing_t pacing;            // commands sent to the device
+    utime_t command_pace;       // minimum time between commands (us)
+    struct hdmi2usb_request request; // framed request awaiting completion
+    devparse_t parser;          // device output parser
+    filterset_t filters;        // output filters shared by subscribers
+    size_t filtered;            // number of connections with an output filter
+    unsigned long input_held;   // clients held by the input rate limit
+    unsigned long queue_held;   // clients held by the queued command limit
+    unsigned long overlong;     // command lines discarded as too long
+    microtimer_t idle_trim;     // next release of idle connection buffers
+    int activated;              // listeners passed by the service manager (device 1 on)
+    size_t admin_index;         // device index of the admin listener (0 = none)
+    size_t websocket_index;     // device index of the WebSocket listener (0 = none)
+    int ready;                  // readiness has been notified
+    int (*reload)(struct hdmi2usb_opts *opts);  // re-read options on SIGHUP (optional)
+    char * const *argv;         // command line, re-executed on upgrade (SIGUSR2)
 };
 
 
@@ -12,6 +12,10 @@
 #include <stdarg.h>
 
 #include "buffer.h"
+#include "segbuf.h"
+#include "timer.h"
+
+#define IODEV_COALESCE_BYTES 1400   // send at once when at least this much is queued
 
 enum devState {
     IODEV_NONE,             // default state
@@ -34,10 +38,12 @@ typedef struct iodev_s iodev_t;
 typedef struct selector_s selector_t;
 typedef struct iodev_cfg_s iodev_cfg_t;
 typedef struct stringstore_s stringstore_t;
+typedef struct session_s session_t;
 
 
 struct iodev_cfg_s {
     const char *name;       // driver identifier
+    int logmodule;          // enum LogModule, for the driver's log level
     void (*free_cfg)(iodev_cfg_t *);
 };
 
@@ -54,9 +60,15 @@ struct iodev_s {
     int listener;               // non-zero = listener
     int state;                  // current state
     size_t bufsize;             // default buffer size (accept sockets)
+    size_t bufmax;              // buffer growth ceiling (accept sockets, 0 = fixed)
     buffer_t rbuf;              // receive buffer
     buffer_t tbuf;              // transmit buffer
+    segbuf_t *tseg;             // shared segments queued ahead of tbuf (optional)
+    utime_t coalesce;           // hold small writes for up to this long (us, 0 = off)
+    utime_t queued_since;       // when output was first seen queued
     stringstore_t *linebuf;     // received command line buffer
+    session_t *session;         // client session state
+    int held;                   // reads paused by the application (backpressure)
 
     // device control
     int (*open)(iodev_t *dev);
@@ -75,6 +87,7 @@ struct iodev_s {
     ssize_t (*write)(iodev_t *dev, void const *buf, size_t len);
 
     int (*sendOk)(iodev_t *dev);
+    int (*recvOk)(iodev_t *dev);
 };
 
 
@@ -87,10 +100,16 @@ extern int iodev_is_open(iodev_t *dev);
 
 extern int iodev_getstate(iodev_t *dev);
 extern int iodev_setstate(iodev_t *dev, int state);
+extern char const *iodev_statename(int state);
 
 extern buffer_t *iodev_tbuf(iodev_t *dev);
 extern buffer_t *iodev_rbuf(iodev_t *dev);
+extern segbuf_t *iodev_tseg(iodev_t *dev);
+extern size_t iodev_pending(iodev_t *dev);
 extern stringstore_t *iodev_stringstore(iodev_t *dev);
+extern session_t *iodev_session(iodev_t *dev);
+extern int iodev_held(iodev_t *dev);
+extern void iodev_hold(iodev_t *dev, int held);
 
 extern selector_t *getselector(iodev_t *dev);
 extern void setselector(iodev_t *dev, selector_t *selector);
@@ -102,7 +121,9 @@ extern int iodev_error(char const *fmt, ...) __attribute__((format (printf, 1, 2
 extern int iodev_notify(char const *fmt, ...) __attribute__((format (printf, 1, 2)));
 
 extern iodev_t *iodev_init(iodev_t *dev, iodev_cfg_t *cfg, size_t bufsize);
+extern iodev_t *iodev_init_elastic(iodev_t *dev, iodev_cfg_t *cfg, size_t bufsize, size_t bufmax);
 extern void iodev_free(iodev_t *dev);
+extern size_t iodev_trim(iodev_t *dev);
 
 extern ssize_t iodev_write(iodev_t *dev, void const *buf, size_t len);
 extern ssize_t iodev_read(iodev_t *dev, void *buf, size_t len);
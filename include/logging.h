@@ -7,6 +7,7 @@
 
 #include <stddef.h>
 #include <stdarg.h>
+#include <stdio.h>
 
 enum Verbosity {
     V_NONE =0,
@@ -21,6 +22,17 @@ enum Verbosity {
     V_MAX = V_TRACE
 };
 
+// Modules with their own log level, adjustable at runtime. A source file
+// defines LOG_MODULE before including this header (default LOG_APP)
+enum LogModule {
+    LOG_APP,
+    LOG_SELECTOR,
+    LOG_SERIAL,
+    LOG_TCP,
+    LOG_UDP,
+    LOG_MODULES
+};
+
 enum LogOption {
     LOG_ECHO    =0x01,          // Also log to:
     LOG_STDERR  =0x02,          //  stderr (stdout is default)
@@ -28,6 +40,7 @@ enum LogOption {
     LOG_UTC     =0x08,          // Log time in UTC
     LOG_FILE    =0x10,          // Log to file
     LOG_NOECHO  =0x20,          // Don't echo log to stdout/stderr
+    LOG_BINARY  =0x40,          // Log file is binary, formatted later by log_decode()
 };
 
 
@@ -35,6 +48,10 @@ enum LogOption {
 // configurable handlers and formatters etc. etc.
 
 extern void log_init(int flags, enum Verbosity verbosity, char const *logpath);
+extern void log_setlevel(enum LogModule module, enum Verbosity verbosity);
+extern int log_setlevels(char const *spec);     // "module=level[,...]", -1 if invalid
+extern int log_checklevels(char const *spec);   // as above, without setting
+extern char const *log_module_name(enum LogModule module);
 extern void log_rotate();               // close current log (if any), start a new one
 extern char const *log_name();          // current log name (NULL if none)
 
@@ -50,4 +67,35 @@ extern int log_debug(char const *fmt, ...) __attribute__((format (printf, 1, 2))
 extern int log_trace(char const *fmt, ...) __attribute__((format (printf, 1, 2)));
 extern int log_message(enum Verbosity verbose, char const *fmt, ...) __attribute__((format (printf, 2, 3)));
 
+// Binary log support (LOG_BINARY)
+// Messages are recorded as a format id, a raw timestamp and the raw
+// arguments, so formats must be string literals (as they all are).
+// log_decode() renders a binary log as text, returning the number of
+// messages or -1 if the input is not a binary log.
+extern long log_decode(FILE *in, FILE *out);
+
+
+// Levels are checked before a call is made or its arguments evaluated,
+// and messages above LOG_LEVEL_MAX are compiled out entirely (release
+// builds set this to V_DEBUG)
+
+#ifndef LOG_LEVEL_MAX
+#define LOG_LEVEL_MAX V_MAX
+#endif
+#ifndef LOG_MODULE
+#define LOG_MODULE LOG_APP
+#endif
+
+extern unsigned char log_levels[LOG_MODULES];
+
+#define log_enabled(module, level) ((level) <= LOG_LEVEL_MAX && (level) <= log_levels[module])
+#define log_module(module, level, ...) (log_enabled(module, level) ? (void)log_message(level, __VA_ARGS__) : (void)0)
+
+#define log_critical(...)   (log_enabled(LOG_MODULE, V_CRITICAL) ? (void)(log_critical)(__VA_ARGS__) : (void)0)
+#define log_error(...)      (log_enabled(LOG_MODULE, V_ERROR) ? (void)(log_error)(__VA_ARGS__) : (void)0)
+#define log_warning(...)    (log_enabled(LOG_MODULE, V_WARN) ? (void)(log_warning)(__VA_ARGS__) : (void)0)
+#define log_info(...)       (log_enabled(LOG_MODULE, V_INFO) ? (void)(log_info)(__VA_ARGS__) : (void)0)
+#define log_debug(...)      (log_enabled(LOG_MODULE, V_DEBUG) ? (void)(log_debug)(__VA_ARGS__) : (void)0)
+#define log_trace(...)      (log_enabled(LOG_MODULE, V_TRACE) ? (void)(log_trace)(__VA_ARGS__) : (void)0)
+
 #endif //GENERIC_LOGGING_H
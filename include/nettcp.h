@@ -6,20 +6,57 @@
 #define GENERIC_NETTCP_H
 
 #include "iodev.h"
+#include "timer.h"
 
 typedef struct tcp_cfg_s tcp_cfg_t;
+typedef struct tcp_profile_s tcp_profile_t;
+
+#define TCP_BACKLOG         128     // default listen(2) backlog
+#define TCP_ACCEPT_BUDGET   32      // most connections accepted per wakeup
+#define TCP_COALESCE        2000    // default write coalescing window (us)
+#define TCP_RETRY_MIN       250000UL    // first reconnect delay (us)
+#define TCP_RETRY_MAX       30000000UL  // reconnect delay doubles up to this (us)
+
+// socket options applied to connections accepted by a listener
+struct tcp_profile_s {
+    int nodelay;                // TCP_NODELAY
+    unsigned coalesce;          // user space write coalescing window (us, 0 = off)
+    int notsent_lowat;          // TCP_NOTSENT_LOWAT (0 = system default)
+    int sndbuf;                 // SO_SNDBUF (0 = system default)
+    int rcvbuf;                 // SO_RCVBUF (0 = system default)
+};
 
 struct tcp_cfg_s {
     iodev_cfg_t cfg;
     socklen_t addrlen;          // length of address info
     struct sockaddr *local;
     struct sockaddr *remote;
+    // listen sockets: admission control
+    int backlog;                // listen(2) backlog
+    unsigned maxconn;           // connections per listener (0 = unlimited)
+    unsigned maxperaddr;        // connections per source address (0 = unlimited)
+    unsigned long rejected;     // connections refused by these limits
+    tcp_profile_t profile;      // options for accepted connections
+    // accepted sockets
+    int listen_fd;              // socket the connection was accepted on
+    // outbound sockets: reconnection
+    microtimer_t retry;         // next connection attempt not before this
+    utime_t backoff;            // current reconnect delay (0 = none yet)
+    unsigned long attempts;     // failed attempts since last connected
+    int (*set_masks)(iodev_t *dev, fd_set *rs, fd_set *ws, fd_set *xs);
+    ssize_t (*write_handler)(iodev_t *dev);
 };
 
 extern tcp_cfg_t *tcp_getcfg(iodev_t *sdev);
+extern void tcp_listen_limits(iodev_t *dev, int backlog, unsigned maxconn, unsigned maxperaddr);
+extern void tcp_listen_profile(iodev_t *dev, tcp_profile_t const *profile);
+extern int tcp_profile_parse(tcp_profile_t *profile, char const *spec);
+extern char const *tcp_profile_str(tcp_profile_t const *profile, char *buf, size_t len);
 
-extern iodev_t *tcp_create_listen(iodev_t *dev, struct sockaddr *local, size_t bufsize);
-extern iodev_t *tcp_create_accepted(iodev_t *dev, int fd, struct sockaddr *remote, size_t bufsize);
+extern iodev_t *tcp_create_listen(iodev_t *dev, struct sockaddr *local, size_t bufsize, size_t bufmax);
+extern iodev_t *tcp_create_accepted(iodev_t *dev, int fd, struct sockaddr *remote, size_t bufsize, size_t bufmax);
 extern iodev_t *tcp_create_connect(iodev_t *dev, struct sockaddr *remote, size_t bufsize);
+extern iodev_t *tcp_adopt(iodev_t *dev, int fd);
+extern int tcp_is_connect(iodev_t *dev);
 
 #endif //GENERIC_NETTCP_H
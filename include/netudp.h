@@ -0,0 +1,47 @@
+//
+// UDP (multicast) publisher device
+// Transmit only: each chunk of the transmit buffer is sent as a single
+// datagram prefixed by a small header carrying a sequence number so
+// that subscribers can detect loss.
+
+#ifndef GENERIC_NETUDP_H
+#define GENERIC_NETUDP_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "iodev.h"
+
+#define UDP_MAGIC       0x4855      // 'HU'
+#define UDP_HDRSIZE     8           // size of the encoded header
+#define UDP_PAYLOAD     1400        // max payload per datagram (stays under typical path MTU)
+#define UDP_TTL         1           // default multicast ttl/hop limit (local subnet only)
+
+typedef struct udp_cfg_s udp_cfg_t;
+typedef struct udp_header_s udp_header_t;
+
+// decoded datagram header (wire format is network byte order)
+struct udp_header_s {
+    uint16_t magic;             // UDP_MAGIC
+    uint16_t length;            // payload length
+    uint32_t seq;               // datagram sequence number
+};
+
+struct udp_cfg_s {
+    iodev_cfg_t cfg;
+    socklen_t addrlen;          // length of address info
+    struct sockaddr *group;     // destination, multicast group or unicast address
+    int ttl;                    // multicast ttl/hop limit
+    uint32_t seq;               // sequence number of the next datagram
+    unsigned long dropped;      // datagrams dropped due to send errors
+};
+
+extern udp_cfg_t *udp_getcfg(iodev_t *dev);
+
+extern iodev_t *udp_create_publish(iodev_t *dev, struct sockaddr *group, int ttl, size_t bufsize);
+
+// datagram header encoding, shared with subscribers
+extern size_t udp_header_encode(void *dst, uint32_t seq, size_t length);
+extern int udp_header_decode(void const *src, size_t size, udp_header_t *hdr);
+
+#endif //GENERIC_NETUDP_H
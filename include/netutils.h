@@ -34,6 +34,7 @@ extern socklen_t sockaddr_len(struct sockaddr *addr);
 extern void *sockaddr_addr(struct sockaddr *addr);
 extern unsigned short sockaddr_port(struct sockaddr *addr);
 extern struct sockaddr *sockaddr_dup(struct sockaddr *addr);
+extern int sockaddr_equal(struct sockaddr *a, struct sockaddr *b);
 
 // public internals
 
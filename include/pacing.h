@@ -0,0 +1,40 @@
+//
+// Command pacing
+//
+// Commands are sent to the device no closer together than the pace. With
+// adaptive pacing the next may be sent as soon as the device prompts after
+// the last one, provided that one was completely written first, and the
+// time each takes is kept as a moving average. The pace remains the upper
+// bound in case a prompt is missed, which is counted as a timeout. The
+// pace and whether pacing is adaptive are passed on each call so that they
+// may be changed at any time.
+
+#ifndef GENERIC_PACING_H
+#define GENERIC_PACING_H
+
+#include "timer.h"
+
+#define PACING_WEIGHT   8       // service time average weight (1/8 per sample)
+
+typedef struct pacing_s pacing_t;
+
+struct pacing_s {
+    utime_t sent;               // when the last command was sent
+    utime_t due;                // the next may be sent from then regardless (0 = now)
+    utime_t prompt_time;        // when the device last signalled it was ready
+    int prompted;               // prompt seen since the last command was sent
+    int awaiting;               // last command sent has not yet completed
+    utime_t service_time;       // moving average of command service time (us)
+    unsigned long timeouts;     // adaptive: commands that did not prompt within the pace
+};
+
+extern void pacing_init(pacing_t *pacing);
+extern void pacing_sent(pacing_t *pacing, utime_t pace, utime_t now);
+extern void pacing_prompt(pacing_t *pacing, int drained, utime_t when);
+extern int pacing_expired(pacing_t *pacing, utime_t now);
+extern int pacing_ready(pacing_t *pacing, int adaptive, utime_t now);
+extern int pacing_timeout(pacing_t *pacing, int adaptive, utime_t now);
+extern utime_t pacing_remaining(pacing_t *pacing, utime_t now);
+extern void pacing_resume(pacing_t *pacing, utime_t remaining, utime_t now);
+
+#endif //GENERIC_PACING_H
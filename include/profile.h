@@ -0,0 +1,53 @@
+//
+// Event loop phase profiler
+//
+// Each pass of the selector loop is split into phases, and the time spent
+// in each is collected into a histogram with power of two buckets (us).
+// Handler time is also attributed to the device it was spent on, so that
+// the worst offender can be named. Collection is always on, it costs a
+// clock read or two per phase.
+
+#ifndef GENERIC_PROFILE_H
+#define GENERIC_PROFILE_H
+
+#include <stddef.h>
+
+#include "timer.h"
+
+#define PROFILE_BUCKETS 24      // bucket n holds times < 2^n us, the last everything longer
+#define PROFILE_MAXFD   1024    // devices are tracked by descriptor up to this
+
+enum ProfilePhase {
+    PROF_IOSET,                 // preparing the select sets (set_masks)
+    PROF_SELECT,                // blocked in select
+    PROF_HANDLERS,              // read, write and except handlers
+    PROF_PROCESS,               // application processing
+    PROF_LOOP,                  // the whole pass, including the above
+    PROF_PHASES
+};
+
+typedef struct profile_hist_s profile_hist_t;
+
+struct profile_hist_s {
+    unsigned long count;
+    utime_t total;
+    utime_t max;
+    unsigned long buckets[PROFILE_BUCKETS];
+};
+
+extern utime_t profile_now();
+extern utime_t profile_mark(int phase, utime_t since);
+extern void profile_add(int phase, utime_t elapsed);
+extern void profile_device(int fd, char const *driver, utime_t elapsed);
+
+extern profile_hist_t const *profile_phase(int phase);
+extern char const *profile_phase_name(int phase);
+extern utime_t profile_percentile(int phase, int percent);
+extern int profile_worst(int *fd, char const **driver, utime_t *total, utime_t *max);
+
+extern int profile_format(int phase, char *buf, size_t size);
+extern int profile_format_worst(char *buf, size_t size);
+extern utime_t profile_since();
+extern void profile_reset();
+
+#endif //GENERIC_PROFILE_H
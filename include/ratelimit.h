@@ -0,0 +1,26 @@
+//
+// Token bucket rate limiter
+//
+// Tokens (bytes) accumulate at a fixed rate up to the burst size. Input
+// is accepted while any tokens remain and is charged for in full after
+// the fact, so the bucket may be overdrawn and must then refill before
+// more is accepted. The rate and burst are passed on each call so that
+// they may be changed at any time.
+
+#ifndef GENERIC_RATELIMIT_H
+#define GENERIC_RATELIMIT_H
+
+#include "timer.h"
+
+typedef struct ratelimit_s ratelimit_t;
+
+struct ratelimit_s {
+    long tokens;                // available, negative when overdrawn
+    utime_t last;               // when tokens were last added (0 = never, starts full)
+};
+
+extern void ratelimit_init(ratelimit_t *rl);
+extern int ratelimit_ready(ratelimit_t *rl, unsigned long rate, unsigned long burst, utime_t now);
+extern void ratelimit_charge(ratelimit_t *rl, unsigned long tokens);
+
+#endif //GENERIC_RATELIMIT_H
@@ -0,0 +1,49 @@
+//
+// Flight recorder
+//
+// A fixed size ring of compact event records, cheap enough to write from
+// the hot paths all of the time. Slots are claimed with an atomic counter,
+// so nothing ever blocks or allocates, and the oldest events are simply
+// overwritten. The ring is dumped to a file on request or after a crash,
+// recorder_decode() renders a dump as a timeline.
+
+#ifndef GENERIC_RECORDER_H
+#define GENERIC_RECORDER_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define RECORDER_EVENTS 4096            // ring size (power of 2)
+#define RECORDER_MAGIC  "H2UREC\x01\n"
+
+enum RecEvent {
+    REC_NONE,
+    REC_WAKEUP,                 // selector woke: a = active devices (max 255), value = ready (-1 = error)
+    REC_READ,                   // fd read: value = bytes (-1 = error)
+    REC_WRITE,                  // fd written: value = bytes (-1 = error)
+    REC_STATE,                  // fd state change: a = old, value = new
+    REC_QUEUE,                  // command input queued from fd: value = bytes
+    REC_SEND,                   // command sent for fd: value = bytes
+    REC_DUMP,                   // dump requested: value = signal (0 = none)
+    REC_STALL,                  // loop stalled on fd (-1 = none): value = ms so far
+    REC_HOLD,                   // fd reads held: a = reason (0 = resumed), value = bytes waiting
+    REC_EVENTS
+};
+
+// 16 bytes per event, written and dumped in host byte order
+typedef struct rec_event_s {
+    int64_t time;               // us since the epoch
+    uint8_t type;               // enum RecEvent
+    uint8_t a;                  // small argument, see above
+    int16_t fd;
+    int32_t value;
+} rec_event_t;
+
+extern void recorder_event(int type, int fd, int a, long value);
+
+extern void recorder_init(char const *path);    // NULL = /tmp/hdmi2usbd-<pid>.rec
+extern char const *recorder_path();
+extern int recorder_dump(char const *path);     // NULL = recorder_path(), async-signal-safe
+extern long recorder_decode(FILE *in, FILE *out);
+
+#endif //GENERIC_RECORDER_H
@@ -0,0 +1,65 @@
+//
+// Chained buffer of reference counted segments
+//
+// Data is held in fixed size segments drawn from a shared slab pool. A
+// segbuf_t is a chain of references to (parts of) segments, so the same
+// data can be queued on any number of chains without being copied, and
+// a chain can be written with a single writev(2).
+
+#ifndef GENERIC_SEGBUF_H
+#define GENERIC_SEGBUF_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+#define SEGBUF_SEGSIZE  1024    // bytes of data per segment
+#define SEGBUF_PERSLAB  64      // segments allocated at a time
+#define SEGBUF_MAXIOV   16      // most segments written per writev(2)
+
+typedef struct segment_s segment_t;
+typedef struct segref_s segref_t;
+typedef struct segbuf_s segbuf_t;
+
+struct segment_s {
+    segment_t *next;            // free list link
+    unsigned refs;              // number of chain references
+    size_t length;              // bytes of data filled so far
+    unsigned char data[SEGBUF_SEGSIZE];
+};
+
+struct segref_s {
+    segref_t *next;             // next in chain, or free list link
+    segment_t *segment;
+    size_t offset,              // first byte referenced
+           length;              // number of bytes referenced
+};
+
+struct segbuf_s {
+    int alloc;
+    segref_t *head,
+             *tail;
+    size_t used,                // bytes held
+           max;                 // capacity limit (0 = unlimited)
+};
+
+extern segbuf_t *segbuf_init(segbuf_t *segbuf, size_t max);
+extern void segbuf_free(segbuf_t *segbuf);
+extern void segbuf_flush(segbuf_t *segbuf);
+
+extern size_t segbuf_used(segbuf_t *segbuf);
+extern size_t segbuf_available(segbuf_t *segbuf);
+extern size_t segbuf_count(segbuf_t *segbuf);
+
+extern size_t segbuf_put(segbuf_t *segbuf, void const *data, size_t len);
+extern size_t segbuf_share(segbuf_t *dst, segbuf_t *src, size_t len);
+extern size_t segbuf_share_whole(segbuf_t *dst, segbuf_t *src, size_t len);
+extern size_t segbuf_peek(segbuf_t *segbuf, void *buf, size_t len);
+extern size_t segbuf_get(segbuf_t *segbuf, void *buf, size_t len);
+extern size_t segbuf_consume(segbuf_t *segbuf, size_t len);
+extern int segbuf_iov(segbuf_t *segbuf, struct iovec *iov, int maxiov);
+
+// slab pool statistics
+extern size_t segbuf_segments_allocated(void);
+extern size_t segbuf_segments_free(void);
+
+#endif //GENERIC_SEGBUF_H
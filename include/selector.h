@@ -8,12 +8,20 @@
 
 #include "array.h"
 #include "iodev.h"
+#include "timer.h"
 
 typedef struct selector_s selector_t;
 
+// Called after each dispatch of ready devices, with the dispatch result
+// A non-zero return value ends selector_loop() with that value
+typedef int (*selector_hook_t)(selector_t *selector, int rc, void *arg);
+
 struct selector_s {
     int alloc;
     array_t devs;
+    selector_hook_t hook;
+    void *hook_arg;
+    utime_t deadline;           // earliest time a device needs attention (0 = none)
 };
 
 struct sockaddr;
@@ -22,13 +30,17 @@ extern selector_t *selector_init(selector_t *selector);
 extern void selector_free(selector_t *selector);
 extern size_t selector_device_count(selector_t *selector);
 extern iodev_t *selector_get_device(selector_t *selector, size_t index);
+extern size_t selector_device_index(selector_t *selector, iodev_t *dev);
 extern void selector_add_device(selector_t *selector, iodev_t *dev);
 extern iodev_t *selector_set(selector_t *selector, iodev_t *dev);
+extern void selector_set_hook(selector_t *selector, selector_hook_t hook, void *arg);
+extern void selector_set_deadline(selector_t *selector, utime_t when);
 
 extern iodev_t *selector_new_device_serial(selector_t *selector, char const *devname, unsigned long baudrate, size_t bufsize);
-extern iodev_t *selector_new_device_listen(selector_t *selector, struct sockaddr *local, size_t bufsize);
+extern iodev_t *selector_new_device_listen(selector_t *selector, struct sockaddr *local, size_t bufsize, size_t bufmax);
 extern iodev_t *selector_new_device_connect(selector_t *selector, struct sockaddr *remote, size_t bufsize);
-extern iodev_t *selector_new_device_accept(selector_t *selector, int fd, struct sockaddr *remote, size_t bufsize);
+extern iodev_t *selector_new_device_accept(selector_t *selector, int fd, struct sockaddr *remote, size_t bufsize, size_t bufmax);
+extern iodev_t *selector_new_device_publish(selector_t *selector, struct sockaddr *group, int ttl, size_t bufsize);
 
 extern int selector_loop(selector_t *selector, unsigned long timeout);
 
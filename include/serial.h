@@ -5,6 +5,8 @@
 #ifndef GENERIC_SERIAL_H
 #define GENERIC_SERIAL_H
 
+#include <termios.h>
+
 #define BINVALID ((unsigned long)-1)
 
 unsigned long baud_to_speed(unsigned long baud);
@@ -13,6 +15,8 @@ unsigned long speed_to_baud(unsigned long speed);
 #include "iodev.h"
 #include "timer.h"
 
+#define CHARACTER_PACING   5000     // default delay between characters (us)
+
 typedef struct serial_cfg_s serial_cfg_t;
 
 struct serial_cfg_s {
@@ -21,9 +25,11 @@ struct serial_cfg_s {
     unsigned long baudrate;
     struct termios *termctl;
     microtimer_t pacer;
+    utime_t pacing;             // delay between characters written (us)
 };
 
 extern serial_cfg_t *serial_getcfg(iodev_t *sdev);
 extern iodev_t *serial_create(iodev_t *dev, char const *devname, unsigned long baudrate, size_t bufsize);
+extern iodev_t *serial_adopt(iodev_t *dev, int fd, struct termios const *termctl);
 
 #endif //GENERIC_SERIAL_H
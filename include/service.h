@@ -0,0 +1,19 @@
+//
+// Service manager integration (systemd protocol, without libsystemd)
+//
+// Socket activation passes pre-opened sockets as descriptors starting at
+// SERVICE_LISTEN_FDS_START, readiness and status are reported by sending
+// "VARIABLE=value" lines to the datagram socket named in $NOTIFY_SOCKET.
+// With a watchdog configured (WATCHDOG_USEC) "WATCHDOG=1" must be sent at
+// least that often. All are no-ops when not run by a service manager.
+
+#ifndef GENERIC_SERVICE_H
+#define GENERIC_SERVICE_H
+
+#define SERVICE_LISTEN_FDS_START 3
+
+extern int service_listen_fds(int unset_environment);
+extern int service_notify(char const *fmt, ...) __attribute__((format (printf, 1, 2)));
+extern unsigned long service_watchdog_usec();
+
+#endif //GENERIC_SERVICE_H
@@ -0,0 +1,59 @@
+//
+// Per-connection client session state
+
+#ifndef GENERIC_SESSION_H
+#define GENERIC_SESSION_H
+
+#include <stdint.h>
+
+#include "array.h"
+#include "ratelimit.h"
+
+enum sessionProto {
+    SESSION_NEW,            // protocol not yet determined
+    SESSION_TEXT,           // newline terminated text commands
+    SESSION_FRAMED,         // length prefixed binary frames
+    SESSION_ADMIN,          // admin control, text commands to the daemon itself
+    SESSION_HANDSHAKE,      // WebSocket, awaiting the upgrade request
+    SESSION_WEBSOCKET,      // WebSocket, text frame commands and binary frame output
+};
+
+enum sessionHold {
+    HOLD_NONE,              // input accepted
+    HOLD_RATE,              // input rate limit reached
+    HOLD_QUEUE,             // too many commands queued
+};
+
+typedef struct session_s session_t;
+
+struct session_s {
+    int alloc;
+    int proto;              // client protocol
+    array_t reqids;         // request ids of queued commands, in line buffer order
+    int filter;             // output filter id (-1 = unfiltered)
+    int compress;           // output compression level (0 = none)
+    ratelimit_t input;      // input rate limit
+    int held;               // reason input is held (enum sessionHold)
+    int discarding;         // dropping the rest of an overlong line
+};
+
+extern session_t *session_init(session_t *session);
+extern void session_free(session_t *session);
+
+extern int session_proto(session_t *session);
+extern void session_setproto(session_t *session, int proto);
+extern int session_filter(session_t *session);
+extern void session_setfilter(session_t *session, int filter);
+extern int session_compress(session_t *session);
+extern void session_setcompress(session_t *session, int level);
+extern int session_held(session_t *session);
+extern void session_sethold(session_t *session, int held);
+extern int session_discarding(session_t *session);
+extern void session_setdiscarding(session_t *session, int discarding);
+
+// framed request queue
+extern size_t session_requests(session_t *session);
+extern void session_push_request(session_t *session, uint32_t reqid);
+extern int session_pop_request(session_t *session, uint32_t *reqid);
+
+#endif //GENERIC_SESSION_H
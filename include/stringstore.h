@@ -32,6 +32,7 @@ enum stringstore_pos {
 extern stringstore_t *stringstore_init(stringstore_t *pstore);
 extern stringstore_t *stringstore_init_n(stringstore_t *pstore, size_t size);
 extern void stringstore_free(stringstore_t *pstore);
+extern size_t stringstore_trim(stringstore_t *pstore);
 
 extern void *stringstore_buffer(stringstore_t *pstore);
 extern size_t stringstore_capacity(stringstore_t *pstore);
@@ -56,6 +57,8 @@ extern int stringstore_split(stringstore_t *pstore, char const *delim);
 
 // consume (remove) bytes from buffer
 extern void stringstore_consume(stringstore_t *pstore, size_t bytes);
+// drop bytes from the end, keeping the first length
+extern void stringstore_truncate(stringstore_t *pstore, size_t length);
 extern void stringstore_clear(stringstore_t *pstore);
 
 #endif //GENERIC_STRSTORE_H
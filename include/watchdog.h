@@ -0,0 +1,34 @@
+//
+// Event loop stall detection
+//
+// The loop reports what it is doing as it goes: waiting in select (idle),
+// or busy in a phase, optionally on behalf of a device. A separate thread
+// checks that no phase has run past the deadline, recording the phase and
+// device when one does. It also feeds the service manager watchdog, but
+// only while the loop is healthy, so that a wedged process is restarted.
+
+#ifndef GENERIC_WATCHDOG_H
+#define GENERIC_WATCHDOG_H
+
+#include "timer.h"
+
+typedef struct watchdog_stall_s watchdog_stall_t;
+
+struct watchdog_stall_s {
+    char const *phase;          // what the loop was doing
+    char const *driver;         // device driver (NULL = none)
+    int fd;                     // device descriptor (-1 = none)
+    utime_t duration;           // how long it took (us), as last seen by the watchdog
+};
+
+extern int watchdog_start(utime_t deadline, utime_t notify);
+extern void watchdog_stop();
+
+// called by the loop
+extern void watchdog_idle();
+extern void watchdog_enter(char const *phase, int fd, char const *driver);
+
+extern int watchdog_stalled(watchdog_stall_t *stall);
+extern unsigned long watchdog_stalls();
+
+#endif //GENERIC_WATCHDOG_H
@@ -0,0 +1,65 @@
+//
+// WebSocket (RFC 6455) server side protocol support
+//
+// A browser connects with an HTTP/1.1 GET asking to upgrade, answered by
+// 101 Switching Protocols. From then on data travels in frames, each a
+// 2 to 14 byte header followed by the payload. Frames from the client
+// are masked, those from the server never are.
+
+#ifndef GENERIC_WEBSOCKET_H
+#define GENERIC_WEBSOCKET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "buffer.h"
+
+#define WS_MAXREQUEST   4096    // longest upgrade request accepted
+#define WS_MAXHEADER    14      // longest frame header
+#define WS_MAXCONTROL   125     // longest control frame payload
+#define WS_ACCEPTSIZE   29      // Sec-WebSocket-Accept value, including the terminator
+
+#define WS_BADREQUEST   "HTTP/1.1 400 Bad Request\r\nConnection: close\r\nContent-Length: 0\r\n\r\n"
+
+enum wsOpcode {
+    WS_CONTINUATION = 0x0,  // further fragment of a message
+    WS_TEXT = 0x1,          // utf-8 message
+    WS_BINARY = 0x2,        // binary message
+    WS_CLOSE = 0x8,         // closing handshake, payload is a status code and reason
+    WS_PING = 0x9,
+    WS_PONG = 0xa,
+};
+
+enum wsStatus {
+    WS_STATUS_NORMAL = 1000,
+    WS_STATUS_PROTOCOL = 1002,      // protocol error
+    WS_STATUS_UNSUPPORTED = 1003,   // data type not accepted
+    WS_STATUS_TOOBIG = 1009,        // message too big to process
+};
+
+typedef struct ws_header_s ws_header_t;
+
+struct ws_header_s {
+    int fin;                // final fragment of a message
+    int opcode;
+    int masked;
+    unsigned char mask[4];
+    uint64_t length;        // payload length
+};
+
+// upgrade handshake
+extern void ws_accept_key(char const *key, size_t keylen, char *accept);
+extern size_t ws_request_length(char const *data, size_t length);
+extern int ws_handshake(char const *request, size_t length, char *response, size_t size);
+
+// framing
+extern size_t ws_header_encode(void *dst, int opcode, uint64_t length);
+extern int ws_header_decode(void const *src, size_t size, ws_header_t *hdr);
+extern void ws_unmask(void *data, size_t length, unsigned char const *mask);
+
+// queue complete (unmasked) frames in a buffer, all or nothing
+extern size_t ws_frame_put(buffer_t *dst, int opcode, void const *data, size_t length);
+extern size_t ws_frame_copy(buffer_t *dst, int opcode, buffer_t *src, size_t length);
+extern size_t ws_close_put(buffer_t *dst, int status);
+
+#endif //GENERIC_WEBSOCKET_H
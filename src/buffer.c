@@ -2,6 +2,11 @@
 // Created by David Nugent on 4/02/2016.
 //
 
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 #include <string.h>
 #include <stdlib.h>
 
@@ -10,6 +15,134 @@
 #define BUFFER_ALLOC    0x51a5a25
 
 
+// Round a requested size up to the next power of 2
+static size_t
+buffer_capacity(size_t size) {
+    size_t capacity = 1;
+    if (size == 0)
+        return 0;
+    while (capacity < size)
+        capacity <<= 1;
+    return capacity;
+}
+
+
+#ifdef __linux__
+
+// Map the same memory twice, back to back, so that data wrapping the end
+// of the buffer can be accessed in one piece. Only done for whole pages;
+// returns NULL (and the caller falls back to malloc) if anything fails
+static void *
+buffer_mirror(size_t size) {
+    long pagesize = sysconf(_SC_PAGESIZE);
+    if (pagesize <= 0 || size < (size_t)pagesize)
+        return NULL;
+    int fd = memfd_create("buffer", MFD_CLOEXEC);
+    if (fd == -1)
+        return NULL;
+    void *data = MAP_FAILED;
+    if (ftruncate(fd, (off_t)size) == 0 &&
+        (data = mmap(NULL, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) != MAP_FAILED) {
+        if (mmap(data, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+            mmap(data + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+            munmap(data, size * 2);
+            data = MAP_FAILED;
+        }
+    }
+    close(fd);
+    return data == MAP_FAILED ? NULL : data;
+}
+
+#endif
+
+
+//// pool of free blocks ////
+
+#define BUFPOOL_CLASSES 48      // one per power of 2 size
+#define BUFPOOL_DEPTH   16      // free blocks kept per size
+
+typedef struct {
+    void *data;
+    int mirrored;
+} bufblock_t;
+
+static struct {
+    size_t count;
+    bufblock_t blocks[BUFPOOL_DEPTH];
+} bufpool[BUFPOOL_CLASSES];
+
+static size_t bufpool_bytes = 0;
+
+
+static void
+buffer_release_block(bufblock_t *block, size_t size) {
+#ifdef __linux__
+    if (block->mirrored)
+        munmap(block->data, size * 2);
+    else
+#endif
+    free(block->data);
+}
+
+
+// take the memory for a buffer of size bytes from the pool, or allocate it
+static void
+buffer_alloc_data(buffer_t *buffer, size_t size) {
+    unsigned sizeclass = (unsigned)__builtin_ctzl(size);
+    buffer->b_size = size;
+    if (sizeclass < BUFPOOL_CLASSES && bufpool[sizeclass].count > 0) {
+        bufblock_t *block = &bufpool[sizeclass].blocks[--bufpool[sizeclass].count];
+        buffer->data = block->data;
+        buffer->mirrored = block->mirrored;
+        bufpool_bytes -= size;
+        return;
+    }
+    buffer->mirrored = 0;
+#ifdef __linux__
+    if ((buffer->data = buffer_mirror(size)) != NULL) {
+        buffer->mirrored = 1;
+        return;
+    }
+#endif
+    buffer->data = malloc(size);
+}
+
+
+// give a buffer's memory back to the pool (or the system if the pool is full)
+static void
+buffer_release_data(buffer_t *buffer) {
+    if (buffer->data != NULL) {
+        unsigned sizeclass = (unsigned)__builtin_ctzl(buffer->b_size);
+        bufblock_t block = { buffer->data, buffer->mirrored };
+        if (sizeclass < BUFPOOL_CLASSES && bufpool[sizeclass].count < BUFPOOL_DEPTH) {
+            bufpool[sizeclass].blocks[bufpool[sizeclass].count++] = block;
+            bufpool_bytes += buffer->b_size;
+        } else
+            buffer_release_block(&block, buffer->b_size);
+    }
+    buffer->data = NULL;
+    buffer->mirrored = 0;
+    buffer->b_size = buffer->b_lo = buffer->b_hi = 0;
+}
+
+
+size_t
+buffer_pool_bytes(void) {
+    return bufpool_bytes;
+}
+
+
+void
+buffer_pool_drain(void) {
+    for (unsigned sizeclass = 0; sizeclass < BUFPOOL_CLASSES; sizeclass++)
+        while (bufpool[sizeclass].count > 0)
+            buffer_release_block(&bufpool[sizeclass].blocks[--bufpool[sizeclass].count], (size_t)1 << sizeclass);
+    bufpool_bytes = 0;
+}
+
+
+//// buffers ////
+
 buffer_t *
 buffer_init(buffer_t *buffer, size_t size) {
     if (buffer != NULL)
@@ -18,28 +151,89 @@ buffer_init(buffer_t *buffer, size_t size) {
         buffer = calloc(1, sizeof(buffer_t));
         buffer->alloc = BUFFER_ALLOC;
     }
-    buffer->b_size = size;
     buffer->b_hi = buffer->b_lo = 0;
-    buffer->data = size ? malloc(buffer->b_size) : NULL;
+    buffer->data = NULL;
+    size = buffer_capacity(size);
+    if (size)
+        buffer_alloc_data(buffer, size);
+    return buffer;
+}
+
+
+// An elastic buffer allocates nothing until it is used, then starts at size
+// bytes and grows up to max bytes
+buffer_t *
+buffer_init_elastic(buffer_t *buffer, size_t size, size_t max) {
+    buffer = buffer_init(buffer, 0);
+    buffer->b_min = buffer_capacity(size ? size : 1);
+    buffer->b_max = buffer_capacity(max);
+    if (buffer->b_max < buffer->b_min)
+        buffer->b_max = buffer->b_min;
     return buffer;
 }
 
 
 void
 buffer_free(buffer_t *buffer) {
-    buffer->b_size = buffer->b_lo = buffer->b_hi = 0;
-    if (buffer->data) {
-        free(buffer->data);
-        buffer->data = NULL;
-    }
+    buffer_release_data(buffer);
+    buffer->b_min = buffer->b_max = buffer->b_mark = 0;
     if (buffer->alloc == BUFFER_ALLOC)
         free(buffer);
 }
 
 
+// reallocate an elastic buffer at a new size, keeping its data
+static int
+buffer_resize(buffer_t *buffer, size_t size) {
+    buffer_t resized;
+    memset(&resized, '\0', sizeof(resized));
+    buffer_alloc_data(&resized, size);
+    if (resized.data == NULL)
+        return -1;
+    size_t used = buffer_used(buffer);
+    buffer_peek(buffer, resized.data, used);
+    buffer_release_data(buffer);
+    buffer->data = resized.data;
+    buffer->mirrored = resized.mirrored;
+    buffer->b_size = size;
+    buffer->b_lo = 0;
+    buffer->b_hi = used;
+    return 0;
+}
+
+
+// Grow an elastic buffer (doubling each time) until len bytes fit or the
+// ceiling is reached. Returns the space now free in the buffer
+size_t
+buffer_reserve(buffer_t *buffer, size_t len) {
+    size_t used = buffer_used(buffer);
+    if (buffer->b_size - used < len && buffer->b_size < buffer->b_max) {
+        size_t size = buffer->b_size ? buffer->b_size : buffer->b_min;
+        while (size - used < len && size < buffer->b_max)
+            size <<= 1;
+        buffer_resize(buffer, size);
+    }
+    return buffer->b_size - used;
+}
+
+
+// Release the memory of an elastic buffer if it has been empty since the
+// previous call. Returns the number of bytes released
+size_t
+buffer_trim(buffer_t *buffer) {
+    size_t size = 0;
+    if (buffer->b_max && buffer->data != NULL && buffer_used(buffer) == 0 && buffer->b_hi == buffer->b_mark) {
+        size = buffer->b_size;
+        buffer_release_data(buffer);
+    }
+    buffer->b_mark = buffer->b_hi;
+    return size;
+}
+
+
 size_t buffer_size(buffer_t *buffer) { return buffer->b_size; }
-size_t buffer_hi(buffer_t *buffer) { return buffer->b_hi; }
-size_t buffer_lo(buffer_t *buffer) { return buffer->b_lo; }
+size_t buffer_hi(buffer_t *buffer) { return buffer->b_size ? buffer->b_hi & (buffer->b_size - 1) : 0; }
+size_t buffer_lo(buffer_t *buffer) { return buffer->b_size ? buffer->b_lo & (buffer->b_size - 1) : 0; }
 void * buffer_base(buffer_t *buffer) { return buffer->data; }
 
 
@@ -51,78 +245,121 @@ buffer_flush(buffer_t *buffer) {
 
 size_t
 buffer_used(buffer_t *buffer) {
-    if (buffer->b_hi >= buffer->b_lo)                       // |_^....v_|
-        return buffer->b_hi - buffer->b_lo;
-    return buffer->b_size - buffer->b_lo + buffer->b_hi;    // |..v__^..|
+    return buffer->b_hi - buffer->b_lo;
 }
 
 
+// elastic buffers report the space available once grown to their ceiling
 size_t
 buffer_available(buffer_t *buffer) {
-    return buffer->b_size ? buffer->b_size - buffer_used(buffer) - 1 : 0;
+    return (buffer->b_max ? buffer->b_max : buffer->b_size) - buffer_used(buffer);
+}
+
+
+// contiguous data starting offset bytes into the used region
+void *
+buffer_peekptr(buffer_t *buffer, size_t offset, size_t *len) {
+    size_t used = buffer_used(buffer);
+    if (offset >= used) {
+        *len = 0;
+        return NULL;
+    }
+    size_t pos = (buffer->b_lo + offset) & (buffer->b_size - 1);
+    size_t length = used - offset;
+    if (!buffer->mirrored && length > buffer->b_size - pos)
+        length = buffer->b_size - pos;
+    *len = length;
+    return buffer->data + pos;
+}
+
+
+void *
+buffer_readptr(buffer_t *buffer, size_t *len) {
+    return buffer_peekptr(buffer, 0, len);
+}
+
+
+// contiguous free space following the used region
+// elastic buffers are grown first once they are three quarters full
+void *
+buffer_writeptr(buffer_t *buffer, size_t *len) {
+    size_t length = buffer->b_size - buffer_used(buffer);
+    if (length <= buffer->b_size / 4 && buffer->b_size < buffer->b_max)
+        length = buffer_reserve(buffer, length + 1);
+    if (length == 0) {
+        *len = 0;
+        return NULL;
+    }
+    size_t pos = buffer->b_hi & (buffer->b_size - 1);
+    if (!buffer->mirrored && length > buffer->b_size - pos)
+        length = buffer->b_size - pos;
+    *len = length;
+    return buffer->data + pos;
+}
+
+
+size_t
+buffer_consume(buffer_t *buffer, size_t len) {
+    size_t used = buffer_used(buffer);
+    if (len > used)
+        len = used;
+    buffer->b_lo += len;
+    return len;
 }
 
 
-static inline size_t
-buffer_inc(buffer_t *buffer, size_t val, size_t by) {
-    val += by;
-    return val >= buffer->b_size ? 0 : val;
+size_t
+buffer_produce(buffer_t *buffer, size_t len) {
+    size_t avail = buffer->b_size - buffer_used(buffer);
+    if (len > avail)
+        len = avail;
+    buffer->b_hi += len;
+    return len;
 }
 
 
+static void
+buffer_reverse(unsigned char *lo, unsigned char *hi) {
+    while (lo < hi) {
+        unsigned char ch = *lo;
+        *lo++ = *--hi;
+        *hi = ch;
+    }
+}
+
+
+// move the data to the start of the buffer memory
 void
 buffer_compact(buffer_t *buffer) {
-    if (buffer->b_lo == 0) {                    // |^....v__|
-        // already compact, nothing to do
-    } else {
-        size_t size;
-        if (buffer->b_lo >= buffer->b_hi) {     // |_^....v_| -> |^....v__|
-            // not wrapped
-            size = buffer->b_lo - buffer->b_hi;
-            if (size)
-                memmove(buffer->data, buffer->data + buffer->b_lo, size);
-            // empty, just reset i/o ptrs
-        } else {                                // |..v__^..| -> |^....v__|
-            // duplicating+replacing the buffer is the simplest way
-            // avoids dealing with temp buffers and overlapping regions
-            void *data = malloc(buffer->b_size);
-            size = buffer->b_size - buffer->b_lo;
-            if (size)
-                memcpy(data, buffer->data + buffer->b_lo, size);
-            if (buffer->b_hi)
-                memcpy(data, buffer->data, buffer->b_hi);
-            size += buffer->b_hi;
-            free(buffer->data);
-            buffer->data = data;
+    size_t lo = buffer_lo(buffer), used = buffer_used(buffer);
+    if (lo != 0) {
+        unsigned char *data = buffer->data;
+        if (lo + used <= buffer->b_size)        // |_^....v_| -> |^....v__|
+            memmove(data, data + lo, used);
+        else {                                  // |..v__^..| -> |^....v__|
+            // rotate in place
+            buffer_reverse(data, data + lo);
+            buffer_reverse(data + lo, data + buffer->b_size);
+            buffer_reverse(data, data + buffer->b_size);
         }
-        buffer->b_lo = 0;
-        buffer->b_hi = size;
     }
+    buffer->b_lo = 0;
+    buffer->b_hi = used;
 }
 
 
 // put data into the buffer
 size_t
 buffer_put(buffer_t *buffer, void const *buf, size_t len) {
-    size_t avail = buffer_available(buffer);
-    if (len >= avail)    // partial put only if insufficient space
+    size_t avail = buffer_reserve(buffer, len);
+    if (len > avail)    // partial put only if insufficient space
         len = avail;
-    else
-        avail = len;
-    size_t top = buffer->b_size - buffer->b_hi;         // |_^....v_|
-    if (buffer->b_lo > buffer->b_hi)                    // |..v__^..|
-        top -= (buffer->b_size - buffer->b_lo);
-    if (top > avail)
-        top = avail;
-    if (top > 0) {
-        memcpy(buffer->data + buffer->b_hi, buf, top);
-        avail -= top;
-        buf += top;
-        buffer->b_hi = buffer_inc(buffer, buffer->b_hi, top);
-    }
-    if (avail) {
-        memcpy(buffer->data, buf, avail);
-        buffer->b_hi = buffer_inc(buffer, buffer->b_hi, avail);
+    for (size_t done = 0, chunk; done < len; done += chunk) {
+        void *ptr = buffer_writeptr(buffer, &chunk);
+        if (chunk > len - done)
+            chunk = len - done;
+        memcpy(ptr, buf + done, chunk);
+        buffer->b_hi += chunk;
     }
     return len;
 }
@@ -131,93 +368,44 @@ buffer_put(buffer_t *buffer, void const *buf, size_t len) {
 size_t
 buffer_peek(buffer_t *buffer, void *buf, size_t len) {
     size_t avail = buffer_used(buffer);
-    if (len > avail)    // partial put only if insufficient data
+    if (len > avail)    // partial peek only if insufficient data
         len = avail;
-    else
-        avail = len;
-    size_t lo = buffer->b_lo;
-    size_t hi = buffer->b_hi;
-    if (lo > hi) {
-        size_t top = buffer->b_size - lo;
-        if (top > avail)
-            top = avail;
-        if (top)
-            memcpy(buf, buffer->data + lo, top);
-        buf += top;
-        avail -= top;
-        lo = buffer_inc(buffer, lo, top);
+    for (size_t done = 0, chunk; done < len; done += chunk) {
+        void *ptr = buffer_peekptr(buffer, done, &chunk);
+        if (chunk > len - done)
+            chunk = len - done;
+        memcpy(buf + done, ptr, chunk);
     }
-    if (avail)
-        memcpy(buf, buffer->data + lo, avail);
     return len;
 }
 
 
 size_t
 buffer_get(buffer_t *buffer, void *buf, size_t len) {
-    size_t avail = buffer_used(buffer);
-    if (len > avail)    // partial put only if insufficient data
-        len = avail;
-    else
-        avail = len;
-    if (buffer->b_lo > buffer->b_hi) {
-        size_t top = buffer->b_size - buffer->b_lo;
-        if (top > avail)
-            top = avail;
-        if (top && buf) {
-            memcpy(buf, buffer->data + buffer->b_lo, top);
-            buf += top;
-        }
-        avail -= top;
-        buffer->b_lo = buffer_inc(buffer, buffer->b_lo, top);
-    }
-    if (avail) {
-        if (buf)
-            memcpy(buf, buffer->data + buffer->b_lo, avail);
-        buffer->b_lo = buffer_inc(buffer, buffer->b_lo, avail);
-    }
-    return len;
+    if (buf != NULL)
+        len = buffer_peek(buffer, buf, len);
+    return buffer_consume(buffer, len);
 }
 
 
 static size_t
 buffer_copymove(buffer_t *dst, buffer_t *src, size_t len, int move) {
-    // ajdust length for max bytes available in dst buffer
-    size_t d_avail = buffer_available(dst);
-    if (len > d_avail)
-        len = d_avail;
-    else d_avail = len;
-    // adjust length for max bytes available in the src buffer
-    size_t s_avail = buffer_used(src);
-    if (len > s_avail)
-        len = s_avail;
-    else s_avail = len;
-    // finally, trim if we have more bytes in src then can fit in dst
-    if (s_avail > d_avail)
-        s_avail = d_avail;
-    // dup hi and lo from source
-    size_t lo = src->b_lo;
-    size_t hi = src->b_hi;
-    // copy top half (if there is one)
-    if (lo > hi) {
-        size_t top = src->b_size - lo;
-        if (top > s_avail)
-            top = s_avail;
-        if (top)
-            buffer_put(dst, src->data + lo, top);
-        s_avail -= top;
-        lo = buffer_inc(src, lo, top);
-    }
-    // copy bottom half
-    if (s_avail) {
-        buffer_put(dst, src->data + lo, s_avail);
-        lo = buffer_inc(src, lo, s_avail);
+    // adjust length for max bytes available in dst buffer and src buffer
+    size_t avail = buffer_available(dst);
+    if (len > avail)
+        len = avail;
+    avail = buffer_used(src);
+    if (len > avail)
+        len = avail;
+    for (size_t done = 0, chunk; done < len; done += chunk) {
+        void *ptr = buffer_peekptr(src, done, &chunk);
+        if (chunk > len - done)
+            chunk = len - done;
+        buffer_put(dst, ptr, chunk);
     }
     // only advance the ptr in src buffer if we are moving
-    if (move) {
-        src->b_lo = lo;
-        src->b_hi = hi;
-    }
+    if (move)
+        src->b_lo += len;
     return len;
 }
 
@@ -0,0 +1,135 @@
+//
+// Shared streaming compression of the serial fan-out
+//
+
+#include <string.h>
+
+#include "compress.h"
+
+#define COMPRESS_OUTMIN     4096
+#define COMPRESS_FLUSH      16      // room for the sync flush marker and block headers
+#define STORED_MAX          0xffff  // largest stored block
+#define STORED_HDRSIZE      5
+
+
+int
+compressor_init(compressor_t *c, int level) {
+    memset(c, '\0', sizeof(compressor_t));
+    c->level = level;
+    // negative window bits: raw deflate, without the zlib header and checksum
+    if (deflateInit2(&c->zs, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return -1;
+    buffer_init_elastic(&c->out, COMPRESS_OUTMIN, COMPRESS_OUTMAX);
+    segbuf_init(&c->segs, 0);
+    c->ready = 1;
+    return 0;
+}
+
+
+void
+compressor_free(compressor_t *c) {
+    if (c->ready) {
+        deflateEnd(&c->zs);
+        buffer_free(&c->out);
+        segbuf_free(&c->segs);
+        c->ready = 0;
+    }
+}
+
+
+// Start afresh with the next chunk, for a connection joining the stream
+// or one that was sent something the others were not
+
+void
+compressor_resync(compressor_t *c) {
+    c->reset = 1;
+}
+
+
+static int
+compressor_deflate(compressor_t *c, int flush) {
+    do {
+        size_t room;
+        void *out = buffer_writeptr(&c->out, &room);
+        if (out == NULL)
+            return -1;      // chunk larger than COMPRESS_OUTMAX
+        c->zs.next_out = out;
+        c->zs.avail_out = (uInt)room;
+        int rc = deflate(&c->zs, flush);
+        buffer_produce(&c->out, room - c->zs.avail_out);
+        if (rc == Z_STREAM_ERROR)
+            return -1;
+    } while (c->zs.avail_in > 0 || c->zs.avail_out == 0);
+    return 0;
+}
+
+// Compress a chunk (copied, not moved, from src) once per pass, returns
+// the size of the compressed output. Called for each connection sharing
+// it, only the first call does the work
+
+size_t
+compressor_chunk(compressor_t *c, buffer_t *src, size_t length) {
+    if (c->done)
+        return buffer_used(&c->out);
+    if (c->reset) {
+        deflateReset(&c->zs);
+        c->reset = 0;
+    }
+    if (length > buffer_used(src))
+        length = buffer_used(src);
+    buffer_reserve(&c->out, deflateBound(&c->zs, length) + COMPRESS_FLUSH);
+    int rc = 0;
+    for (size_t offset = 0, piece; rc == 0 && offset < length; offset += piece) {
+        c->zs.next_in = buffer_peekptr(src, offset, &piece);
+        if (piece > length - offset)
+            piece = length - offset;
+        c->zs.avail_in = (uInt)piece;
+        rc = compressor_deflate(c, Z_NO_FLUSH);
+    }
+    if (rc == 0)
+        compressor_deflate(c, Z_SYNC_FLUSH);
+    c->zs.avail_in = 0;
+    c->bytes_in += length;
+    c->bytes_out += buffer_used(&c->out);
+    c->done = 1;
+    return buffer_used(&c->out);
+}
+
+// End of a pass, connections keep their references to segments
+
+void
+compressor_flush(compressor_t *c) {
+    if (c->done) {
+        buffer_flush(&c->out);
+        segbuf_flush(&c->segs);
+        c->done = 0;
+    }
+}
+
+
+// Queue data as stored blocks, all or nothing. This is only valid at a
+// chunk boundary, where the stream is byte aligned, and the compressor
+// must be resynced as the receiver's history no longer matches
+
+size_t
+compress_stored(buffer_t *dst, void const *data, size_t length) {
+    size_t blocks = length ? (length + STORED_MAX - 1) / STORED_MAX : 1;
+    if (buffer_available(dst) < blocks * STORED_HDRSIZE + length)
+        return 0;
+    char const *p = data;
+    size_t remaining = length;
+    do {
+        size_t len = remaining > STORED_MAX ? STORED_MAX : remaining;
+        // BFINAL=0 BTYPE=00 padded to the byte, then LEN and its complement
+        unsigned char hdr[STORED_HDRSIZE] = {
+            0x00, (unsigned char)len, (unsigned char)(len >> 8),
+            (unsigned char)~len, (unsigned char)(~len >> 8)
+        };
+        buffer_put(dst, hdr, sizeof(hdr));
+        if (len)
+            buffer_put(dst, p, len);
+        p += len;
+        remaining -= len;
+    } while (remaining > 0);
+    return blocks * STORED_HDRSIZE + length;
+}
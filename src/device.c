@@ -4,10 +4,15 @@
 
 
 #include <stddef.h>
+#include <stdio.h>
 #include <string.h>
-#include <wordexp.h>
+#include <ctype.h>
+#include <glob.h>
+#include <dirent.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/fcntl.h>
 
 #include "device.h"
 
@@ -16,12 +21,109 @@
 
 static char const *auto_devices = "/dev/ttyVIZ*|/dev/ttyACM*";
 
+#define SYSFS_TTY   "/sys/class/tty"
+#define USB_PREFIX  "usb:"
+#define USB_DEPTH   4           // levels from a tty up to its usb device
+
+// Known HDMI2USB boards (usb vendor and product ids), preferred by rank
+static struct {
+    unsigned short vid, pid;
+    int rank;
+    char const *name;
+} const boards[] = {
+    { 0x1d50, 0x60b7, RANK_BOARD,       "HDMI2USB.tv Opsis" },
+    { 0x1d50, 0x60b6, RANK_BOARD,       "HDMI2USB.tv Atlys" },
+    { 0x1d50, 0x60b5, RANK_BOARD - 1,   "HDMI2USB.tv FX2" },
+    { 0x2a19, 0x5442, RANK_BOARD - 1,   "Numato Opsis (serial)" },
+    { 0x2a19, 0x5441, RANK_BOARD - 2,   "Numato Opsis (jtag)" },
+};
+
+// Root prepended to /sys and /dev paths (for testing)
+static char const *device_root = "";
+
+void
+device_set_root(char const *root) {
+    device_root = root != NULL ? root : "";
+}
+
+char const *
+device_board(unsigned short vid, unsigned short pid, int *rank) {
+    for (size_t index = 0; index < sizeof(boards) / sizeof(boards[0]); index++) {
+        if (boards[index].vid == vid && boards[index].pid == pid) {
+            if (rank != NULL)
+                *rank = boards[index].rank;
+            return boards[index].name;
+        }
+    }
+    if (rank != NULL)
+        *rank = vid ? RANK_USB : RANK_OTHER;
+    return NULL;
+}
+
+
+// sysfs support
+
+static int
+sysfs_read(char const *dir, char const *attr, char *buf, size_t size) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, attr);
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return -1;
+    ssize_t length = read(fd, buf, size - 1);
+    close(fd);
+    if (length < 0)
+        return -1;
+    while (length > 0 && isspace((unsigned char)buf[length - 1]))
+        --length;
+    buf[length] = '\0';
+    return (int)length;
+}
+
+// Find the usb device a tty belongs to, its "device" link is the usb
+// interface (acm) or a child of it (usb-serial)
+
+static int
+sysfs_usb_ident(char const *tty, unsigned short *vid, unsigned short *pid, char *serial, size_t size) {
+    char path[PATH_MAX], dir[PATH_MAX];
+    snprintf(path, sizeof(path), "%s" SYSFS_TTY "/%s/device", device_root, tty);
+    if (realpath(path, dir) == NULL)
+        return -1;
+    for (int depth = 0; depth < USB_DEPTH; depth++) {
+        char buf[32];
+        if (sysfs_read(dir, "idVendor", buf, sizeof(buf)) > 0) {
+            *vid = (unsigned short)strtoul(buf, NULL, 16);
+            *pid = sysfs_read(dir, "idProduct", buf, sizeof(buf)) > 0 ? (unsigned short)strtoul(buf, NULL, 16) : 0;
+            if (sysfs_read(dir, "serial", serial, size) < 0)
+                *serial = '\0';
+            return 0;
+        }
+        char *slash = strrchr(dir, '/');
+        if (slash == NULL || slash == dir)
+            break;
+        *slash = '\0';
+    }
+    return -1;
+}
+
+// Identify a device node by the usb device behind it (if any)
+
+static int
+device_ident(char const *devname, unsigned short *vid, unsigned short *pid, char *serial, size_t size) {
+    char path[PATH_MAX];
+    if (realpath(devname, path) == NULL)
+        return -1;
+    char const *tty = strrchr(path, '/');
+    return sysfs_usb_ident(tty != NULL ? tty + 1 : path, vid, pid, serial, size);
+}
+
+
 static struct ctrldev *
 new_odev(char const *devicename) {
     struct ctrldev *curr_dev = NULL;
     // requires a real, existing and accessible file
     if (access(devicename, R_OK|W_OK) != -1) {
-        curr_dev = malloc(sizeof(struct ctrldev));
+        curr_dev = calloc(1, sizeof(struct ctrldev));
         if (curr_dev != NULL) {
             curr_dev->devname = strdup(devicename);
             curr_dev->next = NULL;
@@ -35,6 +137,7 @@ ctrldev_free(struct ctrldev *first_dev) {
     if (first_dev) {
         for (struct ctrldev *next = first_dev; next != NULL; ) {
             free(next->devname);
+            free(next->serial);
             struct ctrldev *fnext = next;
             next = next->next;
             free(fnext);
@@ -42,25 +145,140 @@ ctrldev_free(struct ctrldev *first_dev) {
     }
 }
 
-// This should theoretically test to see if it is an hdmi2usb
-// probably by figuring out which driver is handling it,
-// however for now we bypass this and always ok the first one...
-static int
-test_ctrldev(const struct ctrldev *_odev) {
-    return 1;
+// Add a device to the list, ordered by rank (then as found), unless the
+// same node is already present under another name
+
+static void
+add_odev(struct ctrldev **first_dev, struct ctrldev *odev, unsigned short vid, unsigned short pid, char const *serial) {
+    char path[PATH_MAX], other[PATH_MAX];
+    if (realpath(odev->devname, path) != NULL) {
+        for (struct ctrldev *next = *first_dev; next != NULL; next = next->next) {
+            if (realpath(next->devname, other) != NULL && strcmp(path, other) == 0) {
+                ctrldev_free(odev);
+                return;
+            }
+        }
+    }
+    odev->vid = vid;
+    odev->pid = pid;
+    odev->serial = serial != NULL && *serial ? strdup(serial) : NULL;
+    odev->board = device_board(vid, pid, &odev->rank);
+    // udev names these for hdmi2usb boards only
+    if (strncmp(odev->devname, "/dev/ttyVIZ", 11) == 0 && odev->rank < RANK_BOARD)
+        odev->rank = RANK_BOARD;
+    while (*first_dev != NULL && (*first_dev)->rank >= odev->rank)
+        first_dev = &(*first_dev)->next;
+    odev->next = *first_dev;
+    *first_dev = odev;
+}
+
+// Walk the usb ttys, optionally only those matching "usb:vid[:pid[:serial]]"
+
+static void
+find_usb(struct ctrldev **first_dev, char const *spec) {
+    unsigned long want_vid = 0, want_pid = 0;
+    char const *want_serial = NULL;
+    if (spec != NULL) {
+        char *endptr;
+        want_vid = strtoul(spec, &endptr, 16);
+        if (*endptr == ':') {
+            want_pid = strtoul(endptr + 1, &endptr, 16);
+            if (*endptr == ':')
+                want_serial = endptr + 1;
+        }
+    }
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s" SYSFS_TTY, device_root);
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+        return;
+    for (struct dirent *entry; (entry = readdir(dir)) != NULL; ) {
+        unsigned short vid, pid;
+        char serial[128];
+        if (*entry->d_name == '.' || sysfs_usb_ident(entry->d_name, &vid, &pid, serial, sizeof(serial)) != 0)
+            continue;
+        if ((want_vid && vid != want_vid) || (want_pid && pid != want_pid) ||
+                (want_serial != NULL && strcmp(serial, want_serial) != 0))
+            continue;
+        snprintf(path, sizeof(path), "%s/dev/%s", device_root, entry->d_name);
+        struct ctrldev *odev = new_odev(path);
+        if (odev != NULL)
+            add_odev(first_dev, odev, vid, pid, serial);
+    }
+    closedir(dir);
+}
+
+static void
+find_glob(struct ctrldev **first_dev, char const *pattern) {
+    glob_t paths;
+    int flags = 0;
+#ifdef GLOB_TILDE
+    flags |= GLOB_TILDE;
+#endif
+    if (glob(pattern, flags, NULL, &paths) == 0) {
+        for (size_t i =0; i < paths.gl_pathc; i++) {
+            struct ctrldev *odev = new_odev(paths.gl_pathv[i]);
+            if (odev != NULL) {
+                unsigned short vid = 0, pid = 0;
+                char serial[128] = "";
+                device_ident(odev->devname, &vid, &pid, serial, sizeof(serial));
+                add_odev(first_dev, odev, vid, pid, serial);
+            }
+        }
+    }
+    globfree(&paths);
+}
+
+
+// Most recent selection, reused while the same device is still there
+
+static struct {
+    char *filespec;
+    char *devname;
+    unsigned short vid, pid;
+    char serial[128];
+} cache;
+
+static char *
+find_cached(char const *filespec) {
+    unsigned short vid, pid;
+    char serial[128];
+    if (cache.filespec == NULL || strcmp(cache.filespec, filespec) != 0 || access(cache.devname, R_OK|W_OK) == -1 ||
+            device_ident(cache.devname, &vid, &pid, serial, sizeof(serial)) != 0 ||
+            vid != cache.vid || pid != cache.pid || strcmp(serial, cache.serial) != 0)
+        return NULL;
+    return strdup(cache.devname);
+}
+
+void
+find_serial_flush(void) {
+    free(cache.filespec);
+    free(cache.devname);
+    memset(&cache, '\0', sizeof(cache));
 }
 
+// Select the most likely device, known boards are preferred over other
+// usb serial devices, and those over anything else
+
 char *
 find_serial(char const *filespec) {
-    struct ctrldev *first_dev = find_serial_all(filespec);
-    char *result = NULL;
-    for (struct ctrldev *next = first_dev; result == NULL && next != NULL; next = next->next) {
-        if (test_ctrldev(next)) {
-            result = next->devname;
-            next->devname = NULL;
+    char *result = find_cached(filespec);
+    if (result == NULL) {
+        struct ctrldev *first_dev = find_serial_all(filespec);
+        if (first_dev != NULL) {
+            result = first_dev->devname;
+            first_dev->devname = NULL;
+            find_serial_flush();
+            if (first_dev->vid) {   // only usb devices have an identity to check
+                cache.filespec = strdup(filespec);
+                cache.devname = strdup(result);
+                cache.vid = first_dev->vid;
+                cache.pid = first_dev->pid;
+                snprintf(cache.serial, sizeof(cache.serial), "%s", first_dev->serial ? first_dev->serial : "");
+            }
         }
+        ctrldev_free(first_dev);
     }
-    ctrldev_free(first_dev);
     return result;
 }
 
@@ -69,19 +287,28 @@ find_serial(char const *filespec) {
 
 struct ctrldev *
 find_serial_all(char const *filespec) {
-    static struct ctrldev *first_dev = NULL;
+    struct ctrldev *first_dev = NULL;
 
     char const *devices = filespec;
-    if (strcmp(devices, "auto") == 0)
+    if (strcmp(devices, "auto") == 0) {
+        find_usb(&first_dev, NULL);
         devices = auto_devices;
+    }
     size_t len = 0;
-    struct ctrldev **next_dev = &first_dev;
     for (const char *p = devices; p != NULL && *p != '\0'; p += len) {
         const char *sep = strchr(p, '|');
         int skip = sep == NULL ? sep = p + strlen(p), 0 : 1;
         len = sep - p;
         if (len < 1)
             break;
+        if (strncmp(p, USB_PREFIX, strlen(USB_PREFIX)) == 0) {
+            char spec[len + 1];
+            strncpy(spec, p, len);
+            spec[len] = '\0';
+            find_usb(&first_dev, spec + strlen(USB_PREFIX));
+            len += skip;
+            continue;
+        }
         int xtra = *p == '/' || *p == '~' ? 0 : 5;   // need to add device prefix?
         char device[len + xtra + 1];
         if (xtra)
@@ -89,25 +316,18 @@ find_serial_all(char const *filespec) {
         strncpy(device + xtra, p, len);
         device[len + xtra] = '\0';
         // Check for a glob pattern
-        if (strcspn(device, "*?!$[]") != strlen(device) || *device == '~') {
-            wordexp_t exprc;
-            switch (wordexp(device, &exprc, 0)) {
-                case 0:
-                    for (size_t i =0; i < exprc.we_wordc; i++) {
-                        if ((*next_dev = new_odev(exprc.we_wordv[i])) != NULL)
-                            next_dev = &(*next_dev)->next;
-                    }
-                case WRDE_NOSPACE:
-                    wordfree(&exprc);
-                default:
-                    break;
+        if (strcspn(device, "*?[]") != strlen(device) || *device == '~')
+            find_glob(&first_dev, device);
+        else {
+            struct ctrldev *odev = new_odev(device);
+            if (odev != NULL) {
+                unsigned short vid = 0, pid = 0;
+                char serial[128] = "";
+                device_ident(device, &vid, &pid, serial, sizeof(serial));
+                add_odev(&first_dev, odev, vid, pid, serial);
             }
-        } else {
-            if ((*next_dev = new_odev(device)) != NULL)
-                next_dev = &(*next_dev)->next;
         }
         len += skip;
     }
     return first_dev;
 }
-
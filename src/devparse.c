@@ -0,0 +1,205 @@
+//
+// Incremental parser for hdmi2usb firmware output
+//
+// The firmware prints a prompt such as "H2U 00:01:23>" (no newline)
+// when it is ready for input, echoes characters it receives, and
+// otherwise writes CR/LF terminated lines. A prompt can only be
+// distinguished from the start of a line once output pauses, so it is
+// recognised at the end of each chunk fed to the parser.
+
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "devparse.h"
+
+#define DEVPARSE_ALLOC  0xde5a25e
+
+
+static char const *event_names[] = {
+    "line",
+    "prompt",
+    "ack",
+    "status",
+    "edid",
+    "error",
+};
+
+
+char const *
+devparse_event_name(int type) {
+    return type >= 0 && type < DEVEVT_MAX ? event_names[type] : "unknown";
+}
+
+
+devparse_t *
+devparse_init(devparse_t *parser, devparse_handler_t handler, void *arg) {
+    if (parser != NULL)
+        memset(parser, '\0', sizeof(devparse_t));
+    else {
+        parser = calloc(1, sizeof(devparse_t));
+        parser->alloc = DEVPARSE_ALLOC;
+    }
+    parser->handler = handler;
+    parser->arg = arg;
+    return parser;
+}
+
+
+void
+devparse_free(devparse_t *parser) {
+    if (parser != NULL && parser->alloc == DEVPARSE_ALLOC) {
+        parser->alloc = 0;
+        free(parser);
+    }
+}
+
+
+// discard any partial line and parse state (counters are retained)
+void
+devparse_reset(devparse_t *parser) {
+    parser->in_edid = 0;
+    parser->length = parser->truncated = parser->acklen = 0;
+}
+
+
+void
+devparse_expect(devparse_t *parser, char const *command, size_t length) {
+    while (length > 0 && (command[length - 1] == '\n' || command[length - 1] == '\r'))
+        --length;
+    if (length > sizeof(parser->ack))
+        length = sizeof(parser->ack);
+    memcpy(parser->ack, command, length);
+    parser->acklen = length;
+}
+
+
+static void
+devparse_emit(devparse_t *parser, int type, utime_t now, char const *text, size_t length) {
+    devevent_t event = { type, now, text, length };
+    parser->events[type]++;
+    if (parser->handler != NULL)
+        parser->handler(&event, parser->arg);
+}
+
+
+static int
+starts_with(char const *text, size_t length, char const *prefix) {
+    size_t plen = strlen(prefix);
+    return length >= plen && strncasecmp(text, prefix, plen) == 0;
+}
+
+
+// hex dump rows, optionally preceded by an offset ("00: 00 ff ff ...")
+static int
+is_hexdump(char const *text, size_t length) {
+    size_t digits = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (isxdigit((unsigned char)text[i]))
+            digits++;
+        else if (text[i] != ' ' && text[i] != ':' && text[i] != '\t')
+            return 0;
+    }
+    return digits >= 2;
+}
+
+
+// "name: value" where name is a single lower case word (input0, output1, encoder...)
+static int
+is_status(char const *text, size_t length) {
+    size_t i = 0;
+    while (i < length && (islower((unsigned char)text[i]) || isdigit((unsigned char)text[i]) || text[i] == '_'))
+        i++;
+    return i > 0 && i < length && text[i] == ':' && islower((unsigned char)text[0]);
+}
+
+
+static int
+is_error(char const *text, size_t length) {
+    static char const *prefixes[] = { "error", "err:", "unknown command", "invalid", "failed", NULL };
+    for (int i = 0; prefixes[i] != NULL; i++)
+        if (starts_with(text, length, prefixes[i]))
+            return 1;
+    return 0;
+}
+
+
+// prompts look like "H2U 00:01:23>": short, start with a capital letter,
+// end with '>' (trailing spaces allowed) and contain no other brackets
+static int
+is_prompt(char const *text, size_t length) {
+    while (length > 0 && text[length - 1] == ' ')
+        --length;
+    if (length < 2 || length > DEVPARSE_PROMPTMAX || !isupper((unsigned char)text[0]) || text[length - 1] != '>')
+        return 0;
+    for (size_t i = 0; i < length - 1; i++)
+        if (!isprint((unsigned char)text[i]) || text[i] == '<' || text[i] == '>' || text[i] == '=')
+            return 0;
+    return 1;
+}
+
+
+static void
+devparse_line(devparse_t *parser, utime_t now) {
+    char const *text = parser->line;
+    size_t length = parser->length;
+    int type = DEVEVT_LINE;
+
+    if (length == 0)
+        return;     // blank lines carry no information
+    if (parser->acklen && length == parser->acklen && memcmp(text, parser->ack, length) == 0) {
+        parser->acklen = 0;
+        type = DEVEVT_ACK;
+    } else if (starts_with(text, length, "edid")) {
+        parser->in_edid = 1;
+        type = DEVEVT_EDID;
+    } else if (parser->in_edid && is_hexdump(text, length))
+        type = DEVEVT_EDID;
+    else {
+        parser->in_edid = 0;
+        if (is_error(text, length))
+            type = DEVEVT_ERROR;
+        else if (is_status(text, length))
+            type = DEVEVT_STATUS;
+    }
+    devparse_emit(parser, type, now, text, length);
+}
+
+
+size_t
+devparse_feed(devparse_t *parser, void const *data, size_t length, utime_t now) {
+    unsigned long before = 0, after = 0;
+    for (int i = 0; i < DEVEVT_MAX; i++)
+        before += parser->events[i];
+
+    char const *p = data;
+    for (size_t i = 0; i < length; i++) {
+        char ch = p[i];
+        switch (ch) {
+            case '\n':
+                devparse_line(parser, now);
+                parser->length = parser->truncated = 0;
+                break;
+            case '\r':
+            case '\0':
+                break;
+            default:
+                if (parser->length < sizeof(parser->line))
+                    parser->line[parser->length++] = ch;
+                else
+                    parser->truncated++;
+                break;
+        }
+    }
+    // output has paused mid-line, this may be the prompt
+    if (parser->length && !parser->truncated && is_prompt(parser->line, parser->length)) {
+        parser->in_edid = 0;
+        devparse_emit(parser, DEVEVT_PROMPT, now, parser->line, parser->length);
+        parser->length = 0;
+    }
+
+    for (int i = 0; i < DEVEVT_MAX; i++)
+        after += parser->events[i];
+    return after - before;
+}
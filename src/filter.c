@@ -0,0 +1,420 @@
+//
+// Line filters compiled to a DFA
+//
+// Patterns are parsed into a sequence of items (a character set plus
+// a quantifier), which is simulated as an NFA whose states are "the
+// next item to match". Subset construction over 64 bit masks of these
+// positions then yields a DFA, so matching costs one table lookup per
+// character no matter how complex the pattern.
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "filter.h"
+
+#define FILTER_ALLOC    0xf117e25
+#define FILTERSET_ALLOC 0xf117e55
+
+enum filterQuant {
+    Q_ONE,
+    Q_OPT,      // ?
+    Q_STAR,     // *
+};
+
+typedef struct filter_item_s filter_item_t;
+
+struct filter_item_s {
+    unsigned char set[32];      // bitmap of matching characters
+    int quant;
+};
+
+typedef struct filter_nfa_s filter_nfa_t;
+
+struct filter_nfa_s {
+    size_t nitems;
+    int anchor_start;
+    int anchor_end;
+    filter_item_t items[FILTER_MAXITEMS];
+};
+
+#define SET_HAS(set, c)     ((set)[(unsigned char)(c) >> 3] & (1 << ((unsigned char)(c) & 7)))
+#define SET_ADD(set, c)     ((set)[(unsigned char)(c) >> 3] |= (1 << ((unsigned char)(c) & 7)))
+#define BIT(i)              ((uint64_t)1 << (i))
+#define MASK_MATCHED        (~(uint64_t)0)
+
+
+static char const *
+filter_parse_class(char const *p, unsigned char *set, char const **errmsg) {
+    int negate = 0;
+    unsigned char cls[32];
+    memset(cls, 0, sizeof(cls));
+    if (*p == '^')
+        negate = 1, ++p;
+    // a leading ']' is a literal
+    for (int first = 1; *p != '\0' && (first || *p != ']'); first = 0) {
+        unsigned char lo = (unsigned char)*p++;
+        if (lo == '\\' && *p != '\0')
+            lo = (unsigned char)*p++;
+        unsigned char hi = lo;
+        if (*p == '-' && p[1] != ']' && p[1] != '\0') {
+            hi = (unsigned char)p[1];
+            p += 2;
+            if (hi < lo) {
+                *errmsg = "invalid range in character class";
+                return NULL;
+            }
+        }
+        for (unsigned c = lo; c <= hi; c++)
+            SET_ADD(cls, c);
+    }
+    if (*p != ']') {
+        *errmsg = "unterminated character class";
+        return NULL;
+    }
+    for (size_t i = 0; i < sizeof(cls); i++)
+        set[i] = negate ? (unsigned char)~cls[i] : cls[i];
+    return p + 1;
+}
+
+
+static int
+filter_parse(filter_nfa_t *nfa, char const *pattern, char const **errmsg) {
+    char const *p = pattern;
+    memset(nfa, 0, sizeof(filter_nfa_t));
+    if (*p == '^')
+        nfa->anchor_start = 1, ++p;
+    while (*p != '\0') {
+        if (*p == '$' && p[1] == '\0') {
+            nfa->anchor_end = 1;
+            break;
+        }
+        if (*p == '*' || *p == '+' || *p == '?') {
+            if (nfa->nitems == 0 || nfa->items[nfa->nitems - 1].quant != Q_ONE) {
+                *errmsg = "quantifier does not follow an item";
+                return -1;
+            }
+            filter_item_t *last = &nfa->items[nfa->nitems - 1];
+            if (*p == '?')
+                last->quant = Q_OPT;
+            else if (*p == '*')
+                last->quant = Q_STAR;
+            else {  // x+ == xx*
+                if (nfa->nitems == FILTER_MAXITEMS) {
+                    *errmsg = "pattern is too long";
+                    return -1;
+                }
+                nfa->items[nfa->nitems] = *last;
+                nfa->items[nfa->nitems++].quant = Q_STAR;
+            }
+            ++p;
+            continue;
+        }
+        if (nfa->nitems == FILTER_MAXITEMS) {
+            *errmsg = "pattern is too long";
+            return -1;
+        }
+        filter_item_t *item = &nfa->items[nfa->nitems++];
+        item->quant = Q_ONE;
+        switch (*p) {
+            case '.':
+                memset(item->set, 0xff, sizeof(item->set));
+                ++p;
+                break;
+            case '[':
+                p = filter_parse_class(p + 1, item->set, errmsg);
+                if (p == NULL)
+                    return -1;
+                break;
+            case '\\':
+                if (p[1] != '\0')
+                    ++p;
+                // fallthru
+            default:
+                SET_ADD(item->set, *p);
+                ++p;
+                break;
+        }
+    }
+    return 0;
+}
+
+
+// add positions reachable without consuming input
+static uint64_t
+filter_closure(filter_nfa_t *nfa, uint64_t mask) {
+    for (size_t i = 0; i < nfa->nitems; i++)
+        if ((mask & BIT(i)) && nfa->items[i].quant != Q_ONE)
+            mask |= BIT(i + 1);
+    return mask;
+}
+
+
+static uint64_t
+filter_step(filter_nfa_t *nfa, uint64_t mask, unsigned char c) {
+    uint64_t next = 0;
+    if (mask == MASK_MATCHED)
+        return MASK_MATCHED;
+    for (size_t i = 0; i < nfa->nitems; i++)
+        if ((mask & BIT(i)) && SET_HAS(nfa->items[i].set, c))
+            next |= nfa->items[i].quant == Q_STAR ? BIT(i) : BIT(i + 1);
+    if (!nfa->anchor_start)
+        next |= BIT(0);     // a match may start at any position
+    next = filter_closure(nfa, next);
+    // once matched, unanchored patterns stay matched
+    if (!nfa->anchor_end && (next & BIT(nfa->nitems)))
+        return MASK_MATCHED;
+    return next;
+}
+
+
+static int
+filter_state(uint64_t *masks, size_t *nstates, uint64_t mask) {
+    for (size_t i = 0; i < *nstates; i++)
+        if (masks[i] == mask)
+            return (int)i;
+    if (*nstates == FILTER_MAXSTATES)
+        return -1;
+    masks[*nstates] = mask;
+    return (int)(*nstates)++;
+}
+
+
+filter_t *
+filter_compile(filter_t *filter, char const *pattern, char const **errmsg) {
+    filter_nfa_t nfa;
+    uint64_t masks[FILTER_MAXSTATES];
+    unsigned char next[FILTER_MAXSTATES][256];
+    size_t nstates = 0;
+    char const *error = NULL;
+
+    if (filter_parse(&nfa, pattern, &error) == 0) {
+        uint64_t start = filter_closure(&nfa, BIT(0));
+        if (!nfa.anchor_end && (start & BIT(nfa.nitems)))
+            start = MASK_MATCHED;
+        filter_state(masks, &nstates, start);
+        // subset construction, states are processed in order of discovery
+        for (size_t s = 0; error == NULL && s < nstates; s++) {
+            for (unsigned c = 0; c < 256; c++) {
+                int state = filter_state(masks, &nstates, filter_step(&nfa, masks[s], (unsigned char)c));
+                if (state < 0) {
+                    error = "pattern is too complex";
+                    break;
+                }
+                next[s][c] = (unsigned char)state;
+            }
+        }
+    }
+    if (error != NULL) {
+        if (errmsg != NULL)
+            *errmsg = error;
+        return NULL;
+    }
+    if (filter != NULL)
+        memset(filter, '\0', sizeof(filter_t));
+    else {
+        filter = calloc(1, sizeof(filter_t));
+        filter->alloc = FILTER_ALLOC;
+    }
+    filter->nstates = nstates;
+    filter->start = 0;
+    filter->next = malloc(nstates * 256);
+    filter->accept = calloc(nstates, 1);
+    for (size_t s = 0; s < nstates; s++) {
+        memcpy(filter->next + s * 256, next[s], 256);
+        if (masks[s] == MASK_MATCHED)
+            filter->accept[s] = FILTER_MATCHED | FILTER_ACCEPT;
+        else if (masks[s] & BIT(nfa.nitems))
+            filter->accept[s] = FILTER_ACCEPT;
+    }
+    return filter;
+}
+
+
+// release the tables only, for a filter embedded in another structure
+static void
+filter_release(filter_t *filter) {
+    free(filter->next);
+    free(filter->accept);
+    filter->next = filter->accept = NULL;
+    filter->nstates = 0;
+}
+
+
+void
+filter_free(filter_t *filter) {
+    if (filter != NULL) {
+        filter_release(filter);
+        if (filter->alloc == FILTER_ALLOC) {
+            filter->alloc = 0;
+            free(filter);
+        }
+    }
+}
+
+
+int
+filter_match(filter_t *filter, char const *text, size_t length) {
+    unsigned state = filter->start;
+    for (size_t i = 0; i < length; i++) {
+        if (filter->accept[state] & FILTER_MATCHED)
+            return 1;
+        state = filter->next[state * 256 + (unsigned char)text[i]];
+    }
+    return filter->accept[state] & FILTER_ACCEPT;
+}
+
+
+//// filter sets ////
+
+typedef struct filterset_entry_s filterset_entry_t;
+
+struct filterset_entry_s {
+    char *pattern;              // NULL = unused slot
+    filter_t filter;
+    int marked;                 // in use by at least one subscriber
+    int matched;                // result for the current line
+};
+
+
+filterset_t *
+filterset_init(filterset_t *fset) {
+    if (fset != NULL)
+        memset(fset, '\0', sizeof(filterset_t));
+    else {
+        fset = calloc(1, sizeof(filterset_t));
+        fset->alloc = FILTERSET_ALLOC;
+    }
+    array_init(&fset->entries, sizeof(filterset_entry_t), 4);
+    return fset;
+}
+
+
+static void
+filterset_release(filterset_entry_t *entry) {
+    free(entry->pattern);
+    entry->pattern = NULL;
+    filter_release(&entry->filter);
+}
+
+
+void
+filterset_free(filterset_t *fset) {
+    if (fset != NULL) {
+        for (size_t i = 0; i < array_count(&fset->entries); i++)
+            filterset_release(array_get(&fset->entries, i));
+        array_free(&fset->entries);
+        if (fset->alloc == FILTERSET_ALLOC) {
+            fset->alloc = 0;
+            free(fset);
+        }
+    }
+}
+
+
+// number of filters in use
+size_t
+filterset_count(filterset_t *fset) {
+    size_t count = 0;
+    for (size_t i = 0; i < array_count(&fset->entries); i++)
+        if (((filterset_entry_t *)array_get(&fset->entries, i))->pattern != NULL)
+            ++count;
+    return count;
+}
+
+
+static filterset_entry_t *
+filterset_entry(filterset_t *fset, int id) {
+    if (id < 0 || (size_t)id >= array_count(&fset->entries))
+        return NULL;
+    filterset_entry_t *entry = array_get(&fset->entries, (size_t)id);
+    return entry->pattern != NULL ? entry : NULL;
+}
+
+
+// add a filter, or share an existing one with the same pattern
+// returns the filter id, or -1 if the pattern is invalid
+
+int
+filterset_add(filterset_t *fset, char const *pattern, char const **errmsg) {
+    int slot = -1;
+    for (size_t i = 0; i < array_count(&fset->entries); i++) {
+        filterset_entry_t *entry = array_get(&fset->entries, i);
+        if (entry->pattern == NULL) {
+            if (slot < 0)
+                slot = (int)i;
+        } else if (strcmp(entry->pattern, pattern) == 0) {
+            entry->marked = 1;
+            return (int)i;
+        }
+    }
+    filter_t filter;
+    if (filter_compile(&filter, pattern, errmsg) == NULL)
+        return -1;
+    filterset_entry_t *entry = slot < 0 ? array_new(&fset->entries) : array_get(&fset->entries, (size_t)slot);
+    if (slot < 0)
+        slot = (int)array_count(&fset->entries) - 1;
+    entry->pattern = strdup(pattern);
+    entry->filter = filter;
+    entry->marked = 1;
+    entry->matched = 0;
+    return slot;
+}
+
+
+char const *
+filterset_pattern(filterset_t *fset, int id) {
+    filterset_entry_t *entry = filterset_entry(fset, id);
+    return entry != NULL ? entry->pattern : NULL;
+}
+
+
+// Filters are shared without reference counting: subscribers mark the
+// filters they use and a sweep then discards those no longer in use
+
+void
+filterset_unmark(filterset_t *fset) {
+    for (size_t i = 0; i < array_count(&fset->entries); i++)
+        ((filterset_entry_t *)array_get(&fset->entries, i))->marked = 0;
+}
+
+
+void
+filterset_mark(filterset_t *fset, int id) {
+    filterset_entry_t *entry = filterset_entry(fset, id);
+    if (entry != NULL)
+        entry->marked = 1;
+}
+
+
+// release unmarked filters, returns the number released
+size_t
+filterset_sweep(filterset_t *fset) {
+    size_t released = 0;
+    for (size_t i = 0; i < array_count(&fset->entries); i++) {
+        filterset_entry_t *entry = array_get(&fset->entries, i);
+        if (entry->pattern != NULL && !entry->marked) {
+            filterset_release(entry);
+            ++released;
+        }
+    }
+    return released;
+}
+
+
+// evaluate every filter against a line, once
+void
+filterset_match(filterset_t *fset, char const *text, size_t length) {
+    for (size_t i = 0; i < array_count(&fset->entries); i++) {
+        filterset_entry_t *entry = array_get(&fset->entries, i);
+        if (entry->pattern != NULL)
+            entry->matched = filter_match(&entry->filter, text, length);
+    }
+}
+
+
+int
+filterset_matched(filterset_t *fset, int id) {
+    filterset_entry_t *entry = filterset_entry(fset, id);
+    return entry != NULL && entry->matched;
+}
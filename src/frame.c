@@ -0,0 +1,68 @@
+//
+// Length prefixed binary framing for the client protocol
+//
+
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "frame.h"
+
+
+size_t
+frame_header_encode(void *dst, int type, uint32_t reqid, size_t length) {
+    unsigned char *p = dst;
+    uint16_t len = htons((uint16_t)length);
+    uint32_t id = htonl(reqid);
+    p[0] = FRAME_MAGIC;
+    p[1] = (unsigned char)type;
+    memcpy(p + 2, &len, sizeof(len));
+    memcpy(p + 4, &id, sizeof(id));
+    return FRAME_HDRSIZE;
+}
+
+
+// decode a frame header, returns 0 if valid, -1 otherwise
+int
+frame_header_decode(void const *src, size_t size, frame_header_t *hdr) {
+    unsigned char const *p = src;
+    if (size < FRAME_HDRSIZE)
+        return -1;
+    hdr->magic = p[0];
+    hdr->type = p[1];
+    memcpy(&hdr->length, p + 2, sizeof(hdr->length));
+    memcpy(&hdr->reqid, p + 4, sizeof(hdr->reqid));
+    hdr->length = ntohs(hdr->length);
+    hdr->reqid = ntohl(hdr->reqid);
+    return hdr->magic == FRAME_MAGIC ? 0 : -1;
+}
+
+
+// put a frame into a buffer
+// returns the number of bytes queued, 0 if the whole frame did not fit
+
+size_t
+frame_put(buffer_t *dst, int type, uint32_t reqid, void const *data, size_t length) {
+    unsigned char hdr[FRAME_HDRSIZE];
+    if (length > FRAME_MAXDATA || buffer_available(dst) < FRAME_HDRSIZE + length)
+        return 0;
+    buffer_put(dst, hdr, frame_header_encode(hdr, type, reqid, length));
+    if (length)
+        buffer_put(dst, data, length);
+    return FRAME_HDRSIZE + length;
+}
+
+
+// same as frame_put() with the payload copied (not moved) from another buffer
+
+size_t
+frame_copy(buffer_t *dst, int type, uint32_t reqid, buffer_t *src, size_t length) {
+    unsigned char hdr[FRAME_HDRSIZE];
+    if (length > buffer_used(src))
+        length = buffer_used(src);
+    if (length > FRAME_MAXDATA || buffer_available(dst) < FRAME_HDRSIZE + length)
+        return 0;
+    buffer_put(dst, hdr, frame_header_encode(hdr, type, reqid, length));
+    if (length)
+        buffer_copy(dst, src, length);
+    return FRAME_HDRSIZE + length;
+}
@@ -0,0 +1,325 @@
+//
+// Hand over open devices to another process
+//
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "handoff.h"
+#include "netutils.h"
+#include "nettcp.h"
+#include "serial.h"
+#include "session.h"
+#include "stringstore.h"
+
+
+typedef struct handoff_hdr_s handoff_hdr_t;
+typedef struct handoff_rec_s handoff_rec_t;
+
+struct handoff_hdr_s {
+    uint32_t magic;             // HANDOFF_MAGIC
+    uint16_t version;           // HANDOFF_VERSION
+    uint16_t type;              // enum handoffType
+    uint32_t length;            // payload bytes following
+};
+
+// variable length parts of a device record, in payload order
+enum handoffSection {
+    SECT_RBUF,                  // received, not yet processed
+    SECT_TBUF,                  // queued for output (segments, then transmit buffer)
+    SECT_LINEBUF,               // commands not yet sent to the device
+    SECT_REQIDS,                // framed request ids of those commands
+    SECT_FILTER,                // output filter pattern
+    SECT_NAME,                  // serial port name
+    SECT_TERMIOS,               // serial line settings
+    SECTIONS
+};
+
+// device record, both ends are expected to be the same build or close to it
+struct handoff_rec_s {
+    int32_t kind;
+    int32_t state;
+    int32_t proto;              // session protocol (-1 = no session)
+    int32_t compress;           // session output compression level
+    int32_t listener;
+    uint32_t bufsize,
+             bufmax;
+    uint64_t coalesce;
+    uint64_t baudrate;
+    uint32_t addrlen;
+    struct sockaddr_storage addr;
+    uint32_t length[SECTIONS];
+};
+
+
+static int
+handoff_write(int sock, void const *data, size_t length) {
+    while (length > 0) {
+        ssize_t rc = write(sock, data, length);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc <= 0)
+            return -1;
+        data = (char const *)data + rc;
+        length -= (size_t)rc;
+    }
+    return 0;
+}
+
+
+static int
+handoff_read(int sock, void *data, size_t length) {
+    while (length > 0) {
+        ssize_t rc = read(sock, data, length);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc <= 0)
+            return -1;
+        data = (char *)data + rc;
+        length -= (size_t)rc;
+    }
+    return 0;
+}
+
+
+// Send a record, with a descriptor attached to its header if fd >= 0
+
+int
+handoff_send(int sock, int type, int fd, void const *data, size_t length) {
+    handoff_hdr_t hdr = { HANDOFF_MAGIC, HANDOFF_VERSION, (uint16_t)type, (uint32_t)length };
+    struct iovec iov = { &hdr, sizeof(hdr) };
+    struct msghdr msg;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    memset(&msg, '\0', sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (fd >= 0) {
+        memset(&control, '\0', sizeof(control));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+    ssize_t rc;
+    while ((rc = sendmsg(sock, &msg, 0)) < 0 && errno == EINTR)
+        ;
+    if (rc < 0)
+        return -1;
+    // a short send still carried the descriptor, send the rest as plain data
+    if ((size_t)rc < sizeof(hdr) && handoff_write(sock, (char *)&hdr + rc, sizeof(hdr) - (size_t)rc) != 0)
+        return -1;
+    return handoff_write(sock, data, length);
+}
+
+
+// Receive a record, the payload is allocated (and nul terminated) and
+// must be freed by the caller. *fd is -1 if none was attached.
+
+int
+handoff_recv(int sock, int *type, int *fd, void **data, size_t *length) {
+    handoff_hdr_t hdr;
+    struct iovec iov = { &hdr, sizeof(hdr) };
+    struct msghdr msg;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    memset(&msg, '\0', sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    int flags = 0;
+#ifdef MSG_CMSG_CLOEXEC
+    flags |= MSG_CMSG_CLOEXEC;  // never leak into a later exec
+#endif
+    ssize_t rc;
+    while ((rc = recvmsg(sock, &msg, flags)) < 0 && errno == EINTR)
+        ;
+    *fd = -1;
+    *data = NULL;
+    if (rc <= 0)
+        return -1;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+    if ((size_t)rc < sizeof(hdr) && handoff_read(sock, (char *)&hdr + rc, sizeof(hdr) - (size_t)rc) != 0)
+        hdr.magic = 0;
+    if (hdr.magic != HANDOFF_MAGIC || hdr.version != HANDOFF_VERSION || hdr.length > HANDOFF_MAXDATA ||
+            (*data = malloc(hdr.length + 1)) == NULL || handoff_read(sock, *data, hdr.length) != 0) {
+        if (*fd >= 0)
+            close(*fd);
+        free(*data);
+        *fd = -1;
+        *data = NULL;
+        return -1;
+    }
+    ((char *)*data)[hdr.length] = '\0';
+    *type = hdr.type;
+    *length = hdr.length;
+    return 0;
+}
+
+
+//// devices ////
+
+// Send a device with its descriptor (if open), listener is the index of
+// the listener an accepted connection came from
+
+int
+handoff_send_device(int sock, iodev_t *dev, int listener, char const *filter) {
+    handoff_rec_t rec;
+    memset(&rec, '\0', sizeof(rec));
+    char const *name = NULL;
+    struct termios *termctl = NULL;
+    char const *driver = iodev_driver(dev);
+    if (strcmp(driver, "serial") == 0) {
+        serial_cfg_t *scfg = serial_getcfg(dev);
+        rec.kind = HANDOFF_SERIAL;
+        rec.baudrate = scfg->baudrate;
+        name = scfg->portname;
+        termctl = scfg->termctl;
+    } else if (strcmp(driver, "tcp") == 0) {
+        tcp_cfg_t *tcfg = tcp_getcfg(dev);
+        struct sockaddr *addr = tcfg->remote;
+        if (iodev_is_listener(dev)) {
+            rec.kind = HANDOFF_LISTEN;
+            addr = tcfg->local;
+        } else
+            rec.kind = tcp_is_connect(dev) ? HANDOFF_CONNECT : HANDOFF_ACCEPTED;
+        rec.addrlen = sockaddr_len(addr);
+        if (rec.addrlen)
+            memcpy(&rec.addr, addr, rec.addrlen);
+    } else
+        return -1;
+    session_t *session = iodev_session(dev);
+    rec.state = iodev_getstate(dev);
+    rec.proto = session != NULL ? session_proto(session) : -1;
+    rec.compress = session != NULL ? session_compress(session) : 0;
+    rec.listener = listener;
+    rec.bufsize = (uint32_t)dev->bufsize;
+    rec.bufmax = (uint32_t)dev->bufmax;
+    rec.coalesce = dev->coalesce;
+    rec.length[SECT_RBUF] = (uint32_t)buffer_used(&dev->rbuf);
+    rec.length[SECT_TBUF] = (uint32_t)iodev_pending(dev);
+    rec.length[SECT_LINEBUF] = dev->linebuf != NULL ? (uint32_t)stringstore_length(dev->linebuf) : 0;
+    rec.length[SECT_REQIDS] = session != NULL ? (uint32_t)(session_requests(session) * sizeof(uint32_t)) : 0;
+    rec.length[SECT_FILTER] = filter != NULL ? (uint32_t)strlen(filter) : 0;
+    rec.length[SECT_NAME] = name != NULL ? (uint32_t)strlen(name) : 0;
+    rec.length[SECT_TERMIOS] = termctl != NULL ? sizeof(struct termios) : 0;
+    size_t total = sizeof(rec);
+    for (int section = 0; section < SECTIONS; section++)
+        total += rec.length[section];
+
+    unsigned char *data = malloc(total), *p = data + sizeof(rec);
+    if (data == NULL)
+        return -1;
+    memcpy(data, &rec, sizeof(rec));
+    p += buffer_peek(&dev->rbuf, p, rec.length[SECT_RBUF]);
+    if (dev->tseg != NULL)
+        p += segbuf_peek(dev->tseg, p, segbuf_used(dev->tseg));
+    p += buffer_peek(&dev->tbuf, p, buffer_used(&dev->tbuf));
+    if (rec.length[SECT_LINEBUF])
+        memcpy(p, stringstore_buffer(dev->linebuf), rec.length[SECT_LINEBUF]), p += rec.length[SECT_LINEBUF];
+    for (size_t index = 0; session != NULL && index < session_requests(session); index++)
+        memcpy(p, array_get(&session->reqids, index), sizeof(uint32_t)), p += sizeof(uint32_t);
+    memcpy(p, filter, rec.length[SECT_FILTER]), p += rec.length[SECT_FILTER];
+    memcpy(p, name, rec.length[SECT_NAME]), p += rec.length[SECT_NAME];
+    memcpy(p, termctl, rec.length[SECT_TERMIOS]);
+    int rc = handoff_send(sock, HANDOFF_DEVICE, iodev_getstate(dev) >= IODEV_CLOSING ? dev->fd : -1, data, total);
+    free(data);
+    return rc;
+}
+
+
+// Recreate a device from its record and descriptor (fd is -1 for a
+// device that was closed). The caller completes what depends on the
+// application: the listener of an accepted connection and its filter
+
+iodev_t *
+handoff_recv_device(selector_t *selector, int fd, void const *data, size_t length, handoff_device_t *info) {
+    handoff_rec_t rec;
+    if (length < sizeof(rec))
+        return NULL;
+    memcpy(&rec, data, sizeof(rec));
+    unsigned char const *section[SECTIONS], *p = (unsigned char const *)data + sizeof(rec);
+    size_t total = sizeof(rec);
+    for (int index = 0; index < SECTIONS; index++) {
+        section[index] = p;
+        p += rec.length[index];
+        total += rec.length[index];
+    }
+    if (total != length || rec.addrlen > sizeof(rec.addr) || rec.length[SECT_REQIDS] % sizeof(uint32_t) != 0)
+        return NULL;
+    struct sockaddr *addr = rec.addrlen ? (struct sockaddr *)&rec.addr : NULL;
+    iodev_t *dev = NULL;
+    switch (rec.kind) {
+        case HANDOFF_SERIAL: {
+            if (rec.length[SECT_TERMIOS] != sizeof(struct termios))
+                return NULL;
+            struct termios termctl;
+            memcpy(&termctl, section[SECT_TERMIOS], sizeof(termctl));
+            char *portname = strndup((char const *)section[SECT_NAME], rec.length[SECT_NAME]);
+            dev = selector_new_device_serial(selector, portname, (unsigned long)rec.baudrate, rec.bufsize);
+            if (fd >= 0)
+                serial_adopt(dev, fd, &termctl);
+            break;
+        }
+        case HANDOFF_LISTEN:
+            if (addr == NULL || fd < 0)
+                return NULL;
+            dev = selector_new_device_listen(selector, addr, rec.bufsize, rec.bufmax);
+            tcp_adopt(dev, fd);
+            break;
+        case HANDOFF_CONNECT:
+            if (addr == NULL)
+                return NULL;
+            dev = selector_new_device_connect(selector, addr, rec.bufsize);
+            if (fd >= 0)
+                tcp_adopt(dev, fd);
+            break;
+        case HANDOFF_ACCEPTED:
+            if (addr == NULL || fd < 0)
+                return NULL;
+            dev = selector_new_device_accept(selector, fd, addr, rec.bufsize, rec.bufmax);
+            break;
+        default:
+            return NULL;
+    }
+    // resume where the sender left off
+    if (fd >= 0 && rec.state >= IODEV_CLOSING)
+        iodev_setstate(dev, rec.state);
+    dev->coalesce = (utime_t)rec.coalesce;
+    buffer_put(&dev->rbuf, section[SECT_RBUF], rec.length[SECT_RBUF]);
+    size_t queued = dev->tseg != NULL ? segbuf_put(dev->tseg, section[SECT_TBUF], rec.length[SECT_TBUF]) : 0;
+    buffer_put(&dev->tbuf, section[SECT_TBUF] + queued, rec.length[SECT_TBUF] - queued);
+    if (dev->linebuf != NULL && rec.length[SECT_LINEBUF])
+        stringstore_append(dev->linebuf, section[SECT_LINEBUF], rec.length[SECT_LINEBUF]);
+    session_t *session = iodev_session(dev);
+    if (session != NULL && rec.proto >= 0) {
+        session_setproto(session, rec.proto);
+        session_setcompress(session, rec.compress);
+        for (size_t offset = 0; offset < rec.length[SECT_REQIDS]; offset += sizeof(uint32_t)) {
+            uint32_t reqid;
+            memcpy(&reqid, section[SECT_REQIDS] + offset, sizeof(reqid));
+            session_push_request(session, reqid);
+        }
+    }
+    info->kind = rec.kind;
+    info->listener = rec.listener;
+    info->filter = rec.length[SECT_FILTER] ? (char const *)section[SECT_FILTER] : NULL;
+    info->filterlen = rec.length[SECT_FILTER];
+    return dev;
+}
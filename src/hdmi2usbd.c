@@ -15,12 +15,15 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <ctype.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/errno.h>
 #include <signal.h>
 #include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
 
 #ifdef __APPLE__
 #undef daemon
@@ -29,7 +32,8 @@ extern int daemon(int, int);
 #include <unistd.h>
 #endif
 
-#define COMMAND_PACE 500000       // 500ms == 500000us
+#define BUFFER_IDLE 10000000      // release buffers of connections idle for 10s
+#define HANDOFF_TIMEOUT 10        // seconds for an upgraded instance to take over
 
 
 #include "hdmi2usbd.h"
@@ -37,6 +41,16 @@ extern int daemon(int, int);
 #include "device.h"
 #include "netutils.h"
 #include "stringstore.h"
+#include "session.h"
+#include "frame.h"
+#include "websocket.h"
+#include "nettcp.h"
+#include "serial.h"
+#include "handoff.h"
+#include "service.h"
+#include "recorder.h"
+#include "profile.h"
+#include "watchdog.h"
 
 
 //// Logging interface ////
@@ -67,9 +81,18 @@ break_handler(int sig) {
     signal_received = (unsigned short)(sig & 0xffffffff);
 }
 
+// Leave the flight recorder behind, then crash as we would have anyway
+static void
+crash_handler(int sig) {
+    recorder_event(REC_DUMP, -1, 0, sig);
+    recorder_dump(NULL);
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
 static int sigvec_index = 0;
 
-#define MAX_SIGVEC  7
+#define MAX_SIGVEC  12
 static struct {
     int sig;
     void (*handler)(int);
@@ -91,11 +114,246 @@ pop_sighandler() {
     return sigvec_index;
 }
 
+// Log the event loop profile collected so far, and start again
+static void
+hdmi2usb_profile_log() {
+    char line[160];
+    log_info("Event loop profile over %lus", profile_since() / 1000000UL);
+    for (int phase = 0; phase < PROF_PHASES; phase++) {
+        profile_format(phase, line, sizeof(line));
+        log_info("  %s", line);
+    }
+    profile_format_worst(line, sizeof(line));
+    log_info("  %s", line);
+    profile_reset();
+}
+
+// Write out the flight recorder (on SIGUSR1, or when something went badly wrong)
+static void
+hdmi2usb_dump(int sig) {
+    recorder_event(REC_DUMP, -1, 0, sig);
+    if (recorder_dump(NULL) == 0)
+        log_info("Flight recorder dumped to %s", recorder_path());
+    else
+        log_error("Flight recorder dump to %s failed(%d): %s", recorder_path(), errno, strerror(errno));
+}
+
 static int nochdir = 1;
 static int noclose = 1;
 
 //// init and close functions ////
 
+static void hdmi2usb_device_event(devevent_t const *event, void *arg);
+static int hdmi2usb_dispatched(selector_t *selector, int rc, void *arg);
+static int hdmi2usb_inherit(struct hdmi2usb *app, int rc);
+static iodev_t *hdmi2usb_requester(struct hdmi2usb *app);
+static char const *hdmi2usb_set_filter(struct hdmi2usb *app, iodev_t *dev, char const *pattern, size_t length);
+static int hdmi2usb_session_proto(struct hdmi2usb *app, iodev_t *dev);
+static size_t hdmi2usb_linebuf_commands(stringstore_t *linebuf);
+static void hdmi2usb_local_reply(struct hdmi2usb *app, iodev_t *dev, char const *reply);
+
+// Apply the configured buffer sizes, admission limits and client socket
+// options to a listener
+
+static void
+hdmi2usb_listener_opts(struct hdmi2usb *app, iodev_t *dev) {
+    dev->bufsize = app->opts.iobufsize;
+    dev->bufmax = app->opts.iobufmax;
+    tcp_listen_limits(dev, app->opts.backlog, app->opts.maxconn, app->opts.maxperaddr);
+    tcp_listen_profile(dev, &app->opts.sockopts);
+}
+
+// Create a listen socket with the configured admission limits. When
+// reloading, a listener already open on the address is kept (and marked
+// in keep[]) and the current settings are applied to it in place
+
+static iodev_t *
+hdmi2usb_new_listener(struct hdmi2usb *app, struct sockaddr *addr, unsigned char *keep) {
+    iodev_t *dev = NULL;
+    for (size_t index = 0; keep != NULL && index < selector_device_count(&app->selector); index++) {
+        iodev_t *listener = selector_get_device(&app->selector, index);
+        if (iodev_is_listener(listener) && iodev_is_open(listener) && sockaddr_equal(tcp_getcfg(listener)->local, addr)) {
+            keep[index] = 1;
+            dev = listener;
+            break;
+        }
+    }
+    if (dev == NULL)
+        dev = selector_new_device_listen(&app->selector, addr, app->opts.iobufsize, app->opts.iobufmax);
+    hdmi2usb_listener_opts(app, dev);
+    return dev;
+}
+
+// Set up our listen port(s)
+
+static void
+hdmi2usb_listen(struct hdmi2usb *app, unsigned char *keep) {
+    unsigned listen_ports = 0;
+    char buf[64];
+    snprintf(buf, sizeof(buf) - 1, "%u", app->opts.listen_port);
+    ipaddrs_t *addrs = ipaddrs_resolve_stream(app->opts.listen_addr, buf, app->opts.listen_flags);
+    for (ipaddriter_t iter = ipaddriter_create(addrs); ipaddriter_hasnext(&iter); ) {
+        struct sockaddr *addr = ipaddriter_next(&iter);
+        switch (addr->sa_family) {
+            case AF_INET: {
+                struct sockaddr_in *s4 = (void *) addr;
+                if (s4->sin_addr.s_addr == INADDR_ANY) {
+                    listen_ports |= 4;
+                } else if ((listen_ports & 1) == 0) {  // create ipv4 listen socket
+                    inet_ntop(addr->sa_family, sockaddr_addr(addr), buf, sizeof(buf) - 1);
+                    log_debug("Listening on IPv4 address %s", buf);
+                    hdmi2usb_new_listener(app, addr, keep);
+                    listen_ports |= 1;
+                }
+                break;
+            }
+            case AF_INET6: {
+                struct sockaddr_in6 *s6 = (void *) addr;
+                struct in6_addr in6addr = IN6ADDR_ANY_INIT;
+                if (IN6_ARE_ADDR_EQUAL(&s6->sin6_addr, &in6addr)) {
+                    listen_ports |= 4;
+                } else if ((listen_ports & 2) == 0) {   // create ipv6 listen socket
+                    inet_ntop(addr->sa_family, sockaddr_addr(addr), buf, sizeof(buf) - 1);
+                    log_debug("Listening on IPv6 address %s", buf);
+                    hdmi2usb_new_listener(app, addr, keep);
+                    listen_ports |= 2;
+                }
+                break;
+            }
+            default:
+                continue;
+        }
+        if (listen_ports & 4) {
+            log_debug("Listening on ALL interfaces port %u", sockaddr_port(addr));
+            hdmi2usb_new_listener(app, addr, keep);
+            break;
+        } else if (listen_ports == 3)
+            break;
+    }
+    ipaddrs_free(addrs);
+}
+
+// Optional listener on a port of its own, for admin control or WebSocket
+// clients. As with hdmi2usb_new_listener(), one already open on the address,
+// perhaps passed on by an upgrading instance, is kept. Returns its device
+// index, 0 if there is none
+
+static size_t
+hdmi2usb_port_listen(struct hdmi2usb *app, char const *what, char const *host, unsigned short port, unsigned char *keep) {
+    size_t index = 0;
+    if (!port)
+        return index;
+    char buf[64];
+    snprintf(buf, sizeof(buf) - 1, "%u", port);
+    ipaddrs_t *addrs = ipaddrs_resolve_stream(host, buf, app->opts.listen_flags);
+    if (addrs == NULL || ipaddrs_count(addrs) == 0)
+        log_error("Unable to resolve %s address '%s'", what, host);
+    else {
+        struct sockaddr *addr = ipaddrs_get(addrs, 0);
+        inet_ntop(addr->sa_family, sockaddr_addr(addr), buf, sizeof(buf) - 1);
+        log_debug("Listening for %s on %s port %u", what, buf, sockaddr_port(addr));
+        iodev_t *dev = hdmi2usb_new_listener(app, addr, keep);
+        index = selector_device_index(&app->selector, dev);
+    }
+    ipaddrs_free(addrs);
+    return index;
+}
+
+// The admin control (see hdmi2usb_admin_commands) and WebSocket gateway
+// (see hdmi2usb_process_client_websocket) listeners
+
+static void
+hdmi2usb_listen_extra(struct hdmi2usb *app, unsigned char *keep) {
+    app->admin_index = hdmi2usb_port_listen(app, "admin", app->opts.admin_addr, app->opts.admin_port, keep);
+    app->websocket_index = hdmi2usb_port_listen(app, "WebSocket", app->opts.websocket_addr, app->opts.websocket_port,
+                                                keep);
+}
+
+// Socket activation: adopt the listeners passed by the service manager
+// in place of our own. Connections queued on them while we were starting
+// are accepted as soon as the selector runs. Returns the number adopted
+
+static size_t
+hdmi2usb_activated(struct hdmi2usb *app) {
+    size_t adopted = 0;
+    int count = service_listen_fds(1);
+    for (int fd = SERVICE_LISTEN_FDS_START; fd < SERVICE_LISTEN_FDS_START + count; fd++) {
+        struct sockaddr_storage addr;
+        socklen_t addrlen = sizeof(addr);
+        int listening = 0;
+        socklen_t optlen = sizeof(listening);
+        if (getsockname(fd, (struct sockaddr *)&addr, &addrlen) == -1 ||
+                (addr.ss_family != AF_INET && addr.ss_family != AF_INET6) ||
+                getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &optlen) == -1 || !listening) {
+            log_warning("Ignoring fd %d from the service manager, not a listening tcp socket", fd);
+            close(fd);
+            continue;
+        }
+        char buf[64];
+        struct sockaddr *local = (struct sockaddr *)&addr;
+        log_debug("Listening on %s port %u (fd %d from service manager)",
+                  inet_ntop(local->sa_family, sockaddr_addr(local), buf, sizeof(buf)), sockaddr_port(local), fd);
+        iodev_t *dev = selector_new_device_listen(&app->selector, local, app->opts.iobufsize, app->opts.iobufmax);
+        tcp_adopt(dev, fd);
+        hdmi2usb_listener_opts(app, dev);
+        adopted++;
+    }
+    return adopted;
+}
+
+// Optional multicast publisher for passive monitors
+
+static void
+hdmi2usb_publish(struct hdmi2usb *app) {
+    if (app->opts.mcast_addr != NULL) {
+        char buf[64];
+        snprintf(buf, sizeof(buf) - 1, "%u", app->opts.mcast_port);
+        ipaddrs_t *addrs = ipaddrs_resolve(app->opts.mcast_addr, buf, 0, AF_UNSPEC, SOCK_DGRAM);
+        if (addrs == NULL || ipaddrs_count(addrs) == 0)
+            log_error("Unable to resolve multicast address '%s'", app->opts.mcast_addr);
+        else {
+            struct sockaddr *addr = ipaddrs_get(addrs, 0);
+            inet_ntop(addr->sa_family, sockaddr_addr(addr), buf, sizeof(buf) - 1);
+            log_debug("Publishing to %s port %u", buf, sockaddr_port(addr));
+            selector_new_device_publish(&app->selector, addr, app->opts.mcast_ttl, app->opts.iobufsize);
+        }
+        ipaddrs_free(addrs);
+    }
+}
+
+// Relay mode: the upstream daemon takes the place of the serial device
+
+static int
+hdmi2usb_new_upstream(struct hdmi2usb *app, int rc) {
+    char buf[64];
+    snprintf(buf, sizeof(buf) - 1, "%u", app->opts.upstream_port);
+    ipaddrs_t *addrs = ipaddrs_resolve_stream(app->opts.upstream_addr, buf, app->opts.listen_flags);
+    if (addrs == NULL || ipaddrs_count(addrs) == 0) {
+        log_critical("Unable to resolve upstream address '%s'", app->opts.upstream_addr);
+        rc = EX_STARTUP;
+    } else {
+        struct sockaddr *addr = ipaddrs_get(addrs, 0);
+        inet_ntop(addr->sa_family, sockaddr_addr(addr), buf, sizeof(buf) - 1);
+        log_debug("Relaying upstream %s port %u bufsize %u", buf, sockaddr_port(addr), app->opts.iobufsize);
+        selector_new_device_connect(&app->selector, addr, app->opts.iobufsize);
+    }
+    ipaddrs_free(addrs);
+    return rc;
+}
+
+static int
+hdmi2usb_new_serial(struct hdmi2usb *app, int rc) {
+    char *port = find_serial(app->opts.port);
+    if (port == NULL) {
+        log_critical("No available serial device matching '%s'", app->opts.port);
+        rc = EX_STARTUP;
+    } else {
+        log_debug("Selected serial port %s baud %lu bufsize %u", port, app->opts.baudrate, app->opts.iobufsize);
+        selector_new_device_serial(&app->selector, port, app->opts.baudrate, app->opts.iobufsize);
+    }
+    return rc;
+}
+
 static int
 hdmi2usb_init(struct hdmi2usb *app, int rc) {
     // Redirect generic module error & notification messages to the logger
@@ -106,67 +364,52 @@ hdmi2usb_init(struct hdmi2usb *app, int rc) {
     // signal handlers
     push_sighandler(SIGHUP, break_handler);
     push_sighandler(SIGINT, break_handler);
+    push_sighandler(SIGUSR1, break_handler);
+    push_sighandler(SIGUSR2, break_handler);
+    push_sighandler(SIGSEGV, crash_handler);
+    push_sighandler(SIGBUS, crash_handler);
+    push_sighandler(SIGFPE, crash_handler);
+    push_sighandler(SIGILL, crash_handler);
+    push_sighandler(SIGABRT, crash_handler);
     // initialise selector, set up serial device and network listeners
     selector_init(&app->selector);
-    // first, the serial device. We need to exit if we can't open this one
-    char *port = find_serial(app->opts.port);
-    if (port == NULL) {
-        log_critical("No available serial device matching '%s'", app->opts.port);
-        rc = EX_STARTUP;
-    } else {
-        log_debug("Selected serial port %s baud %lu bufsize %u", port, app->opts.baudrate, app->opts.iobufsize);
-        selector_new_device_serial(&app->selector, port, app->opts.baudrate, app->opts.iobufsize);
-        // Set up our listen port(s)
-        // Also need to exit with error message if it fails
-        unsigned listen_ports = 0;
-        char buf[64];
-        snprintf(buf, sizeof(buf) - 1, "%u", app->opts.listen_port);
-        ipaddrs_t *addrs = ipaddrs_resolve_stream(app->opts.listen_addr, buf, app->opts.listen_flags);
-        for (ipaddriter_t iter = ipaddriter_create(addrs); ipaddriter_hasnext(&iter); ) {
-            struct sockaddr *addr = ipaddriter_next(&iter);
-            switch (addr->sa_family) {
-                case AF_INET: {
-                    struct sockaddr_in *s4 = (void *) addr;
-                    if (s4->sin_addr.s_addr == INADDR_ANY) {
-                        listen_ports |= 4;
-                    } else if ((listen_ports & 1) == 0) {  // create ipv4 listen socket
-                        inet_ntop(addr->sa_family, sockaddr_addr(addr), buf, sizeof(buf) - 1);
-                        log_debug("Listening on IPv4 address %s", buf);
-                        selector_new_device_listen(&app->selector, addr, app->opts.iobufsize);
-                        listen_ports |= 1;
-                    }
-                    break;
-                }
-                case AF_INET6: {
-                    struct sockaddr_in6 *s6 = (void *) addr;
-                    struct in6_addr in6addr = IN6ADDR_ANY_INIT;
-                    if (IN6_ARE_ADDR_EQUAL(&s6->sin6_addr, &in6addr)) {
-                        listen_ports |= 4;
-                    } else if ((listen_ports & 2) == 0) {   // create ipv6 listen socket
-                        inet_ntop(addr->sa_family, sockaddr_addr(addr), buf, sizeof(buf) - 1);
-                        log_debug("Listening on IPv6 address %s", buf);
-                        selector_new_device_listen(&app->selector, addr, app->opts.iobufsize);
-                        listen_ports |= 2;
-                    }
-                    break;
-                }
-                default:
-                    continue;
-            }
-            if (listen_ports & 4) {
-                log_debug("Listening on ALL interfaces port %u", sockaddr_port(addr));
-                selector_new_device_listen(&app->selector, addr, app->opts.iobufsize);
-                break;
-            } else if (listen_ports == 3)
-                break;
-        }
-        ipaddrs_free(addrs);
-
-        if (rc == EX_SUCCESS && app->opts.daemonize) {
+    selector_set_hook(&app->selector, hdmi2usb_dispatched, app);
+    devparse_init(&app->parser, hdmi2usb_device_event, app);
+    filterset_init(&app->filters);
+    segbuf_init(&app->fanout, 0);
+    segbuf_init(&app->wsfanout, 0);
+    pacing_init(&app->pacing);
+    app->command_pace = app->opts.command_time * 1000UL;
+    // first, the serial device (or upstream). We need to exit if we can't open this one
+    // when upgrading, all devices are handed over by the previous instance instead
+    if (app->opts.inherit_fd >= 0) {
+        rc = hdmi2usb_inherit(app, rc);
+        app->opts.daemonize = 0;        // already detached (or not) by the previous instance
+    } else if (app->opts.upstream_addr != NULL)
+        rc = hdmi2usb_new_upstream(app, rc);
+    else
+        rc = hdmi2usb_new_serial(app, rc);
+    if (rc == EX_SUCCESS) {
+        if (app->opts.inherit_fd < 0 && (app->activated = (int)hdmi2usb_activated(app)) == 0)
+            hdmi2usb_listen(app, NULL);
+        // these may be among the listeners inherited
+        size_t count = selector_device_count(&app->selector);
+        unsigned char inherited[count];
+        memset(inherited, 0, count);
+        hdmi2usb_listen_extra(app, inherited);
+        hdmi2usb_publish(app);
+        if (app->opts.daemonize) {
             if (daemon(nochdir, noclose) == -1)
                 log_warning("daemon() failed(%d): %s", errno, strerror(errno));
             app->opts.daemonize = 0;    // only do this once
         }
+        recorder_init(app->opts.recorder);
+        // threads do not survive daemon(), so start watching only now
+        unsigned long notify = service_watchdog_usec();
+        if (watchdog_start(app->opts.stall_time * 1000UL, notify) < 0)
+            log_error("Watchdog thread failed(%d): %s", errno, strerror(errno));
+        else if (notify)
+            log_info("Service watchdog keep-alive every %lums", notify / 2000UL);
     }
     return rc;
 }
@@ -174,24 +417,747 @@ hdmi2usb_init(struct hdmi2usb *app, int rc) {
 
 static int
 hdmi2usb_close(struct hdmi2usb *app, int rc) {
+    watchdog_stop();
+    if (rc >= EX_FAILURE)
+        hdmi2usb_dump(0);
     while (pop_sighandler())
         ;
     return rc;
 }
 
 
+static int
+hdmi2usb_same(char const *a, char const *b) {
+    return a == b || (a != NULL && b != NULL && strcmp(a, b) == 0);
+}
+
+// Re-read the options and apply the differences in place. The serial
+// device and all client connections stay open, listeners are opened
+// or closed only where their addresses changed.
+
+static int
+hdmi2usb_reload(struct hdmi2usb *app, int rc) {
+    struct hdmi2usb_opts opts = app->opts;
+    if (app->reload == NULL || app->reload(&opts) != EX_SUCCESS) {
+        log_error("Reload failed, configuration is unchanged");
+        return rc;
+    }
+    struct hdmi2usb_opts old = app->opts;
+    app->opts = opts;
+    app->opts.daemonize = old.daemonize;
+    if (old.verbose != opts.verbose || old.logflags != opts.logflags || !hdmi2usb_same(old.logfile, opts.logfile) ||
+            !hdmi2usb_same(old.loglevels, opts.loglevels)) {
+        log_init(opts.logflags, (enum Verbosity)opts.verbose, opts.logfile);
+        log_setlevels(opts.loglevels);
+        if (!hdmi2usb_same(old.logfile, opts.logfile))
+            log_rotate();
+    }
+    if (!hdmi2usb_same(old.recorder, opts.recorder))
+        recorder_init(opts.recorder);
+    if (old.stall_time != opts.stall_time) {
+        watchdog_stop();
+        if (watchdog_start(opts.stall_time * 1000UL, service_watchdog_usec()) < 0)
+            log_error("Watchdog thread failed(%d): %s", errno, strerror(errno));
+    }
+    if (!hdmi2usb_same(old.port, opts.port) || old.baudrate != opts.baudrate ||
+            !hdmi2usb_same(old.upstream_addr, opts.upstream_addr) || old.upstream_port != opts.upstream_port)
+        log_warning("Device changes take effect on restart");
+    // listeners: keep those still wanted, close the rest. Those passed by
+    // the service manager (which follow the serial device) are all kept,
+    // the listen address does not apply
+    size_t count = selector_device_count(&app->selector);
+    unsigned char keep[count];
+    memset(keep, 0, count);
+    if (!app->activated)
+        hdmi2usb_listen(app, keep);
+    else {
+        for (size_t index = 1; index <= (size_t)app->activated && index < count; index++) {
+            keep[index] = 1;
+            hdmi2usb_listener_opts(app, selector_get_device(&app->selector, index));
+        }
+    }
+    hdmi2usb_listen_extra(app, keep);
+    for (size_t index = 0; index < count; index++) {
+        iodev_t *dev = selector_get_device(&app->selector, index);
+        if (iodev_is_listener(dev) && !keep[index] && iodev_getstate(dev) != IODEV_INACTIVE) {
+            char buf[64];
+            struct sockaddr *local = tcp_getcfg(dev)->local;
+            log_info("Closing listener on %s port %u", inet_ntop(local->sa_family, sockaddr_addr(local), buf, sizeof(buf)),
+                     sockaddr_port(local));
+            dev->close(dev, IOFLAG_INACTIVE);
+        }
+    }
+    // the multicast publisher is replaced only if its group or ttl changed
+    if (!hdmi2usb_same(old.mcast_addr, opts.mcast_addr) || old.mcast_port != opts.mcast_port ||
+            old.mcast_ttl != opts.mcast_ttl) {
+        for (size_t index = 0; index < selector_device_count(&app->selector); index++) {
+            iodev_t *dev = selector_get_device(&app->selector, index);
+            if (strcmp(iodev_driver(dev), "udp") == 0 && iodev_getstate(dev) != IODEV_INACTIVE)
+                dev->close(dev, IOFLAG_INACTIVE);
+        }
+        hdmi2usb_publish(app);
+    }
+    // replaces any pace set by @tune
+    if (old.command_time != opts.command_time)
+        app->command_pace = opts.command_time * 1000UL;
+    // pacing, limits and buffer sizes for new connections now apply
+    log_info("Configuration reloaded");
+    return rc;
+}
+
+
+//// upgrade (handover to a new instance) ////
+
+// Application state carried across an upgrade
+struct hdmi2usb_handoff {
+    int32_t request_active;     // framed request in progress
+    int32_t request_index;      // requester, as the index of the device sent
+    uint32_t request_reqid;
+    int32_t prompted;
+    int32_t awaiting;
+    uint64_t service_time;
+    uint64_t timeouts;
+    uint64_t pace_remaining;    // until the next command may be sent (us)
+    int32_t activated;          // listeners that came from the service manager
+};
+
+// Replace this process with a new instance of the program, passing the
+// handover socket. Runs in the forked child and does not return
+
+static void
+hdmi2usb_exec(struct hdmi2usb *app, int sock) {
+    struct rlimit rl;
+    int maxfd = getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < 65536 ? (int)rl.rlim_cur : 65536;
+    for (int fd = 3; fd < maxfd; fd++)
+        if (fd != sock)
+            close(fd);
+    int argc = 0;
+    while (app->argv[argc] != NULL)
+        argc++;
+    char *argv[argc + 2], inherit[32];
+    int count = 0;
+    for (int index = 0; index < argc; index++)
+        if (strncmp(app->argv[index], "--inherit=", 10) != 0)
+            argv[count++] = app->argv[index];
+    snprintf(inherit, sizeof(inherit), "--inherit=%d", sock);
+    argv[count++] = inherit;
+    argv[count] = NULL;
+    // the service manager expects keep-alives from the new main pid
+    if (getenv("WATCHDOG_PID") != NULL) {
+        char pid[32];
+        snprintf(pid, sizeof(pid), "%d", (int)getpid());
+        setenv("WATCHDOG_PID", pid, 1);
+    }
+    execvp(argv[0], argv);
+    fprintf(stderr, "%s: exec failed(%d): %s\n", argv[0], errno, strerror(errno));
+    _exit(127);
+}
+
+// Send all open devices followed by the application state. Devices are
+// sent in index order, so the receiver recreates them at the indices
+// they are sent as: work those out first so that accepted connections
+// can refer to their listeners
+
+static int
+hdmi2usb_send_handoff(struct hdmi2usb *app, int sock) {
+    size_t count = selector_device_count(&app->selector);
+    int sent[count], nsent = 0;
+    for (size_t index = 0; index < count; index++) {
+        iodev_t *dev = selector_get_device(&app->selector, index);
+        int state = iodev_getstate(dev);
+        // the serial device (or upstream) always goes first, the publisher is recreated
+        if (index == 0 || (state >= IODEV_CLOSING && strcmp(iodev_driver(dev), "udp") != 0))
+            sent[index] = nsent++;
+        else
+            sent[index] = -1;
+    }
+    for (size_t index = 0; index < count; index++) {
+        if (sent[index] < 0)
+            continue;
+        iodev_t *dev = selector_get_device(&app->selector, index);
+        int listener = -1;
+        if (strcmp(iodev_driver(dev), "tcp") == 0 && !iodev_is_listener(dev) && !tcp_is_connect(dev)) {
+            int listen_fd = tcp_getcfg(dev)->listen_fd;
+            for (size_t other = 0; listen_fd >= 0 && other < count; other++) {
+                iodev_t *ldev = selector_get_device(&app->selector, other);
+                if (sent[other] >= 0 && iodev_is_listener(ldev) && iodev_getfd(ldev) == listen_fd) {
+                    listener = sent[other];
+                    break;
+                }
+            }
+        }
+        session_t *session = iodev_session(dev);
+        int filter = session != NULL ? session_filter(session) : -1;
+        char const *pattern = filter >= 0 ? filterset_pattern(&app->filters, filter) : NULL;
+        if (handoff_send_device(sock, dev, listener, pattern) != 0)
+            return -1;
+    }
+    struct hdmi2usb_handoff state = {
+        .request_active = app->request.active && hdmi2usb_requester(app) != NULL,
+        .request_index = app->request.index < count ? sent[app->request.index] : -1,
+        .request_reqid = app->request.reqid,
+        .prompted = app->pacing.prompted,
+        .awaiting = app->pacing.awaiting,
+        .service_time = app->pacing.service_time,
+        .timeouts = app->pacing.timeouts,
+        .pace_remaining = pacing_remaining(&app->pacing, timer_getmillitime()),
+        .activated = app->activated,
+    };
+    if (handoff_send(sock, HANDOFF_STATE, -1, &state, sizeof(state)) != 0)
+        return -1;
+    return handoff_send(sock, HANDOFF_END, -1, NULL, 0);
+}
+
+// Zero downtime upgrade (SIGUSR2): start the program again, which may
+// since have been replaced, and hand it every open device. This process
+// exits once the new instance has taken over, or carries on if it fails
+
+static int
+hdmi2usb_upgrade(struct hdmi2usb *app, int rc) {
+    int sv[2];
+    if (app->argv == NULL) {
+        log_error("Upgrade is not available");
+        return rc;
+    }
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+        log_error("Upgrade failed, socketpair(%d): %s", errno, strerror(errno));
+        return rc;
+    }
+    pid_t pid = fork();
+    if (pid == 0)
+        hdmi2usb_exec(app, sv[1]);
+    close(sv[1]);
+    if (pid == -1) {
+        log_error("Upgrade failed, fork(%d): %s", errno, strerror(errno));
+        close(sv[0]);
+        return rc;
+    }
+    struct timeval tv = { .tv_sec = HANDOFF_TIMEOUT, .tv_usec = 0 };
+    setsockopt(sv[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    char ack = 0;
+    if (hdmi2usb_send_handoff(app, sv[0]) == 0 && read(sv[0], &ack, 1) == 1 && ack == HANDOFF_READY) {
+        log_critical("Handed over to pid %d", (int)pid);
+        service_notify("MAINPID=%d", (int)pid);
+        watchdog_stop();    // keep-alives are now up to the new instance
+        rc = EX_NORMAL;     // exit leaving the devices to the new instance
+    } else {
+        log_error("Upgrade failed, pid %d did not take over", (int)pid);
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+    }
+    close(sv[0]);
+    return rc;
+}
+
+// Take over the devices of an upgrading instance (see hdmi2usb_upgrade)
+
+static int
+hdmi2usb_inherit(struct hdmi2usb *app, int rc) {
+    int sock = app->opts.inherit_fd, type = HANDOFF_END, fd, ok = 1;
+    void *data;
+    size_t length, count = 0, state_length = 0;
+    int *listeners = NULL;
+    struct hdmi2usb_handoff state;
+    while (ok && (ok = handoff_recv(sock, &type, &fd, &data, &length) == 0) && type != HANDOFF_END) {
+        if (type == HANDOFF_DEVICE) {
+            handoff_device_t info;
+            iodev_t *dev = handoff_recv_device(&app->selector, fd, data, length, &info);
+            int *more = realloc(listeners, (count + 1) * sizeof(int));
+            if (dev == NULL || more == NULL) {
+                log_critical("Invalid device record from upgrading instance");
+                if (fd >= 0)
+                    close(fd);
+                ok = 0;
+            } else {
+                listeners = more;
+                listeners[count++] = info.kind == HANDOFF_ACCEPTED ? info.listener : -1;
+                if (info.kind == HANDOFF_LISTEN)
+                    hdmi2usb_listener_opts(app, dev);
+                if (info.filter != NULL)
+                    hdmi2usb_set_filter(app, dev, info.filter, info.filterlen);
+            }
+        } else if (type == HANDOFF_STATE && length == sizeof(state)) {
+            memcpy(&state, data, sizeof(state));
+            state_length = length;
+        } else if (fd >= 0)
+            close(fd);
+        free(data);
+    }
+    if (!ok || count == 0) {
+        log_critical("Unable to take over from upgrading instance");
+        free(listeners);
+        close(sock);
+        return EX_STARTUP;
+    }
+    // accepted connections count against the listeners they came from
+    for (size_t index = 0; index < count; index++) {
+        if (listeners[index] >= 0 && (size_t)listeners[index] < count) {
+            iodev_t *ldev = selector_get_device(&app->selector, (size_t)listeners[index]);
+            if (iodev_is_listener(ldev))
+                tcp_getcfg(selector_get_device(&app->selector, index))->listen_fd = iodev_getfd(ldev);
+        }
+    }
+    free(listeners);
+    if (state_length) {
+        if (state.request_active && state.request_index >= 0 && (size_t)state.request_index < count) {
+            app->request.active = 1;
+            app->request.index = (size_t)state.request_index;
+            app->request.fd = iodev_getfd(selector_get_device(&app->selector, app->request.index));
+            app->request.reqid = state.request_reqid;
+        }
+        app->pacing.prompted = state.prompted;
+        app->pacing.awaiting = state.awaiting;
+        app->pacing.service_time = (utime_t)state.service_time;
+        app->pacing.timeouts = (unsigned long)state.timeouts;
+        pacing_resume(&app->pacing, (utime_t)state.pace_remaining, timer_getmillitime());
+        app->activated = state.activated;
+    }
+    char ack = HANDOFF_READY;
+    if (write(sock, &ack, 1) != 1) {
+        log_critical("Upgrading instance has gone away");
+        rc = EX_STARTUP;
+    } else
+        log_info("Took over %zu devices from upgrading instance", count);
+    close(sock);
+    return rc;
+}
+
+
+//// framed client requests ////
+
+// Return the connection that sent the command currently being serviced
+// by the device (if it is framed and still connected)
+
+static iodev_t *
+hdmi2usb_requester(struct hdmi2usb *app) {
+    if (app->request.active) {
+        if (app->request.index < selector_device_count(&app->selector)) {
+            iodev_t *dev = selector_get_device(&app->selector, app->request.index);
+            if (iodev_is_open(dev) && iodev_getfd(dev) == app->request.fd)
+                return dev;
+        }
+        app->request.active = 0;    // requester has gone away
+    }
+    return NULL;
+}
+
+// Signal completion of the current request to the requester
+
+static void
+hdmi2usb_request_done(struct hdmi2usb *app) {
+    iodev_t *dev = hdmi2usb_requester(app);
+    if (dev != NULL)
+        frame_put(iodev_tbuf(dev), FRAME_DONE, app->request.reqid, NULL, 0);
+    app->request.active = 0;
+}
+
+// Reject a client frame
+
+static void
+hdmi2usb_frame_error(iodev_t *dev, uint32_t reqid, char const *reason) {
+    log_debug("fd %d: request %u rejected: %s", iodev_getfd(dev), reqid, reason);
+    frame_put(iodev_tbuf(dev), FRAME_ERROR, reqid, reason, strlen(reason));
+}
+
+//// output filters ////
+
+// Set (or clear, if the pattern is empty) a connection's output filter
+// returns an error message, or NULL on success
+
+static char const *
+hdmi2usb_set_filter(struct hdmi2usb *app, iodev_t *dev, char const *pattern, size_t length) {
+    session_t *session = iodev_session(dev);
+    char const *errmsg = "invalid pattern";
+    char text[length + 1];
+    memcpy(text, pattern, length);
+    text[length] = '\0';
+    if (length == 0)
+        session_setfilter(session, -1);
+    else {
+        int id = filterset_add(&app->filters, text, &errmsg);
+        if (id < 0)
+            return errmsg;
+        session_setfilter(session, id);
+        app->filtered++;    // recounted in the next sweep
+    }
+    log_debug("fd %d: output filter %s", iodev_getfd(dev), length ? text : "cleared");
+    return NULL;
+}
+
+// Deliver a line of device output to connections whose filter matches
+// each distinct filter is evaluated once per line
+
+static void
+hdmi2usb_filter_fanout(struct hdmi2usb *app, devevent_t const *event) {
+    if (!app->filtered)
+        return;
+    filterset_match(&app->filters, event->text, event->length);
+    iodev_t *requester = hdmi2usb_requester(app);
+    size_t length = event->length;
+    char line[length + 2];
+    memcpy(line, event->text, length);
+    if (event->type != DEVEVT_PROMPT) {
+        line[length++] = '\r';
+        line[length++] = '\n';
+    }
+    for (size_t index = 1; index < selector_device_count(&app->selector); index++) {
+        iodev_t *dev = selector_get_device(&app->selector, index);
+        session_t *session = iodev_session(dev);
+        if (session == NULL || !iodev_is_open(dev) || !filterset_matched(&app->filters, session_filter(session)))
+            continue;
+        if (session_proto(session) == SESSION_FRAMED) {
+            if (dev != requester)   // which receives the unfiltered response
+                frame_put(iodev_tbuf(dev), FRAME_EVENT, 0, line, length);
+        } else if (session_proto(session) == SESSION_WEBSOCKET)
+            ws_frame_put(iodev_tbuf(dev), WS_BINARY, line, length);
+        else if (buffer_available(iodev_tbuf(dev)) >= length)
+            buffer_put(iodev_tbuf(dev), line, length);
+    }
+}
+
+// Discard filters no longer used by any connection
+
+static void
+hdmi2usb_filter_sweep(struct hdmi2usb *app) {
+    app->filtered = 0;
+    filterset_unmark(&app->filters);
+    for (size_t index = 1; index < selector_device_count(&app->selector); index++) {
+        iodev_t *dev = selector_get_device(&app->selector, index);
+        session_t *session = iodev_session(dev);
+        if (session != NULL && iodev_is_open(dev) && session_filter(session) >= 0) {
+            filterset_mark(&app->filters, session_filter(session));
+            app->filtered++;
+        }
+    }
+    filterset_sweep(&app->filters);
+}
+
+
+//// device events ////
+
+// Handle events parsed from the device output
+
+static void
+hdmi2usb_device_event(devevent_t const *event, void *arg) {
+    struct hdmi2usb *app = arg;
+    log_trace("device %s: %.*s", devparse_event_name(event->type), (int)event->length, event->text);
+    switch (event->type) {
+        case DEVEVT_PROMPT: {
+            // only a prompt following the complete command indicates that it has finished
+            iodev_t *serial = selector_get_device(&app->selector, 0);
+            if (serial != NULL)
+                pacing_prompt(&app->pacing, buffer_used(iodev_tbuf(serial)) == 0, event->timestamp);
+            break;
+        }
+        default:
+            break;
+    }
+    hdmi2usb_filter_fanout(app, event);
+}
+
+
 static size_t
 hdmi2usb_process_serial_data(struct hdmi2usb *app, iodev_t *serial) {
     size_t s_bytes = iodev_is_open(serial) ? buffer_used(iodev_rbuf(serial)) : 0;
     if (s_bytes) {
-        // process the datas here
-        //... TODO (maybe?)
-        // pick up anything left over and queue for output to network connections
+        // parse the device output for events, directly from the buffer
+        utime_t now = timer_getmillitime();
+        for (size_t offset = 0, length; offset < s_bytes; offset += length) {
+            void *data = buffer_peekptr(iodev_rbuf(serial), offset, &length);
+            log_trace("serial read %zu bytes: %.*s", length, (int)length, (char const *)data);
+            devparse_feed(&app->parser, data, length, now);
+        }
+        // and queue for output to network connections
         s_bytes = buffer_move(&app->copy, iodev_rbuf(serial), s_bytes);
     }
     return s_bytes;
 }
 
+//
+// hdmi2usb_process_client_frames()
+// decode complete frames from a framed connection's input buffer
+// commands are queued in the line buffer exactly as for text
+// connections, with their request ids queued alongside, and with
+// the same limits on their length and number
+
+static void
+hdmi2usb_process_client_frames(struct hdmi2usb *app, iodev_t *dev, size_t commands) {
+    buffer_t *rbuf = iodev_rbuf(dev);
+    session_t *session = iodev_session(dev);
+    unsigned char header[FRAME_HDRSIZE];
+    frame_header_t hdr;
+
+    while ((!app->opts.maxqueue || commands < app->opts.maxqueue) &&
+            buffer_peek(rbuf, header, FRAME_HDRSIZE) == FRAME_HDRSIZE) {
+        if (frame_header_decode(header, FRAME_HDRSIZE, &hdr) != 0 ||
+                FRAME_HDRSIZE + hdr.length > buffer_used(rbuf) + buffer_available(rbuf)) {
+            // framing is lost and there is no way to resynchronise
+            log_warning("fd %d: invalid frame received, closing", iodev_getfd(dev));
+            hdmi2usb_frame_error(dev, 0, "protocol error");
+            buffer_flush(rbuf);
+            dev->close(dev, IOFLAG_FLUSH);
+            break;
+        }
+        if (buffer_used(rbuf) < FRAME_HDRSIZE + hdr.length)
+            break;  // wait for the rest of this frame
+        char payload[hdr.length + 1];
+        buffer_get(rbuf, NULL, FRAME_HDRSIZE);
+        buffer_get(rbuf, payload, hdr.length);
+        switch (hdr.type) {
+            case FRAME_HELLO:
+                frame_put(iodev_tbuf(dev), FRAME_HELLO, hdr.reqid, NULL, 0);
+                break;
+            case FRAME_COMMAND: {
+                size_t length = hdr.length;
+                while (length > 0 && strchr("\r\n", payload[length - 1]) != NULL)
+                    --length;
+                if (length == 0 || memchr(payload, '\n', length) != NULL || memchr(payload, '\0', length) != NULL)
+                    hdmi2usb_frame_error(dev, hdr.reqid, "invalid command");
+                else if (app->opts.maxline && length > app->opts.maxline) {
+                    log_debug("fd %d: command of %zu bytes refused", iodev_getfd(dev), length);
+                    ++app->overlong;
+                    hdmi2usb_frame_error(dev, hdr.reqid, "command too long");
+                } else {
+                    payload[length++] = '\n';
+                    stringstore_append(iodev_stringstore(dev), payload, length);
+                    session_push_request(session, hdr.reqid);
+                    ++commands;
+                }
+                break;
+            }
+            case FRAME_FILTER: {
+                char const *errmsg = hdmi2usb_set_filter(app, dev, payload, hdr.length);
+                if (errmsg != NULL)
+                    hdmi2usb_frame_error(dev, hdr.reqid, errmsg);
+                else
+                    frame_put(iodev_tbuf(dev), FRAME_DONE, hdr.reqid, NULL, 0);
+                break;
+            }
+            default:
+                hdmi2usb_frame_error(dev, hdr.reqid, "unsupported frame type");
+                break;
+        }
+    }
+}
+
+//
+// hdmi2usb_process_client_websocket()
+// answer the upgrade request of a WebSocket connection, then decode
+// its frames. Text messages are commands, queued in the line buffer
+// just as for text connections and with the same limits; other
+// messages are refused
+
+static void
+hdmi2usb_websocket_close(iodev_t *dev, int status) {
+    ws_close_put(iodev_tbuf(dev), status);
+    buffer_flush(iodev_rbuf(dev));
+    dev->close(dev, IOFLAG_FLUSH);
+}
+
+// Length of the incomplete command at the end of a line buffer
+static size_t
+hdmi2usb_linebuf_partial(stringstore_t *linebuf) {
+    char const *p = stringstore_buffer(linebuf);
+    size_t used = stringstore_length(linebuf), partial = 0;
+    while (partial < used && p[used - partial - 1] != '\n')
+        ++partial;
+    return partial;
+}
+
+// Queue the text of a WebSocket message, which may hold any number of
+// command lines or part of one, applying the line limit to each. A line
+// that is too long is discarded up to the next newline or the end of the
+// message. Returns the number of command lines completed
+
+static size_t
+hdmi2usb_websocket_text(struct hdmi2usb *app, iodev_t *dev, char const *data, size_t length) {
+    stringstore_t *linebuf = iodev_stringstore(dev);
+    session_t *session = iodev_session(dev);
+    size_t commands = 0;
+    while (length > 0) {
+        char const *eol = memchr(data, '\n', length);
+        size_t linelen = eol != NULL ? (size_t)(eol - data) + 1 : length;
+        size_t partial = hdmi2usb_linebuf_partial(linebuf);
+        if (session_discarding(session))
+            session_setdiscarding(session, eol == NULL);
+        else if (app->opts.maxline && partial + linelen - (eol != NULL) > app->opts.maxline) {
+            // drop what was queued of the line, and the rest of it
+            log_debug("fd %d: WebSocket line of %zu%s bytes discarded", iodev_getfd(dev), partial + linelen,
+                      eol != NULL ? "" : "+");
+            stringstore_truncate(linebuf, stringstore_length(linebuf) - partial);
+            session_setdiscarding(session, eol == NULL);
+            ++app->overlong;
+            hdmi2usb_local_reply(app, dev, "@error line too long\r\n");
+        } else {
+            stringstore_append(linebuf, data, linelen);
+            commands += eol != NULL;
+        }
+        data += linelen;
+        length -= linelen;
+    }
+    return commands;
+}
+
+static void
+hdmi2usb_process_client_websocket(struct hdmi2usb *app, iodev_t *dev, size_t commands) {
+    buffer_t *rbuf = iodev_rbuf(dev);
+    stringstore_t *linebuf = iodev_stringstore(dev);
+    session_t *session = iodev_session(dev);
+    if (session_proto(session) == SESSION_HANDSHAKE) {
+        char request[WS_MAXREQUEST], response[256];
+        size_t length = buffer_peek(rbuf, request, sizeof(request));
+        size_t reqlen = ws_request_length(request, length);
+        if (!reqlen && length < sizeof(request))
+            return;     // wait for the rest
+        int rlen = reqlen ? ws_handshake(request, reqlen, response, sizeof(response)) : -1;
+        if (rlen < 0) {
+            log_warning("fd %d: invalid WebSocket upgrade request, closing", iodev_getfd(dev));
+            buffer_put(iodev_tbuf(dev), WS_BADREQUEST, sizeof(WS_BADREQUEST) - 1);
+            buffer_flush(rbuf);
+            dev->close(dev, IOFLAG_FLUSH);
+            return;
+        }
+        buffer_get(rbuf, NULL, reqlen);
+        buffer_put(iodev_tbuf(dev), response, (size_t)rlen);
+        session_setproto(session, SESSION_WEBSOCKET);
+        log_debug("fd %d: WebSocket connected", iodev_getfd(dev));
+    }
+    unsigned char header[WS_MAXHEADER];
+    ws_header_t hdr;
+    int hdrlen;
+    while ((!app->opts.maxqueue || commands < app->opts.maxqueue) &&
+            (hdrlen = ws_header_decode(header, buffer_peek(rbuf, header, WS_MAXHEADER), &hdr)) != 0) {
+        if (hdrlen < 0 || !hdr.masked) {
+            log_warning("fd %d: invalid WebSocket frame received, closing", iodev_getfd(dev));
+            hdmi2usb_websocket_close(dev, WS_STATUS_PROTOCOL);
+            break;
+        }
+        if (hdrlen + hdr.length > buffer_used(rbuf) + buffer_available(rbuf)) {
+            log_warning("fd %d: WebSocket frame of %llu bytes is too large, closing", iodev_getfd(dev),
+                        (unsigned long long)hdr.length);
+            hdmi2usb_websocket_close(dev, WS_STATUS_TOOBIG);
+            break;
+        }
+        if (buffer_used(rbuf) < hdrlen + hdr.length)
+            break;  // wait for the rest of this frame
+        size_t length = (size_t)hdr.length;
+        if (hdr.opcode >= WS_CLOSE && (length > WS_MAXCONTROL || !hdr.fin)) {
+            log_warning("fd %d: invalid WebSocket control frame received, closing", iodev_getfd(dev));
+            hdmi2usb_websocket_close(dev, WS_STATUS_PROTOCOL);
+            break;
+        }
+        // unmasked in place, the payload may be as large as the receive buffer
+        for (size_t offset = 0, piece; offset < length; offset += piece) {
+            unsigned char *data = buffer_peekptr(rbuf, (size_t)hdrlen + offset, &piece), mask[4];
+            if (piece > length - offset)
+                piece = length - offset;
+            for (size_t i = 0; i < sizeof(mask); i++)
+                mask[i] = hdr.mask[(offset + i) & 3];
+            ws_unmask(data, piece, mask);
+        }
+        buffer_get(rbuf, NULL, (size_t)hdrlen);
+        char control[WS_MAXCONTROL];
+        size_t clen = hdr.opcode >= WS_CLOSE ? buffer_get(rbuf, control, length) : 0;
+        if (hdr.opcode == WS_TEXT || hdr.opcode == WS_CONTINUATION) {
+            // a message may span several frames, its end also ends a command line
+            for (size_t offset = 0, piece; offset < length; offset += piece) {
+                char const *data = buffer_peekptr(rbuf, offset, &piece);
+                if (piece > length - offset)
+                    piece = length - offset;
+                commands += hdmi2usb_websocket_text(app, dev, data, piece);
+            }
+            buffer_get(rbuf, NULL, length);
+            if (hdr.fin && session_discarding(session))
+                session_setdiscarding(session, 0);
+            else if (hdr.fin && hdmi2usb_linebuf_partial(linebuf) > 0) {
+                stringstore_append(linebuf, "\n", 1);
+                ++commands;
+            }
+        } else if (hdr.opcode == WS_PING)
+            ws_frame_put(iodev_tbuf(dev), WS_PONG, control, clen);
+        else if (hdr.opcode == WS_CLOSE) {
+            log_debug("fd %d: WebSocket closed by client", iodev_getfd(dev));
+            hdmi2usb_websocket_close(dev, WS_STATUS_NORMAL);
+            break;
+        } else if (hdr.opcode != WS_PONG) {
+            log_warning("fd %d: unsupported WebSocket message type %d, closing", iodev_getfd(dev), hdr.opcode);
+            hdmi2usb_websocket_close(dev, WS_STATUS_UNSUPPORTED);
+            break;
+        }
+    }
+}
+
+// Move complete lines of text to the line buffer, up to the queued
+// command limit. An incomplete line waits in the receive buffer for the
+// rest of it, unless it is already too long (or fills the buffer), when
+// it is discarded along with the rest of the line still to come
+
+static void
+hdmi2usb_process_client_lines(struct hdmi2usb *app, iodev_t *dev, size_t commands) {
+    buffer_t *rbuf = iodev_rbuf(dev);
+    stringstore_t *linebuf = iodev_stringstore(dev);
+    session_t *session = iodev_session(dev);
+    while (buffer_used(rbuf) > 0 && (!app->opts.maxqueue || commands < app->opts.maxqueue)) {
+        size_t linelen = 0, length;
+        int complete = 0;
+        while (!complete && linelen < buffer_used(rbuf)) {
+            char const *data = buffer_peekptr(rbuf, linelen, &length);
+            char const *eol = memchr(data, '\n', length);
+            complete = eol != NULL;
+            linelen += complete ? (size_t)(eol - data) + 1 : length;
+        }
+        if (session_discarding(session)) {
+            buffer_consume(rbuf, linelen);
+            session_setdiscarding(session, !complete);
+            continue;
+        }
+        if (app->opts.maxline && linelen - complete > app->opts.maxline)
+            ;   // too long, with or without the rest of it
+        else if (!complete && buffer_available(rbuf) > 0)
+            break;
+        else if (complete) {
+            for (size_t offset = 0; offset < linelen; offset += length) {
+                void const *data = buffer_peekptr(rbuf, offset, &length);
+                if (length > linelen - offset)
+                    length = linelen - offset;
+                stringstore_append(linebuf, data, length);
+            }
+            buffer_consume(rbuf, linelen);
+            ++commands;
+            continue;
+        }
+        log_debug("fd %d: command line of %zu%s bytes discarded", iodev_getfd(dev), linelen, complete ? "" : "+");
+        buffer_consume(rbuf, linelen);
+        session_setdiscarding(session, !complete);
+        ++app->overlong;
+        hdmi2usb_local_reply(app, dev, "@error line too long\r\n");
+    }
+}
+
+// Hold a connection's reads while it has too many commands queued or has
+// used up its input allowance, returns the reason. While held its input
+// stays in the receive buffer, and the fd is not polled for reads
+
+static int
+hdmi2usb_client_hold(struct hdmi2usb *app, iodev_t *dev, size_t commands) {
+    session_t *session = iodev_session(dev);
+    int held = HOLD_NONE;
+    if (app->opts.maxqueue && commands >= app->opts.maxqueue)
+        held = HOLD_QUEUE;
+    else if (!ratelimit_ready(&session->input, app->opts.input_rate, app->opts.input_burst, timer_getmillitime()))
+        held = HOLD_RATE;
+    if (held != session_held(session)) {
+        if (held == HOLD_QUEUE)
+            ++app->queue_held;
+        else if (held == HOLD_RATE)
+            ++app->input_held;
+        recorder_event(REC_HOLD, iodev_getfd(dev), held, (long)buffer_used(iodev_rbuf(dev)));
+        session_sethold(session, held);
+        iodev_hold(dev, held != HOLD_NONE);
+    }
+    return held;
+}
+
 //
 // hdmi2usb_process_client_data()
 // read pending input from network connections and buffer this
@@ -199,19 +1165,500 @@ hdmi2usb_process_serial_data(struct hdmi2usb *app, iodev_t *serial) {
 // we don't send this directly/immediately because there are
 // limitations on the number of commands we can process at once
 // and the rate at which they can be processed.
+// The first byte received on a connection selects its protocol.
+// Each connection's input is limited in rate, line length and the
+// number of commands it may have queued
 
 static void
 hdmi2usb_process_client_data(struct hdmi2usb *app, iodev_t *dev) {
     buffer_t *rbuf = iodev_rbuf(dev);
     size_t r_bytes = buffer_used(rbuf);
-    if (r_bytes) {
-        stringstore_t *linebuf = iodev_stringstore(dev);
-        if (linebuf) {
-            void *data = alloca(r_bytes);
-            r_bytes = buffer_get(rbuf, data, r_bytes);
-            stringstore_append(linebuf, data, r_bytes);
+    stringstore_t *linebuf = iodev_stringstore(dev);
+    session_t *session = iodev_session(dev);
+    if (linebuf == NULL || session == NULL)
+        return;
+    size_t commands = hdmi2usb_linebuf_commands(linebuf);
+    if (hdmi2usb_client_hold(app, dev, commands) == HOLD_NONE && r_bytes) {
+        if (session_proto(session) == SESSION_NEW) {
+            unsigned char first;
+            buffer_peek(rbuf, &first, 1);
+            session_setproto(session, first == FRAME_MAGIC ? SESSION_FRAMED : SESSION_TEXT);
         }
+        size_t queued = stringstore_length(linebuf);
+        if (session_proto(session) == SESSION_FRAMED)
+            hdmi2usb_process_client_frames(app, dev, commands);
+        else if (session_proto(session) == SESSION_HANDSHAKE || session_proto(session) == SESSION_WEBSOCKET)
+            hdmi2usb_process_client_websocket(app, dev, commands);
+        else
+            hdmi2usb_process_client_lines(app, dev, commands);
+        if (app->opts.input_rate)
+            ratelimit_charge(&session->input, r_bytes - buffer_used(rbuf));
+        if (stringstore_length(linebuf) != queued)
+            recorder_event(REC_QUEUE, iodev_getfd(dev), 0, (long)(stringstore_length(linebuf) - queued));
+    }
+}
+
+// Count the complete commands in a line buffer
+
+static size_t
+hdmi2usb_linebuf_commands(stringstore_t *linebuf) {
+    size_t queued = 0;
+    if (linebuf != NULL) {
+        char const *p = stringstore_buffer(linebuf);
+        for (size_t i = 0; i < stringstore_length(linebuf); i++)
+            if (p[i] == '\n')
+                ++queued;
     }
+    return queued;
+}
+
+// Count the commands queued for the device across all connections
+
+static size_t
+hdmi2usb_queued_commands(struct hdmi2usb *app) {
+    size_t queued = 0;
+    for (size_t index = 1; index < selector_device_count(&app->selector); index++) {
+        iodev_t *dev = selector_get_device(&app->selector, index);
+        if (hdmi2usb_session_proto(app, dev) != SESSION_ADMIN)
+            queued += hdmi2usb_linebuf_commands(iodev_stringstore(dev));
+    }
+    return queued;
+}
+
+// Estimated time (us) needed to send a number of queued commands
+
+static utime_t
+hdmi2usb_queue_drain(struct hdmi2usb *app, size_t queued) {
+    utime_t per_command = app->opts.adaptive && app->pacing.service_time ? app->pacing.service_time : app->command_pace;
+    return queued * per_command;
+}
+
+// The device is ready for another command as the pacing allows (see
+// pacing.h). When relaying, commands are held only while the upstream is
+// not connected
+
+static int
+hdmi2usb_device_ready(struct hdmi2usb *app, iodev_t *serial) {
+    // the upstream daemon paces commands itself, they are sent as soon as it is connected
+    if (app->opts.upstream_addr != NULL)
+        return iodev_getstate(serial) >= IODEV_CONNECTED;
+    return pacing_ready(&app->pacing, app->opts.adaptive, timer_getmillitime());
+}
+
+//
+// hdmi2usb_local_commands()
+// text connections may set their output filter with "@filter [pattern]",
+// compress their output with "@compress [level]" and read the loop profile
+// with "@stats"
+// these are answered immediately, as they do not involve the device
+
+#define LOCAL_FILTER    "@filter"
+#define LOCAL_COMPRESS  "@compress"
+#define LOCAL_STATS     "@stats"
+
+// Length of the command word if the command is this one, otherwise 0
+static size_t
+hdmi2usb_local_word(char const *command, size_t length, char const *word) {
+    size_t cmdlen = strlen(word);
+    if (length < cmdlen || strncmp(command, word, cmdlen) != 0 ||
+        (length > cmdlen && !isspace((unsigned char)command[cmdlen])))
+        return 0;
+    return cmdlen;
+}
+
+static void
+hdmi2usb_local_reply(struct hdmi2usb *app, iodev_t *dev, char const *reply) {
+    size_t rlen = strlen(reply);
+    session_t *session = iodev_session(dev);
+    if (session != NULL && session_proto(session) == SESSION_WEBSOCKET)
+        ws_frame_put(iodev_tbuf(dev), WS_TEXT, reply, rlen);
+    else if (session != NULL && session_compress(session)) {
+        // the other connections sharing the compressor have not seen this
+        if (compress_stored(iodev_tbuf(dev), reply, rlen))
+            compressor_resync(&app->compressors[session_compress(session)]);
+    } else if (buffer_available(iodev_tbuf(dev)) >= rlen)
+        buffer_put(iodev_tbuf(dev), reply, rlen);
+}
+
+// "@compress [level]": deflate everything after the reply, which is not
+// itself compressed. Connections at the same level share the compressor,
+// which is reset for a newcomer at the start of the next chunk
+
+static char const *
+hdmi2usb_set_compress(struct hdmi2usb *app, iodev_t *dev, char const *args, size_t length, int *level) {
+    session_t *session = iodev_session(dev);
+    *level = COMPRESS_DEFAULT;
+    if (length > 0) {
+        char *end;
+        *level = (int)strtol(args, &end, 10);
+        if (end != args + length || *level < 1 || *level >= COMPRESS_LEVELS)
+            return "compression level 1-9";
+    }
+    if (session_proto(session) == SESSION_WEBSOCKET)
+        return "not available on WebSocket connections";
+    if (session_compress(session))
+        return "already compressed";
+    if (session_filter(session) >= 0)
+        return "not available with a filter";
+    compressor_t *c = &app->compressors[*level];
+    if (!c->ready && compressor_init(c, *level) != 0)
+        return "compression unavailable";
+    compressor_resync(c);
+    return NULL;
+}
+
+static void
+hdmi2usb_local_commands(struct hdmi2usb *app, iodev_t *dev) {
+    stringstore_t *linebuf = dev->linebuf;
+    session_t *session = iodev_session(dev);
+    if (linebuf == NULL || session == NULL || session_proto(session) == SESSION_FRAMED)
+        return;
+    while (stringstore_length(linebuf) > 0) {
+        stringstore_iterator_t iter = stringstore_iterator(linebuf);
+        size_t length = 0, cmdlen;
+        char const *command = stringstore_nextstr(&iter, &length);
+        char reply[FILTER_MAXITEMS * 2 + 64];
+        if (command == NULL)
+            break;
+        if ((cmdlen = hdmi2usb_local_word(command, length, LOCAL_STATS)) != 0) {
+            for (int phase = 0; phase <= PROF_PHASES; phase++) {
+                char line[160];
+                if (phase < PROF_PHASES)
+                    profile_format(phase, line, sizeof(line));
+                else
+                    profile_format_worst(line, sizeof(line));
+                snprintf(reply, sizeof(reply), "@stats %s\r\n", line);
+                hdmi2usb_local_reply(app, dev, reply);
+            }
+            snprintf(reply, sizeof(reply), "@ok stats %lus\r\n", profile_since() / 1000000UL);
+        } else if ((cmdlen = hdmi2usb_local_word(command, length, LOCAL_FILTER)) != 0) {
+            // strip the command word, surrounding whitespace and line ending
+            char const *pattern = command + cmdlen;
+            size_t plen = length - cmdlen;
+            while (plen > 0 && isspace((unsigned char)*pattern))
+                ++pattern, --plen;
+            while (plen > 0 && isspace((unsigned char)pattern[plen - 1]))
+                --plen;
+            char const *errmsg = session_compress(session) ? "not available with compression" :
+                                 hdmi2usb_set_filter(app, dev, pattern, plen);
+            if (errmsg != NULL)
+                snprintf(reply, sizeof(reply), "@error %s\r\n", errmsg);
+            else if (plen == 0)
+                snprintf(reply, sizeof(reply), "@ok filter off\r\n");
+            else
+                snprintf(reply, sizeof(reply), "@ok filter %d %.*s\r\n", session_filter(session), (int)plen, pattern);
+        } else if ((cmdlen = hdmi2usb_local_word(command, length, LOCAL_COMPRESS)) != 0) {
+            char const *args = command + cmdlen;
+            size_t alen = length - cmdlen;
+            while (alen > 0 && isspace((unsigned char)*args))
+                ++args, --alen;
+            while (alen > 0 && isspace((unsigned char)args[alen - 1]))
+                --alen;
+            int level;
+            char const *errmsg = hdmi2usb_set_compress(app, dev, args, alen, &level);
+            stringstore_consume(linebuf, length);
+            if (errmsg != NULL) {
+                snprintf(reply, sizeof(reply), "@error %s\r\n", errmsg);
+                hdmi2usb_local_reply(app, dev, reply);
+            } else {
+                // the reply is the last output sent uncompressed
+                snprintf(reply, sizeof(reply), "@ok compress deflate %d\r\n", level);
+                hdmi2usb_local_reply(app, dev, reply);
+                session_setcompress(session, level);
+            }
+            continue;
+        } else
+            break;
+        stringstore_consume(linebuf, length);
+        hdmi2usb_local_reply(app, dev, reply);
+    }
+}
+
+//// admin control ////
+
+//
+// hdmi2usb_admin_commands()
+// connections to the admin port inspect and tune the daemon itself
+// one command per line, answered by zero or more lines of key=value
+// fields and a final "ok" or "error <reason>"
+// these connections receive no device output and send no device commands
+
+#define ADMIN_MAXLINE   256
+
+enum AdminTunable {
+    TUNE_PACE,                  // minimum time between commands (ms)
+    TUNE_CHARPACE,              // delay between characters written to the device (us)
+    TUNE_LOOP,                  // selector timeout (ms)
+    TUNE_RATE,                  // client input rate (bytes/s, 0 = unlimited)
+    TUNE_BURST,                 // client input burst (bytes)
+    TUNE_LINE,                  // longest command line (0 = unlimited)
+    TUNE_QUEUE,                 // commands queued per client (0 = unlimited)
+    TUNABLES
+};
+
+static struct {
+    char const *name;
+    unsigned long min, max;
+} const tunables[TUNABLES] = {
+    { "pace_ms",     1, 60000 },
+    { "charpace_us", 0, 1000000 },
+    { "loop_ms",     1, 10000 },
+    { "input_rate",  0, 0x7fffffffUL },
+    { "input_burst", 1, 0x7fffffffUL },
+    { "max_line",    0, 0x7fffffffUL },
+    { "max_queue",   0, 0x7fffffffUL },
+};
+
+// The serial device, if that is what we are talking to
+static serial_cfg_t *
+hdmi2usb_admin_serial(struct hdmi2usb *app) {
+    iodev_t *serial = selector_get_device(&app->selector, 0);
+    return strcmp(iodev_driver(serial), "serial") == 0 ? serial_getcfg(serial) : NULL;
+}
+
+static void
+hdmi2usb_admin_values(struct hdmi2usb *app, unsigned long *values) {
+    serial_cfg_t *scfg = hdmi2usb_admin_serial(app);
+    values[TUNE_PACE] = app->command_pace / 1000UL;
+    values[TUNE_CHARPACE] = scfg != NULL ? scfg->pacing : 0;
+    values[TUNE_LOOP] = app->opts.loop_time;
+    values[TUNE_RATE] = app->opts.input_rate;
+    values[TUNE_BURST] = app->opts.input_burst;
+    values[TUNE_LINE] = app->opts.maxline;
+    values[TUNE_QUEUE] = app->opts.maxqueue;
+}
+
+static void
+hdmi2usb_admin_format(unsigned long const *values, char *line, size_t size) {
+    int len = 0;
+    for (int tune = 0; tune < TUNABLES && len >= 0 && (size_t)len < size; tune++)
+        len += snprintf(line + len, size - (size_t)len, "%s%s=%lu", tune ? " " : "", tunables[tune].name, values[tune]);
+}
+
+// Validate every key=value first, so that either all are applied or none.
+// The loop picks up the new values from its next pass
+static char const *
+hdmi2usb_admin_set(struct hdmi2usb *app, char const *args, size_t length) {
+    unsigned long values[TUNABLES];
+    hdmi2usb_admin_values(app, values);
+    char spec[length + 1];
+    memcpy(spec, args, length);
+    spec[length] = '\0';
+    int changes = 0;
+    for (char *save = NULL, *item = strtok_r(spec, " \t", &save); item != NULL; item = strtok_r(NULL, " \t", &save)) {
+        char *value = strchr(item, '=');
+        if (value == NULL)
+            return "expected key=value";
+        *value++ = '\0';
+        int tune = 0;
+        while (tune < TUNABLES && strcmp(item, tunables[tune].name) != 0)
+            tune++;
+        if (tune == TUNABLES)
+            return "unknown setting";
+        char *endptr = value;
+        unsigned long number = strtoul(value, &endptr, 10);
+        if (endptr == value || *endptr != '\0' || number < tunables[tune].min || number > tunables[tune].max)
+            return "value out of range";
+        if (tune == TUNE_CHARPACE && hdmi2usb_admin_serial(app) == NULL)
+            return "no serial device";
+        values[tune] = number;
+        changes++;
+    }
+    if (!changes)
+        return "nothing to set";
+    serial_cfg_t *scfg = hdmi2usb_admin_serial(app);
+    app->command_pace = values[TUNE_PACE] * 1000UL;
+    if (scfg != NULL)
+        scfg->pacing = values[TUNE_CHARPACE];
+    app->opts.loop_time = values[TUNE_LOOP];
+    app->opts.input_rate = values[TUNE_RATE];
+    app->opts.input_burst = values[TUNE_BURST];
+    app->opts.maxline = values[TUNE_LINE];
+    app->opts.maxqueue = values[TUNE_QUEUE];
+    char line[ADMIN_MAXLINE];
+    hdmi2usb_admin_format(values, line, sizeof(line));
+    log_info("Admin set %s", line);
+    return NULL;
+}
+
+// One line per device, listeners and connections
+static void
+hdmi2usb_admin_conns(struct hdmi2usb *app, iodev_t *admin) {
+    static char const *protos[] = { "new", "text", "framed", "admin", "handshake", "websocket" };
+    static char const *holds[] = { "no", "rate", "queue" };
+    for (size_t index = 0; index < selector_device_count(&app->selector); index++) {
+        iodev_t *dev = selector_get_device(&app->selector, index);
+        if (iodev_getstate(dev) == IODEV_INACTIVE)
+            continue;
+        char line[ADMIN_MAXLINE], addr[64] = "-";
+        size_t size = sizeof(line) - 2;     // leaving room for the CRLF
+        size_t len = (size_t)snprintf(line, size, "index=%zu fd=%d driver=%s state=%s", index, iodev_getfd(dev),
+                                      iodev_driver(dev), iodev_statename(iodev_getstate(dev)));
+        if (len >= size)
+            len = size - 1;
+        session_t *session = iodev_session(dev);
+        if (iodev_is_listener(dev)) {
+            tcp_cfg_t *cfg = tcp_getcfg(dev);
+            inet_ntop(cfg->local->sa_family, sockaddr_addr(cfg->local), addr, sizeof(addr));
+            snprintf(line + len, size - len, " listen=%s:%u%s rejected=%lu", addr, sockaddr_port(cfg->local),
+                     index == app->admin_index ? " admin=1" : "", cfg->rejected);
+        } else {
+            stringstore_t *linebuf = iodev_stringstore(dev);
+            segbuf_t *tseg = iodev_tseg(dev);
+            struct sockaddr *remote = session != NULL ? tcp_getcfg(dev)->remote : NULL;
+            if (remote != NULL) {
+                char host[48] = "?";
+                inet_ntop(remote->sa_family, sockaddr_addr(remote), host, sizeof(host));
+                snprintf(addr, sizeof(addr), "%s:%u", host, sockaddr_port(remote));
+            }
+            snprintf(line + len, size - len, " peer=%s proto=%s tbuf=%zu/%zu tseg=%zu rbuf=%zu linebuf=%zu queued=%zu filter=%d compress=%d held=%s",
+                     addr, index == 0 ? "device" : session != NULL ? protos[session_proto(session)] : "-",
+                     buffer_used(iodev_tbuf(dev)), buffer_used(iodev_tbuf(dev)) + buffer_available(iodev_tbuf(dev)), tseg != NULL ? segbuf_used(tseg) : 0,
+                     buffer_used(iodev_rbuf(dev)), linebuf != NULL ? stringstore_length(linebuf) : 0,
+                     hdmi2usb_linebuf_commands(linebuf), session != NULL ? session_filter(session) : -1,
+                     session != NULL ? session_compress(session) : 0, holds[session != NULL ? session_held(session) : HOLD_NONE]);
+        }
+        strcat(line, "\r\n");
+        hdmi2usb_local_reply(app, admin, line);
+    }
+}
+
+// Close a client connection, but not the device or a listener
+static char const *
+hdmi2usb_admin_kick(struct hdmi2usb *app, char const *args, size_t length) {
+    char arg[length + 1], *endptr = arg;
+    memcpy(arg, args, length);
+    arg[length] = '\0';
+    long fd = strtol(arg, &endptr, 10);
+    if (endptr == arg || *endptr != '\0')
+        return "expected a descriptor";
+    for (size_t index = 1; index < selector_device_count(&app->selector); index++) {
+        iodev_t *dev = selector_get_device(&app->selector, index);
+        if (iodev_getfd(dev) == fd && iodev_is_open(dev) && iodev_session(dev) != NULL) {
+            log_info("fd %ld: closed by admin request", fd);
+            dev->close(dev, IOFLAG_NONE);
+            return NULL;
+        }
+    }
+    return "no such connection";
+}
+
+static void
+hdmi2usb_admin_stats(struct hdmi2usb *app, iodev_t *admin) {
+    char line[ADMIN_MAXLINE];
+    for (int phase = 0; phase <= PROF_PHASES; phase++) {
+        if (phase < PROF_PHASES)
+            profile_format(phase, line, sizeof(line) - 2);
+        else
+            profile_format_worst(line, sizeof(line) - 2);
+        strcat(line, "\r\n");
+        hdmi2usb_local_reply(app, admin, line);
+    }
+    snprintf(line, sizeof(line), "since=%lus stalls=%lu queued=%zu service_ms=%lu timeouts=%lu\r\n",
+             profile_since() / 1000000UL, watchdog_stalls(), hdmi2usb_queued_commands(app),
+             app->pacing.service_time / 1000UL, app->pacing.timeouts);
+    hdmi2usb_local_reply(app, admin, line);
+    snprintf(line, sizeof(line), "input_held=%lu queue_held=%lu overlong=%lu\r\n", app->input_held, app->queue_held,
+             app->overlong);
+    hdmi2usb_local_reply(app, admin, line);
+    for (int level = 1; level < COMPRESS_LEVELS; level++) {
+        compressor_t *c = &app->compressors[level];
+        if (c->ready) {
+            snprintf(line, sizeof(line), "compress=%d in=%llu out=%llu\r\n", level, c->bytes_in, c->bytes_out);
+            hdmi2usb_local_reply(app, admin, line);
+        }
+    }
+}
+
+static void
+hdmi2usb_admin_commands(struct hdmi2usb *app, iodev_t *dev) {
+    buffer_t *rbuf = iodev_rbuf(dev);
+    stringstore_t *linebuf = iodev_stringstore(dev);
+    size_t length;
+    void *data;
+    while ((data = buffer_readptr(rbuf, &length)) != NULL) {
+        stringstore_append(linebuf, data, length);
+        buffer_consume(rbuf, length);
+    }
+    while (iodev_is_open(dev) && stringstore_length(linebuf) > 0) {
+        stringstore_iterator_t iter = stringstore_iterator(linebuf);
+        char const *command = stringstore_nextstr(&iter, &length);
+        if (command == NULL)
+            break;
+        // split into the command word and its arguments
+        size_t linelen = length, cmdlen = 0;
+        while (linelen > 0 && isspace((unsigned char)command[linelen - 1]))
+            --linelen;
+        while (cmdlen < linelen && !isspace((unsigned char)command[cmdlen]))
+            ++cmdlen;
+        char const *args = command + cmdlen;
+        while (args < command + linelen && isspace((unsigned char)*args))
+            ++args;
+        size_t arglen = linelen - (size_t)(args - command);
+        char const *errmsg = NULL;
+        char line[ADMIN_MAXLINE];
+        unsigned long values[TUNABLES];
+        log_debug("fd %d: admin %.*s", iodev_getfd(dev), (int)linelen, command);
+        if (cmdlen == 0)
+            ;   // blank line, just acknowledge
+        else if (hdmi2usb_local_word(command, cmdlen, "help")) {
+            hdmi2usb_local_reply(app, dev, "conns | get | set key=value... | kick fd | stats | quit\r\n");
+            for (int tune = 0; tune < TUNABLES; tune++) {
+                snprintf(line, sizeof(line), "%s=%lu-%lu\r\n", tunables[tune].name, tunables[tune].min, tunables[tune].max);
+                hdmi2usb_local_reply(app, dev, line);
+            }
+        } else if (hdmi2usb_local_word(command, cmdlen, "conns"))
+            hdmi2usb_admin_conns(app, dev);
+        else if (hdmi2usb_local_word(command, cmdlen, "set") && (errmsg = hdmi2usb_admin_set(app, args, arglen)) != NULL)
+            ;   // nothing was changed
+        else if (hdmi2usb_local_word(command, cmdlen, "get") || hdmi2usb_local_word(command, cmdlen, "set")) {
+            hdmi2usb_admin_values(app, values);
+            hdmi2usb_admin_format(values, line, sizeof(line) - 2);
+            strcat(line, "\r\n");
+            hdmi2usb_local_reply(app, dev, line);
+        } else if (hdmi2usb_local_word(command, cmdlen, "kick"))
+            errmsg = hdmi2usb_admin_kick(app, args, arglen);
+        else if (hdmi2usb_local_word(command, cmdlen, "stats"))
+            hdmi2usb_admin_stats(app, dev);
+        else if (hdmi2usb_local_word(command, cmdlen, "quit")) {
+            hdmi2usb_local_reply(app, dev, "ok\r\n");
+            stringstore_consume(linebuf, length);
+            dev->close(dev, IOFLAG_FLUSH);
+            break;
+        } else
+            errmsg = "unknown command";
+        stringstore_consume(linebuf, length);
+        if (errmsg != NULL) {
+            snprintf(line, sizeof(line), "error %s\r\n", errmsg);
+            hdmi2usb_local_reply(app, dev, line);
+        } else
+            hdmi2usb_local_reply(app, dev, "ok\r\n");
+    }
+}
+
+// Device index to listen fd, -1 if none
+static int
+hdmi2usb_listener_fd(struct hdmi2usb *app, size_t index) {
+    iodev_t *dev = index ? selector_get_device(&app->selector, index) : NULL;
+    return dev != NULL && iodev_is_listener(dev) ? iodev_getfd(dev) : -1;
+}
+
+// The protocol of a client connection, -1 if it has no session. Those
+// accepted on the admin or WebSocket listeners are classified on their
+// first pass, before they could be sent any device output
+static int
+hdmi2usb_session_proto(struct hdmi2usb *app, iodev_t *dev) {
+    session_t *session = iodev_session(dev);
+    if (session == NULL)
+        return -1;
+    if (session_proto(session) == SESSION_NEW && (app->admin_index || app->websocket_index)) {
+        int listen_fd = tcp_getcfg(dev)->listen_fd;     // only accepted tcp connections have a session
+        if (listen_fd == hdmi2usb_listener_fd(app, app->admin_index))
+            session_setproto(session, SESSION_ADMIN);
+        else if (listen_fd == hdmi2usb_listener_fd(app, app->websocket_index))
+            session_setproto(session, SESSION_HANDSHAKE);
+    }
+    return session_proto(session);
 }
 
 //
@@ -223,9 +1670,11 @@ hdmi2usb_process_client_data(struct hdmi2usb *app, iodev_t *dev) {
 // a short period when the command is executed.
 
 static void
-hdmi2usb_process_client_commands(struct hdmi2usb *app, iodev_t *serial, iodev_t *dev) {
+hdmi2usb_process_client_commands(struct hdmi2usb *app, iodev_t *serial, size_t index, iodev_t *dev) {
+    // Local commands are handled here and never reach the device
+    hdmi2usb_local_commands(app, dev);
     // Skip even checking unless it is time to send another command
-    if (timer_expired(&app->last_command)) {
+    if (hdmi2usb_device_ready(app, serial)) {
         // check we are have commands to send to this device
         stringstore_t *linebuf = dev->linebuf;
         if (linebuf != NULL && stringstore_length(linebuf) > 0) {
@@ -236,16 +1685,123 @@ hdmi2usb_process_client_commands(struct hdmi2usb *app, iodev_t *serial, iodev_t
             if (command != NULL && length > 0) {
                 // There is one: send it to the serial device
                 iodev_write(serial, command, length);
+                recorder_event(REC_SEND, iodev_getfd(dev), 0, (long)length);
+                devparse_expect(&app->parser, command, length);
                 // Remove the command from the line buffer, and reset time last command was sent
                 stringstore_consume(linebuf, length);
                 // Need more accurate time here, don't want the latency of the processing loop omitted
-                timer_reset(&app->last_command, COMMAND_PACE);
+                pacing_sent(&app->pacing, app->command_pace, timer_getmillitime());
+                // Any output from here on belongs to this command, not the previous one
+                hdmi2usb_request_done(app);
+                session_t *session = iodev_session(dev);
+                uint32_t reqid;
+                if (session != NULL && session_proto(session) == SESSION_FRAMED && session_pop_request(session, &reqid))
+                    app->request = (struct hdmi2usb_request){ 1, index, iodev_getfd(dev), reqid };
+                if (app->opts.adaptive) {
+                    size_t queued = hdmi2usb_queued_commands(app);
+                    log_debug("command sent, service time %lums, %zu queued, drain %lums", app->pacing.service_time / 1000,
+                              queued, hdmi2usb_queue_drain(app, queued) / 1000);
+                }
             }
         }
 
     }
 }
 
+// Fill a set of shared segments with the processed serial data, at most
+// once per pass however many connections it is shared with
+
+static void
+hdmi2usb_fanout_segments(buffer_t *src, segbuf_t *fanout, void const *header, size_t hdrlen, size_t s_bytes) {
+    if (segbuf_used(fanout) == 0) {
+        if (hdrlen)
+            segbuf_put(fanout, header, hdrlen);
+        for (size_t offset = 0, length; offset < s_bytes; offset += length) {
+            void *data = buffer_peekptr(src, offset, &length);
+            if (length > s_bytes - offset)
+                length = s_bytes - offset;
+            segbuf_put(fanout, data, length);
+        }
+    }
+}
+
+//
+// hdmi2usb_process_fanout()
+// queue processed serial data for output to a network connection
+// framed connections receive it as a response if they sent the
+// current request, otherwise as an unsolicited event
+// WebSocket connections receive it as a binary message, once upgraded
+// compressed connections share the output of one compressor per level
+
+static void
+hdmi2usb_process_fanout(struct hdmi2usb *app, iodev_t *dev, iodev_t *requester, uint32_t reqid, size_t s_bytes) {
+    session_t *session = iodev_session(dev);
+    int proto = session != NULL ? session_proto(session) : SESSION_TEXT;
+    int level = session != NULL ? session_compress(session) : 0;
+    if (proto == SESSION_FRAMED) {
+        if (dev == requester)
+            frame_copy(iodev_tbuf(dev), FRAME_RESPONSE, reqid, &app->copy, s_bytes);
+        else if (session_filter(session) < 0)
+            frame_copy(iodev_tbuf(dev), FRAME_EVENT, 0, &app->copy, s_bytes);
+    } else if (level > 0 && level < COMPRESS_LEVELS) {
+        compressor_t *c = &app->compressors[level];
+        if (!c->ready && compressor_init(c, level) != 0)
+            return;
+        size_t length = compressor_chunk(c, &app->copy, s_bytes), queued = 0;
+        segbuf_t *tseg = iodev_tseg(dev);
+        if (tseg != NULL && buffer_used(iodev_tbuf(dev)) == 0) {
+            hdmi2usb_fanout_segments(&c->out, &c->segs, NULL, 0, length);
+            queued = segbuf_share_whole(tseg, &c->segs, length);
+        } else if (buffer_available(iodev_tbuf(dev)) >= length)
+            queued = buffer_copy(iodev_tbuf(dev), &c->out, length);
+        // part of a chunk would corrupt the stream, so a chunk that does not
+        // fit is skipped, and the next one must not refer back to it
+        if (queued < length)
+            compressor_resync(c);
+    } else if (proto != SESSION_HANDSHAKE && (session == NULL || session_filter(session) < 0)) {
+        // text connections share one set of segments, and WebSocket connections
+        // another with the same data framed, but as these are sent ahead of the
+        // transmit buffer, only while that is empty
+        segbuf_t *tseg = iodev_tseg(dev);
+        if (tseg != NULL && buffer_used(iodev_tbuf(dev)) == 0) {
+            if (proto == SESSION_WEBSOCKET) {
+                unsigned char header[WS_MAXHEADER];
+                size_t hdrlen = ws_header_encode(header, WS_BINARY, s_bytes);
+                hdmi2usb_fanout_segments(&app->copy, &app->wsfanout, header, hdrlen, s_bytes);
+                // a partial message would leave the client out of step
+                segbuf_share_whole(tseg, &app->wsfanout, hdrlen + s_bytes);
+            } else {
+                hdmi2usb_fanout_segments(&app->copy, &app->fanout, NULL, 0, s_bytes);
+                segbuf_share(tseg, &app->fanout, s_bytes);
+            }
+        } else if (proto == SESSION_WEBSOCKET)
+            ws_frame_copy(iodev_tbuf(dev), WS_BINARY, &app->copy, s_bytes);
+        else
+            buffer_copy(iodev_tbuf(dev), &app->copy, s_bytes);
+    }
+    // filtered connections receive matching lines via hdmi2usb_filter_fanout()
+}
+
+// The serial device could not be (re)opened, it may have been unplugged
+// and come back under another name. Look for it again, returns non-zero
+// if it was found and will be reopened
+
+static int
+hdmi2usb_rediscover(struct hdmi2usb *app, iodev_t *serial) {
+    if (strcmp(iodev_driver(serial), "serial") != 0)
+        return 0;
+    serial_cfg_t *cfg = serial_getcfg(serial);
+    char *port = find_serial(app->opts.port);
+    if (port == NULL || strcmp(port, cfg->portname) == 0) {
+        free(port);
+        return 0;
+    }
+    log_warning("Serial device %s is gone, switching to %s", cfg->portname, port);
+    cfg->portname = port;
+    iodev_setstate(serial, IODEV_CLOSED);   // reopened by the selector
+    return 1;
+}
+
 // Process cycle for the application
 
 static int
@@ -254,31 +1810,86 @@ hdmi2usb_process(struct hdmi2usb *app, int rc) {
     // The serial device is alaways at index 0 in the managed devices array.
     // It must be open and active, if not everything else is pointless
     iodev_t *serial = selector_get_device(&app->selector, 0);
-    if (serial == NULL || iodev_getstate(serial) == IODEV_INACTIVE)
+    if (serial == NULL || (iodev_getstate(serial) == IODEV_INACTIVE && !hdmi2usb_rediscover(app, serial))) {
+        hdmi2usb_dump(0);   // the device is gone for good
         return EX_NORMAL;
+    }
+    watchdog_stall_t stall;
+    if (watchdog_stalled(&stall)) {
+        if (stall.driver != NULL)
+            log_warning("Event loop stalled for %lums in %s of %s fd %d", stall.duration / 1000UL, stall.phase,
+                        stall.driver, stall.fd);
+        else
+            log_warning("Event loop stalled for %lums in %s", stall.duration / 1000UL, stall.phase);
+    }
+    // we are ready for service once the device is open (or upstream connected)
+    if (!app->ready && iodev_getstate(serial) >= IODEV_CONNECTED) {
+        if (service_notify("READY=1\nMAINPID=%d", (int)getpid()) < 0)
+            log_warning("service notify error(%d): %s", errno, strerror(errno));
+        app->ready = 1;
+    }
 
     // At least one listen port must also be open, check for this
     // when we iterate ports for application I/O processing
     size_t s_bytes = hdmi2usb_process_serial_data(app, serial);
+    // serial data received so far is attributed to the request in progress
+    iodev_t *requester = hdmi2usb_requester(app);
+    uint32_t reqid = app->request.reqid;
     int listener_count = 0;
     int connect_count = 0;
     for (size_t index = 1; index < selector_device_count(&app->selector); index++) {
         iodev_t *dev = selector_get_device(&app->selector, index);
         if (iodev_is_listener(dev))
             ++listener_count;
+        else if (hdmi2usb_session_proto(app, dev) == SESSION_ADMIN)
+            hdmi2usb_admin_commands(app, dev);
         else {
-            ++connect_count;
+            // the multicast publisher is not a client
+            if (strcmp(iodev_driver(dev), "udp") != 0)
+                ++connect_count;
             // copy processed serial data to non-listener network sockets
             if (s_bytes)
-                buffer_copy(iodev_tbuf(dev), &app->copy, s_bytes);
+                hdmi2usb_process_fanout(app, dev, requester, reqid, s_bytes);
             // process input from network connection
             hdmi2usb_process_client_data(app, dev);
-            // send any pending input on this connection to the device (maybe)
-            hdmi2usb_process_client_commands(app, serial, dev);
         }
     }
-    // reset the copy buffer
+    // reset the copy buffer (connections keep their references to segments)
     buffer_flush(&app->copy);
+    segbuf_flush(&app->fanout);
+    segbuf_flush(&app->wsfanout);
+    for (int level = 1; level < COMPRESS_LEVELS; level++)
+        compressor_flush(&app->compressors[level]);
+    // the current request is complete once the device prompts again,
+    // or has at least had time to respond
+    utime_t now = timer_getmillitime();
+    if (requester != NULL && (app->pacing.prompted || pacing_expired(&app->pacing, now)))
+        hdmi2usb_request_done(app);
+    // no prompt seen, the pace timeout applies
+    if (pacing_timeout(&app->pacing, app->opts.adaptive, now))
+        log_debug("no prompt within %lums of command (%lu timeouts)", app->command_pace / 1000UL, app->pacing.timeouts);
+    // send any pending input on connections to the device (maybe)
+    for (size_t index = 1; index < selector_device_count(&app->selector); index++) {
+        iodev_t *dev = selector_get_device(&app->selector, index);
+        if (!iodev_is_listener(dev) && hdmi2usb_session_proto(app, dev) != SESSION_ADMIN)
+            hdmi2usb_process_client_commands(app, serial, index, dev);
+    }
+    if (app->filtered)
+        hdmi2usb_filter_sweep(app);
+    // give memory of idle connections back to the pool
+    if (timer_expired(&app->idle_trim)) {
+        size_t released = 0;
+        for (size_t index = 1; index < selector_device_count(&app->selector); index++) {
+            iodev_t *dev = selector_get_device(&app->selector, index);
+            if (iodev_is_open(dev) && !iodev_is_listener(dev))
+                released += iodev_trim(dev);
+        }
+        if (released)
+            log_debug("released %zu bytes from idle connections (%zu pooled)", released, buffer_pool_bytes());
+        timer_reset(&app->idle_trim, BUFFER_IDLE);
+    }
+    if (app->opts.profile_time && profile_since() >= app->opts.profile_time * 1000000UL)
+        hdmi2usb_profile_log();
     // exit if there are no active listeners
     return !listener_count ? EX_NORMAL : rc;
 }
@@ -287,6 +1898,17 @@ hdmi2usb_process(struct hdmi2usb *app, int rc) {
 
 //// main application loop ////
 
+// Run application processing after every dispatch, so that a continuously
+// busy selector does not starve it; pending signals end the selector loop
+
+static int
+hdmi2usb_dispatched(selector_t *selector, int rc, void *arg) {
+    (void)selector;
+    if (signal_received)
+        return rc ? rc : -1;
+    return hdmi2usb_process((struct hdmi2usb *)arg, rc);
+}
+
 int
 hdmi2usb_main(struct hdmi2usb *app) {
     int rc = hdmi2usb_init(app, 0);
@@ -296,17 +1918,35 @@ hdmi2usb_main(struct hdmi2usb *app) {
         switch (signal_received) {
             case SIGHUP:
                 log_critical("Reloading on SIGHUP");
-                rc = hdmi2usb_init(app, hdmi2usb_close(app, EX_SUCCESS));
+                signal_received = 0;
+                service_notify("RELOADING=1");
+                rc = hdmi2usb_reload(app, EX_SUCCESS);
+                service_notify("READY=1");
+                break;
+            case SIGUSR1:
+                signal_received = 0;
+                hdmi2usb_dump(SIGUSR1);
+                hdmi2usb_profile_log();
+                rc = EX_SUCCESS;
+                break;
+            case SIGUSR2:
+                log_critical("Upgrading on SIGUSR2");
+                signal_received = 0;
+                rc = hdmi2usb_upgrade(app, EX_SUCCESS);
                 break;
             case SIGINT:
             case SIGQUIT:
             case SIGTERM:
                 log_critical("Keyboard Quit");
+                service_notify("STOPPING=1");
                 rc = EX_REQUEST;
                 break;
-            default:
+            default: {
+                utime_t start = profile_now();
                 rc = hdmi2usb_process(app, rc);
+                profile_mark(PROF_PROCESS, start);
                 break;
+            }
         }
     }
     return hdmi2usb_close(app, rc);
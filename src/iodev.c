@@ -8,9 +8,14 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/errno.h>
+#include <sys/uio.h>
 
 #include "iodev.h"
+#include "selector.h"
 #include "stringstore.h"
+#include "session.h"
+#include "logging.h"
+#include "recorder.h"
 
 #define IODEV_ALLOC 0x25a1da5
 
@@ -18,13 +23,46 @@
 iodev_cfg_t *iodev_getcfg(iodev_t *iodev) { return iodev->cfg; }
 const char *iodev_driver(iodev_t *iodev) { return iodev->cfg->name; }
 int iodev_getstate(iodev_t *dev) { return dev->state; }
-int iodev_setstate(iodev_t *dev, int state) { return dev->state = state; }
+
+int
+iodev_setstate(iodev_t *dev, int state) {
+    recorder_event(REC_STATE, dev->fd, dev->state, state);
+    return dev->state = state;
+}
+
+static char const *state_names[] = {
+    [IODEV_NONE] = "NONE",
+    [IODEV_INACTIVE] = "INACTIVE",
+    [IODEV_CLOSED] = "CLOSED",
+    [IODEV_CLOSING] = "CLOSING",
+    [IODEV_PENDING] = "PENDING",
+    [IODEV_OPEN] = "OPEN",
+    [IODEV_CONNECTED] = "CONNECTED",
+    [IODEV_ACTIVE] = "ACTIVE",
+};
+
+char const *
+iodev_statename(int state) {
+    return state >= 0 && state < (int)(sizeof(state_names) / sizeof(state_names[0])) ? state_names[state] : "?";
+}
+
 int iodev_getfd(iodev_t *dev) { return dev->fd; }
 int iodev_is_listener(iodev_t *dev) { return dev->listener; }
 int iodev_is_open(iodev_t *dev) { return iodev_getstate(dev) >= IODEV_OPEN; }
 buffer_t *iodev_tbuf(iodev_t *dev) { return &dev->tbuf; }
 buffer_t *iodev_rbuf(iodev_t *dev) { return &dev->rbuf; }
+segbuf_t *iodev_tseg(iodev_t *dev) { return dev->tseg; }
+int iodev_held(iodev_t *dev) { return dev->held; }
+void iodev_hold(iodev_t *dev, int held) { dev->held = held; }
+
+
+// Output queued for the device, all of tseg is sent before tbuf
+size_t
+iodev_pending(iodev_t *dev) {
+    return buffer_used(&dev->tbuf) + (dev->tseg != NULL ? segbuf_used(dev->tseg) : 0);
+}
 stringstore_t *iodev_stringstore(iodev_t *dev) { return dev->linebuf; }
+session_t *iodev_session(iodev_t *dev) { return dev->session; }
 
 selector_t *getselector(iodev_t *dev) { return dev->selector; }
 void setselector(iodev_t *dev, selector_t *selector) { dev->selector = selector; }
@@ -131,6 +169,23 @@ iodev_is_set(iodev_t *dev, fd_set *fds) {
 }
 
 
+// Small amounts of queued output are held back for the device's coalescing
+// window, so that bursts of small chunks go out in fewer writes
+static int
+iodev_send_now(iodev_t *dev, size_t pending) {
+    if (!dev->coalesce || pending >= IODEV_COALESCE_BYTES)
+        return 1;
+    utime_t now = timer_getmillitime();
+    if (!dev->queued_since)
+        dev->queued_since = now;
+    if (now - dev->queued_since >= dev->coalesce)
+        return 1;
+    if (dev->selector != NULL)
+        selector_set_deadline(dev->selector, dev->queued_since + dev->coalesce);
+    return 0;
+}
+
+
 static int
 iodev_set_masks(iodev_t *dev, fd_set *r, fd_set *w, fd_set *x) {
     int is_active = 0;
@@ -145,7 +200,7 @@ iodev_set_masks(iodev_t *dev, fd_set *r, fd_set *w, fd_set *x) {
         default:
             break;
         case IODEV_CLOSING:     // pre-close flushing
-            if (buffer_used(iodev_tbuf(dev)) > 0) {
+            if (iodev_pending(dev) > 0) {
                 if (dev->sendOk(dev)) {
                     FD_SET(dev->fd, w);
                     FD_SET(dev->fd, x);
@@ -165,9 +220,10 @@ iodev_set_masks(iodev_t *dev, fd_set *r, fd_set *w, fd_set *x) {
         case IODEV_OPEN:        // open/operating
         case IODEV_CONNECTED:   // connected
         case IODEV_ACTIVE:      // connected with I/O pending
-            if (buffer_available(iodev_rbuf(dev)) > 0)
+            if (dev->recvOk(dev))
                 FD_SET(dev->fd, r);
-            if (buffer_used(iodev_tbuf(dev)) > 0)
+            size_t pending = iodev_pending(dev);
+            if (pending > 0 && iodev_send_now(dev, pending) && dev->sendOk(dev))
                 FD_SET(dev->fd, w);
             FD_SET(dev->fd, x);
             is_active++;
@@ -185,11 +241,13 @@ iodev_read_handler(iodev_t *dev) {
     if (dev->fd == -1)
         iodev_error("iodev %s read error: device is closed", cfg->name);
     else {
-        size_t available = buffer_available(&dev->rbuf);
-        void *tmp = alloca(available);
-        rc = iodev_read(dev, tmp, available);
+        size_t available;
+        void *ptr = buffer_writeptr(&dev->rbuf, &available);
+        rc = iodev_read(dev, ptr, available);
+        recorder_event(REC_READ, dev->fd, 0, rc);
+        log_module(cfg->logmodule, V_TRACE, "%s fd %d: read %zd of %zu bytes", cfg->name, dev->fd, rc, available);
         if (rc > 0)
-            buffer_put(&dev->rbuf, tmp, (size_t)rc);
+            buffer_produce(&dev->rbuf, (size_t)rc);
         else {
             if (rc < 0)
                 iodev_error("iodev %s read error(%d): %s, closing", cfg->name, errno, strerror(errno));
@@ -197,7 +255,10 @@ iodev_read_handler(iodev_t *dev) {
                 iodev_notify("iodev %s EOF from fd %d, closing", cfg->name, dev->fd);
             buffer_flush(&dev->rbuf);
             buffer_flush(&dev->tbuf);
-            dev->close(dev, IODEV_CLOSED);
+            if (dev->tseg != NULL)
+                segbuf_flush(dev->tseg);
+            dev->queued_since = 0;
+            dev->close(dev, IOFLAG_NONE);
         }
     }
     return rc;
@@ -212,20 +273,42 @@ iodev_write_handler(iodev_t *dev) {
     if (dev->fd == -1)
         iodev_error("iodev %s write error: device is closed", cfg->name);
     else {
-        size_t available = buffer_used(&dev->tbuf);
-        if (!available)
-            rc = available;
+        // shared segments first, then the transmit buffer, in one call
+        // the transmit buffer follows only if the whole chain fits
+        struct iovec iov[SEGBUF_MAXIOV + 1];
+        int iovcnt = dev->tseg != NULL ? segbuf_iov(dev->tseg, iov, SEGBUF_MAXIOV) : 0;
+        size_t segbytes = 0;
+        for (int index = 0; index < iovcnt; index++)
+            segbytes += iov[index].iov_len;
+        if (iovcnt == 0 || (iovcnt < SEGBUF_MAXIOV && segbuf_count(dev->tseg) == (size_t)iovcnt)) {
+            size_t available;
+            void *ptr = buffer_readptr(&dev->tbuf, &available);
+            if (available) {
+                iov[iovcnt].iov_base = ptr;
+                iov[iovcnt++].iov_len = available;
+            }
+        }
+        if (!iovcnt)
+            rc = 0;
         else {
-            void *tmp = alloca(available);
-            buffer_peek(&dev->tbuf, tmp, available);
-            rc = write(dev->fd, tmp, available);
+            rc = iovcnt == 1 ? write(dev->fd, iov[0].iov_base, iov[0].iov_len) : writev(dev->fd, iov, iovcnt);
+            recorder_event(REC_WRITE, dev->fd, 0, rc);
+            log_module(cfg->logmodule, V_TRACE, "%s fd %d: wrote %zd bytes (%d iov)", cfg->name, dev->fd, rc, iovcnt);
             if (rc < 0) {
                 iodev_error("iodev %s write error(%d): %s", cfg->name, errno, strerror(errno));
                 buffer_flush(&dev->rbuf);
                 buffer_flush(&dev->tbuf);
+                if (dev->tseg != NULL)
+                    segbuf_flush(dev->tseg);
+                dev->queued_since = 0;
                 dev->close(dev, IODEV_NONE);
-            } else { // advance the counter by amount written
-                buffer_get(&dev->tbuf, NULL, (size_t)rc);
+            } else { // advance the counters by amount written
+                size_t written = (size_t)rc;
+                if (segbytes)
+                    written -= segbuf_consume(dev->tseg, written < segbytes ? written : segbytes);
+                buffer_consume(&dev->tbuf, written);
+                if (iodev_pending(dev) == 0)
+                    dev->queued_since = 0;  // restart the coalescing window
             }
         }
     }
@@ -267,8 +350,23 @@ iodev_sendok(iodev_t *dev) {
 }
 
 
+// room to receive, and not held back by the application
+static int
+iodev_recvok(iodev_t *dev) {
+    return !dev->held && buffer_available(&dev->rbuf) > 0;
+}
+
+
 iodev_t *
 iodev_init(iodev_t *dev, iodev_cfg_t *cfg, size_t bufsize) {
+    return iodev_init_elastic(dev, cfg, bufsize, 0);
+}
+
+
+// Buffers start at bufsize, or if bufmax is larger, start empty and
+// grow on demand up to bufmax
+iodev_t *
+iodev_init_elastic(iodev_t *dev, iodev_cfg_t *cfg, size_t bufsize, size_t bufmax) {
     if (dev == NULL) {
         dev = calloc(1, sizeof(iodev_t));
         dev->alloc = IODEV_ALLOC;
@@ -280,8 +378,14 @@ iodev_init(iodev_t *dev, iodev_cfg_t *cfg, size_t bufsize) {
     dev->selector = NULL;
     dev->state = IODEV_NONE;
     dev->bufsize = bufsize;
-    buffer_init(&dev->rbuf, bufsize);
-    buffer_init(&dev->tbuf, bufsize);
+    dev->bufmax = bufmax;
+    if (bufsize && bufmax > bufsize) {
+        buffer_init_elastic(&dev->rbuf, bufsize, bufmax);
+        buffer_init_elastic(&dev->tbuf, bufsize, bufmax);
+    } else {
+        buffer_init(&dev->rbuf, bufsize);
+        buffer_init(&dev->tbuf, bufsize);
+    }
     // default i/o functions
     dev->open = iodev_open;
     dev->close = iodev_close;
@@ -294,6 +398,7 @@ iodev_init(iodev_t *dev, iodev_cfg_t *cfg, size_t bufsize) {
     dev->read = iodev_read;
     dev->write = iodev_write;
     dev->sendOk = iodev_sendok;
+    dev->recvOk = iodev_recvok;
     return dev;
 }
 
@@ -303,8 +408,10 @@ iodev_free(iodev_t *dev) {
     if (dev != NULL) {
         buffer_free(&dev->rbuf);
         buffer_free(&dev->tbuf);
+        segbuf_free(dev->tseg);
         iodev_free_cfg(dev->cfg);
         stringstore_free(dev->linebuf);
+        session_free(dev->session);
         if (dev->alloc == IODEV_ALLOC) {
             dev->alloc = 0;
             free(dev);
@@ -312,3 +419,12 @@ iodev_free(iodev_t *dev) {
     }
 }
 
+
+// Release buffer memory of an idle device, returns the number of bytes released
+size_t
+iodev_trim(iodev_t *dev) {
+    size_t released = buffer_trim(&dev->rbuf) + buffer_trim(&dev->tbuf);
+    if (dev->linebuf != NULL)
+        released += stringstore_trim(dev->linebuf);
+    return released;
+}
@@ -0,0 +1,66 @@
+//
+// hdmi2usblog: render binary logs (hdmi2usbd --binlog) and flight recorder
+// dumps (hdmi2usbd --recorder) as text
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "logging.h"
+#include "recorder.h"
+
+// Input is tried as each format in turn, so it must be seekable (pipes
+// are copied to a temporary file first)
+
+static FILE *
+seekable(FILE *in) {
+    if (fseek(in, 0L, SEEK_SET) == 0)
+        return in;
+    FILE *tmp = tmpfile();
+    if (tmp != NULL) {
+        char buf[8192];
+        for (size_t length; (length = fread(buf, 1, sizeof(buf), in)) > 0; )
+            fwrite(buf, 1, length, tmp);
+        rewind(tmp);
+    }
+    return tmp;
+}
+
+static int
+decode(char const *name, FILE *in) {
+    FILE *src = seekable(in);
+    long count = src != NULL ? log_decode(src, stdout) : -1;
+    if (count < 0 && src != NULL) {
+        rewind(src);
+        count = recorder_decode(src, stdout);
+    }
+    if (src != NULL && src != in)
+        fclose(src);
+    if (count < 0) {
+        fprintf(stderr, "%s: not a binary log or recorder dump\n", name);
+        return 1;
+    }
+    return 0;
+}
+
+int
+main(int argc, char **argv) {
+    int rc = 0;
+    if (argc > 1 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0)) {
+        fprintf(stderr, "usage: %s [ logfile|dumpfile ... ]\n (reads stdin if no files are given)\n", argv[0]);
+        return 0;
+    }
+    if (argc < 2)
+        rc = decode("<stdin>", stdin);
+    for (int index = 1; index < argc; index++) {
+        FILE *in = fopen(argv[index], "rb");
+        if (in == NULL) {
+            fprintf(stderr, "%s: %s\n", argv[index], strerror(errno));
+            rc = 1;
+        } else {
+            rc |= decode(argv[index], in);
+            fclose(in);
+        }
+    }
+    return rc;
+}
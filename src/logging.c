@@ -3,13 +3,24 @@
 //
 
 #include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
 #include <sys/time.h>
 #include <unistd.h>
+#include <strings.h>
 #include "logging.h"
 
+// the functions themselves, not the level checking macros
+#undef log_critical
+#undef log_error
+#undef log_warning
+#undef log_info
+#undef log_debug
+#undef log_trace
+
 static struct {
     // configuration data
     enum Verbosity verbosity;   // Logging verbosity
@@ -21,6 +32,7 @@ static struct {
     int log_counter;
     char *logname;              // Current logfile name
     FILE *logfp;                // Current logfile FILE*
+    unsigned generation;        // binary log: incremented for each file opened
 } logData = {
     V_DEFAULT,
     LOG_ECHO,
@@ -34,6 +46,16 @@ static struct {
 };
 
 
+unsigned char log_levels[LOG_MODULES] = { V_DEFAULT, V_DEFAULT, V_DEFAULT, V_DEFAULT, V_DEFAULT };
+
+static char const *modules[LOG_MODULES] = {
+    "app",
+    "selector",
+    "serial",
+    "tcp",
+    "udp",
+};
+
 static char const *levels[] = {
     "NONE",             // 0 (use default)
     "FATAL",            // 1
@@ -64,21 +86,90 @@ log_init(int flags, enum Verbosity verbosity, char const *logpath) {
         logData.flags |= LOG_ECHO;
     if (logData.verbosity == V_NONE)
         logData.verbosity = V_DEFAULT;
+    for (int module = 0; module < LOG_MODULES; module++)
+        log_levels[module] = (unsigned char)logData.verbosity;
+}
+
+
+char const *
+log_module_name(enum LogModule module) {
+    return module < LOG_MODULES ? modules[module] : NULL;
+}
+
+// The overall verbosity is that of the most verbose module
+
+void
+log_setlevel(enum LogModule module, enum Verbosity verbosity) {
+    if (module < LOG_MODULES) {
+        log_levels[module] = (unsigned char)(verbosity > V_MAX ? V_MAX : verbosity);
+        logData.verbosity = V_NONE;
+        for (int index = 0; index < LOG_MODULES; index++)
+            if (log_levels[index] > logData.verbosity)
+                logData.verbosity = (enum Verbosity)log_levels[index];
+    }
+}
+
+// Parse "module=level[,module=level...]" into levels, where the level is
+// a number or name, and module "all" sets every module
+
+static int
+log_parselevels(char const *spec, unsigned char *parsed) {
+    int rc = 0;
+    for (char const *p = spec; rc == 0 && p != NULL && *p != '\0'; ) {
+        size_t namelen = strcspn(p, "=,");
+        char const *value = p + namelen + 1;
+        size_t valuelen = p[namelen] == '=' ? strcspn(value, ",") : 0;
+        int level = -1;
+        if (valuelen == 1 && *value >= '0' && *value <= '0' + V_MAX)
+            level = *value - '0';
+        for (int index = 0; valuelen && level < 0 && index <= V_MAX; index++)
+            if (strlen(levels[index]) == valuelen && strncasecmp(levels[index], value, valuelen) == 0)
+                level = index;
+        rc = -1;
+        for (int module = 0; level > V_NONE && module < LOG_MODULES; module++) {
+            if ((namelen == 3 && strncmp(p, "all", 3) == 0) ||
+                    (strlen(modules[module]) == namelen && strncmp(modules[module], p, namelen) == 0)) {
+                parsed[module] = (unsigned char)level;
+                rc = 0;
+            }
+        }
+        if (rc == 0)
+            p = value + valuelen + (value[valuelen] == ',');
+    }
+    return rc;
+}
+
+int
+log_checklevels(char const *spec) {
+    unsigned char parsed[LOG_MODULES];
+    return log_parselevels(spec, parsed);
+}
+
+// Levels are left unchanged if the spec is invalid
+
+int
+log_setlevels(char const *spec) {
+    unsigned char parsed[LOG_MODULES];
+    memcpy(parsed, log_levels, sizeof(parsed));
+    int rc = log_parselevels(spec, parsed);
+    for (int module = 0; rc == 0 && module < LOG_MODULES; module++)
+        log_setlevel((enum LogModule)module, (enum Verbosity)parsed[module]);
+    return rc;
 }
 
 
 static size_t
-datetime_fmt(char *dest, size_t size, char const *fmtstr) {
+datetime_fmt_tv(char *dest, size_t size, char const *fmtstr, struct timeval tv, int utc) {
     char fmt[256];
-    struct timeval tv;
+    struct timeval now;
     struct timezone tz;
 
-    if (gettimeofday(&tv, &tz) != 0)
+    if (gettimeofday(&now, &tz) != 0)
         return (size_t)-1; // should log this but most likely will get recusion hell!
     int sign ='+';
     int hours =0, mins =0;
     struct tm *current_time;
-    if (logData.flags & LOG_UTC)
+    if (utc)
         current_time = gmtime(&tv.tv_sec);
     else {
         current_time = localtime(&tv.tv_sec);
@@ -90,6 +181,454 @@ datetime_fmt(char *dest, size_t size, char const *fmtstr) {
     return (size_t)strftime(dest, size, fmt, current_time);
 }
 
+static size_t
+datetime_fmt(char *dest, size_t size, char const *fmtstr) {
+    struct timeval tv;
+    if (gettimeofday(&tv, NULL) != 0)
+        return (size_t)-1;
+    return datetime_fmt_tv(dest, size, fmtstr, tv, logData.flags & LOG_UTC);
+}
+
+
+//// binary log ////
+
+// Format conversion specifications, shared by the writer (which needs the
+// argument types) and the decoder (which renders them)
+
+enum logArg {
+    ARG_INT,        // int (and char, short)
+    ARG_LONG,
+    ARG_LLONG,
+    ARG_SIZE,
+    ARG_INTMAX,
+    ARG_PTRDIFF,
+    ARG_DOUBLE,
+    ARG_LDOUBLE,
+    ARG_STRING,
+    ARG_PTR,
+};
+
+#define PREC_NONE   -1
+#define PREC_ARG    -2      // width or precision is given by an argument
+
+typedef struct {
+    char const *start;      // the '%'
+    int width;              // digits or PREC_ARG (PREC_NONE if absent)
+    int precision;
+    int arg;                // enum logArg (-1 for "%%")
+    char conv;
+} logspec_t;
+
+// a width or precision, INT_MAX if it is larger
+static int
+log_spec_number(char const **p) {
+    long value = strtol(*p, (char **)p, 10);
+    return value < 0 ? 0 : value > INT_MAX ? INT_MAX : (int)value;
+}
+
+static char const *
+log_spec(char const *p, logspec_t *spec) {
+    spec->start = p++;
+    spec->width = spec->precision = PREC_NONE;
+    p += strspn(p, "-+ #0'");
+    if (*p == '*')
+        spec->width = PREC_ARG, ++p;
+    else if (*p >= '0' && *p <= '9')
+        spec->width = log_spec_number(&p);
+    if (*p == '.') {
+        if (*++p == '*')
+            spec->precision = PREC_ARG, ++p;
+        else
+            spec->precision = log_spec_number(&p);
+    }
+    int arg = ARG_INT;
+    switch (*p) {
+        case 'h':
+            p += p[1] == 'h' ? 2 : 1;
+            break;
+        case 'l':
+            arg = p[1] == 'l' ? (++p, ARG_LLONG) : ARG_LONG;
+            ++p;
+            break;
+        case 'q':
+            arg = ARG_LLONG, ++p;
+            break;
+        case 'z':
+            arg = ARG_SIZE, ++p;
+            break;
+        case 'j':
+            arg = ARG_INTMAX, ++p;
+            break;
+        case 't':
+            arg = ARG_PTRDIFF, ++p;
+            break;
+        case 'L':
+            arg = ARG_LDOUBLE, ++p;
+            break;
+        default:
+            break;
+    }
+    spec->conv = *p;
+    switch (*p) {
+        case '%':
+            spec->arg = -1;
+            break;
+        case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+            spec->arg = arg == ARG_LDOUBLE ? ARG_INT : arg;
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            spec->arg = arg == ARG_LDOUBLE ? ARG_LDOUBLE : ARG_DOUBLE;
+            break;
+        case 's':
+            spec->arg = ARG_STRING;
+            break;
+        case 'p':
+            spec->arg = ARG_PTR;
+            break;
+        default:    // %n, wide characters etc. are not supported
+            return NULL;
+    }
+    return p + 1;
+}
+
+
+#define BLOG_MAGIC      "H2ULOG\x01\n"
+#define BLOG_FORMATS    1024        // distinct formats (power of 2)
+#define BLOG_MAXARGS    16
+#define BLOG_MAXRECORD  4096
+#define BLOG_FLUSH      1000000     // flush buffered records at least every second (us)
+
+enum {
+    BLOG_FORMAT = 'F',      // id, length, format text
+    BLOG_MESSAGE = 'M',     // level, id, length, timestamp (us), arguments
+};
+
+typedef struct {
+    char const *fmt;        // NULL = free slot
+    unsigned short id;
+    unsigned short nspecs;
+    unsigned generation;    // last file it was written to
+    logspec_t specs[BLOG_MAXARGS];
+} logformat_t;
+
+static logformat_t blog_formats[BLOG_FORMATS];
+static unsigned short blog_nformats;
+static int64_t blog_flushed;        // when buffered records were last flushed
+
+// Parse a format into its conversions, returns the number of conversions
+// or -1 if it cannot be recorded in binary
+
+static int
+blog_parse(char const *fmt, logspec_t *specs, int max) {
+    int count = 0;
+    for (char const *p = fmt; (p = strchr(p, '%')) != NULL; ) {
+        if (count == max || (p = log_spec(p, &specs[count])) == NULL)
+            return -1;
+        if (specs[count].arg >= 0)
+            ++count;
+    }
+    return count;
+}
+
+// Find or add a format, by address
+
+static logformat_t *
+blog_format(char const *fmt) {
+    size_t slot = ((uintptr_t)fmt >> 2) * 2654435761u % BLOG_FORMATS;
+    while (blog_formats[slot].fmt != NULL) {
+        if (blog_formats[slot].fmt == fmt)
+            return &blog_formats[slot];
+        slot = (slot + 1) % BLOG_FORMATS;
+    }
+    if (blog_nformats >= BLOG_FORMATS / 2)
+        return NULL;    // table is too full
+    logformat_t *lf = &blog_formats[slot];
+    int count = blog_parse(fmt, lf->specs, BLOG_MAXARGS);
+    if (count < 0)
+        return NULL;
+    lf->fmt = fmt;
+    lf->id = ++blog_nformats;   // 0 is the pre-formatted message
+    lf->nspecs = (unsigned short)count;
+    lf->generation = 0;
+    return lf;
+}
+
+static void
+blog_open(FILE *fp) {
+    fseek(fp, 0, SEEK_END);
+    if (ftell(fp) == 0) {
+        uint32_t flags = (uint32_t)(logData.flags & LOG_UTC);
+        fwrite(BLOG_MAGIC, 1, sizeof(BLOG_MAGIC) - 1, fp);
+        fwrite(&flags, sizeof(flags), 1, fp);
+    }
+    logData.generation++;   // formats are written again to each file
+}
+
+static void
+blog_put16(unsigned char *p, unsigned value) {
+    uint16_t v = (uint16_t)value;
+    memcpy(p, &v, sizeof(v));
+}
+
+// Encode arguments, integers as 64 bits, strings as length and content
+
+static size_t
+blog_encode(logformat_t *lf, unsigned char *data, size_t size, va_list args) {
+    unsigned char *p = data, *end = data + size;
+    int64_t last = 0;   // most recent '*' argument
+    for (int index = 0; index < lf->nspecs; index++) {
+        logspec_t *spec = &lf->specs[index];
+        for (int star = (spec->width == PREC_ARG) + (spec->precision == PREC_ARG); star > 0; star--) {
+            last = va_arg(args, int);
+            if (p + sizeof(last) <= end)
+                memcpy(p, &last, sizeof(last)), p += sizeof(last);
+        }
+        int64_t value = 0;
+        double dvalue;
+        switch (spec->arg) {
+            case ARG_INT:       value = va_arg(args, int); break;
+            case ARG_LONG:      value = va_arg(args, long); break;
+            case ARG_LLONG:     value = va_arg(args, long long); break;
+            case ARG_SIZE:      value = (int64_t)va_arg(args, size_t); break;
+            case ARG_INTMAX:    value = va_arg(args, intmax_t); break;
+            case ARG_PTRDIFF:   value = va_arg(args, ptrdiff_t); break;
+            case ARG_PTR:       value = (int64_t)(uintptr_t)va_arg(args, void *); break;
+            case ARG_DOUBLE:
+            case ARG_LDOUBLE:
+                dvalue = spec->arg == ARG_DOUBLE ? va_arg(args, double) : (double)va_arg(args, long double);
+                if (p + sizeof(dvalue) <= end)
+                    memcpy(p, &dvalue, sizeof(dvalue)), p += sizeof(dvalue);
+                continue;
+            case ARG_STRING: {
+                char const *str = va_arg(args, char const *);
+                size_t length = 0;
+                if (str == NULL)
+                    str = "(null)";
+                int precision = spec->precision == PREC_ARG ? (last < 0 ? -1 : (int)last) : spec->precision;
+                length = precision >= 0 ? strnlen(str, (size_t)precision) : strlen(str);
+                if (p + 2 > end)
+                    continue;
+                if (length > (size_t)(end - p - 2))
+                    length = (size_t)(end - p - 2);
+                blog_put16(p, (unsigned)length);
+                memcpy(p + 2, str, length);
+                p += 2 + length;
+                continue;
+            }
+            default:
+                continue;
+        }
+        if (p + sizeof(value) <= end)
+            memcpy(p, &value, sizeof(value)), p += sizeof(value);
+    }
+    return (size_t)(p - data);
+}
+
+static int
+blog_log(enum Verbosity verbosity, char const *fmt, va_list args) {
+    unsigned char record[BLOG_MAXRECORD];
+    size_t const hdrsize = 1 + 1 + 2 + 2 + 8;
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    int64_t timestamp = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+    logformat_t *lf = blog_format(fmt);
+    size_t length;
+    if (lf == NULL) {   // not recordable, pre-format it
+        int n = vsnprintf((char *)record + hdrsize + 2, sizeof(record) - hdrsize - 2, fmt, args);
+        length = n < 0 ? 0 : (size_t)n < sizeof(record) - hdrsize - 2 ? (size_t)n : sizeof(record) - hdrsize - 3;
+        blog_put16(record + hdrsize, (unsigned)length);
+        length += 2;
+    } else {
+        if (lf->generation != logData.generation) {
+            unsigned char hdr[5];
+            size_t fmtlen = strlen(fmt);
+            hdr[0] = BLOG_FORMAT;
+            blog_put16(hdr + 1, lf->id);
+            blog_put16(hdr + 3, (unsigned)fmtlen);
+            fwrite(hdr, 1, sizeof(hdr), logData.logfp);
+            fwrite(fmt, 1, fmtlen, logData.logfp);
+            lf->generation = logData.generation;
+        }
+        length = blog_encode(lf, record + hdrsize, sizeof(record) - hdrsize, args);
+    }
+    record[0] = BLOG_MESSAGE;
+    record[1] = (unsigned char)verbosity;
+    blog_put16(record + 2, lf != NULL ? lf->id : 0);
+    blog_put16(record + 4, (unsigned)length);
+    memcpy(record + 6, &timestamp, sizeof(timestamp));
+    int rc = (int)fwrite(record, 1, hdrsize + length, logData.logfp);
+    if (verbosity <= V_ERROR || timestamp - blog_flushed >= BLOG_FLUSH) {
+        fflush(logData.logfp);
+        blog_flushed = timestamp;
+    }
+    return rc;
+}
+
+
+// Decoder
+
+static unsigned
+blog_get16(unsigned char const *p) {
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Render a recorded message using its format
+
+// Append to a conversion being rebuilt at offset n (-1 if it has already
+// failed), returns the new length, or -1 if it does not fit. The format
+// comes from the log file, so nothing about its length can be assumed
+
+static int
+blog_cvt(char *cvt, size_t size, int n, char const *fmt, ...) {
+    if (n < 0 || (size_t)n >= size)
+        return -1;
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(cvt + n, size - (size_t)n, fmt, args);
+    va_end(args);
+    return len < 0 || (size_t)len >= size - (size_t)n ? -1 : n + len;
+}
+
+static void
+blog_render(FILE *out, char const *fmt, unsigned char const *data, size_t length) {
+    unsigned char const *p = data, *end = data + length;
+    for (char const *next = fmt; *next != '\0'; ) {
+        char const *pct = strchr(next, '%');
+        if (pct == NULL) {
+            fputs(next, out);
+            break;
+        }
+        fwrite(next, 1, (size_t)(pct - next), out);
+        logspec_t spec;
+        if ((next = log_spec(pct, &spec)) == NULL)
+            break;
+        if (spec.arg < 0) {
+            fputc('%', out);
+            continue;
+        }
+        int64_t stars[2] = { 0, 0 };
+        for (int star = 0; star < (spec.width == PREC_ARG) + (spec.precision == PREC_ARG); star++)
+            if (p + sizeof(int64_t) <= end)
+                memcpy(&stars[star], p, sizeof(int64_t)), p += sizeof(int64_t);
+        // rebuild the conversion with any '*' values filled in and
+        // length modifiers replaced by those of the recorded types
+        char cvt[64];
+        int n = blog_cvt(cvt, sizeof(cvt), 0, "%%%.*s", (int)strspn(spec.start + 1, "-+ #0'"), spec.start + 1);
+        int star = 0;
+        int64_t width = spec.width == PREC_ARG ? stars[star++] : spec.width;
+        int64_t precision = spec.precision == PREC_ARG ? stars[star] : spec.precision;
+        if (width > BLOG_MAXRECORD || width < -BLOG_MAXRECORD || precision > BLOG_MAXRECORD)
+            n = -1;     // padding beyond any record written
+        else if (spec.width != PREC_NONE)
+            n = blog_cvt(cvt, sizeof(cvt), n, "%d", (int)width);
+        if (spec.arg != ARG_STRING && precision >= 0)
+            n = blog_cvt(cvt, sizeof(cvt), n, ".%d", (int)precision);
+        if (spec.arg == ARG_STRING)
+            n = blog_cvt(cvt, sizeof(cvt), n, ".*s");
+        else if (spec.arg == ARG_DOUBLE || spec.arg == ARG_LDOUBLE)
+            n = blog_cvt(cvt, sizeof(cvt), n, "%c", spec.conv);
+        else if (spec.arg == ARG_PTR)
+            n = blog_cvt(cvt, sizeof(cvt), n, "p");
+        else if (spec.conv == 'c')
+            n = blog_cvt(cvt, sizeof(cvt), n, "c");
+        else
+            n = blog_cvt(cvt, sizeof(cvt), n, "ll%c", spec.conv);
+        if (n < 0) {
+            // not from our writer, the rest of the record is not rendered
+            fputs("<invalid conversion>", out);
+            break;
+        }
+        if (spec.arg == ARG_STRING) {
+            size_t slen = p + 2 <= end ? blog_get16(p) : 0;
+            char const *str = (char const *)p + 2;
+            if (p + 2 + slen > end)
+                slen = 0, str = "";
+            p += 2 + slen;
+            fprintf(out, cvt, (int)slen, str);
+        } else if (spec.arg == ARG_DOUBLE || spec.arg == ARG_LDOUBLE) {
+            double dvalue = 0;
+            if (p + sizeof(dvalue) <= end)
+                memcpy(&dvalue, p, sizeof(dvalue)), p += sizeof(dvalue);
+            fprintf(out, cvt, dvalue);
+        } else {
+            int64_t value = 0;
+            if (p + sizeof(value) <= end)
+                memcpy(&value, p, sizeof(value)), p += sizeof(value);
+            if (spec.arg == ARG_PTR)
+                fprintf(out, cvt, (void *)(uintptr_t)value);
+            else if (spec.conv == 'c')
+                fprintf(out, cvt, (int)value);
+            else
+                fprintf(out, cvt, (long long)value);
+        }
+    }
+}
+
+long
+log_decode(FILE *in, FILE *out) {
+    char magic[sizeof(BLOG_MAGIC) - 1];
+    uint32_t flags;
+    if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) || memcmp(magic, BLOG_MAGIC, sizeof(magic)) != 0 ||
+            fread(&flags, sizeof(flags), 1, in) != 1)
+        return -1;
+    // indexed by 16 bit id and length, too large for the stack
+    size_t nformats = 65536;
+    char **formats = calloc(nformats, sizeof(char *));
+    unsigned char hdr[14], *data = malloc(65536);
+    if (formats == NULL || data == NULL) {
+        free(formats);
+        free(data);
+        return -1;
+    }
+    long count = 0;
+    for (int type; (type = fgetc(in)) != EOF; ) {
+        if (type == BLOG_FORMAT) {
+            if (fread(hdr, 1, 4, in) != 4)
+                break;
+            unsigned id = blog_get16(hdr), length = blog_get16(hdr + 2);
+            char *fmt = malloc(length + 1);
+            if (fmt == NULL || fread(fmt, 1, length, in) != length) {
+                free(fmt);
+                break;
+            }
+            fmt[length] = '\0';
+            free(formats[id]);
+            formats[id] = fmt;
+        } else if (type == BLOG_MAGIC[0]) {     // another writer started on the file
+            if (fread(magic + 1, 1, sizeof(magic) - 1, in) != sizeof(magic) - 1 || fread(&flags, sizeof(flags), 1, in) != 1)
+                break;
+        } else if (type == BLOG_MESSAGE) {
+            if (fread(hdr + 1, 1, 13, in) != 13)
+                break;
+            unsigned level = hdr[1], id = blog_get16(hdr + 2), length = blog_get16(hdr + 4);
+            int64_t timestamp;
+            memcpy(&timestamp, hdr + 6, sizeof(timestamp));
+            if (fread(data, 1, length, in) != length)
+                break;
+            char logdate[256];
+            struct timeval tv = { .tv_sec = (time_t)(timestamp / 1000000), .tv_usec = (suseconds_t)(timestamp % 1000000) };
+            datetime_fmt_tv(logdate, sizeof(logdate) - 1, logData.datefmt, tv, flags & LOG_UTC);
+            fprintf(out, "%s %s ", logdate, levels[level <= V_TRACE ? level : V_TRACE]);
+            if (id == 0 && length >= 2)
+                fwrite(data + 2, 1, blog_get16(data) <= length - 2 ? blog_get16(data) : length - 2, out);
+            else if (formats[id] != NULL)
+                blog_render(out, formats[id], data, length);
+            else
+                fprintf(out, "<unknown format %u>", id);
+            fputc('\n', out);
+            count++;
+        } else
+            break;  // corrupt (or truncated) log
+    }
+    for (size_t id = 0; id < nformats; id++)
+        free(formats[id]);
+    free(formats);
+    free(data);
+    return count;
+}
+
 
 static char *
 log_newName() {
@@ -115,6 +654,8 @@ log_rotate() {
         // emergency mode, just go into echo to stdout or stderr
         if (logData.logfp == NULL && !(logData.flags & LOG_NOECHO))
             logData.flags |= LOG_ECHO;
+        else if (logData.logfp != NULL && logData.flags & LOG_BINARY)
+            blog_open(logData.logfp);
     }
 }
 
@@ -126,20 +667,34 @@ log_log(enum Verbosity verbosity, char const *fmt, va_list args) {
     if (verbosity <= logData.verbosity) {
         if (verbosity > V_TRACE) // Prevent potential bounds errors
             verbosity = V_TRACE;
+        if (logData.logfp == NULL && logData.flags & LOG_FILE)
+            log_rotate();
+        int binary = logData.logfp != NULL && logData.flags & LOG_BINARY;
+        if (binary) {
+            // formatting (and the timestamp) is left to the decoder
+            va_list args_2;
+            va_copy(args_2, args);
+            int written = blog_log(verbosity, fmt, args_2);
+            va_end(args_2);
+            if (logData.flags & LOG_SYNC) {
+                fflush(logData.logfp);
+                fsync(fileno(logData.logfp));
+            }
+            if (!(logData.flags & LOG_ECHO))
+                return written;
+        }
         char logdate[256];
         if (datetime_fmt(logdate, sizeof(logdate) - 1, logData.datefmt) == (size_t) -1) {
             fprintf(stderr, "FATAL: invalid date format '%s'\n", logData.datefmt);
             exit(2);
         }
-        if (logData.logfp == NULL && logData.flags & LOG_FILE)
-            log_rotate();
         char fmtstr[strlen(logdate) + strlen(fmt) + 128];
         snprintf(fmtstr, sizeof(fmtstr), logData.logfmt, logdate, levels[verbosity], fmt);
         if (rc >= sizeof(fmtstr)) {
             fprintf(stderr, "FATAL: invalid log format '%s'\n", logData.logfmt);
             exit(2);
         }
-        if (logData.logfp != NULL) {
+        if (logData.logfp != NULL && !binary) {
             va_list args_2 = {{0}};
             va_copy(args_2, args);
             rc = vfprintf(logData.logfp, fmtstr, args_2);
@@ -7,6 +7,8 @@
 // Very little application specific code to see here, move on...
 
 #include <stdio.h>
+#include <ctype.h>
+#include <errno.h>
 #include <getopt.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,23 +17,43 @@
 #include "hdmi2usbd.h"
 #include "logging.h"
 #include "serial.h"
+#include "netudp.h"
 
 
 // short options
-const char shortopts[] = "p:s:l:b:L:c:equF46vV::d::Dh";
+const char shortopts[] = "f:p:s:l:k:C:A:O:i:m:T:U:X:w:I:b:B:L:M:R:P:W:c:aequFG46vV::d::Dh";
 // long options
 const struct option longopts[] = {
 //  { char*name, int has_arg, int *flag, int val }
+    { "config",     required_argument,  NULL,           'f' },
     { "port",       required_argument,  NULL,           'p' },
     { "speed",      required_argument,  NULL,           's' },
     { "bufsize",    required_argument,  NULL,           'b' },
+    { "bufmax",     required_argument,  NULL,           'B' },
     { "listen",     required_argument,  NULL,           'l' },
+    { "backlog",    required_argument,  NULL,           'k' },
+    { "maxconn",    required_argument,  NULL,           'C' },
+    { "maxperaddr", required_argument,  NULL,           'A' },
+    { "sockopts",   required_argument,  NULL,           'O' },
+    { "input",      required_argument,  NULL,           'i' },
+    { "multicast",  required_argument,  NULL,           'm' },
+    { "mcastttl",   required_argument,  NULL,           'T' },
+    { "upstream",   required_argument,  NULL,           'U' },
+    { "admin",      required_argument,  NULL,           'X' },
+    { "websocket",  required_argument,  NULL,           'w' },
+    { "inherit",    required_argument,  NULL,           'I' },
     { "log",        required_argument,  NULL,           'L' },
+    { "loglevels",  required_argument,  NULL,           'M' },
+    { "recorder",   required_argument,  NULL,           'R' },
     { "ctime",      required_argument,  NULL,           'c' },
+    { "profile",    required_argument,  NULL,           'P' },
+    { "watchdog",   required_argument,  NULL,           'W' },
+    { "adaptive",   no_argument,        NULL,           'a' },
     { "echo",       no_argument,        NULL,           'e' },
     { "quiet",      no_argument,        NULL,           'q' },
     { "utc",        no_argument,        NULL,           'u' },
     { "fsync",      no_argument,        NULL,           'F' },
+    { "binlog",     no_argument,        NULL,           'G' },
     { "inet4",      no_argument,        NULL,           '4' },
     { "inet6",      no_argument,        NULL,           '6' },
     { "daemon",     no_argument,        NULL,           'D' },
@@ -43,16 +65,35 @@ const struct option longopts[] = {
 // options text (for help)
 const char *helpopts[][3] = {
 //  { char*default, char*arg_help, char*description }
+    { NULL,             "FILENAME",                 "read options from FILENAME (re-read on SIGHUP)" },
     { "auto",           "auto|device [device...]",  "set serial port names (may contain wildcards)" },
     { "115200",         "baudrate",                 "set baud rate" },
     { "2048",           "buffer_size",              "set default iobuffer size" },
+    { "65536",          "buffer_size",              "set maximum client connection buffer size" },
     { "localhost:8501", "[ip/hostname]:portnum",    "set listen address"},
+    { "128",            "count",                    "set listen queue size" },
+    { "0",              "count",                    "limit connections per listen address (0=unlimited)" },
+    { "0",              "count",                    "limit connections per client address (0=unlimited)" },
+    { "streaming",      "profile[,key=value...]",   "client socket options (interactive|streaming|bulk, nodelay= coalesce= lowat= sndbuf= rcvbuf=)" },
+    { "rate=0,burst=4096,line=1024,queue=64", "key=value[,...]", "client input limits (bytes/s, bytes, line length, queued commands, 0=unlimited)" },
+    { NULL,             "group:portnum",            "publish serial output to udp multicast group" },
+    { "1",              "hops",                     "multicast ttl/hop limit (1=local subnet only)" },
+    { NULL,             "[ip/hostname]:portnum",    "relay an upstream hdmi2usbd instead of a serial device" },
+    { "localhost:0",    "[ip/hostname]:portnum",    "admin control port, for inspection and live tuning (0=off)" },
+    { "localhost:0",    "[ip/hostname]:portnum",    "WebSocket port for browser clients (0=off)" },
+    { NULL,             "fd",                       "take over devices from an upgrading instance (internal)" },
     { NULL,             "FILENAME",                 "log to FILENAME (may contain strftime(3) strings)" },
-    { "2000",           "TIMEOUT (ms)",             "minimum wait time between sending commands" },
+    { NULL,             "module=level[,...]",       "set log levels per module (app|selector|serial|tcp|udp|all)" },
+    { "/tmp/hdmi2usbd-<pid>.rec", "FILENAME",       "dump recent events to FILENAME on SIGUSR1 (read with hdmi2usblog)" },
+    { "500",            "TIMEOUT (ms)",             "minimum wait time between sending commands" },
+    { "0",              "INTERVAL (s)",             "log event loop timings every INTERVAL (0=off, see also @stats)" },
+    { "1000",           "TIMEOUT (ms)",             "report event loop stalls longer than TIMEOUT (0=off)" },
+    { NULL,             NULL,                       "send next command as soon as the device prompts" },
     { NULL,             NULL,                       "echo log to stdout (twice for stderr)" },
     { NULL,             NULL,                       "don't echo log" },
     { NULL,             NULL,                       "log dates as UTC"},
     { NULL,             NULL,                       "force sync after each log write" },
+    { NULL,             NULL,                       "write the log file in binary (read with hdmi2usblog)" },
     { NULL,             NULL,                       "listen on only ipv4 address(es)" },
     { NULL,             NULL,                       "listen on only ipv6 address(es)" },
     { NULL,             NULL,                       "detach and fork into background" },
@@ -103,178 +144,426 @@ parse_port(char *at, int *rc) {
     return result;
 }
 
+// parse an [ip/hostname]:portnum argument
+// address and port are only replaced if present in the argument
+
 int
-parse_args(int argc, char * const *argv, struct hdmi2usb_opts *opts) {
-    int rc =EX_SUCCESS, r =0;
-    int longindex = 0;
+parse_address(char const *str, char const **paddr, unsigned short *pport) {
+    int rc = 0;
+    char *at;
+    if (str == NULL) {
+        fprintf(stderr, "missing address argument");
+        rc = 2;
+    } else if (*str == '[') {  // [address]:port syntax
+        at = strchr(str, ']');
+        if (at != NULL) {
+            size_t i = at - str - 1;
+            ++at;
+            if (i > 0) {
+                char addr[i + 1];
+                strncpy(addr, str + 1, i);
+                addr[i] = '\0';
+                *paddr = strdup(addr);
+            }
+            *pport = parse_port(at, &rc);
+        } else {
+            fprintf(stderr, "invalid address '%s'", str);
+            rc = 2;
+        }
+    } else {
+        at = strchr(str, ':');
+        if (at == NULL)
+            at = (char *)str + strlen(str);
+        size_t i = at - str;
+        if (i > 0) {
+            char addr[i + 1];
+            strncpy(addr, str, i);
+            addr[i] = '\0';
+            *paddr = strdup(addr);
+        }
+        *pport = parse_port(at, &rc);
+    }
+    return rc;
+}
 
-    while (rc == 0 && (r = getopt_long(argc, argv, shortopts, longopts, &longindex)) != EOF) {
-        switch (r) {
-            case 'h':
-                exit(usage(stdout, 0));
-                // notreached
-            case 'v':
-                printf("%s version %s\n", HDMI2USBD_NAME, HDMI2USBD_VERSION);
-                exit(EX_SUCCESS);
-                // notreached
-            case 'V':
-            case 'd':
-                if (optarg == NULL)
-                    opts->verbose++;
-                else {
-                    char *endptr = optarg;
-                    opts->verbose = (int)strtol(optarg, &endptr, 10) & 7;
-                    if (endptr == NULL || *endptr != '\0') {
-                        fprintf(stderr, "invalid verbosity (0-7) '%s'\n", optarg);
-                        rc = usage(stderr, 2);
-                    }
+// parse client input limits, a comma separated list of key=value
+// settings, eg. "rate=1024,queue=16"
+
+static int
+parse_input_limits(char const *spec, struct hdmi2usb_opts *opts) {
+    while (spec != NULL && *spec != '\0') {
+        size_t length = strcspn(spec, ",");
+        char item[length + 1];
+        memcpy(item, spec, length);
+        item[length] = '\0';
+        spec += length;
+        if (*spec == ',')
+            ++spec;
+        if (length == 0)
+            continue;
+        char *value = strchr(item, '=');
+        if (value == NULL)
+            return -1;
+        *value++ = '\0';
+        char *endptr = value;
+        unsigned long number = strtoul(value, &endptr, 10);
+        if (*value == '\0' || *endptr != '\0' || number > 0x7fffffffUL)
+            return -1;
+        if (strcmp(item, "rate") == 0)
+            opts->input_rate = number;
+        else if (strcmp(item, "burst") == 0 && number > 0)
+            opts->input_burst = number;
+        else if (strcmp(item, "line") == 0)
+            opts->maxline = number;
+        else if (strcmp(item, "queue") == 0)
+            opts->maxqueue = number;
+        else
+            return -1;
+    }
+    return 0;
+}
+
+static int parse_config(char const *filename, struct hdmi2usb_opts *opts);
+
+// Apply a single option, from the command line or a config file
+
+static int
+parse_option(int r, char *optarg, struct hdmi2usb_opts *opts) {
+    int rc =EX_SUCCESS;
+
+    switch (r) {
+        case 'h':
+            exit(usage(stdout, 0));
+            // notreached
+        case 'v':
+            printf("%s version %s\n", HDMI2USBD_NAME, HDMI2USBD_VERSION);
+            exit(EX_SUCCESS);
+            // notreached
+        case 'f':
+            opts->config = optarg;
+            rc = parse_config(optarg, opts);
+            break;
+        case 'V':
+        case 'd':
+            if (optarg == NULL)
+                opts->verbose++;
+            else {
+                char *endptr = optarg;
+                opts->verbose = (int)strtol(optarg, &endptr, 10) & 7;
+                if (endptr == NULL || *endptr != '\0') {
+                    fprintf(stderr, "invalid verbosity (0-7) '%s'\n", optarg);
+                    rc = usage(stderr, 2);
                 }
+            }
+            break;
+        case 'c': {
+            char *endptr = optarg;
+            unsigned long cmdtime = strtoul(optarg, &endptr, 10);
+            if (endptr != NULL && *endptr == '\0') {
+                opts->command_time = cmdtime;
                 break;
-            case 'c': {
-                char *endptr = optarg;
-                unsigned long cmdtime = strtoul(optarg, &endptr, 10);
-                if (endptr != NULL && *endptr == '\0') {
-                    opts->command_time = cmdtime;
+            }
+            fprintf(stderr, "invalid or missing command time: '%s'\n", optarg);
+            rc = usage(stderr, EX_STARTUP);
+            break;
+        }
+        case 'P':
+        case 'W': {
+            char *endptr = optarg;
+            unsigned long interval = strtoul(optarg, &endptr, 10);
+            if (endptr != optarg && *endptr == '\0') {
+                if (r == 'P')
+                    opts->profile_time = interval;
+                else
+                    opts->stall_time = interval;
+                break;
+            }
+            fprintf(stderr, "invalid interval: '%s'\n", optarg);
+            rc = usage(stderr, EX_STARTUP);
+            break;
+        }
+        case '4':
+            opts->logflags ^= AF_INET;
+            break;
+        case '6':
+            opts->logflags ^= AF_INET6;
+            break;
+        case 'D':
+            opts->daemonize = 1;
+            break;
+        case 'a':
+            opts->adaptive = 1;
+            break;
+        case 's': {
+            char *endptr = optarg;
+            unsigned long baudrate = strtoul(optarg, &endptr, 10);
+            if (endptr != NULL && *endptr == '\0') {
+                opts->baudrate = speed_to_baud(baudrate);
+                if (opts->baudrate != BINVALID)
                     break;
-                }
-                fprintf(stderr, "invalid or missing command time: '%s'\n", optarg);
-                rc = usage(stderr, EX_STARTUP);
+            }
+            fprintf(stderr, "invalid speed '%s'\n", optarg);
+            rc = usage(stderr, EX_STARTUP);
+            break;
+        }
+        case 'b': {
+            char *endptr = optarg;
+            unsigned bufsize = (unsigned)strtoul(optarg, &endptr, 10);
+            if (endptr != NULL && *endptr == '\0') {
+                opts->iobufsize = bufsize;
                 break;
             }
-            case '4':
-                opts->logflags ^= AF_INET;
+            fprintf(stderr, "invalid buffsize '%s'\n", optarg);
+            rc = usage(stderr, EX_STARTUP);
+            break;
+        }
+        case 'B': {
+            char *endptr = optarg;
+            unsigned bufmax = (unsigned)strtoul(optarg, &endptr, 10);
+            if (endptr != NULL && *endptr == '\0') {
+                opts->iobufmax = bufmax;
                 break;
-            case '6':
-                opts->logflags ^= AF_INET6;
+            }
+            fprintf(stderr, "invalid bufmax '%s'\n", optarg);
+            rc = usage(stderr, EX_STARTUP);
+            break;
+        }
+        case 'k':
+        case 'C':
+        case 'A': {
+            char *endptr = optarg;
+            unsigned long count = strtoul(optarg, &endptr, 10);
+            if (endptr != NULL && *endptr == '\0' && count <= 65535) {
+                if (r == 'k')
+                    opts->backlog = (int)count;
+                else if (r == 'C')
+                    opts->maxconn = (unsigned)count;
+                else
+                    opts->maxperaddr = (unsigned)count;
                 break;
-            case 'D':
-                opts->daemonize = 1;
+            }
+            fprintf(stderr, "invalid count '%s'\n", optarg);
+            rc = usage(stderr, EX_STARTUP);
+            break;
+        }
+        case 'O':
+            if (tcp_profile_parse(&opts->sockopts, optarg) == 0)
                 break;
-            case 's': {
-                char *endptr = optarg;
-                unsigned long baudrate = strtoul(optarg, &endptr, 10);
-                if (endptr != NULL && *endptr == '\0') {
-                    opts->baudrate = speed_to_baud(baudrate);
-                    if (opts->baudrate != BINVALID)
-                        break;
-                }
-                fprintf(stderr, "invalid speed '%s'\n", optarg);
-                rc = usage(stderr, EX_STARTUP);
+            fprintf(stderr, "invalid socket options '%s'\n", optarg);
+            rc = usage(stderr, EX_STARTUP);
+            break;
+        case 'i':
+            if (parse_input_limits(optarg, opts) == 0)
+                break;
+            fprintf(stderr, "invalid input limits '%s'\n", optarg);
+            rc = usage(stderr, EX_STARTUP);
+            break;
+        case 'l':
+            if (parse_address(optarg, &opts->listen_addr, &opts->listen_port) == 0)
+                break;
+            rc = usage(stderr, EX_STARTUP);
+            break;
+        case 'm':
+            if (parse_address(optarg, &opts->mcast_addr, &opts->mcast_port) == 0)
+                break;
+            rc = usage(stderr, EX_STARTUP);
+            break;
+        case 'T': {
+            char *endptr = optarg;
+            unsigned long ttl = strtoul(optarg, &endptr, 10);
+            if (endptr != NULL && *endptr == '\0' && ttl >= 1 && ttl <= 255) {
+                opts->mcast_ttl = (int)ttl;
                 break;
             }
-            case 'b': {
-                char *endptr = optarg;
-                unsigned bufsize = (unsigned)strtoul(optarg, &endptr, 10);
-                if (endptr != NULL && *endptr == '\0') {
-                    opts->iobufsize = bufsize;
-                    break;
-                }
-                fprintf(stderr, "invalid buffsize '%s'\n", optarg);
-                rc = usage(stderr, EX_STARTUP);
+            fprintf(stderr, "invalid multicast ttl (1-255) '%s'\n", optarg);
+            rc = usage(stderr, EX_STARTUP);
+            break;
+        }
+        case 'U':
+            if (parse_address(optarg, &opts->upstream_addr, &opts->upstream_port) == 0 && opts->upstream_addr != NULL)
+                break;
+            rc = usage(stderr, EX_STARTUP);
+            break;
+        case 'X':
+            if (parse_address(optarg, &opts->admin_addr, &opts->admin_port) == 0)
+                break;
+            rc = usage(stderr, EX_STARTUP);
+            break;
+        case 'w':
+            if (parse_address(optarg, &opts->websocket_addr, &opts->websocket_port) == 0)
+                break;
+            rc = usage(stderr, EX_STARTUP);
+            break;
+        case 'I': {
+            char *endptr = optarg;
+            long fd = strtol(optarg, &endptr, 10);
+            if (endptr != optarg && *endptr == '\0' && fd > 2) {
+                opts->inherit_fd = (int)fd;
                 break;
             }
-            case 'l': {
-                char *at, *str = optarg;
-                if (str == NULL)
-                    fprintf(stderr, "-l missing argument");
-                else if (*str == '[') {  // [address]:port syntax
-                    at = strchr(str, ']');
-                    if (at != NULL) {
-                        size_t i = at - str - 1;
-                        ++at;
-                        if (i > 0) {
-                            char listen_addr[i + 1];
-                            strncpy(listen_addr, str + 1, i);
-                            listen_addr[i] = '\0';
-                            opts->listen_addr = strdup(listen_addr);
-                        }
-                        opts->listen_port = parse_port(at, &rc);
-                        if (!rc)
-                            break;
-                    } else
-                        fprintf(stderr, "invalid address '%s'", optarg);
-                } else {
-                    at = strchr(str, ':');
-                    if (at == NULL)
-                        at = str + strlen(str);
-                    size_t i = at - optarg;
-                    if (i > 0) {
-                        char listen_addr[i + 1];
-                        strncpy(listen_addr, optarg, i);
-                        listen_addr[i] = '\0';
-                        opts->listen_addr = strdup(listen_addr);
-                    }
-                    opts->listen_port = parse_port(at, &rc);
-                    if (!rc)
-                        break;
-                }
-                rc = usage(stderr, EX_STARTUP);
+            fprintf(stderr, "invalid descriptor '%s'\n", optarg);
+            rc = usage(stderr, EX_STARTUP);
+            break;
+        }
+        case 'p':   // a single port, or a list from a config file
+            opts->port = optarg;
+            break;
+        case 'L':
+            opts->logfile = optarg;
+            break;
+        case 'R':
+            opts->recorder = optarg;
+            break;
+        case 'M':
+            if (log_checklevels(optarg) == 0) {
+                opts->loglevels = optarg;
                 break;
             }
-            case 'p': {
-                const char *args[MAX_SERIAL_SPECS + 1];
-                int count = 0, index = optind - 1;
-                for (count =0; index < argc && index < MAX_SERIAL_SPECS; count++) {
-                    const char *next = argv[index++];
-                    if (next == NULL || *next == '-' || *next == '\0')
-                        break;
-                    args[count] = next;
-                }
-                optind = index - 1;
-                if (count > 0) {
-                    size_t length =0;
-                    for (int i =0; i < count; i++)
-                        length += strlen(args[i]) + 1;
-                    char *ports = malloc(length);
-                    *ports = '\0';
-                    for (int i =0; i < count; i++) {
-                        strcat(ports, args[i]);
-                        strcat(ports, "|");
-                    }
-                    opts->port = ports;
+            fprintf(stderr, "invalid log levels '%s'\n", optarg);
+            rc = usage(stderr, EX_STARTUP);
+            break;
+        case 'e':   // -> echo -> stderr -> off
+            if (opts->logflags & LOG_ECHO) {
+                if (!(opts->logflags & LOG_STDERR)) { // echo -> stderr
+                    opts->logflags |= LOG_STDERR;
                     break;
                 }
-                // fallthru
-            }
-            case 'L':
-                opts->logfile = optarg;
+                // fallthru: stderr -> off
+            } else { // quiet -> echo
+                opts->logflags |= LOG_ECHO;
+                opts->logflags &= ~(LOG_NOECHO | LOG_STDERR);
                 break;
-            case 'e':   // -> echo -> stderr -> off
-                if (opts->logflags & LOG_ECHO) {
-                    if (!(opts->logflags & LOG_STDERR)) { // echo -> stderr
-                        opts->logflags |= LOG_STDERR;
-                        break;
-                    }
-                    // fallthru: stderr -> off
-                } else { // quiet -> echo
-                    opts->logflags |= LOG_ECHO;
-                    opts->logflags &= ~(LOG_NOECHO | LOG_STDERR);
+            }
+            // fallthru
+        case 'q':
+            opts->logflags &= ~(LOG_ECHO|LOG_STDERR);
+            opts->logflags |= LOG_NOECHO;
+            break;
+        case'u':
+            opts->logflags |= LOG_UTC;
+            break;
+        case 'F':
+            opts->logflags |= LOG_SYNC;
+            break;
+        case 'G':
+            opts->logflags |= LOG_BINARY;
+            break;
+        default:
+            fprintf(stderr, "parameter -%c is not being handled", r);
+        case ':':
+        case '?':
+            rc = usage(stderr, EX_STARTUP);
+            break;
+    }
+    return rc;
+}
+
+int
+parse_args(int argc, char * const *argv, struct hdmi2usb_opts *opts) {
+    int rc =EX_SUCCESS, r =0;
+    int longindex = 0;
+
+    while (rc == 0 && (r = getopt_long(argc, argv, shortopts, longopts, &longindex)) != EOF) {
+        if (r == 'p') {
+            const char *args[MAX_SERIAL_SPECS + 1];
+            int count = 0, index = optind - 1;
+            for (count =0; index < argc && index < MAX_SERIAL_SPECS; count++) {
+                const char *next = argv[index++];
+                if (next == NULL || *next == '-' || *next == '\0')
                     break;
+                args[count] = next;
+            }
+            optind = index - 1;
+            if (count > 0) {
+                size_t length =0;
+                for (int i =0; i < count; i++)
+                    length += strlen(args[i]) + 1;
+                char *ports = malloc(length + 1);
+                *ports = '\0';
+                for (int i =0; i < count; i++) {
+                    strcat(ports, args[i]);
+                    strcat(ports, "|");
                 }
-                // fallthru
-            case 'q':
-                opts->logflags &= ~(LOG_ECHO|LOG_STDERR);
-                opts->logflags |= LOG_NOECHO;
-                break;
-            case'u':
-                opts->logflags |= LOG_UTC;
-                break;
-            case 'F':
-                opts->logflags |= LOG_SYNC;
-                break;
-            default:
-                fprintf(stderr, "parameter -%c is not being handled", r);
-            case ':':
-            case '?':
-                rc = usage(stderr, EX_STARTUP);
-                break;
+                opts->port = ports;
+                continue;
+            }
         }
+        rc = parse_option(r, optarg, opts);
     }
     if (opts->logflags & AF_INET6 && opts->logflags & AF_INET)
         opts->logflags &= ~(AF_INET|AF_INET6);
     return rc;
 }
 
+// Read options from a file, one per line as "name [=] value" using the
+// long option names, '#' starts a comment. Options given on the command
+// line after --config override those in the file.
+
+static int
+parse_config(char const *filename, struct hdmi2usb_opts *opts) {
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "unable to read config '%s': %s\n", filename, strerror(errno));
+        return EX_STARTUP;
+    }
+    char line[512];
+    int rc = EX_SUCCESS;
+    for (int lineno = 1; rc == EX_SUCCESS && fgets(line, sizeof(line), fp) != NULL; lineno++) {
+        char *name = line, *end = strchr(line, '#');
+        if (end == NULL)
+            end = line + strlen(line);
+        while (end > name && isspace((unsigned char)end[-1]))
+            --end;
+        *end = '\0';
+        while (isspace((unsigned char)*name))
+            ++name;
+        if (*name == '\0')
+            continue;
+        char *value = name + strcspn(name, " \t=");
+        if (*value != '\0') {
+            *value++ = '\0';
+            value += strspn(value, " \t=");
+        }
+        int index = 0, count = sizeof(longopts) / sizeof(struct option);
+        while (index < count && strcmp(longopts[index].name, name) != 0)
+            index++;
+        if (index == count || strchr("fhvI", longopts[index].val) != NULL) {
+            fprintf(stderr, "%s:%d: unknown option '%s'\n", filename, lineno, name);
+            rc = EX_STARTUP;
+        } else if (longopts[index].has_arg == required_argument && *value == '\0') {
+            fprintf(stderr, "%s:%d: missing value for '%s'\n", filename, lineno, name);
+            rc = EX_STARTUP;
+        } else if (longopts[index].val == 'p') {
+            // a list of ports, separated by whitespace
+            char *ports = strdup(value);
+            for (char *p = ports; *p != '\0'; p++)
+                if (isspace((unsigned char)*p))
+                    *p = '|';
+            rc = parse_option('p', ports, opts);
+        } else    // option values are referenced, not copied
+            rc = parse_option(longopts[index].val, *value ? strdup(value) : NULL, opts);
+    }
+    fclose(fp);
+    return rc;
+}
+
+
+// Saved for re-reading the options on SIGHUP
+
+static int saved_argc;
+static char * const *saved_argv;
+static struct hdmi2usb_opts default_opts;
+
+static int
+reload_opts(struct hdmi2usb_opts *opts) {
+    struct hdmi2usb_opts fresh = default_opts;
+    optind = 0;
+    int rc = parse_args(saved_argc, saved_argv, &fresh);
+    if (rc == EX_SUCCESS)
+        *opts = fresh;
+    return rc;
+}
+
 
 int
 main(int argc, char * const *argv) {
@@ -283,18 +572,47 @@ main(int argc, char * const *argv) {
             .verbose = 0,
             .logflags = 0,
             .logfile = NULL,
+            .loglevels = NULL,
+            .recorder = NULL,
             .daemonize = 0,
             .baudrate = speed_to_baud(115200),
             .port = "auto",
             .iobufsize = 2048,
+            .iobufmax = 65536,
+            .input_rate = 0,
+            .input_burst = 4096,
+            .maxline = 1024,
+            .maxqueue = 64,
             .listen_addr = "localhost",
             .listen_port = 8501,
             .listen_flags = 0,
+            .backlog = 128,
+            .maxconn = 0,
+            .maxperaddr = 0,
+            .sockopts = { .nodelay = 1, .coalesce = TCP_COALESCE, .notsent_lowat = 16384 },
+            .mcast_addr = NULL,
+            .mcast_port = 8502,
+            .mcast_ttl = UDP_TTL,
+            .upstream_addr = NULL,
+            .upstream_port = 8501,
+            .admin_addr = "localhost",
+            .admin_port = 0,
+            .websocket_addr = "localhost",
+            .websocket_port = 0,
             .loop_time = 20UL,
-            .command_time = 2000UL
+            .command_time = 500UL,
+            .adaptive = 0,
+            .profile_time = 0,
+            .stall_time = 1000UL,
+            .inherit_fd = -1
         }
     };
 
+    saved_argc = argc;
+    saved_argv = argv;
+    default_opts = app.opts;
+    app.reload = reload_opts;
+    app.argv = argv;
     int rc = parse_args(argc, argv, &app.opts);
     if (rc == 0) {
         buffer_init(&app.proc, app.opts.iobufsize * 2);
@@ -302,17 +620,46 @@ main(int argc, char * const *argv) {
         log_init(app.opts.logflags,
                  (enum Verbosity)app.opts.verbose,
                  app.opts.logfile);
+        log_setlevels(app.opts.loglevels);
         log_critical("%s version %s starting", HDMI2USBD_NAME, HDMI2USBD_VERSION);
-        log_debug("       Device : %s", app.opts.port);
-        log_debug("     Baudrate : %ld", baud_to_speed(app.opts.baudrate));
+        if (app.opts.config != NULL)
+            log_debug("       Config : %s", app.opts.config);
+        if (app.opts.upstream_addr != NULL)
+            log_debug("     Upstream : %s port %u", app.opts.upstream_addr, app.opts.upstream_port);
+        else {
+            log_debug("       Device : %s", app.opts.port);
+            log_debug("     Baudrate : %ld", baud_to_speed(app.opts.baudrate));
+        }
         log_debug(" Bind Address : %s", app.opts.listen_addr);
         log_debug("    Bind Port : %u", app.opts.listen_port);
+        log_debug("      Backlog : %d", app.opts.backlog);
+        if (app.opts.maxconn || app.opts.maxperaddr)
+            log_debug("  Conn Limits : %u per listener, %u per client", app.opts.maxconn, app.opts.maxperaddr);
+        char sockopts[128];
+        log_debug("  Socket Opts : %s", tcp_profile_str(&app.opts.sockopts, sockopts, sizeof(sockopts)));
+        log_debug(" Input Limits : rate=%lu,burst=%lu,line=%lu,queue=%lu", app.opts.input_rate, app.opts.input_burst,
+                  app.opts.maxline, app.opts.maxqueue);
+        if (app.opts.mcast_addr != NULL)
+            log_debug("    Multicast : %s port %u ttl %d", app.opts.mcast_addr, app.opts.mcast_port, app.opts.mcast_ttl);
+        if (app.opts.admin_port)
+            log_debug("        Admin : %s port %u", app.opts.admin_addr, app.opts.admin_port);
+        if (app.opts.websocket_port)
+            log_debug("    WebSocket : %s port %u", app.opts.websocket_addr, app.opts.websocket_port);
         log_debug(" I/O Buffsize : %u", app.opts.iobufsize);
+        if (app.opts.iobufmax > app.opts.iobufsize)
+            log_debug(" I/O Buffmax  : %u", app.opts.iobufmax);
         log_debug("   Logging To : %s", app.opts.logfile ? app.opts.logfile : "<not set>");
         log_debug("Log Verbosity : %d", app.opts.verbose);
+        if (app.opts.loglevels != NULL)
+            log_debug("   Log Levels : %s", app.opts.loglevels);
         log_debug("    Log Times : %s", app.opts.logflags & LOG_UTC ? "UTC" : "Local");
         log_debug("     Log Sync : %s", app.opts.logflags & LOG_SYNC ? "enabled" : "disabled");
+        log_debug("   Log Format : %s", app.opts.logflags & LOG_BINARY ? "binary" : "text");
         log_debug("    Daemonize : %s", app.opts.daemonize ? "Yes" : "No");
+        log_debug("       Pacing : %s", app.opts.adaptive ? "adaptive" : "fixed");
+        if (app.opts.profile_time)
+            log_debug("      Profile : every %lus", app.opts.profile_time);
+        log_debug("   Stall Time : %lums", app.opts.stall_time);
         rc = hdmi2usb_main(&app);
         log_critical("%s ended (exitcode=%d)", HDMI2USBD_NAME, rc);
     }
@@ -2,8 +2,14 @@
 // Created by David Nugent on 2/02/2016.
 //
 
+#ifdef __linux__
+#define _GNU_SOURCE     // accept4()
+#endif
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <netdb.h>
@@ -16,6 +22,9 @@
 #include "netutils.h"
 #include "selector.h"
 #include "stringstore.h"
+#include "session.h"
+#define LOG_MODULE LOG_TCP
+#include "logging.h"
 
 
 tcp_cfg_t *
@@ -46,6 +55,105 @@ tcp_open(iodev_t *dev) {
 }
 
 
+//// outbound (connect) socket support functions ////
+
+static void
+tcp_connected(iodev_t *dev) {
+    tcp_cfg_t *cfg = tcp_getcfg(dev);
+    char paddr[64];
+    iodev_notify("connected to %s port %u on fd=%d",
+                 inet_ntop(cfg->remote->sa_family, sockaddr_addr(cfg->remote), paddr, sizeof(paddr)),
+                 sockaddr_port(cfg->remote), dev->fd);
+    int yes = 1;
+    if (setsockopt(dev->fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes)) == -1)
+        iodev_error("setsockopt(%d, TCP_NODELAY) error(%d): %s", dev->fd, errno, strerror(errno));
+    cfg->backoff = 0;
+    cfg->attempts = 0;
+    iodev_setstate(dev, IODEV_CONNECTED);
+}
+
+
+// Connect without blocking, completion is seen when the socket becomes
+// writable. Attempts are spaced out by tcp_close_connect()
+
+static int
+tcp_open_connect(iodev_t *dev) {
+    if (iodev_getstate(dev) >= IODEV_OPEN)
+        dev->close(dev, IOFLAG_NONE);
+
+    tcp_cfg_t *cfg = tcp_getcfg(dev);
+    if (dev->fd != -1 || cfg->remote == NULL)
+        return dev->fd;
+    if (!timer_expired(&cfg->retry)) {
+        if (dev->selector != NULL)
+            selector_set_deadline(dev->selector, timer_getmillitime() + timer_remaining(&cfg->retry));
+        return dev->fd;
+    }
+    dev->fd = socket(cfg->remote->sa_family, SOCK_STREAM, IPPROTO_IP);
+    if (dev->fd == -1) {
+        iodev_error("socket create error(%d): %s", errno, strerror(errno));
+        iodev_setstate(dev, IODEV_CLOSED);
+        dev->close(dev, IOFLAG_NONE);
+        return dev->fd;
+    }
+    int opts = fcntl(dev->fd, F_GETFL);
+    if (opts < 0 || fcntl(dev->fd, F_SETFL, opts | O_NONBLOCK) < 0)
+        iodev_error("fcntl(%d) error(%d): %s", dev->fd, errno, strerror(errno));
+    iodev_setstate(dev, IODEV_PENDING);
+    log_debug("tcp connecting on fd=%d, port %u", dev->fd, sockaddr_port(cfg->remote));
+    if (connect(dev->fd, cfg->remote, cfg->addrlen) == 0)
+        tcp_connected(dev);
+    else if (errno != EINPROGRESS) {
+        iodev_error("socket connect error(%d): %s", errno, strerror(errno));
+        dev->close(dev, IOFLAG_NONE);
+    }
+    return dev->fd;
+}
+
+
+static int
+tcp_set_masks_connect(iodev_t *dev, fd_set *r, fd_set *w, fd_set *x) {
+    tcp_cfg_t *cfg = tcp_getcfg(dev);
+    switch (iodev_getstate(dev)) {
+        case IODEV_NONE:        // default (startup) state
+        case IODEV_CLOSED:      // currently closed, due for reconnect
+            dev->open(dev);
+            if (iodev_getstate(dev) != IODEV_PENDING)
+                break;
+        case IODEV_PENDING:     // waiting for connect to complete
+            FD_CLR(dev->fd, r);
+            FD_SET(dev->fd, w);
+            FD_SET(dev->fd, x);
+            return 1;
+        default:
+            return cfg->set_masks(dev, r, w, x);
+    }
+    return 0;
+}
+
+
+static ssize_t
+tcp_write_handler_connect(iodev_t *dev) {
+    tcp_cfg_t *cfg = tcp_getcfg(dev);
+    if (iodev_getstate(dev) != IODEV_PENDING)
+        return cfg->write_handler(dev);
+    int err = 0;
+    socklen_t errlen = sizeof(err);
+    if (getsockopt(dev->fd, SOL_SOCKET, SO_ERROR, &err, &errlen) == -1)
+        err = errno;
+    if (err == 0)
+        tcp_connected(dev);
+    else {
+        char paddr[64];
+        iodev_error("connect to %s port %u failed(%d): %s",
+                    inet_ntop(cfg->remote->sa_family, sockaddr_addr(cfg->remote), paddr, sizeof(paddr)),
+                    sockaddr_port(cfg->remote), err, strerror(err));
+        dev->close(dev, IOFLAG_NONE);
+    }
+    return 0;
+}
+
+
 static int
 tcp_accept(iodev_t *dev, int fd, struct sockaddr *addr) {
     char paddr[64];
@@ -54,16 +162,6 @@ tcp_accept(iodev_t *dev, int fd, struct sockaddr *addr) {
                  fd);
     iodev_setstate(dev, IODEV_OPEN);
     dev->fd = fd;
-    // set non-blocking
-    int opts = fcntl(dev->fd, F_GETFL);
-    if (opts < 0)
-        iodev_error("fcntl(%d, F_GETFL) error(%d): %s", dev->fd, errno, strerror(errno));
-    else {
-        opts |= O_NONBLOCK;
-        if (fcntl(dev->fd, F_SETFL, opts) < 0)
-            iodev_error("fcntl(%d, F_SETFL) error(%d): %s", dev->fd, errno, strerror(errno));
-    }
-
     iodev_setstate(dev, IODEV_CONNECTED);
     return fd;
 }
@@ -71,7 +169,115 @@ tcp_accept(iodev_t *dev, int fd, struct sockaddr *addr) {
 
 //// listen socket support functions ////
 
-#define BACKLOG_SIZE 16
+void
+tcp_listen_limits(iodev_t *dev, int backlog, unsigned maxconn, unsigned maxperaddr) {
+    tcp_cfg_t *cfg = tcp_getcfg(dev);
+    if (backlog <= 0)
+        backlog = TCP_BACKLOG;
+    // already listening, a new backlog is applied by calling listen() again
+    if (cfg->backlog != backlog && iodev_getstate(dev) >= IODEV_CONNECTED && listen(dev->fd, backlog) < 0)
+        iodev_error("socket listen(%d) error(%d): %s", dev->fd, errno, strerror(errno));
+    cfg->backlog = backlog;
+    cfg->maxconn = maxconn;
+    cfg->maxperaddr = maxperaddr;
+}
+
+void
+tcp_listen_profile(iodev_t *dev, tcp_profile_t const *profile) {
+    tcp_getcfg(dev)->profile = *profile;
+}
+
+
+static struct {
+    char const *name;
+    tcp_profile_t profile;
+} const tcp_presets[] = {
+    // low latency for interactive use, small writes sent immediately
+    { "interactive",    { .nodelay = 1, .coalesce = 0 } },
+    // streamed device output, short coalescing window and shallow kernel queue
+    { "streaming",      { .nodelay = 1, .coalesce = TCP_COALESCE, .notsent_lowat = 16384 } },
+    // throughput over latency, leave it to the kernel
+    { "bulk",           { .nodelay = 0, .coalesce = 0 } },
+};
+
+
+// Parse a profile spec, a comma separated list of preset names and
+// key=value settings, applied in order, eg. "streaming,sndbuf=65536"
+int
+tcp_profile_parse(tcp_profile_t *profile, char const *spec) {
+    while (spec != NULL && *spec != '\0') {
+        size_t length = strcspn(spec, ",");
+        char item[length + 1];
+        memcpy(item, spec, length);
+        item[length] = '\0';
+        spec += length;
+        if (*spec == ',')
+            ++spec;
+        if (length == 0)
+            continue;
+        char *value = strchr(item, '=');
+        if (value == NULL) {
+            size_t index = 0;
+            while (index < sizeof(tcp_presets) / sizeof(tcp_presets[0]) && strcmp(tcp_presets[index].name, item) != 0)
+                index++;
+            if (index == sizeof(tcp_presets) / sizeof(tcp_presets[0]))
+                return -1;
+            *profile = tcp_presets[index].profile;
+            continue;
+        }
+        *value++ = '\0';
+        char *endptr = value;
+        unsigned long number = strtoul(value, &endptr, 10);
+        if (*value == '\0' || *endptr != '\0' || number > 0x7fffffffUL)
+            return -1;
+        if (strcmp(item, "nodelay") == 0 && number <= 1)
+            profile->nodelay = (int)number;
+        else if (strcmp(item, "coalesce") == 0)
+            profile->coalesce = (unsigned)number;
+        else if (strcmp(item, "lowat") == 0)
+            profile->notsent_lowat = (int)number;
+        else if (strcmp(item, "sndbuf") == 0)
+            profile->sndbuf = (int)number;
+        else if (strcmp(item, "rcvbuf") == 0)
+            profile->rcvbuf = (int)number;
+        else
+            return -1;
+    }
+    return 0;
+}
+
+
+char const *
+tcp_profile_str(tcp_profile_t const *profile, char *buf, size_t len) {
+    snprintf(buf, len, "nodelay=%d,coalesce=%u,lowat=%d,sndbuf=%d,rcvbuf=%d",
+             profile->nodelay, profile->coalesce, profile->notsent_lowat, profile->sndbuf, profile->rcvbuf);
+    return buf;
+}
+
+
+static void
+tcp_setsockopt(iodev_t *dev, int level, int option, char const *name, int value) {
+    if (setsockopt(dev->fd, level, option, &value, sizeof(value)) == -1)
+        iodev_error("setsockopt(%d, %s) error(%d): %s", dev->fd, name, errno, strerror(errno));
+}
+
+
+// Apply a listener's profile to a newly accepted connection
+static void
+tcp_apply_profile(iodev_t *dev, tcp_profile_t const *profile) {
+    if (profile->nodelay)
+        tcp_setsockopt(dev, IPPROTO_TCP, TCP_NODELAY, "TCP_NODELAY", 1);
+#ifdef TCP_NOTSENT_LOWAT
+    if (profile->notsent_lowat)
+        tcp_setsockopt(dev, IPPROTO_TCP, TCP_NOTSENT_LOWAT, "TCP_NOTSENT_LOWAT", profile->notsent_lowat);
+#endif
+    if (profile->sndbuf)
+        tcp_setsockopt(dev, SOL_SOCKET, SO_SNDBUF, "SO_SNDBUF", profile->sndbuf);
+    if (profile->rcvbuf)
+        tcp_setsockopt(dev, SOL_SOCKET, SO_RCVBUF, "SO_RCVBUF", profile->rcvbuf);
+    dev->coalesce = profile->coalesce;
+}
+
 
 static int
 tcp_open_listen(iodev_t *dev) {
@@ -107,7 +313,7 @@ tcp_open_listen(iodev_t *dev) {
         if (bind(dev->fd, cfg->local, cfg->addrlen) == -1) {
             iodev_error("socket bind error(%d): %s", errno, strerror(errno));
             dev->close(dev, IOFLAG_INACTIVE);
-        } else if (listen(dev->fd, BACKLOG_SIZE) < 0) {
+        } else if (listen(dev->fd, cfg->backlog) < 0) {
             iodev_error("socket bind error(%d): %s", errno, strerror(errno));
             dev->close(dev, IOFLAG_INACTIVE);
         } else {
@@ -147,19 +353,90 @@ tcp_set_masks_listen(iodev_t *dev, fd_set *r, fd_set *w, fd_set *x) {
 
 
 
+static int
+tcp_same_host(struct sockaddr *a, struct sockaddr *b) {
+    if (a == NULL || b == NULL || a->sa_family != b->sa_family)
+        return 0;
+    size_t len = a->sa_family == AF_INET6 ? sizeof(struct in6_addr) : sizeof(struct in_addr);
+    return memcmp(sockaddr_addr(a), sockaddr_addr(b), len) == 0;
+}
+
+
+// Check a new connection against the listener's limits, this is done
+// before a device is allocated for it
+static int
+tcp_admit(iodev_t *dev, struct sockaddr *remote) {
+    tcp_cfg_t *cfg = tcp_getcfg(dev);
+    if (!cfg->maxconn && !cfg->maxperaddr)
+        return 1;
+    unsigned connections = 0, from_host = 0;
+    selector_t *selector = dev->selector;
+    for (size_t index = 0; index < selector_device_count(selector); index++) {
+        iodev_t *conn = selector_get_device(selector, index);
+        if (iodev_is_listener(conn) || !iodev_is_open(conn) || conn->cfg->free_cfg != tcp_free_cfg)
+            continue;
+        tcp_cfg_t *ccfg = tcp_getcfg(conn);
+        if (ccfg->listen_fd != dev->fd)
+            continue;
+        connections++;
+        if (cfg->maxperaddr && tcp_same_host(ccfg->remote, remote))
+            from_host++;
+    }
+    char paddr[64];
+    if (cfg->maxconn && connections >= cfg->maxconn)
+        iodev_notify("connection from %s refused: listener limit %u reached (%lu refused)",
+                     inet_ntop(remote->sa_family, sockaddr_addr(remote), paddr, sizeof(paddr)),
+                     cfg->maxconn, ++cfg->rejected);
+    else if (cfg->maxperaddr && from_host >= cfg->maxperaddr)
+        iodev_notify("connection from %s refused: per address limit %u reached (%lu refused)",
+                     inet_ntop(remote->sa_family, sockaddr_addr(remote), paddr, sizeof(paddr)),
+                     cfg->maxperaddr, ++cfg->rejected);
+    else
+        return 1;
+    return 0;
+}
+
+
 static ssize_t
 tcp_accept_handler(iodev_t *dev) {
     // we got here via read event from select on this socket
-    struct sockaddr_storage sock;
-    socklen_t socklen = sizeof(sock);
-
-    int fd = accept(dev->fd, (struct sockaddr *)&sock, &socklen);
-    if (fd < 0)
-        iodev_notify("accept failure(%d): %s", errno, strerror(errno));
-    else {
-        selector_new_device_accept(dev->selector, fd, (struct sockaddr *)&sock, dev->bufsize);
+    // drain pending connections, up to a limit per wakeup
+    selector_t *selector = dev->selector;
+    size_t self = selector_device_index(selector, dev);
+    ssize_t accepted = 0;
+    for (int budget = TCP_ACCEPT_BUDGET; budget > 0; budget--) {
+        struct sockaddr_storage sock;
+        socklen_t socklen = sizeof(sock);
+#ifdef __linux__
+        int fd = accept4(dev->fd, (struct sockaddr *)&sock, &socklen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+        int fd = accept(dev->fd, (struct sockaddr *)&sock, &socklen);
+        if (fd >= 0) {
+            // set non-blocking and close on exec, as accept4() does above
+            int opts = fcntl(fd, F_GETFL);
+            if (opts < 0 || fcntl(fd, F_SETFL, opts | O_NONBLOCK) < 0)
+                iodev_error("fcntl(%d, F_SETFL) error(%d): %s", fd, errno, strerror(errno));
+            if (fcntl(fd, F_SETFD, FD_CLOEXEC) < 0)
+                iodev_error("fcntl(%d, F_SETFD) error(%d): %s", fd, errno, strerror(errno));
+        }
+#endif
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                iodev_notify("accept failure(%d): %s", errno, strerror(errno));
+            break;
+        }
+        if (!tcp_admit(dev, (struct sockaddr *)&sock))
+            close(fd);
+        else {
+            iodev_t *conn = selector_new_device_accept(selector, fd, (struct sockaddr *)&sock, dev->bufsize, dev->bufmax);
+            // the device array may have moved
+            dev = selector_get_device(selector, self);
+            tcp_getcfg(conn)->listen_fd = dev->fd;
+            tcp_apply_profile(conn, &tcp_getcfg(dev)->profile);
+            accepted++;
+        }
     }
-    return fd;
+    return accepted;
 }
 
 
@@ -180,19 +457,40 @@ tcp_close(iodev_t *dev, int flags) {
         case IODEV_CLOSING:
             // check to see if we have sent all data
             if (flags & IOFLAG_FLUSH) {
-                if (buffer_available(iodev_tbuf(dev)))
+                if (iodev_pending(dev))
                     break;  // still data in buffer, retry later
             //  tcflush(dev->fd, TCOFLUSH);
             }
         case IODEV_PENDING: // never flush if only pending
+            log_debug("tcp close fd=%d", dev->fd);
             close(dev->fd);
             dev->fd = -1;
-            iodev_setstate(dev, IODEV_CLOSED);
+            if (dev->tseg != NULL)
+                segbuf_flush(dev->tseg);    // release shared segments
+            iodev_setstate(dev, flags & IOFLAG_INACTIVE ? IODEV_INACTIVE : IODEV_CLOSED);
             break;
     }
 }
 
 
+// Closed outbound connections are retried, with increasing delays while
+// the remote end remains unavailable
+
+static void
+tcp_close_connect(iodev_t *dev, int flags) {
+    tcp_close(dev, flags);
+    if (iodev_getstate(dev) == IODEV_CLOSED) {
+        tcp_cfg_t *cfg = tcp_getcfg(dev);
+        cfg->backoff = cfg->backoff == 0 ? TCP_RETRY_MIN : cfg->backoff * 2;
+        if (cfg->backoff > TCP_RETRY_MAX)
+            cfg->backoff = TCP_RETRY_MAX;
+        timer_reset(&cfg->retry, cfg->backoff);
+        if (++cfg->attempts == 1 || cfg->backoff == TCP_RETRY_MAX)
+            iodev_notify("reconnecting in %lums (attempt %lu)", cfg->backoff / 1000UL, cfg->attempts);
+    }
+}
+
+
 static void
 tcp_close_accept(iodev_t *dev, int flags) {
     tcp_close(dev, flags);
@@ -208,18 +506,22 @@ tcp_configure(iodev_t *dev, void *data) {
 }
 
 static iodev_t *
-tcp_create(iodev_t *dev, struct sockaddr *local, struct sockaddr *remote, size_t bufsize, int with_linebuf) {
+tcp_create(iodev_t *dev, struct sockaddr *local, struct sockaddr *remote, size_t bufsize, size_t bufmax, int with_linebuf) {
     // First create the basic (slightly larger) config
     iodev_cfg_t *cfg = iodev_alloc_cfg(sizeof(tcp_cfg_t), "tcp", tcp_free_cfg);
-    iodev_t *tcp = iodev_init(dev, cfg, bufsize);
+    cfg->logmodule = LOG_TCP;
+    iodev_t *tcp = iodev_init_elastic(dev, cfg, bufsize, bufmax);
 
     // Initialise the extras
     tcp_cfg_t *tcfg = tcp_getcfg(tcp);
     tcfg->addrlen = local != NULL ? sockaddr_len(local) : remote != NULL ? sockaddr_len(remote) : 0;
     tcfg->local = sockaddr_dup(local);
     tcfg->remote = sockaddr_dup(remote);
-    if (with_linebuf)
-        dev->linebuf = stringstore_init(NULL);
+    if (with_linebuf) {
+        tcp->linebuf = bufmax > bufsize ? stringstore_init_n(NULL, 0) : stringstore_init(NULL);
+        tcp->session = session_init(NULL);
+        tcp->tseg = segbuf_init(NULL, bufmax > bufsize ? bufmax : bufsize);
+    }
 
     // default functions
     tcp->open = tcp_open;
@@ -231,12 +533,14 @@ tcp_create(iodev_t *dev, struct sockaddr *local, struct sockaddr *remote, size_t
 
 
 iodev_t *
-tcp_create_listen(iodev_t *dev, struct sockaddr *local, size_t bufsize) {
-    iodev_t *tcp = tcp_create(dev, local, NULL, 0, 0);
+tcp_create_listen(iodev_t *dev, struct sockaddr *local, size_t bufsize, size_t bufmax) {
+    iodev_t *tcp = tcp_create(dev, local, NULL, 0, 0, 0);
 
     // we don't use bufsize for this socket since there is no IO
     // but use it for devices created via accept(), so record it here
     tcp->bufsize = bufsize;
+    tcp->bufmax = bufmax;
+    tcp_listen_limits(tcp, TCP_BACKLOG, 0, 0);
 
     // special "open" and "read" for listen sockets
     tcp->open = tcp_open_listen;
@@ -249,17 +553,47 @@ tcp_create_listen(iodev_t *dev, struct sockaddr *local, size_t bufsize) {
 
 iodev_t *
 tcp_create_connect(iodev_t *dev, struct sockaddr *remote, size_t bufsize) {
-    iodev_t *tcp = tcp_create(dev, NULL, remote, bufsize, 1);
+    iodev_t *tcp = tcp_create(dev, NULL, remote, bufsize, 0, 0);
 
-    // tcp->close = tcp_close_connect;
+    // connect and reconnect in the background, wrapping the default handlers
+    tcp_cfg_t *tcfg = tcp_getcfg(tcp);
+    tcfg->set_masks = tcp->set_masks;
+    tcfg->write_handler = tcp->write_handler;
+    tcp->open = tcp_open_connect;
+    tcp->close = tcp_close_connect;
+    tcp->set_masks = tcp_set_masks_connect;
+    tcp->write_handler = tcp_write_handler_connect;
 
     return tcp;
 }
 
 
+// Take over an already listening or connected socket (from another
+// process or the service manager), in place of opening a new one
+
+iodev_t *
+tcp_adopt(iodev_t *dev, int fd) {
+    dev->fd = fd;
+    int opts = fcntl(dev->fd, F_GETFL);
+    if (opts < 0 || fcntl(dev->fd, F_SETFL, opts | O_NONBLOCK) < 0)
+        iodev_error("fcntl(%d) error(%d): %s", dev->fd, errno, strerror(errno));
+    if (tcp_is_connect(dev))
+        tcp_connected(dev);
+    else
+        iodev_setstate(dev, IODEV_CONNECTED);
+    return dev;
+}
+
+
+int
+tcp_is_connect(iodev_t *dev) {
+    return tcp_getcfg(dev)->write_handler != NULL;
+}
+
+
 iodev_t *
-tcp_create_accepted(iodev_t *dev, int fd, struct sockaddr *remote, size_t bufsize) {
-    iodev_t *tcp = tcp_create(dev, NULL, remote, bufsize, 1);
+tcp_create_accepted(iodev_t *dev, int fd, struct sockaddr *remote, size_t bufsize, size_t bufmax) {
+    iodev_t *tcp = tcp_create(dev, NULL, remote, bufsize, bufmax, 1);
     tcp_accept(tcp, fd, remote);
     tcp->close = tcp_close_accept;
     return tcp;
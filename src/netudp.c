@@ -0,0 +1,238 @@
+//
+// UDP (multicast) publisher device
+//
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/errno.h>
+#include <sys/fcntl.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "netudp.h"
+#include "netutils.h"
+#define LOG_MODULE LOG_UDP
+#include "logging.h"
+
+
+udp_cfg_t *
+udp_getcfg(iodev_t *dev) {
+    return (udp_cfg_t *)iodev_getcfg(dev);
+}
+
+
+static void
+udp_free_cfg(iodev_cfg_t *cfg) {
+    if (cfg != NULL) {
+        udp_cfg_t *udpcfg = (udp_cfg_t *)cfg;
+        free(udpcfg->group);
+    }
+}
+
+
+//// datagram header ////
+
+size_t
+udp_header_encode(void *dst, uint32_t seq, size_t length) {
+    unsigned char *p = dst;
+    uint16_t magic = htons(UDP_MAGIC);
+    uint16_t len = htons((uint16_t)length);
+    uint32_t sequence = htonl(seq);
+    memcpy(p, &magic, sizeof(magic));
+    memcpy(p + 2, &len, sizeof(len));
+    memcpy(p + 4, &sequence, sizeof(sequence));
+    return UDP_HDRSIZE;
+}
+
+
+// returns 0 if valid, -1 if not a publisher datagram
+int
+udp_header_decode(void const *src, size_t size, udp_header_t *hdr) {
+    unsigned char const *p = src;
+    if (size < UDP_HDRSIZE)
+        return -1;
+    memcpy(&hdr->magic, p, sizeof(hdr->magic));
+    memcpy(&hdr->length, p + 2, sizeof(hdr->length));
+    memcpy(&hdr->seq, p + 4, sizeof(hdr->seq));
+    hdr->magic = ntohs(hdr->magic);
+    hdr->length = ntohs(hdr->length);
+    hdr->seq = ntohl(hdr->seq);
+    if (hdr->magic != UDP_MAGIC || hdr->length > size - UDP_HDRSIZE)
+        return -1;
+    return 0;
+}
+
+
+static int
+udp_is_multicast(struct sockaddr *addr) {
+    switch (addr->sa_family) {
+        case AF_INET: {
+            struct sockaddr_in *s4 = (void *)addr;
+            return IN_MULTICAST(ntohl(s4->sin_addr.s_addr));
+        }
+        case AF_INET6: {
+            struct sockaddr_in6 *s6 = (void *)addr;
+            return IN6_IS_ADDR_MULTICAST(&s6->sin6_addr);
+        }
+        default:
+            return 0;
+    }
+}
+
+
+// device control
+static int
+udp_open(iodev_t *dev) {
+    if (iodev_getstate(dev) >= IODEV_OPEN)
+        dev->close(dev, IOFLAG_NONE);
+
+    udp_cfg_t *cfg = udp_getcfg(dev);
+    dev->fd = socket(cfg->group->sa_family, SOCK_DGRAM, IPPROTO_UDP);
+    if (dev->fd == -1) {
+        iodev_error("udp socket create error(%d): %s", errno, strerror(errno));
+        iodev_setstate(dev, IODEV_INACTIVE);
+        return dev->fd;
+    }
+    iodev_setstate(dev, IODEV_OPEN);
+    // set non-blocking
+    int opts = fcntl(dev->fd, F_GETFL);
+    if (opts < 0)
+        iodev_error("fcntl(%d, F_GETFL) error(%d): %s", dev->fd, errno, strerror(errno));
+    else {
+        opts |= O_NONBLOCK;
+        if (fcntl(dev->fd, F_SETFL, opts) < 0)
+            iodev_error("fcntl(%d, F_SETFL) error(%d): %s", dev->fd, errno, strerror(errno));
+    }
+    if (udp_is_multicast(cfg->group)) {
+        int rc;
+        if (cfg->group->sa_family == AF_INET) {
+            unsigned char ttl = (unsigned char)cfg->ttl;
+            rc = setsockopt(dev->fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+        } else {
+            int hops = cfg->ttl;
+            rc = setsockopt(dev->fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &hops, sizeof(hops));
+        }
+        if (rc == -1)
+            iodev_error("setsockopt(%d) multicast ttl error(%d): %s", dev->fd, errno, strerror(errno));
+    }
+    char paddr[64];
+    iodev_notify("publishing to %s port %u on fd=%d",
+                 inet_ntop(cfg->group->sa_family, sockaddr_addr(cfg->group), paddr, sizeof(paddr)),
+                 sockaddr_port(cfg->group), dev->fd);
+    iodev_setstate(dev, IODEV_CONNECTED);
+    return dev->fd;
+}
+
+
+static void
+udp_close(iodev_t *dev, int flags) {
+    switch (iodev_getstate(dev)) {
+        case IODEV_NONE:
+        case IODEV_INACTIVE:
+        case IODEV_CLOSED:
+            // do nothing for these states, we are already closed
+            break;
+        default:
+            // datagrams are never held back, so closing is immediate
+            close(dev->fd);
+            dev->fd = -1;
+            buffer_flush(iodev_tbuf(dev));
+            iodev_setstate(dev, flags & IOFLAG_INACTIVE ? IODEV_INACTIVE : IODEV_CLOSED);
+            break;
+    }
+}
+
+
+static int
+udp_set_masks(iodev_t *dev, fd_set *r, fd_set *w, fd_set *x) {
+    int is_active = 0;
+    if (dev->fd >= 0) {
+        // clear all by default
+        FD_CLR(dev->fd, r);
+        FD_CLR(dev->fd, w);
+        FD_CLR(dev->fd, x);
+    }
+    switch (iodev_getstate(dev)) {
+        case IODEV_NONE:        // default (startup) state
+        case IODEV_CLOSED:      // currently closed, due for reopen
+            dev->open(dev);
+        default:
+            break;
+        case IODEV_OPEN:        // open/operating
+        case IODEV_CONNECTED:   // connected
+        case IODEV_ACTIVE:      // connected with I/O pending
+            // transmit only, nothing is ever read from this socket
+            if (buffer_used(iodev_tbuf(dev)) > 0)
+                FD_SET(dev->fd, w);
+            is_active++;
+            break;
+    }
+    return is_active;
+}
+
+
+// Send the entire transmit buffer as a sequence of datagrams
+
+static ssize_t
+udp_write_handler(iodev_t *dev) {
+    ssize_t rc = -1;
+    udp_cfg_t *cfg = udp_getcfg(dev);
+
+    if (dev->fd == -1)
+        iodev_error("iodev %s write error: device is closed", cfg->cfg.name);
+    else {
+        buffer_t *tbuf = iodev_tbuf(dev);
+        unsigned char datagram[UDP_HDRSIZE + UDP_PAYLOAD];
+        rc = 0;
+        while (buffer_used(tbuf) > 0) {
+            size_t length = buffer_peek(tbuf, datagram + UDP_HDRSIZE, UDP_PAYLOAD);
+            udp_header_encode(datagram, cfg->seq, length);
+            if (sendto(dev->fd, datagram, UDP_HDRSIZE + length, 0, cfg->group, cfg->addrlen) < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+                    break;  // retry when writable again
+                // the datagram is lost, but subscribers will see the gap in sequence
+                iodev_error("iodev %s sendto error(%d): %s", cfg->cfg.name, errno, strerror(errno));
+                cfg->dropped++;
+            } else {
+                log_trace("udp datagram seq=%u length=%zu", (unsigned)cfg->seq, length);
+                rc += length;
+            }
+            buffer_get(tbuf, NULL, length);
+            cfg->seq++;
+        }
+    }
+    return rc;
+}
+
+
+static int
+udp_configure(iodev_t *dev, void *data) {
+    return 0;
+}
+
+
+iodev_t *
+udp_create_publish(iodev_t *dev, struct sockaddr *group, int ttl, size_t bufsize) {
+    // First create the basic (slightly larger) config
+    iodev_cfg_t *cfg = iodev_alloc_cfg(sizeof(udp_cfg_t), "udp", udp_free_cfg);
+    cfg->logmodule = LOG_UDP;
+    iodev_t *udp = iodev_init(dev, cfg, bufsize);
+
+    // Initialise the extras
+    udp_cfg_t *ucfg = udp_getcfg(udp);
+    ucfg->addrlen = sockaddr_len(group);
+    ucfg->group = sockaddr_dup(group);
+    ucfg->ttl = ttl > 0 ? ttl : UDP_TTL;
+    ucfg->seq = 0;
+
+    udp->open = udp_open;
+    udp->close = udp_close;
+    udp->configure = udp_configure;
+    udp->set_masks = udp_set_masks;
+    udp->write_handler = udp_write_handler;
+
+    return udp;
+}
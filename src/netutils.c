@@ -133,6 +133,15 @@ sockaddr_dup(struct sockaddr *addr) {
     return memcpy(dst, addr, addrlen);
 }
 
+// same family, address and port
+int
+sockaddr_equal(struct sockaddr *a, struct sockaddr *b) {
+    if (a == NULL || b == NULL || a->sa_family != b->sa_family || sockaddr_port(a) != sockaddr_port(b))
+        return 0;
+    size_t len = a->sa_family == AF_INET6 ? sizeof(struct in6_addr) : sizeof(struct in_addr);
+    return memcmp(sockaddr_addr(a), sockaddr_addr(b), len) == 0;
+}
+
 
 
 struct sockaddr *
@@ -0,0 +1,88 @@
+//
+// Command pacing
+//
+
+#include <string.h>
+
+#include "pacing.h"
+
+
+void
+pacing_init(pacing_t *pacing) {
+    memset(pacing, '\0', sizeof(pacing_t));
+}
+
+
+// A command has been written to the device
+
+void
+pacing_sent(pacing_t *pacing, utime_t pace, utime_t now) {
+    pacing->prompted = 0;
+    pacing->awaiting = 1;
+    pacing->sent = now;
+    pacing->due = now + pace;
+}
+
+
+// The device prompted. Only a prompt following the complete command shows
+// that it has finished, so one seen while the command is still being
+// written (drained is zero) is ignored
+
+void
+pacing_prompt(pacing_t *pacing, int drained, utime_t when) {
+    if (!drained)
+        return;
+    pacing->prompt_time = when;
+    pacing->prompted = 1;
+    if (pacing->awaiting) {
+        // update the moving average of command service time
+        long sample = timer_calc_difference(when, pacing->sent);
+        long average = (long)pacing->service_time;
+        if (sample > 0)
+            pacing->service_time = (utime_t)(average ? average + (sample - average) / PACING_WEIGHT : sample);
+        pacing->awaiting = 0;
+    }
+}
+
+
+int
+pacing_expired(pacing_t *pacing, utime_t now) {
+    return now >= pacing->due;
+}
+
+
+// The device is ready for another command when the pace has passed or,
+// with adaptive pacing, as soon as it has prompted after the last one
+
+int
+pacing_ready(pacing_t *pacing, int adaptive, utime_t now) {
+    return (adaptive && pacing->prompted) || pacing_expired(pacing, now);
+}
+
+
+// The last command is no longer awaited once the pace has passed without
+// a prompt, returns non-zero if this counts as a timeout
+
+int
+pacing_timeout(pacing_t *pacing, int adaptive, utime_t now) {
+    if (!pacing->awaiting || !pacing_expired(pacing, now))
+        return 0;
+    pacing->awaiting = 0;
+    if (adaptive)
+        ++pacing->timeouts;
+    return adaptive;
+}
+
+
+utime_t
+pacing_remaining(pacing_t *pacing, utime_t now) {
+    return pacing_expired(pacing, now) ? 0 : pacing->due - now;
+}
+
+
+// Carry on where another instance left off (see hdmi2usb_upgrade)
+
+void
+pacing_resume(pacing_t *pacing, utime_t remaining, utime_t now) {
+    pacing->due = remaining ? now + remaining : 0;
+}
@@ -0,0 +1,150 @@
+//
+// Event loop phase profiler
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "profile.h"
+
+
+static struct {
+    utime_t since;                      // start of collection
+    profile_hist_t phases[PROF_PHASES];
+    struct {
+        char const *driver;
+        utime_t total;
+        utime_t max;
+    } devices[PROFILE_MAXFD];
+} profile;
+
+static char const *phase_names[PROF_PHASES] = {
+    "ioset", "select", "handlers", "process", "loop"
+};
+
+
+// Monotonic, so that clock adjustments do not show up as stalls
+
+utime_t
+profile_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (utime_t)now.tv_sec * 1000000UL + (utime_t)(now.tv_nsec / 1000);
+}
+
+// Account the time since an earlier mark (if any) to a phase, and return
+// the current time as the start of the next
+
+utime_t
+profile_mark(int phase, utime_t since) {
+    utime_t now = profile_now();
+    if (since)
+        profile_add(phase, now > since ? now - since : 0);
+    return now;
+}
+
+void
+profile_add(int phase, utime_t elapsed) {
+    if (phase >= 0 && phase < PROF_PHASES) {
+        profile_hist_t *hist = &profile.phases[phase];
+        int bucket = elapsed ? 64 - __builtin_clzll((unsigned long long)elapsed) : 0;
+        hist->buckets[bucket < PROFILE_BUCKETS ? bucket : PROFILE_BUCKETS - 1]++;
+        hist->count++;
+        hist->total += elapsed;
+        if (elapsed > hist->max)
+            hist->max = elapsed;
+        if (!profile.since)
+            profile.since = profile_now();
+    }
+}
+
+void
+profile_device(int fd, char const *driver, utime_t elapsed) {
+    if (fd >= 0 && fd < PROFILE_MAXFD) {
+        profile.devices[fd].driver = driver;
+        profile.devices[fd].total += elapsed;
+        if (elapsed > profile.devices[fd].max)
+            profile.devices[fd].max = elapsed;
+    }
+}
+
+
+profile_hist_t const *
+profile_phase(int phase) {
+    return phase >= 0 && phase < PROF_PHASES ? &profile.phases[phase] : NULL;
+}
+
+char const *
+profile_phase_name(int phase) {
+    return phase >= 0 && phase < PROF_PHASES ? phase_names[phase] : "?";
+}
+
+// Upper bound of the bucket holding the given percentile (0 if empty)
+
+utime_t
+profile_percentile(int phase, int percent) {
+    profile_hist_t const *hist = profile_phase(phase);
+    if (hist == NULL || hist->count == 0)
+        return 0;
+    unsigned long wanted = (hist->count * (unsigned long)percent + 99) / 100, seen = 0;
+    for (int bucket = 0; bucket < PROFILE_BUCKETS - 1; bucket++) {
+        if ((seen += hist->buckets[bucket]) >= wanted)
+            return bucket ? 1UL << bucket : 1;
+    }
+    return hist->max;
+}
+
+// The device its handlers spent the most time on, 0 if none
+
+int
+profile_worst(int *fd, char const **driver, utime_t *total, utime_t *max) {
+    int worst = -1;
+    for (int index = 0; index < PROFILE_MAXFD; index++) {
+        if (profile.devices[index].total && (worst < 0 || profile.devices[index].total > profile.devices[worst].total))
+            worst = index;
+    }
+    if (worst < 0)
+        return 0;
+    *fd = worst;
+    *driver = profile.devices[worst].driver;
+    *total = profile.devices[worst].total;
+    *max = profile.devices[worst].max;
+    return 1;
+}
+
+
+int
+profile_format(int phase, char *buf, size_t size) {
+    profile_hist_t const *hist = profile_phase(phase);
+    if (hist == NULL)
+        return -1;
+    return snprintf(buf, size, "%-8s n=%lu avg=%luus p50<%luus p99<%luus max=%luus total=%lums",
+                    profile_phase_name(phase), hist->count, hist->count ? hist->total / hist->count : 0,
+                    profile_percentile(phase, 50), profile_percentile(phase, 99), hist->max, hist->total / 1000);
+}
+
+int
+profile_format_worst(char *buf, size_t size) {
+    int fd;
+    char const *driver;
+    utime_t total, max;
+    if (!profile_worst(&fd, &driver, &total, &max))
+        return snprintf(buf, size, "worst    none");
+    utime_t elapsed = profile.since ? profile_now() - profile.since : 0;
+    return snprintf(buf, size, "worst    %s fd %d total=%lums (%.1f%%) max=%luus", driver ? driver : "?", fd,
+                    total / 1000, elapsed ? total * 100.0 / elapsed : 0.0, max);
+}
+
+// Time since collection started, or was last reset
+
+utime_t
+profile_since() {
+    return profile.since ? profile_now() - profile.since : 0;
+}
+
+void
+profile_reset() {
+    memset(&profile, '\0', sizeof(profile));
+    profile.since = profile_now();
+}
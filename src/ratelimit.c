@@ -0,0 +1,50 @@
+//
+// Token bucket rate limiter
+//
+
+#include <string.h>
+
+#include "ratelimit.h"
+
+#define USECS_PER_SEC 1000000UL
+
+
+void
+ratelimit_init(ratelimit_t *rl) {
+    memset(rl, '\0', sizeof(ratelimit_t));
+}
+
+
+// Add the tokens earned since the last call, returns non-zero if any are
+// available. A rate of 0 is unlimited, and a limit set later starts with
+// a full bucket rather than any debt run up meanwhile
+
+int
+ratelimit_ready(ratelimit_t *rl, unsigned long rate, unsigned long burst, utime_t now) {
+    if (rate == 0) {
+        ratelimit_init(rl);
+        return 1;
+    }
+    if (rl->last == 0 || now < rl->last) {
+        rl->tokens = (long)burst;
+        rl->last = now;
+    } else {
+        unsigned long earned = (unsigned long)((unsigned long long)(now - rl->last) * rate / USECS_PER_SEC);
+        if (earned > 0) {
+            rl->tokens += (long)earned;
+            // advance only by the time accounted for, keeping the remainder
+            rl->last += (utime_t)((unsigned long long)earned * USECS_PER_SEC / rate);
+        }
+        if (rl->tokens >= (long)burst) {
+            rl->tokens = (long)burst;
+            rl->last = now;
+        }
+    }
+    return rl->tokens > 0;
+}
+
+
+void
+ratelimit_charge(ratelimit_t *rl, unsigned long tokens) {
+    rl->tokens -= (long)tokens;
+}
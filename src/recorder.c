@@ -0,0 +1,177 @@
+//
+// Flight recorder
+//
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/fcntl.h>
+#include <sys/time.h>
+
+#include "recorder.h"
+#include "iodev.h"
+
+
+static struct {
+    uint64_t head;              // total events recorded, next slot is head % RECORDER_EVENTS
+    char path[PATH_MAX];        // default dump file
+    rec_event_t ring[RECORDER_EVENTS];
+} recorder;
+
+// Claim the next slot and fill it, the writer never waits for anything
+
+void
+recorder_event(int type, int fd, int a, long value) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    uint64_t slot = __atomic_fetch_add(&recorder.head, 1, __ATOMIC_RELAXED);
+    rec_event_t *event = &recorder.ring[slot & (RECORDER_EVENTS - 1)];
+    event->time = (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+    event->type = (uint8_t)type;
+    event->a = (uint8_t)(a < 0 ? 0 : a > UINT8_MAX ? UINT8_MAX : a);
+    event->fd = (int16_t)fd;
+    event->value = (int32_t)(value < INT32_MIN ? INT32_MIN : value > INT32_MAX ? INT32_MAX : value);
+}
+
+
+void
+recorder_init(char const *path) {
+    if (path != NULL)
+        snprintf(recorder.path, sizeof(recorder.path), "%s", path);
+    else
+        snprintf(recorder.path, sizeof(recorder.path), "/tmp/hdmi2usbd-%ld.rec", (long)getpid());
+}
+
+char const *
+recorder_path() {
+    if (!*recorder.path)
+        recorder_init(NULL);
+    return recorder.path;
+}
+
+static int
+recorder_write(int fd, void const *data, size_t length) {
+    for (char const *p = data; length > 0; ) {
+        ssize_t rc = write(fd, p, length);
+        if (rc <= 0)
+            return -1;
+        p += rc;
+        length -= (size_t)rc;
+    }
+    return 0;
+}
+
+// Write the ring to a file, oldest event first. Only system calls are
+// used here (no stdio or allocation), so this is safe in a signal handler
+// provided that recorder_init() was called beforehand.
+
+int
+recorder_dump(char const *path) {
+    if (path == NULL)
+        path = *recorder.path ? recorder.path : "/tmp/hdmi2usbd.rec";
+    int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if (fd == -1)
+        return -1;
+    uint64_t head = __atomic_load_n(&recorder.head, __ATOMIC_ACQUIRE);
+    uint32_t header[2] = {
+        sizeof(rec_event_t),
+        (uint32_t)(head < RECORDER_EVENTS ? head : RECORDER_EVENTS)
+    };
+    size_t first = head < RECORDER_EVENTS ? 0 : (size_t)(head & (RECORDER_EVENTS - 1));
+    int rc = recorder_write(fd, RECORDER_MAGIC, sizeof(RECORDER_MAGIC) - 1);
+    if (rc == 0)
+        rc = recorder_write(fd, header, sizeof(header));
+    if (rc == 0)   // from the oldest event to the end of the ring, then the rest
+        rc = recorder_write(fd, recorder.ring + first, (header[1] - first) * sizeof(rec_event_t));
+    if (rc == 0 && first)
+        rc = recorder_write(fd, recorder.ring, first * sizeof(rec_event_t));
+    close(fd);
+    return rc;
+}
+
+
+// Timeline rendering
+
+static char const *event_names[REC_EVENTS] = {
+    "none", "wakeup", "read", "write", "state", "queue", "send", "dump", "stall", "hold"
+};
+
+// enum sessionHold
+static char const *hold_names[] = { "resumed", "rate limited", "queue full" };
+
+static char const *state_names[] = {
+    [IODEV_NONE] = "NONE",
+    [IODEV_INACTIVE] = "INACTIVE",
+    [IODEV_CLOSED] = "CLOSED",
+    [IODEV_CLOSING] = "CLOSING",
+    [IODEV_PENDING] = "PENDING",
+    [IODEV_OPEN] = "OPEN",
+    [IODEV_CONNECTED] = "CONNECTED",
+    [IODEV_ACTIVE] = "ACTIVE",
+};
+
+static char const *
+state_name(long state) {
+    return state >= 0 && state < (long)(sizeof(state_names) / sizeof(state_names[0])) ? state_names[state] : "?";
+}
+
+static void
+recorder_print(FILE *out, rec_event_t const *event, int64_t previous) {
+    char when[32];
+    time_t secs = (time_t)(event->time / 1000000);
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&secs));
+    fprintf(out, "%s.%06ld %+9lldus %-6s ", when, (long)(event->time % 1000000),
+            (long long)(previous ? event->time - previous : 0),
+            event->type < REC_EVENTS ? event_names[event->type] : "?");
+    switch (event->type) {
+        case REC_WAKEUP:
+            fprintf(out, "%d ready of %u active\n", (int)event->value, event->a);
+            break;
+        case REC_READ:
+        case REC_WRITE:
+        case REC_QUEUE:
+        case REC_SEND:
+            fprintf(out, "fd %d: %d bytes\n", event->fd, (int)event->value);
+            break;
+        case REC_STATE:
+            fprintf(out, "fd %d: %s -> %s\n", event->fd, state_name(event->a), state_name(event->value));
+            break;
+        case REC_DUMP:
+            fprintf(out, "signal %d\n", (int)event->value);
+            break;
+        case REC_STALL:
+            fprintf(out, "fd %d: loop stalled for %dms\n", event->fd, (int)event->value);
+            break;
+        case REC_HOLD:
+            fprintf(out, "fd %d: reads %s, %d bytes waiting\n", event->fd,
+                    event->a < sizeof(hold_names) / sizeof(hold_names[0]) ? hold_names[event->a] : "held", (int)event->value);
+            break;
+        default:
+            fprintf(out, "type %u fd %d a %u value %d\n", event->type, event->fd, event->a, (int)event->value);
+            break;
+    }
+}
+
+// Render a dump as text, one line per event with the time since the one
+// before it. Returns the number of events or -1 if the input is not a dump.
+
+long
+recorder_decode(FILE *in, FILE *out) {
+    char magic[sizeof(RECORDER_MAGIC) - 1];
+    uint32_t header[2];
+    if (fread(magic, sizeof(magic), 1, in) != 1 || memcmp(magic, RECORDER_MAGIC, sizeof(magic)) != 0 ||
+            fread(header, sizeof(header), 1, in) != 1 || header[0] != sizeof(rec_event_t))
+        return -1;
+    long count = 0;
+    int64_t previous = 0;
+    rec_event_t event;
+    while (count < (long)header[1] && fread(&event, sizeof(event), 1, in) == 1) {
+        recorder_print(out, &event, previous);
+        previous = event.time;
+        count++;
+    }
+    return count;
+}
@@ -0,0 +1,278 @@
+//
+// Chained buffer of reference counted segments
+//
+// Segments and chain references are allocated a slab at a time and
+// recycled through free lists; slabs are never returned to the system.
+// A segment is released to its free list when its last reference goes.
+// Only the chain whose reference ends at the segment's fill point may
+// append to it, as bytes beyond other references are never seen.
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "segbuf.h"
+
+#define SEGBUF_ALLOC    0x5e6b0f5
+
+
+static segment_t *free_segments = NULL;
+static segref_t *free_refs = NULL;
+static size_t segments_allocated = 0;
+static size_t segments_free = 0;
+
+
+size_t segbuf_segments_allocated(void) { return segments_allocated; }
+size_t segbuf_segments_free(void) { return segments_free; }
+
+
+static segment_t *
+segment_alloc(void) {
+    if (free_segments == NULL) {
+        segment_t *slab = calloc(SEGBUF_PERSLAB, sizeof(segment_t));
+        if (slab == NULL)
+            return NULL;
+        for (int i = 0; i < SEGBUF_PERSLAB; i++) {
+            slab[i].next = free_segments;
+            free_segments = &slab[i];
+        }
+        segments_allocated += SEGBUF_PERSLAB;
+        segments_free += SEGBUF_PERSLAB;
+    }
+    segment_t *segment = free_segments;
+    free_segments = segment->next;
+    --segments_free;
+    segment->next = NULL;
+    segment->refs = 0;
+    segment->length = 0;
+    return segment;
+}
+
+
+static void
+segment_release(segment_t *segment) {
+    if (--segment->refs == 0) {
+        segment->next = free_segments;
+        free_segments = segment;
+        ++segments_free;
+    }
+}
+
+
+static segref_t *
+segref_alloc(segment_t *segment, size_t offset, size_t length) {
+    if (free_refs == NULL) {
+        segref_t *slab = calloc(SEGBUF_PERSLAB, sizeof(segref_t));
+        if (slab == NULL)
+            return NULL;
+        for (int i = 0; i < SEGBUF_PERSLAB; i++) {
+            slab[i].next = free_refs;
+            free_refs = &slab[i];
+        }
+    }
+    segref_t *ref = free_refs;
+    free_refs = ref->next;
+    ref->next = NULL;
+    ref->segment = segment;
+    ref->offset = offset;
+    ref->length = length;
+    segment->refs++;
+    return ref;
+}
+
+
+static void
+segref_release(segref_t *ref) {
+    segment_release(ref->segment);
+    ref->segment = NULL;
+    ref->next = free_refs;
+    free_refs = ref;
+}
+
+
+static void
+segbuf_link(segbuf_t *segbuf, segref_t *ref) {
+    if (segbuf->tail != NULL)
+        segbuf->tail->next = ref;
+    else
+        segbuf->head = ref;
+    segbuf->tail = ref;
+}
+
+
+segbuf_t *
+segbuf_init(segbuf_t *segbuf, size_t max) {
+    if (segbuf != NULL)
+        memset(segbuf, '\0', sizeof(segbuf_t));
+    else {
+        segbuf = calloc(1, sizeof(segbuf_t));
+        segbuf->alloc = SEGBUF_ALLOC;
+    }
+    segbuf->max = max;
+    return segbuf;
+}
+
+
+void
+segbuf_free(segbuf_t *segbuf) {
+    if (segbuf != NULL) {
+        segbuf_flush(segbuf);
+        if (segbuf->alloc == SEGBUF_ALLOC) {
+            segbuf->alloc = 0;
+            free(segbuf);
+        }
+    }
+}
+
+
+void
+segbuf_flush(segbuf_t *segbuf) {
+    segbuf_consume(segbuf, segbuf->used);
+}
+
+
+size_t segbuf_used(segbuf_t *segbuf) { return segbuf->used; }
+
+
+size_t
+segbuf_available(segbuf_t *segbuf) {
+    if (segbuf->max == 0)
+        return (size_t)-1 - segbuf->used;
+    return segbuf->used < segbuf->max ? segbuf->max - segbuf->used : 0;
+}
+
+
+size_t
+segbuf_count(segbuf_t *segbuf) {
+    size_t count = 0;
+    for (segref_t *ref = segbuf->head; ref != NULL; ref = ref->next)
+        count++;
+    return count;
+}
+
+
+// copy data into the chain, filling the tail segment first if it can be appended to
+size_t
+segbuf_put(segbuf_t *segbuf, void const *data, size_t len) {
+    size_t avail = segbuf_available(segbuf);
+    if (len > avail)    // partial put only if insufficient space
+        len = avail;
+    size_t done = 0;
+    while (done < len) {
+        segref_t *ref = segbuf->tail;
+        if (ref == NULL || ref->offset + ref->length != ref->segment->length || ref->segment->length == SEGBUF_SEGSIZE) {
+            segment_t *segment = segment_alloc();
+            if (segment == NULL || (ref = segref_alloc(segment, 0, 0)) == NULL) {
+                if (segment != NULL) {
+                    segment->refs = 1;
+                    segment_release(segment);
+                }
+                break;
+            }
+            segbuf_link(segbuf, ref);
+        }
+        segment_t *segment = ref->segment;
+        size_t chunk = SEGBUF_SEGSIZE - segment->length;
+        if (chunk > len - done)
+            chunk = len - done;
+        memcpy(segment->data + segment->length, (unsigned char const *)data + done, chunk);
+        segment->length += chunk;
+        ref->length += chunk;
+        done += chunk;
+    }
+    segbuf->used += done;
+    return done;
+}
+
+
+// queue the first len bytes of src on dst as well, by reference
+size_t
+segbuf_share(segbuf_t *dst, segbuf_t *src, size_t len) {
+    size_t avail = segbuf_available(dst);
+    if (len > avail)
+        len = avail;
+    if (len > src->used)
+        len = src->used;
+    size_t done = 0;
+    for (segref_t *ref = src->head; ref != NULL && done < len; ref = ref->next) {
+        size_t chunk = ref->length;
+        if (chunk > len - done)
+            chunk = len - done;
+        segref_t *copy = segref_alloc(ref->segment, ref->offset, chunk);
+        if (copy == NULL)
+            break;
+        segbuf_link(dst, copy);
+        done += chunk;
+    }
+    dst->used += done;
+    return done;
+}
+
+
+// as segbuf_share(), but all len bytes or none, for data such as a framed
+// message that is of no use in part
+size_t
+segbuf_share_whole(segbuf_t *dst, segbuf_t *src, size_t len) {
+    if (len > segbuf_available(dst) || len > src->used)
+        return 0;
+    return segbuf_share(dst, src, len);
+}
+
+
+size_t
+segbuf_peek(segbuf_t *segbuf, void *buf, size_t len) {
+    size_t done = 0;
+    for (segref_t *ref = segbuf->head; ref != NULL && done < len; ref = ref->next) {
+        size_t chunk = ref->length;
+        if (chunk > len - done)
+            chunk = len - done;
+        memcpy((unsigned char *)buf + done, ref->segment->data + ref->offset, chunk);
+        done += chunk;
+    }
+    return done;
+}
+
+
+size_t
+segbuf_get(segbuf_t *segbuf, void *buf, size_t len) {
+    if (buf != NULL)
+        len = segbuf_peek(segbuf, buf, len);
+    return segbuf_consume(segbuf, len);
+}
+
+
+// remove data from the front of the chain, releasing references as they empty
+size_t
+segbuf_consume(segbuf_t *segbuf, size_t len) {
+    if (len > segbuf->used)
+        len = segbuf->used;
+    size_t done = 0;
+    while (done < len) {
+        segref_t *ref = segbuf->head;
+        size_t chunk = ref->length;
+        if (chunk > len - done) {
+            chunk = len - done;
+            ref->offset += chunk;
+            ref->length -= chunk;
+        } else {
+            segbuf->head = ref->next;
+            if (segbuf->head == NULL)
+                segbuf->tail = NULL;
+            segref_release(ref);
+        }
+        done += chunk;
+    }
+    segbuf->used -= done;
+    return done;
+}
+
+
+// describe the start of the chain for writev(2), returns the number of iovecs filled
+int
+segbuf_iov(segbuf_t *segbuf, struct iovec *iov, int maxiov) {
+    int count = 0;
+    for (segref_t *ref = segbuf->head; ref != NULL && count < maxiov; ref = ref->next, count++) {
+        iov[count].iov_base = ref->segment->data + ref->offset;
+        iov[count].iov_len = ref->length;
+    }
+    return count;
+}
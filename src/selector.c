@@ -11,8 +11,13 @@
 
 #include "selector.h"
 #include "nettcp.h"
+#include "netudp.h"
 #include "serial.h"
+#define LOG_MODULE LOG_SELECTOR
 #include "logging.h"
+#include "recorder.h"
+#include "profile.h"
+#include "watchdog.h"
 
 
 #define SELECTOR_ALLOC 0xa51d15a
@@ -48,6 +53,22 @@ selector_free(selector_t *selector) {
 }
 
 
+void
+selector_set_hook(selector_t *selector, selector_hook_t hook, void *arg) {
+    selector->hook = hook;
+    selector->hook_arg = arg;
+}
+
+
+// Devices waiting on time rather than I/O ask to be woken by this time
+// the earliest requested in each pass of the loop applies
+void
+selector_set_deadline(selector_t *selector, utime_t when) {
+    if (selector->deadline == 0 || when < selector->deadline)
+        selector->deadline = when;
+}
+
+
 size_t
 selector_device_count(selector_t *selector) {
     return array_count(&selector->devs);
@@ -60,6 +81,12 @@ selector_get_device(selector_t *selector, size_t index) {
 }
 
 
+size_t
+selector_device_index(selector_t *selector, iodev_t *dev) {
+    return array_index(&selector->devs, dev);
+}
+
+
 iodev_t *
 selector_set(selector_t *selector, iodev_t *dev) {
     dev->selector = selector;
@@ -72,14 +99,16 @@ selector_new_device(selector_t *selector) {
     // first, look for an inactive slot
     for (size_t index =1; index < array_count(&selector->devs); ++index) {
         iodev_t *dev = array_get(&selector->devs, index);
-        if (iodev_getstate(dev) == IODEV_INACTIVE)
+        if (iodev_getstate(dev) == IODEV_INACTIVE) {
+            iodev_free(dev);    // release what the previous occupant left behind
             return dev;
+        }
     }
     // otherwise, append new one at end
     return (iodev_t *)array_new(&selector->devs);
 }
 
-// Four device type creators
+// Device type creators
 
 // Allocate a serial iodev
 iodev_t *
@@ -89,8 +118,8 @@ selector_new_device_serial(selector_t *selector, char const *devname, unsigned l
 
 // Allocate a listen socket iodev
 iodev_t *
-selector_new_device_listen(selector_t *selector, struct sockaddr *local, size_t bufsize) {
-    return selector_set(selector, tcp_create_listen(selector_new_device(selector), local, bufsize));
+selector_new_device_listen(selector_t *selector, struct sockaddr *local, size_t bufsize, size_t bufmax) {
+    return selector_set(selector, tcp_create_listen(selector_new_device(selector), local, bufsize, bufmax));
 }
 
 // Allocate a socket connection iodev
@@ -101,8 +130,14 @@ selector_new_device_connect(selector_t *selector, struct sockaddr *remote, size_
 
 // Allocate an accepted socket connection iodev
 iodev_t *
-selector_new_device_accept(selector_t *selector, int fd, struct sockaddr *remote, size_t bufsize) {
-    return selector_set(selector, tcp_create_accepted(selector_new_device(selector), fd, remote, bufsize));
+selector_new_device_accept(selector_t *selector, int fd, struct sockaddr *remote, size_t bufsize, size_t bufmax) {
+    return selector_set(selector, tcp_create_accepted(selector_new_device(selector), fd, remote, bufsize, bufmax));
+}
+
+// Allocate a udp (multicast) publisher iodev
+iodev_t *
+selector_new_device_publish(selector_t *selector, struct sockaddr *group, int ttl, size_t bufsize) {
+    return selector_set(selector, udp_create_publish(selector_new_device(selector), group, ttl, bufsize));
 }
 
 
@@ -135,13 +170,19 @@ selector_dispatch(selector_t *selector, int ready, fd_set *r, fd_set *w, fd_set
     int rc = 0;
     array_t *devs = &selector->devs;
     for (size_t index =0; ready > 0 && index < array_count(devs); ++index) {
+        // handlers may add devices, so the array can move under them
         iodev_t *dev = array_get(devs, index);
+        int fd = iodev_getfd(dev), was_ready = ready;
+        utime_t start = profile_now();
+        watchdog_enter("handler", fd, iodev_driver(dev));
         if (dev->is_set(dev, r))
-            ready--, dev->read_handler(dev);
+            ready--, dev->read_handler(dev), dev = array_get(devs, index);
         if (dev->is_set(dev, w))
-            ready--, dev->write_handler(dev);
+            ready--, dev->write_handler(dev), dev = array_get(devs, index);
         if (dev->is_set(dev, x))
             ready--, dev->except_handler(dev);
+        if (ready != was_ready)
+            profile_device(fd, iodev_driver(dev), profile_now() - start);
     }
     return rc;
 }
@@ -167,24 +208,53 @@ selector_loop(selector_t *selector, unsigned long timeout) {
     int rc = 0;
     fd_set rd_set, wr_set, ex_set;
 
-    FD_ZERO(&rd_set);
-    FD_ZERO(&wr_set);
-    FD_ZERO(&ex_set);
-
     while (rc == 0) {
-        // set up fd_sets
+        // set up fd_sets, from scratch as devices closed since the
+        // last pass can no longer clear their own descriptors
+        FD_ZERO(&rd_set);
+        FD_ZERO(&wr_set);
+        FD_ZERO(&ex_set);
+        selector->deadline = 0;
+        utime_t start = profile_now();
+        watchdog_enter("ioset", -1, NULL);
         selector_status_t stat = selector_ioset(selector, &rd_set, &wr_set, &ex_set);
         if (stat.active_count == 0)
             break;
+        utime_t mark = profile_mark(PROF_IOSET, start);
         struct timeval to = {
             .tv_sec = timeout / 1000L,
             .tv_usec = (unsigned)((timeout % 1000) * 1000)
         };
-        int rdy = select(stat.highest_fd + 1, &rd_set, &wr_set, &ex_set, timeout == 0 ? NULL : &to);
-        if (rdy > 0)
+        int has_timeout = timeout != 0;
+        if (selector->deadline) {
+            // wake up early if a device asked for it
+            utime_t now = timer_getmillitime();
+            utime_t wait = selector->deadline > now ? selector->deadline - now : 0;
+            if (!has_timeout || wait < (utime_t)to.tv_sec * 1000000UL + (utime_t)to.tv_usec) {
+                to.tv_sec = (time_t)(wait / 1000000UL);
+                to.tv_usec = (suseconds_t)(wait % 1000000UL);
+                has_timeout = 1;
+            }
+        }
+        watchdog_idle();
+        int rdy = select(stat.highest_fd + 1, &rd_set, &wr_set, &ex_set, has_timeout ? &to : NULL);
+        watchdog_enter("dispatch", -1, NULL);
+        mark = profile_mark(PROF_SELECT, mark);
+        recorder_event(REC_WAKEUP, -1, (int)stat.active_count, rdy);
+        log_trace("select: %d of %d devices ready", rdy, stat.active_count);
+        if (rdy > 0) {
             rc = selector_dispatch(selector, rdy, &rd_set, &wr_set, &ex_set);
-        else {
-            if (rdy < 0) {
+            mark = profile_mark(PROF_HANDLERS, mark);
+            // let the application act on what was just read before selecting again
+            if (selector->hook != NULL) {
+                watchdog_enter("process", -1, NULL);
+                rc = selector->hook(selector, rc, selector->hook_arg);
+                profile_mark(PROF_PROCESS, mark);
+            }
+            profile_mark(PROF_LOOP, start);
+        } else {
+            profile_mark(PROF_LOOP, start);
+            if (rdy < 0 && errno != EINTR) {   // signals are left to the caller
                 int select_errno = errno;
                 selector_debug(selector, rdy, select_errno, &rd_set, &wr_set, &ex_set);
                 log_warning("select error(%d): %s", select_errno, strerror(select_errno));
@@ -192,5 +262,6 @@ selector_loop(selector_t *selector, unsigned long timeout) {
             break;
         }
     }
+    watchdog_enter("main", -1, NULL);   // back to the caller
     return rc;
 }
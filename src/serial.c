@@ -11,8 +11,9 @@
 #include <unistd.h>
 
 #include "serial.h"
-
-#define CHARACTER_PACING   5000
+#define LOG_MODULE LOG_SERIAL
+#include "logging.h"
+#include "recorder.h"
 
 // Miscellaneous serial functions
 
@@ -122,6 +123,7 @@ serial_open(iodev_t *dev) {
 #endif
                 // set serial devices directly to "connected" state after successfully opened
                 iodev_setstate(dev, IODEV_CONNECTED);
+                log_debug("serial %s open on fd %d", cfg->portname, dev->fd);
                 return dev->fd;
             }
         }
@@ -132,6 +134,19 @@ serial_open(iodev_t *dev) {
 }
 
 
+// Take over a port already open and configured (by another process),
+// without reopening or resetting it
+
+iodev_t *
+serial_adopt(iodev_t *dev, int fd, struct termios const *termctl) {
+    serial_cfg_t *cfg = serial_getcfg(dev);
+    *cfg->termctl = *termctl;
+    dev->fd = fd;
+    iodev_setstate(dev, IODEV_CONNECTED);
+    return dev;
+}
+
+
 static void
 serial_close(iodev_t *dev, int flags) {
     serial_cfg_t *cfg = serial_getcfg(dev);
@@ -149,11 +164,12 @@ serial_close(iodev_t *dev, int flags) {
         case IODEV_CLOSING:
             // check to see if we have sent all data
             if (flags & IOFLAG_FLUSH) {
-                if (buffer_available(iodev_tbuf(dev)))
+                if (buffer_used(iodev_tbuf(dev)))
                     break;  // still data in buffer, retry later
                 tcflush(dev->fd, TCOFLUSH);
             }
         case IODEV_PENDING: // never flush if only pending
+            log_debug("serial %s closed", cfg->portname);
             close(dev->fd);
             dev->fd = -1;
             iodev_setstate(dev, IODEV_CLOSED);
@@ -177,12 +193,14 @@ serial_write_handler(iodev_t *dev) {
             unsigned char ch;
             buffer_peek(&dev->tbuf, &ch, 1);
             rc = write(dev->fd, &ch, 1);
+            recorder_event(REC_WRITE, dev->fd, 0, rc);
+            log_trace("serial write '%c'", ch >= ' ' && ch < 0x7f ? ch : '.');
             if (rc < 0) {
                 iodev_error("iodev %s write error(%d): %s", cfg->name, errno, strerror(errno));
                 dev->close(dev, IODEV_NONE);
             } else { // advance the counter by amount written
                 buffer_get(&dev->tbuf, NULL, (size_t)rc);
-                timer_reset(&scfg->pacer, CHARACTER_PACING);
+                timer_reset(&scfg->pacer, scfg->pacing);
             }
         }
     }
@@ -205,12 +223,14 @@ iodev_t *
 serial_create(iodev_t *dev, char const *devname, unsigned long baudrate, size_t bufsize) {
     // First create the basic (slightly larger) config
     iodev_cfg_t *cfg = iodev_alloc_cfg(sizeof(serial_cfg_t), "serial", NULL);
+    cfg->logmodule = LOG_SERIAL;
     iodev_t *serial = iodev_init(dev, cfg, bufsize);
 
     // Initialise the extras
     serial_cfg_t *scfg = serial_getcfg(serial);
     scfg->portname = devname;
     scfg->baudrate = baudrate;
+    scfg->pacing = CHARACTER_PACING;
 
     // Set up the initial termios
     scfg->termctl = serial_termios(calloc(1, sizeof(struct termios)), (speed_t)baudrate);
@@ -0,0 +1,100 @@
+//
+// Service manager integration (systemd protocol, without libsystemd)
+//
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "service.h"
+
+
+// Return the number of sockets passed by the service manager (LISTEN_FDS),
+// if they are meant for this process (LISTEN_PID). They are marked close
+// on exec, and the variables optionally removed so that they are not
+// inherited by child processes.
+
+int
+service_listen_fds(int unset_environment) {
+    int count = 0;
+    char const *pid = getenv("LISTEN_PID"), *fds = getenv("LISTEN_FDS");
+    if (pid != NULL && fds != NULL && strtol(pid, NULL, 10) == (long)getpid()) {
+        char *endptr;
+        long n = strtol(fds, &endptr, 10);
+        if (endptr != fds && *endptr == '\0' && n > 0 && n < 1024)
+            count = (int)n;
+        for (int fd = SERVICE_LISTEN_FDS_START; fd < SERVICE_LISTEN_FDS_START + count; fd++) {
+            int flags = fcntl(fd, F_GETFD);
+            if (flags >= 0)
+                fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+        }
+    }
+    if (unset_environment) {
+        unsetenv("LISTEN_PID");
+        unsetenv("LISTEN_FDS");
+        unsetenv("LISTEN_FDNAMES");
+    }
+    return count;
+}
+
+
+// Send a state notification, one or more newline separated "NAME=value"
+// assignments. Returns 1 if sent, 0 if there is no service manager to
+// notify, or -1 on error (errno is set).
+
+int
+service_notify(char const *fmt, ...) {
+    char const *path = getenv("NOTIFY_SOCKET");
+    if (path == NULL || (*path != '/' && *path != '@'))
+        return 0;
+    struct sockaddr_un addr;
+    size_t pathlen = strlen(path);
+    if (pathlen >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memset(&addr, '\0', sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, pathlen);
+    if (*path == '@')
+        addr.sun_path[0] = '\0';    // abstract namespace
+    char state[256];
+    va_list args;
+    va_start(args, fmt);
+    int length = vsnprintf(state, sizeof(state), fmt, args);
+    va_end(args);
+    if (length < 0 || (size_t)length >= sizeof(state)) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (fd == -1)
+        return -1;
+    ssize_t sent = sendto(fd, state, (size_t)length, 0, (struct sockaddr *)&addr,
+                          (socklen_t)(offsetof(struct sockaddr_un, sun_path) + pathlen));
+    int error = errno;
+    close(fd);
+    errno = error;
+    return sent == length ? 1 : -1;
+}
+
+
+// Return the service manager's watchdog interval (us), if it expects keep
+// alive notifications from this process (WATCHDOG_PID, when set), or 0
+
+unsigned long
+service_watchdog_usec() {
+    char const *usec = getenv("WATCHDOG_USEC"), *pid = getenv("WATCHDOG_PID");
+    if (usec == NULL || (pid != NULL && strtol(pid, NULL, 10) != (long)getpid()))
+        return 0;
+    char *endptr;
+    unsigned long interval = strtoul(usec, &endptr, 10);
+    return endptr != usec && *endptr == '\0' ? interval : 0;
+}
@@ -0,0 +1,68 @@
+//
+// Per-connection client session state
+//
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "session.h"
+
+#define SESSION_ALLOC   0x5e5a10c
+
+
+session_t *
+session_init(session_t *session) {
+    if (session != NULL)
+        memset(session, '\0', sizeof(session_t));
+    else {
+        session = calloc(1, sizeof(session_t));
+        session->alloc = SESSION_ALLOC;
+    }
+    session->proto = SESSION_NEW;
+    session->filter = -1;
+    ratelimit_init(&session->input);
+    array_init(&session->reqids, sizeof(uint32_t), 8);
+    return session;
+}
+
+
+void
+session_free(session_t *session) {
+    if (session != NULL) {
+        array_free(&session->reqids);
+        if (session->alloc == SESSION_ALLOC) {
+            session->alloc = 0;
+            free(session);
+        }
+    }
+}
+
+
+int session_proto(session_t *session) { return session->proto; }
+void session_setproto(session_t *session, int proto) { session->proto = proto; }
+int session_filter(session_t *session) { return session->filter; }
+void session_setfilter(session_t *session, int filter) { session->filter = filter; }
+int session_compress(session_t *session) { return session->compress; }
+void session_setcompress(session_t *session, int level) { session->compress = level; }
+int session_held(session_t *session) { return session->held; }
+void session_sethold(session_t *session, int held) { session->held = held; }
+int session_discarding(session_t *session) { return session->discarding; }
+void session_setdiscarding(session_t *session, int discarding) { session->discarding = discarding; }
+size_t session_requests(session_t *session) { return array_count(&session->reqids); }
+
+
+void
+session_push_request(session_t *session, uint32_t reqid) {
+    array_append(&session->reqids, &reqid);
+}
+
+
+// remove the oldest queued request id, returns 0 if there was none
+int
+session_pop_request(session_t *session, uint32_t *reqid) {
+    if (array_count(&session->reqids) == 0)
+        return 0;
+    *reqid = *(uint32_t *)array_get(&session->reqids, 0);
+    array_delete(&session->reqids, 0);
+    return 1;
+}
@@ -12,6 +12,7 @@
 
 #define STRSTORE_ALLOC  0x5a1dc51
 #define STRSTORE_SIZE   2048
+#define STRSTORE_MININC 128     // growth increment for stores created empty
 
 stringstore_t *
 stringstore_init(stringstore_t *pstore) {
@@ -29,8 +30,9 @@ stringstore_init_n(stringstore_t *pstore, size_t size) {
         pstore->alloc = STRSTORE_ALLOC;
     }
     pstore->ss_used = 0;
-    pstore->ss_inc = pstore->ss_size = size ? size : STRSTORE_ALLOC;
-    pstore->ss_buff = calloc(1, size);
+    pstore->ss_size = size;
+    pstore->ss_inc = size ? size : STRSTORE_MININC;
+    pstore->ss_buff = size ? calloc(1, size) : NULL;
     return pstore;
 }
 
@@ -98,6 +100,21 @@ strstore_resize(stringstore_t *pstore, size_t to_length) {
     return to_length;
 }
 
+// Release the buffer space of an empty store, it is reallocated on demand
+// returns the number of bytes released
+
+size_t
+stringstore_trim(stringstore_t *pstore) {
+    size_t size = 0;
+    if (pstore->ss_used == 0 && pstore->ss_buff != NULL) {
+        size = pstore->ss_size;
+        free(pstore->ss_buff);
+        pstore->ss_buff = NULL;
+        pstore->ss_size = 0;
+    }
+    return size;
+}
+
 // Shortcut to resize to current used length
 
 size_t
@@ -235,3 +252,8 @@ stringstore_consume(stringstore_t *pstore, size_t bytes) {
     }
 }
 
+void
+stringstore_truncate(stringstore_t *pstore, size_t length) {
+    if (length < stringstore_length(pstore))
+        pstore->ss_used = length;
+}
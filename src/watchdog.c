@@ -0,0 +1,177 @@
+//
+// Event loop stall detection
+//
+
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "watchdog.h"
+#include "profile.h"
+#include "recorder.h"
+#include "service.h"
+
+#define WATCHDOG_MINTICK 10000UL    // check at most every 10ms
+
+
+static struct {
+    pthread_t thread;
+    int running;
+    int stop;
+    utime_t deadline;           // a phase running longer than this is a stall (us)
+    utime_t notify;             // service manager keep-alive interval (us, 0 = none)
+    // loop status, written only by the loop
+    int busy;                   // 0 = waiting in select
+    utime_t since;              // when the current phase started
+    char const *phase;
+    char const *driver;
+    int fd;
+    // stalls, guarded by lock
+    pthread_mutex_t lock;
+    utime_t flagged;            // start of the last phase found stalled
+    unsigned long stalls;       // detected
+    unsigned long reported;     // returned by watchdog_stalled()
+    watchdog_stall_t last;
+} watchdog = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .fd = -1,
+};
+
+
+// The loop's side, only a few stores unless the phase ending was stalled
+
+static void
+watchdog_set(int busy, char const *phase, int fd, char const *driver) {
+    if (!watchdog.running)
+        return;
+    utime_t now = profile_now();
+    if (__atomic_load_n(&watchdog.flagged, __ATOMIC_ACQUIRE) == watchdog.since) {
+        pthread_mutex_lock(&watchdog.lock);     // stalled, now we know for how long
+        if (watchdog.flagged == watchdog.since)
+            watchdog.last.duration = now - watchdog.since;
+        pthread_mutex_unlock(&watchdog.lock);
+    }
+    __atomic_store_n(&watchdog.busy, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&watchdog.phase, phase, __ATOMIC_RELAXED);
+    __atomic_store_n(&watchdog.fd, fd, __ATOMIC_RELAXED);
+    __atomic_store_n(&watchdog.driver, driver, __ATOMIC_RELAXED);
+    __atomic_store_n(&watchdog.since, now, __ATOMIC_RELAXED);
+    __atomic_store_n(&watchdog.busy, busy, __ATOMIC_RELEASE);
+}
+
+void
+watchdog_idle() {
+    watchdog_set(0, "select", -1, NULL);
+}
+
+void
+watchdog_enter(char const *phase, int fd, char const *driver) {
+    watchdog_set(1, phase, fd, driver);
+}
+
+
+// Returns 1 and the details for each stall detected, once the loop
+// has moved past it
+
+int
+watchdog_stalled(watchdog_stall_t *stall) {
+    int rc = 0;
+    if (__atomic_load_n(&watchdog.stalls, __ATOMIC_ACQUIRE) != watchdog.reported) {
+        pthread_mutex_lock(&watchdog.lock);
+        if (watchdog.flagged != watchdog.since) {
+            *stall = watchdog.last;
+            watchdog.reported = watchdog.stalls;
+            rc = 1;
+        }
+        pthread_mutex_unlock(&watchdog.lock);
+    }
+    return rc;
+}
+
+unsigned long
+watchdog_stalls() {
+    return __atomic_load_n(&watchdog.stalls, __ATOMIC_ACQUIRE);
+}
+
+
+// The watchdog's side
+
+static int
+watchdog_check(utime_t now) {
+    if (!__atomic_load_n(&watchdog.busy, __ATOMIC_ACQUIRE))
+        return 1;
+    utime_t since = __atomic_load_n(&watchdog.since, __ATOMIC_RELAXED);
+    if (now < since || now - since <= watchdog.deadline)
+        return 1;
+    pthread_mutex_lock(&watchdog.lock);
+    if (watchdog.flagged != since) {
+        watchdog.last.phase = __atomic_load_n(&watchdog.phase, __ATOMIC_RELAXED);
+        watchdog.last.driver = __atomic_load_n(&watchdog.driver, __ATOMIC_RELAXED);
+        watchdog.last.fd = __atomic_load_n(&watchdog.fd, __ATOMIC_RELAXED);
+        recorder_event(REC_STALL, watchdog.last.fd, 0, (long)((now - since) / 1000));
+        __atomic_store_n(&watchdog.flagged, since, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&watchdog.stalls, 1, __ATOMIC_RELEASE);
+    }
+    watchdog.last.duration = now - since;
+    pthread_mutex_unlock(&watchdog.lock);
+    return 0;
+}
+
+static void *
+watchdog_thread(void *arg) {
+    (void)arg;
+    utime_t tick = watchdog.deadline / 4, fed = 0;
+    if (watchdog.notify && watchdog.notify / 4 < tick)
+        tick = watchdog.notify / 4;
+    if (tick < WATCHDOG_MINTICK)
+        tick = WATCHDOG_MINTICK;
+    while (!__atomic_load_n(&watchdog.stop, __ATOMIC_ACQUIRE)) {
+        struct timespec ts = { .tv_sec = (time_t)(tick / 1000000UL), .tv_nsec = (long)(tick % 1000000UL) * 1000 };
+        nanosleep(&ts, NULL);
+        utime_t now = profile_now();
+        // keep the service manager happy only while the loop is
+        if (watchdog_check(now) && watchdog.notify && now - fed >= watchdog.notify / 2) {
+            service_notify("WATCHDOG=1");
+            fed = now;
+        }
+    }
+    return NULL;
+}
+
+// Start watching, with a stall deadline and service manager keep-alive
+// interval (0 = none), both in us. The deadline is at most half of the
+// interval, a stall must show before the service manager gives up on us.
+// Signals are left to the loop's thread.
+
+int
+watchdog_start(utime_t deadline, utime_t notify) {
+    if (watchdog.running || (!deadline && !notify))
+        return 0;
+    watchdog.deadline = deadline && (!notify || deadline < notify / 2) ? deadline : notify / 2;
+    watchdog.notify = notify;
+    watchdog.stop = 0;
+    watchdog.since = profile_now();
+    sigset_t all, saved;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    int rc = pthread_create(&watchdog.thread, NULL, watchdog_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    if (rc != 0) {
+        errno = rc;
+        return -1;
+    }
+    watchdog.running = 1;
+    return 1;
+}
+
+void
+watchdog_stop() {
+    if (watchdog.running) {
+        __atomic_store_n(&watchdog.stop, 1, __ATOMIC_RELEASE);
+        pthread_join(watchdog.thread, NULL);
+        watchdog.running = 0;
+    }
+}
@@ -0,0 +1,294 @@
+//
+// WebSocket (RFC 6455) server side protocol support
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "websocket.h"
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+
+//// SHA-1, only used for the handshake ////
+
+static uint32_t
+sha1_rol(uint32_t value, int bits) {
+    return (value << bits) | (value >> (32 - bits));
+}
+
+static void
+sha1_block(uint32_t *state, unsigned char const *block) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++)
+        w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 |
+               (uint32_t)block[i * 4 + 2] << 8 | (uint32_t)block[i * 4 + 3];
+    for (int i = 16; i < 80; i++)
+        w[i] = sha1_rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+    for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20)
+            f = (b & c) | (~b & d), k = 0x5a827999;
+        else if (i < 40)
+            f = b ^ c ^ d, k = 0x6ed9eba1;
+        else if (i < 60)
+            f = (b & c) | (b & d) | (c & d), k = 0x8f1bbcdc;
+        else
+            f = b ^ c ^ d, k = 0xca62c1d6;
+        uint32_t t = sha1_rol(a, 5) + f + e + k + w[i];
+        e = d, d = c, c = sha1_rol(b, 30), b = a, a = t;
+    }
+    state[0] += a, state[1] += b, state[2] += c, state[3] += d, state[4] += e;
+}
+
+static void
+sha1(void const *data, size_t length, unsigned char *digest) {
+    uint32_t state[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+    unsigned char const *p = data;
+    size_t remaining = length;
+    for (; remaining >= 64; p += 64, remaining -= 64)
+        sha1_block(state, p);
+    // pad with 0x80, zeros and the length in bits, in one or two blocks
+    unsigned char last[128];
+    memset(last, 0, sizeof(last));
+    memcpy(last, p, remaining);
+    last[remaining] = 0x80;
+    size_t blocks = remaining < 56 ? 1 : 2;
+    uint64_t bits = (uint64_t)length * 8;
+    for (int i = 0; i < 8; i++)
+        last[blocks * 64 - 1 - i] = (unsigned char)(bits >> (i * 8));
+    for (size_t block = 0; block < blocks; block++)
+        sha1_block(state, last + block * 64);
+    for (int i = 0; i < 20; i++)
+        digest[i] = (unsigned char)(state[i / 4] >> (24 - (i % 4) * 8));
+}
+
+static void
+base64(unsigned char const *data, size_t length, char *out) {
+    static char const digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    for (size_t i = 0; i < length; i += 3) {
+        uint32_t n = (uint32_t)data[i] << 16 | (i + 1 < length ? (uint32_t)data[i + 1] << 8 : 0) |
+                     (i + 2 < length ? data[i + 2] : 0);
+        *out++ = digits[(n >> 18) & 63];
+        *out++ = digits[(n >> 12) & 63];
+        *out++ = i + 1 < length ? digits[(n >> 6) & 63] : '=';
+        *out++ = i + 2 < length ? digits[n & 63] : '=';
+    }
+    *out = '\0';
+}
+
+
+//// upgrade handshake ////
+
+// The Sec-WebSocket-Accept value for a client's Sec-WebSocket-Key,
+// accept must have room for WS_ACCEPTSIZE characters
+
+void
+ws_accept_key(char const *key, size_t keylen, char *accept) {
+    char text[keylen + sizeof(WS_GUID)];
+    unsigned char digest[20];
+    memcpy(text, key, keylen);
+    memcpy(text + keylen, WS_GUID, sizeof(WS_GUID) - 1);
+    sha1(text, keylen + sizeof(WS_GUID) - 1, digest);
+    base64(digest, sizeof(digest), accept);
+}
+
+// Length of the request up to and including the blank line ending
+// its headers, 0 if that has not been received yet
+
+size_t
+ws_request_length(char const *data, size_t length) {
+    for (size_t offset = 0; offset + 4 <= length; offset++) {
+        if (memcmp(data + offset, "\r\n\r\n", 4) == 0)
+            return offset + 4;
+    }
+    return 0;
+}
+
+// a comma separated header value includes this token (case-insensitive)
+static int
+ws_has_token(char const *value, size_t length, char const *token) {
+    size_t toklen = strlen(token);
+    while (length > 0) {
+        while (length > 0 && (*value == ',' || isspace((unsigned char)*value)))
+            ++value, --length;
+        size_t itemlen = 0;
+        while (itemlen < length && value[itemlen] != ',')
+            ++itemlen;
+        size_t trimmed = itemlen;
+        while (trimmed > 0 && isspace((unsigned char)value[trimmed - 1]))
+            --trimmed;
+        if (trimmed == toklen && strncasecmp(value, token, toklen) == 0)
+            return 1;
+        value += itemlen, length -= itemlen;
+    }
+    return 0;
+}
+
+// Check a complete upgrade request and write the response that accepts
+// it. Returns the length of the response, or -1 if the request is not a
+// valid WebSocket upgrade (or the response does not fit)
+
+int
+ws_handshake(char const *request, size_t length, char *response, size_t size) {
+    char const *end = request + length, *line = request, *eol;
+    char const *key = NULL;
+    size_t keylen = 0;
+    int upgrade = 0, connection = 0, version = 0;
+    if (length < 4 || memcmp(request, "GET ", 4) != 0)
+        return -1;
+    for (int first = 1; line < end && (eol = memchr(line, '\n', (size_t)(end - line))) != NULL; line = eol + 1) {
+        size_t linelen = (size_t)(eol - line);
+        if (linelen > 0 && line[linelen - 1] == '\r')
+            --linelen;
+        if (first) {    // request line: GET <target> HTTP/1.1
+            if (linelen < 9 || memcmp(line + linelen - 9, " HTTP/1.1", 9) != 0)
+                return -1;
+            first = 0;
+            continue;
+        }
+        char const *colon = memchr(line, ':', linelen);
+        if (colon == NULL)
+            continue;
+        size_t namelen = (size_t)(colon - line);
+        char const *value = colon + 1;
+        size_t valuelen = linelen - namelen - 1;
+        while (valuelen > 0 && isspace((unsigned char)*value))
+            ++value, --valuelen;
+        while (valuelen > 0 && isspace((unsigned char)value[valuelen - 1]))
+            --valuelen;
+        if (namelen == 7 && strncasecmp(line, "Upgrade", 7) == 0)
+            upgrade = ws_has_token(value, valuelen, "websocket");
+        else if (namelen == 10 && strncasecmp(line, "Connection", 10) == 0)
+            connection = ws_has_token(value, valuelen, "upgrade");
+        else if (namelen == 21 && strncasecmp(line, "Sec-WebSocket-Version", 21) == 0)
+            version = valuelen == 2 && memcmp(value, "13", 2) == 0;
+        else if (namelen == 17 && strncasecmp(line, "Sec-WebSocket-Key", 17) == 0)
+            key = value, keylen = valuelen;
+    }
+    if (!upgrade || !connection || !version || key == NULL || keylen != 24)
+        return -1;
+    char accept[WS_ACCEPTSIZE];
+    ws_accept_key(key, keylen, accept);
+    int rc = snprintf(response, size, "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n"
+                      "Connection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n", accept);
+    return rc < 0 || (size_t)rc >= size ? -1 : rc;
+}
+
+
+//// framing ////
+
+// encode a final, unmasked frame header, returns its length
+size_t
+ws_header_encode(void *dst, int opcode, uint64_t length) {
+    unsigned char *p = dst;
+    p[0] = (unsigned char)(0x80 | (opcode & 0x0f));
+    if (length < 126) {
+        p[1] = (unsigned char)length;
+        return 2;
+    }
+    if (length <= 0xffff) {
+        p[1] = 126;
+        p[2] = (unsigned char)(length >> 8);
+        p[3] = (unsigned char)length;
+        return 4;
+    }
+    p[1] = 127;
+    for (int i = 0; i < 8; i++)
+        p[2 + i] = (unsigned char)(length >> (56 - i * 8));
+    return 10;
+}
+
+
+// decode a frame header, returns its length, 0 if incomplete, -1 if invalid
+int
+ws_header_decode(void const *src, size_t size, ws_header_t *hdr) {
+    unsigned char const *p = src;
+    if (size < 2)
+        return 0;
+    if (p[0] & 0x70)    // reserved bits, no extensions were negotiated
+        return -1;
+    hdr->fin = (p[0] & 0x80) != 0;
+    hdr->opcode = p[0] & 0x0f;
+    hdr->masked = (p[1] & 0x80) != 0;
+    hdr->length = p[1] & 0x7f;
+    size_t hdrlen = 2;
+    if (hdr->length == 126) {
+        if (size < 4)
+            return 0;
+        hdr->length = (uint64_t)p[2] << 8 | p[3];
+        hdrlen = 4;
+    } else if (hdr->length == 127) {
+        if (size < 10)
+            return 0;
+        hdr->length = 0;
+        for (int i = 0; i < 8; i++)
+            hdr->length = hdr->length << 8 | p[2 + i];
+        if (hdr->length >> 63)
+            return -1;
+        hdrlen = 10;
+    }
+    if (hdr->masked) {
+        if (size < hdrlen + 4)
+            return 0;
+        memcpy(hdr->mask, p + hdrlen, 4);
+        hdrlen += 4;
+    }
+    // control frames are never fragmented and have short payloads
+    if (hdr->opcode >= WS_CLOSE && (!hdr->fin || hdr->length > WS_MAXCONTROL))
+        return -1;
+    return (int)hdrlen;
+}
+
+
+void
+ws_unmask(void *data, size_t length, unsigned char const *mask) {
+    unsigned char *p = data;
+    for (size_t i = 0; i < length; i++)
+        p[i] ^= mask[i & 3];
+}
+
+
+// put a frame into a buffer
+// returns the number of bytes queued, 0 if the whole frame did not fit
+
+size_t
+ws_frame_put(buffer_t *dst, int opcode, void const *data, size_t length) {
+    unsigned char hdr[WS_MAXHEADER];
+    size_t hdrlen = ws_header_encode(hdr, opcode, length);
+    if (buffer_available(dst) < hdrlen + length)
+        return 0;
+    buffer_put(dst, hdr, hdrlen);
+    if (length)
+        buffer_put(dst, data, length);
+    return hdrlen + length;
+}
+
+
+// same as ws_frame_put() with the payload copied (not moved) from another buffer
+
+size_t
+ws_frame_copy(buffer_t *dst, int opcode, buffer_t *src, size_t length) {
+    unsigned char hdr[WS_MAXHEADER];
+    if (length > buffer_used(src))
+        length = buffer_used(src);
+    size_t hdrlen = ws_header_encode(hdr, opcode, length);
+    if (buffer_available(dst) < hdrlen + length)
+        return 0;
+    buffer_put(dst, hdr, hdrlen);
+    if (length)
+        buffer_copy(dst, src, length);
+    return hdrlen + length;
+}
+
+
+// a close frame with a status code (in network byte order)
+
+size_t
+ws_close_put(buffer_t *dst, int status) {
+    unsigned char payload[2] = { (unsigned char)(status >> 8), (unsigned char)status };
+    return ws_frame_put(dst, WS_CLOSE, payload, sizeof(payload));
+}
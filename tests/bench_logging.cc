@@ -0,0 +1,53 @@
+//
+// Logging throughput: text log file vs binary log file
+//
+//  usage: benchLogging [ messages ]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+extern "C" {
+#include "logging.h"
+}
+
+static double
+now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static double
+run(int flags, char const *path, long count) {
+    unlink(path);
+    log_init(flags, V_TRACE, path);
+    log_rotate();
+    char const chunk[] = "input0: 1920x1080 (connected)\r\nH2U 00:00:01>";
+    double start = now();
+    for (long index = 0; index < count; index++) {
+        log_trace("serial read %zu bytes: %.*s", sizeof(chunk) - 1, (int)sizeof(chunk) - 1, chunk);
+        log_debug("fd %d: %lu queued, drain %lums", 7, (unsigned long)index, 500UL);
+    }
+    double elapsed = now() - start;
+    log_rotate();   // flush
+    return elapsed;
+}
+
+int
+main(int argc, char **argv) {
+    long count = argc > 1 ? strtol(argv[1], NULL, 10) : 500000;
+    char text[] = "/tmp/bench_logging.log", binary[] = "/tmp/bench_logging.blog";
+    double t_text = run(LOG_NOECHO, text, count);
+    double t_binary = run(LOG_NOECHO | LOG_BINARY, binary, count);
+    long messages = count * 2;
+    printf("%ld messages\n", messages);
+    printf("  text:   %7.3fs %8.0f ns/message %10.0f messages/s\n", t_text, t_text * 1e9 / messages, messages / t_text);
+    printf("  binary: %7.3fs %8.0f ns/message %10.0f messages/s (%.1fx)\n", t_binary, t_binary * 1e9 / messages,
+           messages / t_binary, t_text / t_binary);
+    unlink(text);
+    unlink(binary);
+    return 0;
+}
@@ -3,6 +3,7 @@
 //
 
 #include <iostream>
+#include <string>
 #include "gtest/gtest.h"
 
 extern "C" {
@@ -38,8 +39,13 @@ namespace {
         for (size_t i =0; i < sizes; i++) {
             size_t size = buffer_sizes[i];
             buffer_t *buffer = buffer_init(NULL, size);
-            ASSERT_EQ(size, buffer_size(buffer));
+            // capacity is rounded up to a power of 2
+            size_t capacity = buffer_size(buffer);
+            ASSERT_LE(size, capacity);
+            ASSERT_GE(size * 2, capacity);
+            ASSERT_EQ(ZERO, capacity & (capacity - 1));
             ASSERT_EQ(ZERO, buffer_used(buffer));
+            ASSERT_EQ(capacity, buffer_available(buffer));
             buffer_free(buffer);
         }
     }
@@ -50,6 +56,7 @@ namespace {
             size_t size = buffer_sizes[i];
             buffer_t *buffer = buffer_init(NULL, size);
             log_info("%lu", size);
+            size = buffer_size(buffer);
             if (size == BUFSIZE_NONE) {
                 unsigned char value = '!';
                 // Unbuffered needs to always fail put here
@@ -63,10 +70,10 @@ namespace {
                 for (size_t i =0; i++ < (size*2);) {
                     unsigned char value = (unsigned char) ('0' + (i % 10));
                     size_t rc = buffer_put(buffer, &value, 1);
-                    if (i < size) {
-                        // should succeed up to size-1 puts
+                    if (i <= size) {
+                        // should succeed up to size puts
                         EXPECT_EQ((size_t)1, rc);
-                        EXPECT_EQ((size - i) - 1, buffer_available(buffer));
+                        EXPECT_EQ(size - i, buffer_available(buffer));
                     } else {
                         // buffer is full...
                         // after that, it should always fail
@@ -79,7 +86,7 @@ namespace {
                     unsigned char value = (unsigned char) ('0' + (i % 10));
                     unsigned char got;
                     size_t rc = buffer_get(buffer, &got, 1);
-                    if (i < size) {
+                    if (i <= size) {
                         EXPECT_EQ((size_t)1, rc);
                         EXPECT_EQ(value, got);
                         // each value retrieved should make another byte available
@@ -87,7 +94,7 @@ namespace {
                     } else {
                         // buffer should now be empty and get should have failed
                         EXPECT_EQ(ZERO, rc);
-                        EXPECT_EQ(size - 1, buffer_available(buffer));
+                        EXPECT_EQ(size, buffer_available(buffer));
                     }
                 }
             }
@@ -109,6 +116,7 @@ namespace {
             size_t size = buffer_sizes[i];
             buffer_t *b = buffer_init(NULL, size);
             log_info("%lu", size);
+            size = buffer_size(b);
             if (size == BUFSIZE_NONE) {
                 ASSERT_EQ(ZERO, buffer_put(b, &buf, STRINGLENGTH));
             } else {
@@ -117,15 +125,15 @@ namespace {
                 size_t bytecount = 0;
                 while (buffer_available(b) > 0) {
                     size_t rc = buffer_put(b, &buf, STRINGLENGTH);
-                    if (bytecount + STRINGLENGTH < size) {
+                    if (bytecount + STRINGLENGTH <= size) {
                         ASSERT_EQ(rc, STRINGLENGTH);
                     } else {
                         // should be left over
-                        ASSERT_EQ(rc, ((size-1) % STRINGLENGTH));
+                        ASSERT_EQ(rc, (size % STRINGLENGTH));
                     }
                     bytecount += rc;
                 }
-                ASSERT_EQ(size - 1, bytecount);
+                ASSERT_EQ(size, bytecount);
             }
             buffer_free(b);
         }
@@ -134,6 +142,7 @@ namespace {
             size_t size = buffer_sizes[i];
             buffer_t *b = buffer_init(NULL, size);
             log_info("%lu", size);
+            size = buffer_size(b);
             if (size == BUFSIZE_NONE) {
                 ASSERT_EQ(ZERO, buffer_put(b, &buf, STRINGLENGTH));
             } else {
@@ -142,7 +151,7 @@ namespace {
                 size_t bytecount = 0;
                 while (buffer_available(b) > 0) {
                     size_t rc = buffer_put(b, &buf, STRINGLENGTH);
-                    if (bytecount + STRINGLENGTH < size) {
+                    if (bytecount + STRINGLENGTH <= size) {
                         ASSERT_EQ(rc, STRINGLENGTH);
                         bytecount += STRINGLENGTH;
                         unsigned char removed[REMOVELENGTH+1];
@@ -159,7 +168,7 @@ namespace {
                         bytecount += rc;
                     }
                 }
-                ASSERT_EQ(size - 1, bytecount);
+                ASSERT_EQ(size, bytecount);
             }
             buffer_free(b);
         }
@@ -200,4 +209,95 @@ namespace {
         log_info("done.");
     }
 
+    TEST(BufferFunctions, testBufferDirectAccess) {
+        // small buffers are not mirrored, wrapped data is in two pieces
+        buffer_t *b = buffer_init(NULL, 16);
+        char data[16];
+        size_t len;
+        EXPECT_EQ((size_t)12, buffer_put(b, "0123456789ab", 12));
+        EXPECT_EQ((size_t)10, buffer_get(b, data, 10));
+        void *ptr = buffer_writeptr(b, &len);
+        EXPECT_EQ(buffer_hi(b), (size_t)((char *)ptr - (char *)buffer_base(b)));
+        EXPECT_EQ((size_t)4, len);              // up to the end of memory
+        memcpy(ptr, "cdef", 4);
+        EXPECT_EQ((size_t)4, buffer_produce(b, 4));
+        EXPECT_EQ((size_t)10, buffer_put(b, "ghijklmnop", 10));
+        EXPECT_EQ(ZERO, buffer_available(b));
+        EXPECT_EQ(NULLPTR, buffer_writeptr(b, &len));
+        ptr = buffer_readptr(b, &len);
+        ASSERT_EQ((size_t)6, len);
+        EXPECT_EQ(0, memcmp(ptr, "abcdef", 6));
+        ptr = buffer_peekptr(b, 6, &len);
+        ASSERT_EQ((size_t)10, len);
+        EXPECT_EQ(0, memcmp(ptr, "ghijklmnop", 10));
+        // compaction rotates the data in place
+        buffer_compact(b);
+        EXPECT_EQ(ZERO, buffer_lo(b));
+        ptr = buffer_readptr(b, &len);
+        ASSERT_EQ((size_t)16, len);
+        EXPECT_EQ(0, memcmp(ptr, "abcdefghijklmnop", 16));
+        EXPECT_EQ((size_t)3, buffer_consume(b, 3));
+        EXPECT_EQ((size_t)13, buffer_get(b, NULL, 100));
+        buffer_free(b);
+    }
+
+    TEST(BufferFunctions, testBufferMirrored) {
+        buffer_t *b = buffer_init(NULL, BUFSIZE_HUGE);
+        size_t size = buffer_size(b), len;
+        if (!b->mirrored) {
+            buffer_free(b);
+            return;     // not supported on this platform
+        }
+        std::string fill(size - 100, 'x');
+        EXPECT_EQ(fill.length(), buffer_put(b, fill.data(), fill.length()));
+        EXPECT_EQ(fill.length(), buffer_get(b, NULL, fill.length()));
+        // writable and readable regions are contiguous across the wrap
+        void *ptr = buffer_writeptr(b, &len);
+        EXPECT_EQ(size, len);
+        std::string text(1000, 'y');
+        memcpy(ptr, text.data(), text.length());
+        buffer_produce(b, text.length());
+        ptr = buffer_readptr(b, &len);
+        ASSERT_EQ(text.length(), len);
+        EXPECT_EQ(0, memcmp(ptr, text.data(), len));
+        buffer_free(b);
+    }
+
+    TEST(BufferFunctions, testBufferElastic) {
+        buffer_pool_drain();
+        buffer_t *b = buffer_init_elastic(NULL, 100, 1000);
+        // nothing is allocated until used, but the ceiling is available
+        EXPECT_EQ(ZERO, buffer_size(b));
+        EXPECT_EQ((size_t)1024, buffer_available(b));
+        std::string text(300, 'z');
+        EXPECT_EQ(text.length(), buffer_put(b, text.data(), text.length()));
+        EXPECT_EQ((size_t)512, buffer_size(b));     // 128 doubled until it fits
+        EXPECT_EQ((size_t)724, buffer_available(b));
+        // growth stops at the ceiling
+        std::string more(2000, 'y');
+        EXPECT_EQ((size_t)724, buffer_put(b, more.data(), more.length()));
+        EXPECT_EQ((size_t)1024, buffer_size(b));
+        char data[300];
+        ASSERT_EQ((size_t)300, buffer_get(b, data, sizeof(data)));
+        EXPECT_EQ(0, memcmp(data, text.data(), sizeof(data)));
+        // trimmed only once empty, and idle since the previous trim
+        EXPECT_EQ(ZERO, buffer_trim(b));
+        buffer_get(b, NULL, 1024);
+        buffer_put(b, "x", 1);
+        buffer_get(b, NULL, 1);
+        EXPECT_EQ(ZERO, buffer_trim(b));
+        size_t pooled = buffer_pool_bytes();        // includes blocks outgrown
+        EXPECT_EQ((size_t)1024, buffer_trim(b));
+        EXPECT_EQ(ZERO, buffer_size(b));
+        EXPECT_EQ(pooled + 1024, buffer_pool_bytes());
+        // memory is taken from the pool when needed again
+        buffer_t *c = buffer_init(NULL, 1000);
+        EXPECT_EQ(pooled, buffer_pool_bytes());
+        buffer_free(c);
+        buffer_free(b);
+        EXPECT_EQ(pooled + 1024, buffer_pool_bytes());
+        buffer_pool_drain();
+        EXPECT_EQ(ZERO, buffer_pool_bytes());
+    }
+
 } // namespace
@@ -0,0 +1,152 @@
+//
+// Shared streaming compression of the serial fan-out
+//
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "compress.h"
+}
+
+namespace {
+
+#define ZERO (size_t)0
+
+    // a client's view of the stream
+    class Inflater {
+    public:
+        Inflater() {
+            memset(&zs, '\0', sizeof(zs));
+            inflateInit2(&zs, -MAX_WBITS);
+        }
+        ~Inflater() {
+            inflateEnd(&zs);
+        }
+        // decode everything queued in a buffer
+        std::string inflate(buffer_t *src) {
+            std::string data(buffer_used(src), '\0');
+            buffer_get(src, &data[0], data.size());
+            std::string result;
+            zs.next_in = (Bytef *)&data[0];
+            zs.avail_in = (uInt)data.size();
+            while (zs.avail_in > 0) {
+                unsigned char out[1024];
+                zs.next_out = out;
+                zs.avail_out = sizeof(out);
+                int rc = ::inflate(&zs, Z_SYNC_FLUSH);
+                if (rc != Z_OK && rc != Z_BUF_ERROR)
+                    return "<error>";
+                result.append((char *)out, sizeof(out) - zs.avail_out);
+                if (rc == Z_BUF_ERROR)
+                    break;
+            }
+            return result;
+        }
+    private:
+        z_stream zs;
+    };
+
+    // compress a chunk and queue the output for one client
+    size_t
+    chunk(compressor_t *c, std::string const &data, buffer_t *dst) {
+        buffer_t *src = buffer_init(NULL, 4096);
+        buffer_put(src, data.data(), data.size());
+        size_t length = compressor_chunk(c, src, data.size());
+        EXPECT_EQ(data.size(), buffer_used(src));   // copied, not moved
+        buffer_copy(dst, &c->out, length);
+        buffer_free(src);
+        return length;
+    }
+
+    TEST(CompressFunctions, chunks) {
+        compressor_t c;
+        ASSERT_EQ(0, compressor_init(&c, COMPRESS_DEFAULT));
+        buffer_t *dst = buffer_init(NULL, 4096);
+        Inflater client;
+        std::string line = "Input HDMI0: 1280x720@60.00Hz\r\n";
+        EXPECT_GT(chunk(&c, line, dst), ZERO);
+        EXPECT_EQ(line, client.inflate(dst));
+        // once per pass, however many connections share it
+        EXPECT_EQ(buffer_used(&c.out), compressor_chunk(&c, dst, 100));
+        compressor_flush(&c);
+        EXPECT_EQ(ZERO, buffer_used(&c.out));
+        // repeated output refers back to the first chunk
+        size_t length = chunk(&c, line, dst);
+        EXPECT_LT(length, line.size());
+        EXPECT_EQ(line, client.inflate(dst));
+        EXPECT_EQ(line.size() * 2, c.bytes_in);
+        compressor_flush(&c);
+        compressor_free(&c);
+        buffer_free(dst);
+    }
+
+    TEST(CompressFunctions, resync) {
+        compressor_t c;
+        ASSERT_EQ(0, compressor_init(&c, COMPRESS_DEFAULT));
+        buffer_t *dst = buffer_init(NULL, 4096);
+        buffer_t *late = buffer_init(NULL, 4096);
+        Inflater client, joiner;
+        std::string line = "Output HDMI0: 1280x720@60.00Hz\r\n";
+        chunk(&c, line, dst);
+        compressor_flush(&c);
+        // a connection joins, starting with the next chunk
+        compressor_resync(&c);
+        chunk(&c, line, dst);
+        buffer_copy(late, &c.out, buffer_used(&c.out));
+        compressor_flush(&c);
+        EXPECT_EQ(line + line, client.inflate(dst));
+        EXPECT_EQ(line, joiner.inflate(late));
+        compressor_free(&c);
+        buffer_free(dst);
+        buffer_free(late);
+    }
+
+    TEST(CompressFunctions, skippedChunk) {
+        compressor_t c;
+        ASSERT_EQ(0, compressor_init(&c, COMPRESS_DEFAULT));
+        buffer_t *dst = buffer_init(NULL, 4096);
+        buffer_t *slow = buffer_init(NULL, 4096);
+        Inflater client, lagging;
+        std::string first = "Input HDMI0: 1280x720@60.00Hz\r\n", second = "Input HDMI1: 1920x1080@60.00Hz\r\n";
+        chunk(&c, first, dst);
+        buffer_copy(slow, &c.out, buffer_used(&c.out));
+        compressor_flush(&c);
+        // one connection has no room for this chunk
+        chunk(&c, second, dst);
+        compressor_resync(&c);
+        compressor_flush(&c);
+        chunk(&c, first + second, dst);
+        buffer_copy(slow, &c.out, buffer_used(&c.out));
+        compressor_flush(&c);
+        EXPECT_EQ(first + second + first + second, client.inflate(dst));
+        EXPECT_EQ(first + first + second, lagging.inflate(slow));
+        compressor_free(&c);
+        buffer_free(dst);
+        buffer_free(slow);
+    }
+
+    TEST(CompressFunctions, stored) {
+        compressor_t c;
+        ASSERT_EQ(0, compressor_init(&c, COMPRESS_DEFAULT));
+        buffer_t *dst = buffer_init(NULL, 4096);
+        Inflater client;
+        std::string line = "Status: ok\r\n", reply = "@ok stats 10s\r\n";
+        chunk(&c, line, dst);
+        compressor_flush(&c);
+        // a reply to one connection, between chunks
+        EXPECT_EQ(5 + reply.size(), compress_stored(dst, reply.data(), reply.size()));
+        compressor_resync(&c);
+        chunk(&c, line, dst);
+        compressor_flush(&c);
+        EXPECT_EQ(line + reply + line, client.inflate(dst));
+        // all or nothing when the buffer is nearly full
+        std::string filler(buffer_available(dst) - 4, 'x');
+        buffer_put(dst, filler.data(), filler.size());
+        EXPECT_EQ(ZERO, compress_stored(dst, reply.data(), reply.size()));
+        compressor_free(&c);
+        buffer_free(dst);
+    }
+
+}
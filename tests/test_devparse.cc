@@ -0,0 +1,116 @@
+//
+// Incremental parser for hdmi2usb firmware output
+//
+
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "devparse.h"
+}
+
+namespace {
+
+    struct recorded {
+        int type;
+        utime_t timestamp;
+        std::string text;
+    };
+
+    static void
+    record_event(devevent_t const *event, void *arg) {
+        std::vector<recorded> *events = (std::vector<recorded> *)arg;
+        events->push_back({ event->type, event->timestamp, std::string(event->text, event->length) });
+    }
+
+    class DevparseFunctions : public ::testing::Test {
+    protected:
+        devparse_t parser;
+        std::vector<recorded> events;
+
+        void SetUp() override {
+            devparse_init(&parser, record_event, &events);
+        }
+
+        void feed(char const *text, utime_t now = 1) {
+            devparse_feed(&parser, text, strlen(text), now);
+        }
+    };
+
+    TEST_F(DevparseFunctions, classifyLines) {
+        feed("input0: 1920x1080 (connected)\r\n"
+             "Unknown command\r\n"
+             "Error: no such output\r\n"
+             "Some other text\r\n"
+             "\r\n");
+        ASSERT_EQ((size_t)4, events.size());
+        EXPECT_EQ(DEVEVT_STATUS, events[0].type);
+        EXPECT_EQ("input0: 1920x1080 (connected)", events[0].text);
+        EXPECT_EQ(DEVEVT_ERROR, events[1].type);
+        EXPECT_EQ(DEVEVT_ERROR, events[2].type);
+        EXPECT_EQ(DEVEVT_LINE, events[3].type);
+        EXPECT_EQ((unsigned long)1, parser.events[DEVEVT_STATUS]);
+        EXPECT_EQ((unsigned long)2, parser.events[DEVEVT_ERROR]);
+    }
+
+    TEST_F(DevparseFunctions, promptAndAck) {
+        feed("H2U 00:00:12>", 100);
+        ASSERT_EQ((size_t)1, events.size());
+        EXPECT_EQ(DEVEVT_PROMPT, events[0].type);
+        EXPECT_EQ((utime_t)100, events[0].timestamp);
+        EXPECT_EQ("H2U 00:00:12>", events[0].text);
+        // the echo of a sent command is acknowledged, split across any number of chunks
+        devparse_expect(&parser, "status\n", 7);
+        feed("st", 200);
+        feed("atu", 201);
+        EXPECT_EQ((size_t)1, events.size());
+        feed("s\r\noutput0: 1280x720\r\nH2U 00:00:13>", 300);
+        ASSERT_EQ((size_t)4, events.size());
+        EXPECT_EQ(DEVEVT_ACK, events[1].type);
+        EXPECT_EQ("status", events[1].text);
+        EXPECT_EQ(DEVEVT_STATUS, events[2].type);
+        EXPECT_EQ(DEVEVT_PROMPT, events[3].type);
+        EXPECT_EQ((utime_t)300, events[3].timestamp);
+        // the same text again is no longer an ack
+        feed("status\r\n");
+        EXPECT_EQ(DEVEVT_LINE, events.back().type);
+    }
+
+    TEST_F(DevparseFunctions, promptSplitAcrossChunks) {
+        // a partial prompt is held until it is complete
+        feed("H2U 00:0");
+        EXPECT_EQ((size_t)0, events.size());
+        feed("0:12> ");
+        ASSERT_EQ((size_t)1, events.size());
+        EXPECT_EQ(DEVEVT_PROMPT, events[0].type);
+        // ordinary text ending in '>' is not a prompt
+        feed("value -> ");
+        feed("<something>");
+        EXPECT_EQ((size_t)1, events.size());
+    }
+
+    TEST_F(DevparseFunctions, edidDump) {
+        feed("EDID for input0:\r\n"
+             "00: 00 ff ff ff ff ff ff 00\r\n"
+             "08: 4c 2d 00 0e 00 00 00 00\r\n"
+             "input0: 1920x1080\r\n"
+             "00 ff\r\n");
+        ASSERT_EQ((size_t)5, events.size());
+        EXPECT_EQ(DEVEVT_EDID, events[0].type);
+        EXPECT_EQ(DEVEVT_EDID, events[1].type);
+        EXPECT_EQ(DEVEVT_EDID, events[2].type);
+        EXPECT_EQ(DEVEVT_STATUS, events[3].type);
+        EXPECT_EQ(DEVEVT_LINE, events[4].type);
+    }
+
+    TEST_F(DevparseFunctions, longLinesTruncated) {
+        std::string line(DEVPARSE_LINEMAX * 2, 'x');
+        feed(line.c_str());
+        EXPECT_EQ((size_t)0, events.size());
+        feed("\r\n");
+        ASSERT_EQ((size_t)1, events.size());
+        EXPECT_EQ((size_t)DEVPARSE_LINEMAX, events[0].text.length());
+    }
+
+} // namespace
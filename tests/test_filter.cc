@@ -0,0 +1,111 @@
+//
+// Line filters compiled to a DFA
+//
+
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "filter.h"
+}
+
+namespace {
+
+    static int
+    matches(char const *pattern, char const *text) {
+        char const *errmsg = NULL;
+        filter_t *filter = filter_compile(NULL, pattern, &errmsg);
+        EXPECT_NE((filter_t *)0, filter) << pattern << ": " << (errmsg ? errmsg : "");
+        if (filter == NULL)
+            return -1;
+        int rc = filter_match(filter, text, strlen(text));
+        filter_free(filter);
+        return rc ? 1 : 0;
+    }
+
+    TEST(FilterFunctions, literalsAndAnchors) {
+        EXPECT_EQ(1, matches("input", "input0: 1920x1080"));
+        EXPECT_EQ(1, matches("1080", "input0: 1920x1080"));
+        EXPECT_EQ(0, matches("output", "input0: 1920x1080"));
+        EXPECT_EQ(1, matches("^input", "input0: 1920x1080"));
+        EXPECT_EQ(0, matches("^1920", "input0: 1920x1080"));
+        EXPECT_EQ(1, matches("1080$", "input0: 1920x1080"));
+        EXPECT_EQ(0, matches("1920$", "input0: 1920x1080"));
+        EXPECT_EQ(1, matches("^input0: 1920x1080$", "input0: 1920x1080"));
+        EXPECT_EQ(1, matches("", "anything"));
+        EXPECT_EQ(1, matches("^$", ""));
+        EXPECT_EQ(0, matches("^$", "x"));
+    }
+
+    TEST(FilterFunctions, quantifiersAndClasses) {
+        EXPECT_EQ(1, matches("^input[0-9]:", "input1: disconnected"));
+        EXPECT_EQ(0, matches("^input[0-9]:", "inputx: disconnected"));
+        EXPECT_EQ(1, matches("^(in|out)", "(in|out)put"));  // no alternation, literals
+        EXPECT_EQ(1, matches("^[io][a-z]*put[0-9]+:", "output12: 720p"));
+        EXPECT_EQ(0, matches("^[io][a-z]*put[0-9]+:", "output: 720p"));
+        EXPECT_EQ(1, matches("^colou?r$", "color"));
+        EXPECT_EQ(1, matches("^colou?r$", "colour"));
+        EXPECT_EQ(0, matches("^colou?r$", "colouur"));
+        EXPECT_EQ(1, matches("a.*b.*c", "xxaxxbxxcxx"));
+        EXPECT_EQ(0, matches("a.*b.*c", "xxaxxcxxbxx"));
+        EXPECT_EQ(1, matches("[^ ]+ error$", "fatal error"));
+        EXPECT_EQ(1, matches("\\.\\*", "x.*y"));
+        EXPECT_EQ(0, matches("\\.\\*", "x..y"));
+        // overlapping restarts in unanchored searches
+        EXPECT_EQ(1, matches("aab", "aaab"));
+        EXPECT_EQ(1, matches("abab$", "abababab"));
+    }
+
+    TEST(FilterFunctions, invalidPatterns) {
+        char const *errmsg = NULL;
+        EXPECT_EQ((filter_t *)0, filter_compile(NULL, "*abc", &errmsg));
+        EXPECT_NE((char const *)0, errmsg);
+        EXPECT_EQ((filter_t *)0, filter_compile(NULL, "a**", &errmsg));
+        EXPECT_EQ((filter_t *)0, filter_compile(NULL, "[abc", &errmsg));
+        EXPECT_EQ((filter_t *)0, filter_compile(NULL, "[z-a]", &errmsg));
+        std::string toolong(FILTER_MAXITEMS + 1, 'x');
+        EXPECT_EQ((filter_t *)0, filter_compile(NULL, toolong.c_str(), &errmsg));
+    }
+
+    TEST(FilterFunctions, longestPattern) {
+        // every position live at once must not read as a match
+        std::string pattern(FILTER_MAXITEMS, 'x');
+        pattern[FILTER_MAXITEMS - 1] = 'y';
+        std::string text(FILTER_MAXITEMS * 2, 'x');
+        EXPECT_EQ(0, matches(pattern.c_str(), text.c_str()));
+        EXPECT_EQ(1, matches(pattern.c_str(), (text + "y").c_str()));
+        EXPECT_EQ(0, matches(pattern.c_str(), (text.substr(0, FILTER_MAXITEMS - 2) + "y").c_str()));
+    }
+
+    TEST(FilterFunctions, filterSetSharing) {
+        filterset_t *fset = filterset_init(NULL);
+        char const *errmsg = NULL;
+        int a = filterset_add(fset, "^input", &errmsg);
+        int b = filterset_add(fset, "error", &errmsg);
+        int c = filterset_add(fset, "^input", &errmsg);
+        EXPECT_LE(0, a);
+        EXPECT_LE(0, b);
+        EXPECT_NE(a, b);
+        EXPECT_EQ(a, c);    // same pattern is shared
+        EXPECT_EQ(-1, filterset_add(fset, "[", &errmsg));
+        EXPECT_EQ((size_t)2, filterset_count(fset));
+
+        char const line[] = "input0: error reading EDID";
+        filterset_match(fset, line, strlen(line));
+        EXPECT_TRUE(filterset_matched(fset, a));
+        EXPECT_TRUE(filterset_matched(fset, b));
+        char const other[] = "output0: 720p";
+        filterset_match(fset, other, strlen(other));
+        EXPECT_FALSE(filterset_matched(fset, a));
+        EXPECT_FALSE(filterset_matched(fset, b));
+
+        // unused filters are released by a sweep, and their slots reused
+        filterset_unmark(fset);
+        filterset_mark(fset, b);
+        EXPECT_EQ((size_t)1, filterset_sweep(fset));
+        EXPECT_EQ((char const *)0, filterset_pattern(fset, a));
+        EXPECT_STREQ("error", filterset_pattern(fset, b));
+        EXPECT_EQ(a, filterset_add(fset, "^output", &errmsg));
+        filterset_free(fset);
+    }
+
+} // namespace
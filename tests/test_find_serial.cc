@@ -3,6 +3,9 @@
 //
 
 
+#include <string>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include "gtest/gtest.h"
 
 extern "C" {
@@ -33,4 +36,104 @@ namespace {
         log_info("Selected device %s", ctrl_dev);
     }
 
+    // Build a fake sysfs and /dev tree: a modem and an hdmi2usb board
+
+    class FakeSysfs : public ::testing::Test {
+    protected:
+        std::string root;
+
+        void mkfile(std::string const &path, char const *content) {
+            int fd = open((root + path).c_str(), O_CREAT|O_WRONLY|O_TRUNC, 0600);
+            ASSERT_LE(0, fd);
+            ASSERT_EQ((ssize_t)strlen(content), write(fd, content, strlen(content)));
+            close(fd);
+        }
+
+        void mkdirs(std::string const &path) {
+            std::string partial = root;
+            for (size_t pos = 1; pos != std::string::npos; ) {
+                pos = path.find('/', pos + 1);
+                partial = root + path.substr(0, pos);
+                mkdir(partial.c_str(), 0700);
+            }
+        }
+
+        void usbtty(char const *tty, char const *usbdev, char const *vid, char const *pid, char const *serial) {
+            std::string dev = std::string("/sys/devices/usb1/") + usbdev;
+            mkdirs(dev + "/" + usbdev + ":1.0");
+            mkfile(dev + "/idVendor", vid);
+            mkfile(dev + "/idProduct", pid);
+            mkfile(dev + "/serial", serial);
+            mkdirs(std::string("/sys/class/tty/") + tty);
+            ASSERT_EQ(0, symlink((root + dev + "/" + usbdev + ":1.0").c_str(),
+                                 (root + "/sys/class/tty/" + tty + "/device").c_str()));
+            mkfile(std::string("/dev/") + tty, "");
+        }
+
+        void SetUp() override {
+            char tmpl[] = "/tmp/find_serial_XXXXXX";
+            ASSERT_NE((char *)0, mkdtemp(tmpl));
+            root = tmpl;
+            mkdirs("/dev");
+            usbtty("ttyACM0", "1-1", "1199\n", "9071\n", "MODEM1\n");
+            usbtty("ttyACM1", "1-2", "1d50\n", "60b7\n", "OPSIS1\n");
+            device_set_root(root.c_str());
+            find_serial_flush();
+        }
+
+        void TearDown() override {
+            device_set_root(NULL);
+            find_serial_flush();
+            std::string cmd = "rm -rf " + root;
+            EXPECT_EQ(0, system(cmd.c_str()));
+        }
+    };
+
+    TEST_F(FakeSysfs, prefersKnownBoards) {
+        struct ctrldev *first_dev = find_serial_all("usb:");
+        ASSERT_NE((struct ctrldev *)0, first_dev);
+        EXPECT_EQ(root + "/dev/ttyACM1", first_dev->devname);
+        EXPECT_EQ(0x1d50, first_dev->vid);
+        EXPECT_EQ(0x60b7, first_dev->pid);
+        EXPECT_STREQ("OPSIS1", first_dev->serial);
+        EXPECT_NE((char const *)0, first_dev->board);
+        ASSERT_NE((struct ctrldev *)0, first_dev->next);
+        EXPECT_EQ(root + "/dev/ttyACM0", first_dev->next->devname);
+        EXPECT_EQ(RANK_USB, first_dev->next->rank);
+        EXPECT_EQ((struct ctrldev *)0, first_dev->next->next);
+        ctrldev_free(first_dev);
+
+        // also when named by a pattern, and regardless of the order given
+        std::string pattern = root + "/dev/ttyACM*";
+        char *port = find_serial(pattern.c_str());
+        EXPECT_EQ(root + "/dev/ttyACM1", port);
+        free(port);
+        pattern = root + "/dev/ttyACM0|" + root + "/dev/ttyACM1";
+        port = find_serial(pattern.c_str());
+        EXPECT_EQ(root + "/dev/ttyACM1", port);
+        free(port);
+    }
+
+    TEST_F(FakeSysfs, selectByIdentity) {
+        char *port = find_serial("usb:1199:9071:MODEM1");
+        EXPECT_EQ(root + "/dev/ttyACM0", port);
+        free(port);
+        EXPECT_EQ((char *)0, find_serial("usb:1d50:60b7:OTHER"));
+        EXPECT_EQ((struct ctrldev *)0, find_serial_all("usb:abcd"));
+    }
+
+    TEST_F(FakeSysfs, cacheFollowsIdentity) {
+        char *port = find_serial("usb:1d50");
+        EXPECT_EQ(root + "/dev/ttyACM1", port);
+        free(port);
+        // the board is re-enumerated as another node, a modem takes its place
+        std::string tty = root + "/sys/class/tty/";
+        ASSERT_EQ(0, rename((tty + "ttyACM1").c_str(), (tty + "ttyACM2").c_str()));
+        ASSERT_EQ(0, rename((tty + "ttyACM0").c_str(), (tty + "ttyACM1").c_str()));
+        mkfile("/dev/ttyACM2", "");
+        port = find_serial("usb:1d50");
+        EXPECT_EQ(root + "/dev/ttyACM2", port);
+        free(port);
+    }
+
 } // namespace
@@ -0,0 +1,93 @@
+//
+// Length prefixed binary framing for the client protocol
+//
+
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "frame.h"
+#include "session.h"
+}
+
+namespace {
+
+#define ZERO (size_t)0
+
+    TEST(FrameFunctions, headerEncodeDecode) {
+        unsigned char data[FRAME_HDRSIZE];
+        frame_header_t hdr;
+        EXPECT_EQ((size_t)FRAME_HDRSIZE, frame_header_encode(data, FRAME_RESPONSE, 0x01020304, 0x1234));
+        EXPECT_EQ(FRAME_MAGIC, data[0]);
+        EXPECT_EQ(FRAME_RESPONSE, data[1]);
+        ASSERT_EQ(0, frame_header_decode(data, sizeof(data), &hdr));
+        EXPECT_EQ(FRAME_RESPONSE, hdr.type);
+        EXPECT_EQ(0x1234, hdr.length);
+        EXPECT_EQ((uint32_t)0x01020304, hdr.reqid);
+        // short header and bad magic are both invalid
+        EXPECT_EQ(-1, frame_header_decode(data, FRAME_HDRSIZE - 1, &hdr));
+        data[0] = 'x';
+        EXPECT_EQ(-1, frame_header_decode(data, sizeof(data), &hdr));
+    }
+
+    TEST(FrameFunctions, framePutAllOrNothing) {
+        buffer_t *buffer = buffer_init(NULL, 64);
+        char const payload[] = "status";
+        size_t length = sizeof(payload) - 1;
+        EXPECT_EQ(FRAME_HDRSIZE + length, frame_put(buffer, FRAME_EVENT, 0, payload, length));
+        EXPECT_EQ(FRAME_HDRSIZE + length, buffer_used(buffer));
+        // fill the buffer until a whole frame no longer fits
+        while (frame_put(buffer, FRAME_EVENT, 0, payload, length) != ZERO)
+            ;
+        size_t used = buffer_used(buffer);
+        EXPECT_LT(buffer_available(buffer), FRAME_HDRSIZE + length);
+        EXPECT_EQ(ZERO, frame_put(buffer, FRAME_EVENT, 0, payload, length));
+        EXPECT_EQ(used, buffer_used(buffer));
+        // frames read back intact
+        unsigned char header[FRAME_HDRSIZE];
+        frame_header_t hdr;
+        char data[sizeof(payload)];
+        ASSERT_EQ((size_t)FRAME_HDRSIZE, buffer_get(buffer, header, FRAME_HDRSIZE));
+        ASSERT_EQ(0, frame_header_decode(header, FRAME_HDRSIZE, &hdr));
+        EXPECT_EQ(length, hdr.length);
+        ASSERT_EQ(length, buffer_get(buffer, data, hdr.length));
+        EXPECT_EQ(0, memcmp(payload, data, length));
+        buffer_free(buffer);
+    }
+
+    TEST(FrameFunctions, frameCopy) {
+        buffer_t *src = buffer_init(NULL, 128);
+        buffer_t *dst = buffer_init(NULL, 128);
+        buffer_put(src, "0123456789", 10);
+        // copying leaves the source intact, and is clipped to what it holds
+        EXPECT_EQ((size_t)FRAME_HDRSIZE + 10, frame_copy(dst, FRAME_RESPONSE, 42, src, 100));
+        EXPECT_EQ((size_t)10, buffer_used(src));
+        unsigned char frame[FRAME_HDRSIZE + 10];
+        ASSERT_EQ(sizeof(frame), buffer_get(dst, frame, sizeof(frame)));
+        frame_header_t hdr;
+        ASSERT_EQ(0, frame_header_decode(frame, sizeof(frame), &hdr));
+        EXPECT_EQ((uint32_t)42, hdr.reqid);
+        EXPECT_EQ(10, hdr.length);
+        EXPECT_EQ(0, memcmp(frame + FRAME_HDRSIZE, "0123456789", 10));
+        buffer_free(dst);
+        buffer_free(src);
+    }
+
+    TEST(FrameFunctions, sessionRequests) {
+        session_t *session = session_init(NULL);
+        uint32_t reqid = 0;
+        EXPECT_EQ(SESSION_NEW, session_proto(session));
+        session_setproto(session, SESSION_FRAMED);
+        EXPECT_EQ(SESSION_FRAMED, session_proto(session));
+        EXPECT_EQ(0, session_pop_request(session, &reqid));
+        for (uint32_t id = 100; id < 120; id++)
+            session_push_request(session, id);
+        EXPECT_EQ((size_t)20, session_requests(session));
+        for (uint32_t id = 100; id < 120; id++) {
+            ASSERT_EQ(1, session_pop_request(session, &reqid));
+            EXPECT_EQ(id, reqid);
+        }
+        EXPECT_EQ(ZERO, session_requests(session));
+        session_free(session);
+    }
+
+} // namespace
@@ -2,6 +2,7 @@
 // Created by David Nugent on 2/02/2016.
 //
 
+#include <string>
 #include "gtest/gtest.h"
 
 extern "C" {
@@ -41,6 +42,113 @@ namespace {
         }
     }
 
+    TEST(LoggingFunctions, moduleLevels) {
+        log_init(LOG_ECHO|LOG_STDERR|LOG_SYNC, V_INFO, "logfile-%Y%m%d_%H%M%S.log");
+        EXPECT_TRUE(log_enabled(LOG_SERIAL, V_INFO));
+        EXPECT_FALSE(log_enabled(LOG_SERIAL, V_DEBUG));
+        EXPECT_EQ(0, log_setlevels("serial=trace,tcp=6"));
+        EXPECT_TRUE(log_enabled(LOG_SERIAL, V_TRACE));
+        EXPECT_TRUE(log_enabled(LOG_TCP, V_DEBUG));
+        EXPECT_FALSE(log_enabled(LOG_TCP, V_TRACE));
+        EXPECT_FALSE(log_enabled(LOG_APP, V_DEBUG));
+        // invalid specs change nothing
+        EXPECT_EQ(-1, log_setlevels("serial=2,bogus=3"));
+        EXPECT_EQ(-1, log_setlevels("udp=loud"));
+        EXPECT_EQ(-1, log_setlevels("udp"));
+        EXPECT_EQ(-1, log_checklevels("all=0"));
+        EXPECT_TRUE(log_enabled(LOG_SERIAL, V_TRACE));
+        EXPECT_EQ(0, log_setlevels("all=Error"));
+        EXPECT_FALSE(log_enabled(LOG_SERIAL, V_WARN));
+        EXPECT_EQ(std::string("selector"), log_module_name(LOG_SELECTOR));
+        log_init(LOG_ECHO|LOG_STDERR|LOG_SYNC, V_TRACE, "logfile-%Y%m%d_%H%M%S.log");
+    }
+
+    TEST(LoggingFunctions, binaryLogDecode) {
+        char path[] = "/tmp/logfile-binary-XXXXXX";
+        int fd = mkstemp(path);
+        ASSERT_LE(0, fd);
+        close(fd);
+        unlink(path);
+        log_init(LOG_NOECHO|LOG_BINARY|LOG_UTC, V_DEBUG, path);
+        log_rotate();
+        char const text[] = "input0: 1920x1080 TRAILING";
+        for (int pass = 0; pass < 2; pass++) {
+            log_info("fd %d: %zu bytes [%-6s] %5.2f%% %.*s", -3, (size_t)42, "ab", 12.345, 17, text);
+            log_debug("%c %lu %llx %p %s", 'x', 1234567890UL, 0xabcdefULL, (void *)0x1000, (char const *)NULL);
+        }
+        log_trace("This should not appear in the log");
+        log_rotate();   // closes (and flushes) the file
+
+        FILE *in = fopen(path, "rb");
+        ASSERT_NE((FILE *)0, in);
+        FILE *out = tmpfile();
+        EXPECT_EQ(4, log_decode(in, out));
+        fclose(in);
+        rewind(out);
+        char line[512];
+        std::string decoded;
+        while (fgets(line, sizeof(line), out) != NULL) {
+            char const *msg = strstr(line, "INFO ");
+            if (msg == NULL)
+                msg = strstr(line, "DEBUG ");
+            ASSERT_NE((char const *)0, msg) << line;
+            decoded += strchr(msg, ' ') + 1;
+        }
+        fclose(out);
+        std::string expect = "fd -3: 42 bytes [ab    ] 12.35% input0: 1920x1080\n"
+                             "x 1234567890 abcdef 0x1000 (null)\n";
+        EXPECT_EQ(expect + expect, decoded);
+
+        FILE *text_in = tmpfile();
+        fputs("not a binary log\n", text_in);
+        rewind(text_in);
+        EXPECT_EQ(-1, log_decode(text_in, stdout));
+        fclose(text_in);
+        unlink(path);
+        log_init(LOG_ECHO|LOG_STDERR|LOG_SYNC, V_TRACE, "logfile-%Y%m%d_%H%M%S.log");
+        log_rotate();
+    }
+
+    // a format record then a message using it, with one integer argument
+    static void
+    put_record(FILE *fp, unsigned id, std::string const &fmt, int64_t value) {
+        uint16_t id16 = (uint16_t)id, len16 = (uint16_t)fmt.size();
+        fputc('F', fp);
+        fwrite(&id16, sizeof(id16), 1, fp);
+        fwrite(&len16, sizeof(len16), 1, fp);
+        fwrite(fmt.data(), 1, fmt.size(), fp);
+        int64_t timestamp = 0;
+        len16 = sizeof(value);
+        fputc('M', fp);
+        fputc(V_INFO, fp);
+        fwrite(&id16, sizeof(id16), 1, fp);
+        fwrite(&len16, sizeof(len16), 1, fp);
+        fwrite(&timestamp, sizeof(timestamp), 1, fp);
+        fwrite(&value, sizeof(value), 1, fp);
+    }
+
+    TEST(LoggingFunctions, binaryLogBadConversion) {
+        FILE *in = tmpfile();
+        uint32_t flags = LOG_UTC;
+        fputs("H2ULOG\x01\n", in);
+        fwrite(&flags, sizeof(flags), 1, in);
+        // far longer than any conversion our writer produces
+        put_record(in, 1, "a %" + std::string(100, '-') + "5d b", 7);
+        put_record(in, 2, "c %0999999999999d d", 7);
+        put_record(in, 3, "e %5d f", 7);
+        rewind(in);
+        FILE *out = tmpfile();
+        EXPECT_EQ(3, log_decode(in, out));
+        fclose(in);
+        rewind(out);
+        char line[512];
+        std::string decoded;
+        while (fgets(line, sizeof(line), out) != NULL)
+            decoded += strstr(line, "INFO ") + 5;
+        fclose(out);
+        EXPECT_EQ("a <invalid conversion>\nc <invalid conversion>\ne     7 f\n", decoded);
+    }
+
     TEST(LoggingFunctions, logFatal) {
         static char const *errorMessage = "Exiting with a fatal message";
         ASSERT_EXIT(log_fatal(2, errorMessage, ""), ::testing::ExitedWithCode(2), errorMessage);
@@ -0,0 +1,153 @@
+//
+// TCP client and listener devices
+//
+
+#include <string>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "nettcp.h"
+#include "selector.h"
+}
+
+namespace {
+
+    TEST(NettcpFunctions, profilePresets) {
+        tcp_profile_t profile = { 0 };
+        EXPECT_EQ(0, tcp_profile_parse(&profile, "streaming"));
+        EXPECT_EQ(1, profile.nodelay);
+        EXPECT_EQ((unsigned)TCP_COALESCE, profile.coalesce);
+        EXPECT_EQ(0, tcp_profile_parse(&profile, "interactive"));
+        EXPECT_EQ(1, profile.nodelay);
+        EXPECT_EQ((unsigned)0, profile.coalesce);
+        EXPECT_EQ(0, tcp_profile_parse(&profile, "bulk"));
+        EXPECT_EQ(0, profile.nodelay);
+        EXPECT_EQ(-1, tcp_profile_parse(&profile, "fast"));
+    }
+
+    TEST(NettcpFunctions, profileSettings) {
+        tcp_profile_t profile = { 0 };
+        // settings are applied in order, after any preset
+        EXPECT_EQ(0, tcp_profile_parse(&profile, "bulk,nodelay=1,coalesce=500,,sndbuf=65536,rcvbuf=8192,lowat=4096"));
+        EXPECT_EQ(1, profile.nodelay);
+        EXPECT_EQ((unsigned)500, profile.coalesce);
+        EXPECT_EQ(65536, profile.sndbuf);
+        EXPECT_EQ(8192, profile.rcvbuf);
+        EXPECT_EQ(4096, profile.notsent_lowat);
+        char buf[128];
+        EXPECT_STREQ("nodelay=1,coalesce=500,lowat=4096,sndbuf=65536,rcvbuf=8192",
+                     tcp_profile_str(&profile, buf, sizeof(buf)));
+        EXPECT_EQ(-1, tcp_profile_parse(&profile, "nodelay=2"));
+        EXPECT_EQ(-1, tcp_profile_parse(&profile, "sndbuf="));
+        EXPECT_EQ(-1, tcp_profile_parse(&profile, "sndbuf=12k"));
+        EXPECT_EQ(-1, tcp_profile_parse(&profile, "window=10"));
+    }
+
+    TEST(NettcpFunctions, writeSegmentsAheadOfBuffer) {
+        int fds[2];
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+        struct sockaddr_in remote = {};
+        remote.sin_family = AF_INET;
+        remote.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        iodev_t *dev = tcp_create_accepted(NULL, fds[0], (struct sockaddr *)&remote, 2048, 65536);
+        ASSERT_NE(nullptr, iodev_tseg(dev));
+        // more shared segments than one writev(2) takes, then a reply
+        segbuf_t shared;
+        segbuf_init(&shared, 0);
+        std::string expected;
+        for (int i = 0; i < SEGBUF_MAXIOV + 4; i++) {
+            std::string data(SEGBUF_SEGSIZE, (char)('a' + i));
+            segbuf_put(&shared, data.data(), data.size());
+            expected += data;
+        }
+        segbuf_share(iodev_tseg(dev), &shared, segbuf_used(&shared));
+        segbuf_free(&shared);
+        buffer_put(iodev_tbuf(dev), "[REPLY]", 7);
+        expected += "[REPLY]";
+        while (iodev_pending(dev) > 0)
+            ASSERT_GT(dev->write_handler(dev), 0);
+        std::string received;
+        char data[4096];
+        ssize_t rc;
+        while (received.size() < expected.size() && (rc = recv(fds[1], data, sizeof(data), MSG_DONTWAIT)) > 0)
+            received.append(data, (size_t)rc);
+        EXPECT_EQ(expected, received);
+        iodev_free(dev);
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    // connect to a loopback port from a given local address
+    int
+    connect_from(char const *host, in_port_t port) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        inet_pton(AF_INET, host, &addr.sin_addr);
+        EXPECT_EQ(0, bind(fd, (struct sockaddr *)&addr, sizeof(addr)));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = port;
+        EXPECT_EQ(0, connect(fd, (struct sockaddr *)&addr, sizeof(addr)));
+        return fd;
+    }
+
+    // a refused connection is closed as soon as it is accepted
+    bool
+    refused(int fd) {
+        char data[16];
+        return recv(fd, data, sizeof(data), MSG_DONTWAIT) == 0;
+    }
+
+    TEST(NettcpFunctions, admitLimits) {
+        selector_t selector;
+        selector_init(&selector);
+        struct sockaddr_in local = {};
+        local.sin_family = AF_INET;
+        local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        iodev_t *listener = selector_new_device_listen(&selector, (struct sockaddr *)&local, 2048, 65536);
+        size_t self = selector_device_index(&selector, listener);
+        tcp_listen_limits(listener, TCP_BACKLOG, 3, 2);
+        ASSERT_GE(listener->open(listener), 0);
+        socklen_t addrlen = sizeof(local);
+        ASSERT_EQ(0, getsockname(iodev_getfd(listener), (struct sockaddr *)&local, &addrlen));
+        in_port_t port = local.sin_port;
+
+        int fds[6];
+        fds[0] = connect_from("127.0.0.1", port);
+        fds[1] = connect_from("127.0.0.1", port);
+        listener = selector_get_device(&selector, self);
+        EXPECT_EQ(2, listener->read_handler(listener));
+        // per address limit
+        fds[2] = connect_from("127.0.0.1", port);
+        listener = selector_get_device(&selector, self);
+        EXPECT_EQ(0, listener->read_handler(listener));
+        EXPECT_TRUE(refused(fds[2]));
+        fds[3] = connect_from("127.0.0.2", port);
+        listener = selector_get_device(&selector, self);
+        EXPECT_EQ(1, listener->read_handler(listener));
+        // listener limit
+        fds[4] = connect_from("127.0.0.3", port);
+        listener = selector_get_device(&selector, self);
+        EXPECT_EQ(0, listener->read_handler(listener));
+        EXPECT_TRUE(refused(fds[4]));
+        EXPECT_EQ(2UL, tcp_getcfg(listener)->rejected);
+        // a closed connection frees its slot
+        iodev_t *conn = selector_get_device(&selector, self + 1);
+        ASSERT_TRUE(iodev_is_open(conn));
+        conn->close(conn, IOFLAG_NONE);
+        fds[5] = connect_from("127.0.0.1", port);
+        listener = selector_get_device(&selector, self);
+        EXPECT_EQ(1, listener->read_handler(listener));
+        EXPECT_EQ(2UL, tcp_getcfg(listener)->rejected);
+
+        selector_free(&selector);
+        for (int i = 0; i < 6; i++)
+            close(fds[i]);
+    }
+
+} // namespace
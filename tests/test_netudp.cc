@@ -0,0 +1,120 @@
+//
+// UDP (multicast) publisher device
+//
+
+#include <string>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "netudp.h"
+#include "logging.h"
+}
+
+namespace {
+
+    // Example subscriber: reassembles the published stream from datagrams
+    // and uses the sequence numbers to detect lost or reordered datagrams
+
+    struct subscriber {
+        int fd;
+        bool started;
+        uint32_t expected;
+        unsigned long lost;
+        std::string stream;
+
+        subscriber() : fd(-1), started(false), expected(0), lost(0) {}
+
+        void receive(unsigned char const *datagram, size_t size) {
+            udp_header_t hdr;
+            if (udp_header_decode(datagram, size, &hdr) != 0)
+                return;
+            if (started && hdr.seq != expected)
+                lost += (uint32_t)(hdr.seq - expected);
+            started = true;
+            expected = hdr.seq + 1;
+            stream.append((char const *)datagram + UDP_HDRSIZE, hdr.length);
+        }
+
+        void drain() {
+            unsigned char datagram[UDP_HDRSIZE + UDP_PAYLOAD];
+            ssize_t rc;
+            while ((rc = recv(fd, datagram, sizeof(datagram), MSG_DONTWAIT)) > 0)
+                receive(datagram, (size_t)rc);
+        }
+    };
+
+    class UdpFunctions : public ::testing::Test {
+    protected:
+        subscriber sub;
+        struct sockaddr_in addr;
+
+        void SetUp() override {
+            sub.fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+            ASSERT_NE(-1, sub.fd);
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            addr.sin_port = 0;
+            ASSERT_EQ(0, bind(sub.fd, (struct sockaddr *)&addr, sizeof(addr)));
+            socklen_t len = sizeof(addr);
+            ASSERT_EQ(0, getsockname(sub.fd, (struct sockaddr *)&addr, &len));
+        }
+
+        void TearDown() override {
+            close(sub.fd);
+        }
+    };
+
+    TEST_F(UdpFunctions, headerEncodeDecode) {
+        unsigned char data[UDP_HDRSIZE];
+        udp_header_t hdr;
+        EXPECT_EQ((size_t)UDP_HDRSIZE, udp_header_encode(data, 0xfffffffe, 123));
+        EXPECT_EQ(-1, udp_header_decode(data, sizeof(data), &hdr));  // truncated payload
+        unsigned char datagram[UDP_HDRSIZE + 123];
+        udp_header_encode(datagram, 0xfffffffe, 123);
+        ASSERT_EQ(0, udp_header_decode(datagram, sizeof(datagram), &hdr));
+        EXPECT_EQ(UDP_MAGIC, hdr.magic);
+        EXPECT_EQ(123, hdr.length);
+        EXPECT_EQ(0xfffffffe, hdr.seq);
+        datagram[0] ^= 0xff;
+        EXPECT_EQ(-1, udp_header_decode(datagram, sizeof(datagram), &hdr));
+    }
+
+    TEST_F(UdpFunctions, publishAndReassemble) {
+        iodev_t *dev = udp_create_publish(NULL, (struct sockaddr *)&addr, 0, 8192);
+        ASSERT_LE(0, dev->open(dev));
+        ASSERT_EQ(IODEV_CONNECTED, iodev_getstate(dev));
+
+        std::string expected;
+        for (int i = 0; i < 120; i++)
+            expected += "status line " + std::to_string(i) + "\r\n";
+        // deliver in several bursts, each larger than one datagram payload
+        for (size_t offset = 0; offset < expected.size(); ) {
+            size_t len = std::min(expected.size() - offset, (size_t)3000);
+            ASSERT_EQ((ssize_t)len, iodev_write(dev, expected.data() + offset, len));
+            ASSERT_EQ((ssize_t)len, dev->write_handler(dev));
+            EXPECT_EQ((size_t)0, buffer_used(iodev_tbuf(dev)));
+            sub.drain();
+            offset += len;
+        }
+        EXPECT_EQ((unsigned long)0, sub.lost);
+        EXPECT_EQ(expected, sub.stream);
+        EXPECT_EQ(sub.expected, udp_getcfg(dev)->seq);
+
+        // skipping a sequence number is reported as loss by the subscriber
+        udp_getcfg(dev)->seq++;
+        iodev_write(dev, "x", 1);
+        dev->write_handler(dev);
+        sub.drain();
+        EXPECT_EQ((unsigned long)1, sub.lost);
+
+        dev->close(dev, IOFLAG_INACTIVE);
+        EXPECT_EQ(IODEV_INACTIVE, iodev_getstate(dev));
+        iodev_free(dev);
+    }
+
+} // namespace
@@ -0,0 +1,141 @@
+//
+// Command pacing
+//
+
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "pacing.h"
+}
+
+namespace {
+
+#define MSEC    1000UL
+#define PACE    (500 * MSEC)
+
+    // a device that takes a fixed time to service each command, and is
+    // written to at a fixed rate
+    struct Device {
+        utime_t service, write;     // per command
+        utime_t busy_until = 0, written_at = 0;
+        Device(utime_t service, utime_t write) : service(service), write(write) {}
+        void send(utime_t now) {
+            written_at = now + write;
+            busy_until = written_at + service;
+        }
+        bool drained(utime_t now) const { return now >= written_at; }
+        bool prompts(utime_t now) const { return busy_until && now >= busy_until; }
+    };
+
+    // send count commands, stepping the clock 1ms at a time, returns the time taken
+    utime_t
+    run(pacing_t *pacing, Device &device, int adaptive, int count) {
+        utime_t now = MSEC;
+        for (int sent = 0; sent < count; now += MSEC) {
+            if (device.prompts(now)) {
+                pacing_prompt(pacing, device.drained(now), device.busy_until);
+                device.busy_until = 0;
+            }
+            pacing_timeout(pacing, adaptive, now);
+            if (pacing_ready(pacing, adaptive, now)) {
+                pacing_sent(pacing, PACE, now);
+                device.send(now);
+                sent++;
+            }
+        }
+        return now;
+    }
+
+    TEST(PacingFunctions, fixedPace) {
+        pacing_t pacing;
+        pacing_init(&pacing);
+        EXPECT_TRUE(pacing_ready(&pacing, 0, MSEC));
+        pacing_sent(&pacing, PACE, MSEC);
+        EXPECT_FALSE(pacing_ready(&pacing, 0, 2 * MSEC));
+        EXPECT_EQ(PACE - MSEC, pacing_remaining(&pacing, 2 * MSEC));
+        // a prompt does not hurry a fixed pace
+        pacing_prompt(&pacing, 1, 50 * MSEC);
+        EXPECT_FALSE(pacing_ready(&pacing, 0, 60 * MSEC));
+        EXPECT_TRUE(pacing_ready(&pacing, 0, MSEC + PACE));
+        EXPECT_EQ(0UL, pacing_remaining(&pacing, MSEC + PACE));
+    }
+
+    TEST(PacingFunctions, readyOnPrompt) {
+        pacing_t pacing;
+        pacing_init(&pacing);
+        pacing_sent(&pacing, PACE, MSEC);
+        // a prompt while the command is still being written does not count
+        pacing_prompt(&pacing, 0, 20 * MSEC);
+        EXPECT_FALSE(pacing_ready(&pacing, 1, 30 * MSEC));
+        EXPECT_EQ(0UL, pacing.service_time);
+        EXPECT_TRUE(pacing.awaiting);
+        pacing_prompt(&pacing, 1, 41 * MSEC);
+        EXPECT_TRUE(pacing_ready(&pacing, 1, 42 * MSEC));
+        EXPECT_FALSE(pacing.awaiting);
+        // the next command waits for its own prompt
+        pacing_sent(&pacing, PACE, 42 * MSEC);
+        EXPECT_FALSE(pacing_ready(&pacing, 1, 43 * MSEC));
+    }
+
+    TEST(PacingFunctions, movingAverage) {
+        pacing_t pacing;
+        pacing_init(&pacing);
+        // the first sample is taken as it is
+        pacing_sent(&pacing, PACE, 1000 * MSEC);
+        pacing_prompt(&pacing, 1, 1080 * MSEC);
+        EXPECT_EQ(80 * MSEC, pacing.service_time);
+        // then each moves it 1/8 of the way
+        pacing_sent(&pacing, PACE, 2000 * MSEC);
+        pacing_prompt(&pacing, 1, 2160 * MSEC);
+        EXPECT_EQ(90 * MSEC, pacing.service_time);
+        pacing_sent(&pacing, PACE, 3000 * MSEC);
+        pacing_prompt(&pacing, 1, 3010 * MSEC);
+        EXPECT_EQ(80 * MSEC, pacing.service_time);
+        // one prompt per command, and a prompt that predates it is ignored
+        pacing_prompt(&pacing, 1, 3500 * MSEC);
+        EXPECT_EQ(80 * MSEC, pacing.service_time);
+        pacing_sent(&pacing, PACE, 4000 * MSEC);
+        pacing_prompt(&pacing, 1, 4000 * MSEC);
+        EXPECT_EQ(80 * MSEC, pacing.service_time);
+    }
+
+    TEST(PacingFunctions, timeouts) {
+        pacing_t pacing;
+        pacing_init(&pacing);
+        EXPECT_FALSE(pacing_timeout(&pacing, 1, MSEC));
+        pacing_sent(&pacing, PACE, MSEC);
+        EXPECT_FALSE(pacing_timeout(&pacing, 1, PACE));
+        EXPECT_TRUE(pacing_timeout(&pacing, 1, MSEC + PACE));
+        EXPECT_EQ(1UL, pacing.timeouts);
+        EXPECT_FALSE(pacing.awaiting);
+        // counted once, and a late prompt is not a sample
+        EXPECT_FALSE(pacing_timeout(&pacing, 1, 2 * PACE));
+        pacing_prompt(&pacing, 1, 2 * PACE);
+        EXPECT_EQ(0UL, pacing.service_time);
+        // without adaptive pacing a missing prompt is expected
+        pacing_sent(&pacing, PACE, 3 * PACE);
+        EXPECT_FALSE(pacing_timeout(&pacing, 0, 4 * PACE));
+        EXPECT_FALSE(pacing.awaiting);
+        EXPECT_EQ(1UL, pacing.timeouts);
+    }
+
+    TEST(PacingFunctions, simulatedDevice) {
+        pacing_t fixed, adaptive;
+        pacing_init(&fixed);
+        pacing_init(&adaptive);
+        Device slow(40 * MSEC, 5 * MSEC), fast(40 * MSEC, 5 * MSEC);
+        utime_t paced = run(&fixed, slow, 0, 10);
+        utime_t prompted = run(&adaptive, fast, 1, 10);
+        EXPECT_GE(paced, 9 * PACE);
+        EXPECT_LT(prompted, 10 * 50 * MSEC);
+        EXPECT_EQ(45 * MSEC, adaptive.service_time);
+        EXPECT_EQ(0UL, adaptive.timeouts);
+        // a device that stops prompting falls back to the pace
+        pacing_t missed;
+        pacing_init(&missed);
+        Device silent(2 * PACE, 5 * MSEC);
+        EXPECT_GE(run(&missed, silent, 1, 4), 3 * PACE);
+        EXPECT_EQ(3UL, missed.timeouts);
+    }
+
+}
@@ -0,0 +1,62 @@
+//
+// Event loop phase profiler
+//
+
+#include <string>
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "profile.h"
+}
+
+namespace {
+
+    TEST(ProfileFunctions, histogram) {
+        profile_reset();
+        for (int index = 0; index < 98; index++)
+            profile_add(PROF_SELECT, 100);      // bucket < 128us
+        profile_add(PROF_SELECT, 5000);         // < 8192us
+        profile_add(PROF_SELECT, 20000);
+        profile_hist_t const *hist = profile_phase(PROF_SELECT);
+        ASSERT_NE((profile_hist_t const *)0, hist);
+        EXPECT_EQ(100ul, hist->count);
+        EXPECT_EQ(98ul * 100 + 5000 + 20000, hist->total);
+        EXPECT_EQ(20000ul, hist->max);
+        EXPECT_EQ(128ul, profile_percentile(PROF_SELECT, 50));
+        EXPECT_EQ(8192ul, profile_percentile(PROF_SELECT, 99));
+        EXPECT_EQ(32768ul, profile_percentile(PROF_SELECT, 100));
+        EXPECT_EQ(0ul, profile_percentile(PROF_IOSET, 50));
+        // very long times land in the last bucket
+        profile_add(PROF_LOOP, 1ul << 40);
+        EXPECT_EQ(1ul << 40, profile_percentile(PROF_LOOP, 50));
+        EXPECT_EQ((profile_hist_t const *)0, profile_phase(PROF_PHASES));
+
+        char line[160];
+        EXPECT_GT(profile_format(PROF_SELECT, line, sizeof(line)), 0);
+        EXPECT_EQ(std::string("select   n=100 avg=348us p50<128us p99<8192us max=20000us total=34ms"), line);
+        profile_reset();
+        EXPECT_EQ(0ul, profile_phase(PROF_SELECT)->count);
+    }
+
+    TEST(ProfileFunctions, worstDevice) {
+        profile_reset();
+        int fd;
+        char const *driver;
+        utime_t total, max;
+        EXPECT_EQ(0, profile_worst(&fd, &driver, &total, &max));
+        profile_device(5, "tcp", 300);
+        profile_device(3, "serial", 200);
+        profile_device(3, "serial", 250);
+        profile_device(PROFILE_MAXFD, "tcp", 100000);   // not tracked
+        ASSERT_EQ(1, profile_worst(&fd, &driver, &total, &max));
+        EXPECT_EQ(3, fd);
+        EXPECT_EQ(std::string("serial"), driver);
+        EXPECT_EQ(450ul, total);
+        EXPECT_EQ(250ul, max);
+        char line[160];
+        profile_format_worst(line, sizeof(line));
+        EXPECT_EQ(0, strncmp(line, "worst    serial fd 3 total=0ms", 30)) << line;
+        profile_reset();
+    }
+
+} // namespace
@@ -0,0 +1,56 @@
+//
+// Token bucket rate limiter
+//
+
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "ratelimit.h"
+}
+
+namespace {
+
+#define SECOND  1000000UL
+
+    TEST(RateLimitFunctions, unlimited) {
+        ratelimit_t rl;
+        ratelimit_init(&rl);
+        ratelimit_charge(&rl, 1000000);
+        EXPECT_TRUE(ratelimit_ready(&rl, 0, 0, SECOND));
+        // no debt carried over once a limit is set
+        EXPECT_TRUE(ratelimit_ready(&rl, 100, 400, 2 * SECOND));
+        EXPECT_EQ(400, rl.tokens);
+    }
+
+    TEST(RateLimitFunctions, burstThenRate) {
+        ratelimit_t rl;
+        ratelimit_init(&rl);
+        utime_t now = 10 * SECOND;
+        // starts with a full bucket
+        ASSERT_TRUE(ratelimit_ready(&rl, 100, 400, now));
+        EXPECT_EQ(400, rl.tokens);
+        // overdrawn by a large read, refills at the rate
+        ratelimit_charge(&rl, 500);
+        EXPECT_FALSE(ratelimit_ready(&rl, 100, 400, now));
+        EXPECT_FALSE(ratelimit_ready(&rl, 100, 400, now + SECOND));
+        EXPECT_EQ(0, rl.tokens);
+        EXPECT_TRUE(ratelimit_ready(&rl, 100, 400, now + SECOND + SECOND / 100));
+        EXPECT_EQ(1, rl.tokens);
+        // never more than the burst
+        EXPECT_TRUE(ratelimit_ready(&rl, 100, 400, now + 60 * SECOND));
+        EXPECT_EQ(400, rl.tokens);
+    }
+
+    TEST(RateLimitFunctions, keepsRemainder) {
+        ratelimit_t rl;
+        ratelimit_init(&rl);
+        utime_t now = SECOND;
+        ratelimit_ready(&rl, 3, 10, now);
+        ratelimit_charge(&rl, 10);
+        // frequent checks still earn 3 tokens a second
+        for (int step = 1; step <= 100; step++)
+            ratelimit_ready(&rl, 3, 10, now + step * (SECOND / 100));
+        EXPECT_EQ(3, rl.tokens);
+    }
+
+}
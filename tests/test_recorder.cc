@@ -0,0 +1,69 @@
+//
+// Flight recorder
+//
+
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "recorder.h"
+}
+
+namespace {
+
+    TEST(RecorderFunctions, dumpAfterWrap) {
+        char path[] = "/tmp/recorder-XXXXXX";
+        int fd = mkstemp(path);
+        ASSERT_NE(-1, fd);
+        close(fd);
+        // overwrite anything recorded by other tests, and wrap
+        const long total = RECORDER_EVENTS + 10;
+        for (long index = 0; index < total; index++)
+            recorder_event(REC_SEND, 7, 0, index);
+        ASSERT_EQ(0, recorder_dump(path));
+
+        // oldest first, and only the most recent RECORDER_EVENTS
+        FILE *in = fopen(path, "rb");
+        ASSERT_NE((FILE *)0, in);
+        char magic[sizeof(RECORDER_MAGIC) - 1];
+        uint32_t header[2];
+        ASSERT_EQ(1u, fread(magic, sizeof(magic), 1, in));
+        ASSERT_EQ(1u, fread(header, sizeof(header), 1, in));
+        EXPECT_EQ(sizeof(rec_event_t), header[0]);
+        EXPECT_EQ((uint32_t)RECORDER_EVENTS, header[1]);
+        rec_event_t event, last = {};
+        for (long index = total - RECORDER_EVENTS; index < total; index++) {
+            ASSERT_EQ(1u, fread(&event, sizeof(event), 1, in));
+            EXPECT_EQ(REC_SEND, event.type);
+            EXPECT_EQ(7, event.fd);
+            ASSERT_EQ(index, event.value);
+            EXPECT_LE(last.time, event.time);
+            last = event;
+        }
+        EXPECT_EQ(0u, fread(&event, sizeof(event), 1, in));
+
+        // and as a timeline
+        rewind(in);
+        FILE *out = tmpfile();
+        EXPECT_EQ(RECORDER_EVENTS, recorder_decode(in, out));
+        fclose(in);
+        rewind(out);
+        char line[256];
+        ASSERT_NE((char *)0, fgets(line, sizeof(line), out));
+        EXPECT_NE((char *)0, strstr(line, "send   fd 7: 10 bytes")) << line;
+        fclose(out);
+        unlink(path);
+    }
+
+    TEST(RecorderFunctions, decodeRejectsOtherFiles) {
+        FILE *in = tmpfile();
+        fputs("H2ULOG\x01\nnot a recorder dump\n", in);
+        rewind(in);
+        EXPECT_EQ(-1, recorder_decode(in, stdout));
+        fclose(in);
+    }
+
+} // namespace
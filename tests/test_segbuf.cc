@@ -0,0 +1,117 @@
+//
+// Chained buffer of reference counted segments
+//
+
+#include <string>
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "segbuf.h"
+#include "websocket.h"
+}
+
+namespace {
+
+#define ZERO (size_t)0
+
+    TEST(SegbufFunctions, putGetAcrossSegments) {
+        segbuf_t *sb = segbuf_init(NULL, 0);
+        std::string text;
+        for (int i = 0; i < 3000; i++)
+            text += (char)('a' + i % 26);
+        EXPECT_EQ(text.length(), segbuf_put(sb, text.data(), text.length()));
+        EXPECT_EQ(text.length(), segbuf_used(sb));
+        EXPECT_EQ((size_t)3, segbuf_count(sb));     // 1024 + 1024 + 952
+        // small puts fill the tail segment
+        EXPECT_EQ((size_t)5, segbuf_put(sb, "12345", 5));
+        EXPECT_EQ((size_t)3, segbuf_count(sb));
+        char data[4000];
+        EXPECT_EQ((size_t)1000, segbuf_get(sb, data, 1000));
+        EXPECT_EQ(0, memcmp(data, text.data(), 1000));
+        EXPECT_EQ((size_t)2005, segbuf_get(sb, data, sizeof(data)));
+        EXPECT_EQ(0, memcmp(data, text.data() + 1000, 2000));
+        EXPECT_EQ(0, memcmp(data + 2000, "12345", 5));
+        EXPECT_EQ(ZERO, segbuf_used(sb));
+        EXPECT_EQ(ZERO, segbuf_count(sb));
+        segbuf_free(sb);
+    }
+
+    TEST(SegbufFunctions, capacityLimit) {
+        segbuf_t sb;
+        segbuf_init(&sb, 100);
+        std::string text(150, 'x');
+        EXPECT_EQ((size_t)100, segbuf_put(&sb, text.data(), text.length()));
+        EXPECT_EQ(ZERO, segbuf_available(&sb));
+        EXPECT_EQ(ZERO, segbuf_put(&sb, "y", 1));
+        segbuf_free(&sb);
+    }
+
+    TEST(SegbufFunctions, sharedSegments) {
+        segbuf_t *src = segbuf_init(NULL, 0);
+        segbuf_put(src, "x", 1);    // make sure a slab is allocated
+        segbuf_flush(src);
+        size_t before = segbuf_segments_free();
+        segbuf_t *a = segbuf_init(NULL, 0);
+        segbuf_t *b = segbuf_init(NULL, 0);
+        std::string text(1500, 'z');
+        segbuf_put(src, text.data(), text.length());
+        size_t used = before - 2;
+        EXPECT_EQ(used, segbuf_segments_free());
+        EXPECT_EQ(text.length(), segbuf_share(a, src, text.length()));
+        EXPECT_EQ((size_t)700, segbuf_share(b, src, 700));
+        // no segments were copied
+        EXPECT_EQ(used, segbuf_segments_free());
+        segbuf_flush(src);
+        EXPECT_EQ(used, segbuf_segments_free());
+        // appending to a shared segment does not disturb other chains
+        EXPECT_EQ((size_t)3, segbuf_put(b, "abc", 3));
+        EXPECT_EQ((size_t)3, segbuf_put(a, "def", 3));
+        char data[1600];
+        ASSERT_EQ((size_t)703, segbuf_get(b, data, sizeof(data)));
+        EXPECT_EQ(0, memcmp(data + 700, "abc", 3));
+        ASSERT_EQ((size_t)1503, segbuf_peek(a, data, sizeof(data)));
+        EXPECT_EQ(0, memcmp(data, text.data(), text.length()));
+        EXPECT_EQ(0, memcmp(data + 1500, "def", 3));
+        // the chain can be written with writev
+        struct iovec iov[SEGBUF_MAXIOV];
+        int count = segbuf_iov(a, iov, SEGBUF_MAXIOV);
+        size_t total = 0;
+        for (int i = 0; i < count; i++)
+            total += iov[i].iov_len;
+        EXPECT_EQ(segbuf_used(a), total);
+        segbuf_free(a);
+        segbuf_free(b);
+        segbuf_free(src);
+        // all released once the last reference has gone
+        EXPECT_EQ(before, segbuf_segments_free());
+    }
+
+    TEST(SegbufFunctions, shareWholeFrames) {
+        segbuf_t tseg, fanout;
+        segbuf_init(&tseg, 4096);
+        segbuf_init(&fanout, 0);
+        std::string filler(4000, 'f'), text(200, 't');
+        segbuf_put(&tseg, filler.data(), filler.length());
+        unsigned char header[WS_MAXHEADER];
+        size_t hdrlen = ws_header_encode(header, WS_BINARY, text.length());
+        segbuf_put(&fanout, header, hdrlen);
+        segbuf_put(&fanout, text.data(), text.length());
+        // a frame that does not fit is not queued at all
+        EXPECT_EQ(ZERO, segbuf_share_whole(&tseg, &fanout, hdrlen + text.length()));
+        EXPECT_EQ(filler.length(), segbuf_used(&tseg));
+        EXPECT_EQ(ZERO, segbuf_share_whole(&tseg, &fanout, hdrlen + text.length() + 1));
+        // once there is room, the whole frame
+        segbuf_consume(&tseg, 3000);
+        EXPECT_EQ(hdrlen + text.length(), segbuf_share_whole(&tseg, &fanout, hdrlen + text.length()));
+        char data[4096];
+        size_t used = segbuf_get(&tseg, data, sizeof(data));
+        ASSERT_EQ(1000 + hdrlen + text.length(), used);
+        ws_header_t hdr;
+        ASSERT_EQ((int)hdrlen, ws_header_decode(data + 1000, used - 1000, &hdr));
+        EXPECT_EQ((uint64_t)text.length(), hdr.length);
+        EXPECT_EQ(text, std::string(data + 1000 + hdrlen, used - 1000 - hdrlen));
+        segbuf_free(&tseg);
+        segbuf_free(&fanout);
+    }
+
+} // namespace
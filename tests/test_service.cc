@@ -0,0 +1,85 @@
+//
+// Service manager integration (systemd protocol, without libsystemd)
+//
+
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "service.h"
+}
+
+namespace {
+
+    TEST(ServiceFunctions, listenFds) {
+        char pid[32];
+        snprintf(pid, sizeof(pid), "%d", (int)getpid());
+        unsetenv("LISTEN_PID");
+        unsetenv("LISTEN_FDS");
+        EXPECT_EQ(0, service_listen_fds(0));
+        // meant for another process
+        setenv("LISTEN_PID", "1", 1);
+        setenv("LISTEN_FDS", "2", 1);
+        EXPECT_EQ(0, service_listen_fds(0));
+        setenv("LISTEN_PID", pid, 1);
+        setenv("LISTEN_FDS", "bad", 1);
+        EXPECT_EQ(0, service_listen_fds(0));
+        setenv("LISTEN_FDS", "0", 1);
+        EXPECT_EQ(0, service_listen_fds(1));
+        // unset removes the variables
+        setenv("LISTEN_PID", pid, 1);
+        setenv("LISTEN_FDS", "1", 1);
+        EXPECT_EQ(1, service_listen_fds(1));
+        EXPECT_EQ((char *)0, getenv("LISTEN_PID"));
+        EXPECT_EQ(0, service_listen_fds(0));
+    }
+
+    TEST(ServiceFunctions, notify) {
+        unsetenv("NOTIFY_SOCKET");
+        EXPECT_EQ(0, service_notify("READY=1"));
+
+        std::string path = "/tmp/service-test-" + std::to_string(getpid());
+        int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+        ASSERT_LE(0, fd);
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        unlink(path.c_str());
+        ASSERT_EQ(0, bind(fd, (struct sockaddr *)&addr, sizeof(addr)));
+
+        setenv("NOTIFY_SOCKET", path.c_str(), 1);
+        EXPECT_EQ(1, service_notify("READY=1\nMAINPID=%d", 42));
+        char buf[256];
+        ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+        EXPECT_EQ("READY=1\nMAINPID=42", std::string(buf, n > 0 ? (size_t)n : 0));
+
+        setenv("NOTIFY_SOCKET", "relative/path", 1);
+        EXPECT_EQ(0, service_notify("READY=1"));
+        unsetenv("NOTIFY_SOCKET");
+        close(fd);
+        unlink(path.c_str());
+    }
+
+    TEST(ServiceFunctions, watchdogUsec) {
+        char pid[32];
+        snprintf(pid, sizeof(pid), "%d", (int)getpid());
+        unsetenv("WATCHDOG_USEC");
+        unsetenv("WATCHDOG_PID");
+        EXPECT_EQ(0ul, service_watchdog_usec());
+        setenv("WATCHDOG_USEC", "3000000", 1);
+        EXPECT_EQ(3000000ul, service_watchdog_usec());
+        setenv("WATCHDOG_PID", "1", 1);         // meant for another process
+        EXPECT_EQ(0ul, service_watchdog_usec());
+        setenv("WATCHDOG_PID", pid, 1);
+        EXPECT_EQ(3000000ul, service_watchdog_usec());
+        setenv("WATCHDOG_USEC", "soon", 1);
+        EXPECT_EQ(0ul, service_watchdog_usec());
+        unsetenv("WATCHDOG_USEC");
+        unsetenv("WATCHDOG_PID");
+    }
+
+} // namespace
@@ -149,4 +149,16 @@ namespace {
         stringstore_free(pstore);
     }
 
+    TEST(StringstoreFunctions, stringstoreTruncate) {
+        stringstore_t *pstore = stringstore_init_n(NULL, MY_STRSTORE_SIZE);
+        stringstore_storestr(pstore, "status\npartial");
+        stringstore_truncate(pstore, 7);
+        ASSERT_EQ((size_t)7, stringstore_length(pstore));
+        EXPECT_EQ(0, memcmp("status\n", stringstore_buffer(pstore), 7));
+        // never lengthens
+        stringstore_truncate(pstore, 100);
+        EXPECT_EQ((size_t)7, stringstore_length(pstore));
+        stringstore_free(pstore);
+    }
+
 } // namespace
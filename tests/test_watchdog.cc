@@ -0,0 +1,76 @@
+//
+// Event loop stall detection
+//
+
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "watchdog.h"
+}
+
+namespace {
+
+    TEST(WatchdogFunctions, stallDetected) {
+        watchdog_stall_t stall;
+        EXPECT_EQ(0, watchdog_start(0, 0));     // nothing to do
+        ASSERT_EQ(1, watchdog_start(50000, 0));
+        unsigned long stalls = watchdog_stalls();
+        watchdog_enter("handler", 9, "serial");
+        usleep(10000);
+        watchdog_idle();
+        usleep(100000);                         // waiting is not stalling
+        EXPECT_EQ(stalls, watchdog_stalls());
+        watchdog_enter("handler", 9, "serial");
+        usleep(200000);
+        EXPECT_EQ(stalls + 1, watchdog_stalls());
+        EXPECT_EQ(0, watchdog_stalled(&stall)); // not over yet
+        watchdog_enter("process", -1, NULL);
+        ASSERT_EQ(1, watchdog_stalled(&stall));
+        EXPECT_EQ(std::string("handler"), stall.phase);
+        EXPECT_EQ(std::string("serial"), stall.driver);
+        EXPECT_EQ(9, stall.fd);
+        EXPECT_LE(200000ul, stall.duration);
+        EXPECT_GT(1000000ul, stall.duration);
+        EXPECT_EQ(0, watchdog_stalled(&stall)); // reported once
+        watchdog_idle();
+        watchdog_stop();
+    }
+
+    TEST(WatchdogFunctions, keepAliveWhileHealthy) {
+        std::string path = "/tmp/watchdog-test-" + std::to_string(getpid());
+        int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+        ASSERT_LE(0, fd);
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        unlink(path.c_str());
+        ASSERT_EQ(0, bind(fd, (struct sockaddr *)&addr, sizeof(addr)));
+        setenv("NOTIFY_SOCKET", path.c_str(), 1);
+
+        char buf[64];
+        ASSERT_EQ(1, watchdog_start(0, 100000)); // stall after 50ms
+        watchdog_idle();
+        usleep(150000);
+        ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+        EXPECT_EQ("WATCHDOG=1", std::string(buf, n > 0 ? (size_t)n : 0));
+        // wedged: no more keep-alives
+        watchdog_enter("main", -1, NULL);
+        usleep(60000);
+        while (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+            ;
+        usleep(200000);
+        EXPECT_GT(0, recv(fd, buf, sizeof(buf), MSG_DONTWAIT));
+        watchdog_idle();
+        watchdog_stop();
+
+        unsetenv("NOTIFY_SOCKET");
+        close(fd);
+        unlink(path.c_str());
+    }
+
+} // namespace
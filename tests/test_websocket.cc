@@ -0,0 +1,154 @@
+//
+// WebSocket (RFC 6455) server side protocol support
+//
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+extern "C" {
+#include "websocket.h"
+}
+
+namespace {
+
+#define ZERO (size_t)0
+
+    std::string
+    upgrade_request(char const *headers) {
+        return std::string("GET /chat HTTP/1.1\r\nHost: server.example.com\r\n") + headers + "\r\n";
+    }
+
+    TEST(WebSocketFunctions, acceptKey) {
+        // the example from RFC 6455 section 1.3
+        char const key[] = "dGhlIHNhbXBsZSBub25jZQ==";
+        char accept[WS_ACCEPTSIZE];
+        ws_accept_key(key, sizeof(key) - 1, accept);
+        EXPECT_STREQ("s3pPLMBiTxaQ9kYGzzhZRbK+xOo=", accept);
+    }
+
+    TEST(WebSocketFunctions, requestLength) {
+        std::string request = upgrade_request("Upgrade: websocket\r\n");
+        EXPECT_EQ(request.size(), ws_request_length(request.data(), request.size()));
+        EXPECT_EQ(ZERO, ws_request_length(request.data(), request.size() - 1));
+        // anything after the headers is not part of the request
+        request += "\x81\x80";
+        EXPECT_EQ(request.size() - 2, ws_request_length(request.data(), request.size()));
+    }
+
+    TEST(WebSocketFunctions, handshake) {
+        char response[256];
+        std::string request = upgrade_request("Upgrade: websocket\r\nConnection: keep-alive, Upgrade\r\n"
+                                              "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n");
+        int length = ws_handshake(request.data(), request.size(), response, sizeof(response));
+        ASSERT_GT(length, 0);
+        std::string reply(response, (size_t)length);
+        EXPECT_EQ(0U, reply.find("HTTP/1.1 101 Switching Protocols\r\n"));
+        EXPECT_NE(std::string::npos, reply.find("Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n"));
+        EXPECT_EQ(reply.size() - 4, reply.rfind("\r\n\r\n"));
+        // header names and tokens are not case sensitive
+        request = upgrade_request("upgrade: WebSocket\r\nconnection: upgrade\r\n"
+                                  "sec-websocket-key: dGhlIHNhbXBsZSBub25jZQ==\r\nsec-websocket-version: 13\r\n");
+        EXPECT_GT(ws_handshake(request.data(), request.size(), response, sizeof(response)), 0);
+    }
+
+    TEST(WebSocketFunctions, handshakeInvalid) {
+        char response[256];
+        char const *invalid[] = {
+            "Connection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n",
+            "Upgrade: websocket\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n",
+            "Upgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Version: 13\r\n",
+            "Upgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: short\r\nSec-WebSocket-Version: 13\r\n",
+            "Upgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 8\r\n",
+            "Upgrade: websockets\r\nConnection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n",
+        };
+        for (auto headers : invalid) {
+            std::string request = upgrade_request(headers);
+            EXPECT_EQ(-1, ws_handshake(request.data(), request.size(), response, sizeof(response))) << headers;
+        }
+        std::string post = "POST / HTTP/1.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                           "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+        EXPECT_EQ(-1, ws_handshake(post.data(), post.size(), response, sizeof(response)));
+    }
+
+    TEST(WebSocketFunctions, headerLengths) {
+        unsigned char data[WS_MAXHEADER];
+        ws_header_t hdr;
+        struct { uint64_t length; size_t hdrlen; } sizes[] = {
+            { 0, 2 }, { 125, 2 }, { 126, 4 }, { 0xffff, 4 }, { 0x10000, 10 }, { 0x123456789ULL, 10 }
+        };
+        for (auto &size : sizes) {
+            EXPECT_EQ(size.hdrlen, ws_header_encode(data, WS_BINARY, size.length));
+            EXPECT_EQ(0x82, data[0]);
+            ASSERT_EQ((int)size.hdrlen, ws_header_decode(data, size.hdrlen, &hdr));
+            EXPECT_TRUE(hdr.fin);
+            EXPECT_FALSE(hdr.masked);
+            EXPECT_EQ(WS_BINARY, hdr.opcode);
+            EXPECT_EQ(size.length, hdr.length);
+            // incomplete until the whole header has arrived
+            EXPECT_EQ(0, ws_header_decode(data, size.hdrlen - 1, &hdr));
+        }
+    }
+
+    TEST(WebSocketFunctions, maskedClientFrame) {
+        // "Hello" from RFC 6455 section 5.7
+        unsigned char frame[] = { 0x81, 0x85, 0x37, 0xfa, 0x21, 0x3d, 0x7f, 0x9f, 0x4d, 0x51, 0x58 };
+        ws_header_t hdr;
+        ASSERT_EQ(6, ws_header_decode(frame, sizeof(frame), &hdr));
+        EXPECT_TRUE(hdr.fin);
+        EXPECT_TRUE(hdr.masked);
+        EXPECT_EQ(WS_TEXT, hdr.opcode);
+        ASSERT_EQ((uint64_t)5, hdr.length);
+        EXPECT_EQ(0, ws_header_decode(frame, 5, &hdr));   // mask not yet received
+        ws_unmask(frame + 6, 5, hdr.mask);
+        EXPECT_EQ(0, memcmp("Hello", frame + 6, 5));
+    }
+
+    TEST(WebSocketFunctions, headerInvalid) {
+        ws_header_t hdr;
+        unsigned char reserved[] = { 0xc1, 0x00 };
+        EXPECT_EQ(-1, ws_header_decode(reserved, sizeof(reserved), &hdr));
+        unsigned char fragmented_ping[] = { 0x09, 0x00 };
+        EXPECT_EQ(-1, ws_header_decode(fragmented_ping, sizeof(fragmented_ping), &hdr));
+        unsigned char long_close[] = { 0x88, 0x7e, 0x00, 0x80 };
+        EXPECT_EQ(-1, ws_header_decode(long_close, sizeof(long_close), &hdr));
+    }
+
+    TEST(WebSocketFunctions, framePutAndCopy) {
+        buffer_t *src = buffer_init(NULL, 256);
+        buffer_t *dst = buffer_init(NULL, 256);
+        unsigned char header[WS_MAXHEADER];
+        ws_header_t hdr;
+        EXPECT_EQ((size_t)2 + 6, ws_frame_put(dst, WS_TEXT, "@ok hi", 6));
+        buffer_put(src, "0123456789", 10);
+        EXPECT_EQ((size_t)2 + 10, ws_frame_copy(dst, WS_BINARY, src, 10));
+        EXPECT_EQ((size_t)10, buffer_used(src));   // copied, not moved
+        EXPECT_EQ((size_t)4, ws_close_put(dst, WS_STATUS_NORMAL));
+
+        char data[16];
+        ASSERT_EQ((size_t)2, buffer_get(dst, header, 2));
+        ASSERT_EQ(2, ws_header_decode(header, 2, &hdr));
+        EXPECT_EQ(WS_TEXT, hdr.opcode);
+        ASSERT_EQ((size_t)6, buffer_get(dst, data, (size_t)hdr.length));
+        EXPECT_EQ(0, memcmp("@ok hi", data, 6));
+        ASSERT_EQ((size_t)2, buffer_get(dst, header, 2));
+        ASSERT_EQ(2, ws_header_decode(header, 2, &hdr));
+        EXPECT_EQ(WS_BINARY, hdr.opcode);
+        ASSERT_EQ((size_t)10, buffer_get(dst, data, (size_t)hdr.length));
+        EXPECT_EQ(0, memcmp("0123456789", data, 10));
+        ASSERT_EQ((size_t)4, buffer_get(dst, header, 4));
+        EXPECT_EQ(0x88, header[0]);
+        EXPECT_EQ(0x03, header[2]);
+        EXPECT_EQ(0xe8, header[3]);
+
+        // all or nothing when the buffer is nearly full
+        while (ws_frame_put(dst, WS_BINARY, "0123456789", 10) != ZERO)
+            ;
+        size_t used = buffer_used(dst);
+        EXPECT_EQ(ZERO, ws_frame_copy(dst, WS_BINARY, src, 10));
+        EXPECT_EQ(used, buffer_used(dst));
+        buffer_free(src);
+        buffer_free(dst);
+    }
+
+}